@@ -4,6 +4,9 @@
 #include "system_info.h"
 #include "ml307_ssl_transport.h"
 #include "audio_codec.h"
+#include "pcm_kernels.h"
+#include "latency_monitor.h"
+#include "json_writer.h"
 #include "mqtt_protocol.h"
 #include "websocket_protocol.h"
 #include "font_awesome_symbols.h"
@@ -20,7 +23,6 @@
 #include <esp_log.h>
 #include <cJSON.h>
 #include <driver/gpio.h>
-#include <arpa/inet.h>
 
 #define TAG "Application"
 
@@ -39,9 +41,36 @@ static const char* const STATE_STRINGS[] = {
     "invalid_state"
 };
 
-Application::Application() {
+Application::Application()
+    : main_tasks_(MAIN_TASK_QUEUE_CAPACITY),
+      audio_decode_queue_(AUDIO_DECODE_QUEUE_CAPACITY, AUDIO_DECODE_MAX_PAYLOAD_SIZE),
+      jitter_buffer_(AUDIO_JITTER_BUFFER_CAPACITY, AUDIO_JITTER_BUFFER_MIN_DELAY_MS, AUDIO_JITTER_BUFFER_MAX_DELAY_MS),
+      uplink_preroll_(UPLINK_PREROLL_CAPACITY, UPLINK_PREROLL_MAX_PAYLOAD_SIZE)
+#if CONFIG_USE_UPLINK_VAD_GATE
+      , uplink_gate_(16000, CONFIG_UPLINK_VAD_HANGOVER_MS, CONFIG_UPLINK_VAD_LOOKBACK_MS)
+#endif
+{
     event_group_ = xEventGroupCreate();
-    background_task_ = new BackgroundTask(4096 * 8);
+    auto decode = [this](AudioFrame& frame) {
+        DecodeAudio(frame);
+        decode_pending_--;
+    };
+#if CONFIG_SPIRAM
+    // Opus needs a deep stack, the encoder stack may live in PSRAM like the wake word encoder's
+    encoder_worker_ = std::make_unique<AudioWorker>("audio_encoder", AUDIO_ENCODER_QUEUE_CAPACITY,
+        AUDIO_ENCODER_TASK_STACK_SIZE, AUDIO_ENCODER_TASK_PRIORITY, AUDIO_ENCODER_TASK_CORE, MALLOC_CAP_SPIRAM,
+        [this](AudioFrame& frame) { EncodeAudio(frame); });
+    decoder_worker_ = std::make_unique<AudioWorker>("audio_decoder", AUDIO_DECODER_QUEUE_CAPACITY,
+        AUDIO_DECODER_TASK_STACK_SIZE, AUDIO_DECODER_TASK_PRIORITY, AUDIO_DECODER_TASK_CORE, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT,
+        decode);
+#else
+    // Every stack comes from internal RAM, so encoding, decoding and the cues share one task,
+    // like the background task they replaced. It runs at the decoder priority for playback.
+    encoder_worker_ = std::make_unique<AudioWorker>("audio_codec", AUDIO_ENCODER_QUEUE_CAPACITY,
+        AUDIO_ENCODER_TASK_STACK_SIZE, AUDIO_DECODER_TASK_PRIORITY, -1, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT,
+        [this](AudioFrame& frame) { EncodeAudio(frame); });
+    decoder_worker_ = std::make_unique<AudioWorker>(*encoder_worker_, "audio_decoder", AUDIO_DECODER_QUEUE_CAPACITY, decode);
+#endif
 
 #if CONFIG_USE_AUDIO_PROCESSOR
     audio_processor_ = std::make_unique<AfeAudioProcessor>();
@@ -68,9 +97,6 @@ Application::~Application() {
         esp_timer_stop(clock_timer_handle_);
         esp_timer_delete(clock_timer_handle_);
     }
-    if (background_task_ != nullptr) {
-        delete background_task_;
-    }
     vEventGroupDelete(event_group_);
 }
 
@@ -128,13 +154,14 @@ void Application::CheckNewVersion() {
             auto codec = board.GetAudioCodec();
             codec->EnableInput(false);
             codec->EnableOutput(false);
-            {
-                std::lock_guard<std::mutex> lock(mutex_);
-                audio_decode_queue_.clear();
-            }
-            background_task_->WaitForCompletion();
-            delete background_task_;
-            background_task_ = nullptr;
+            audio_decode_queue_.Clear();
+            jitter_buffer_.Reset();
+            // Free the worker stacks for the upgrade, the playback task is idle with the output disabled
+            WaitForAudioWorkers();
+            audio_mixer_->AddSource(kAudioSourceCue, nullptr, 0);
+            cue_player_.reset();
+            encoder_worker_.reset();
+            decoder_worker_.reset();
             vTaskDelay(pdMS_TO_TICKS(1000));
 
             ota_.StartUpgrade([display](int progress, size_t speed) {
@@ -205,7 +232,7 @@ void Application::ShowActivationCode() {
         digit_sound{'9', Lang::Sounds::P3_9}
     }};
 
-    // This sentence uses 9KB of SRAM, so we need to wait for it to finish
+    // The digits are queued after the sentence and played in order
     Alert(Lang::Strings::ACTIVATION, message.c_str(), "happy", Lang::Sounds::P3_ACTIVATION);
 
     for (const auto& digit : code) {
@@ -224,7 +251,6 @@ void Application::Alert(const char* status, const char* message, const char* emo
     display->SetEmotion(emotion);
     display->SetChatMessage("system", message);
     if (!sound.empty()) {
-        ResetDecoder();
         PlaySound(sound);
     }
 }
@@ -238,33 +264,15 @@ void Application::DismissAlert() {
     }
 }
 
+// Returns at once, the cue is decoded on its own task and mixed over any speech
 void Application::PlaySound(const std::string_view& sound) {
-    // Wait for the previous sound to finish
-    {
-        std::unique_lock<std::mutex> lock(mutex_);
-        audio_decode_cv_.wait(lock, [this]() {
-            return audio_decode_queue_.empty();
-        });
-    }
-    background_task_->WaitForCompletion();
-
-    // The assets are encoded at 16000Hz, 60ms frame duration
-    SetDecodeSampleRate(16000, 60);
-    const char* data = sound.data();
-    size_t size = sound.size();
-    for (const char* p = data; p < data + size; ) {
-        auto p3 = (BinaryProtocol3*)p;
-        p += sizeof(BinaryProtocol3);
-
-        auto payload_size = ntohs(p3->payload_size);
-        AudioStreamPacket packet;
-        packet.payload.resize(payload_size);
-        memcpy(packet.payload.data(), p3->payload, payload_size);
-        p += payload_size;
-
-        std::lock_guard<std::mutex> lock(mutex_);
-        audio_decode_queue_.emplace_back(std::move(packet));
+    if (!cue_player_) {
+        return;
     }
+    auto codec = Board::GetInstance().GetAudioCodec();
+    codec->EnableOutput(true);
+    last_output_time_ = std::chrono::steady_clock::now();
+    cue_player_->Play(sound);
 }
 
 void Application::ToggleChatState() {
@@ -281,7 +289,7 @@ void Application::ToggleChatState() {
     if (device_state_ == kDeviceStateIdle) {
         Schedule([this]() {
             SetDeviceState(kDeviceStateConnecting);
-            if (!protocol_->OpenAudioChannel()) {
+            if (!OpenAudioChannel()) {
                 return;
             }
 
@@ -313,7 +321,7 @@ void Application::StartListening() {
         Schedule([this]() {
             if (!protocol_->IsAudioChannelOpened()) {
                 SetDeviceState(kDeviceStateConnecting);
-                if (!protocol_->OpenAudioChannel()) {
+                if (!OpenAudioChannel()) {
                     return;
                 }
             }
@@ -341,6 +349,7 @@ void Application::StopListening() {
 
     Schedule([this]() {
         if (device_state_ == kDeviceStateListening) {
+            LatencyMonitor::GetInstance().OnSpeechEnd();
             protocol_->SendStopListening();
             SetDeviceState(kDeviceStateIdle);
         }
@@ -357,7 +366,8 @@ void Application::Start() {
     /* Setup the audio codec */
     auto codec = board.GetAudioCodec();
     opus_decoder_ = std::make_unique<OpusDecoderWrapper>(codec->output_sample_rate(), 1, OPUS_FRAME_DURATION_MS);
-    opus_encoder_ = std::make_unique<OpusEncoderWrapper>(16000, 1, OPUS_FRAME_DURATION_MS);
+    decode_frame_samples_ = codec->output_sample_rate() * OPUS_FRAME_DURATION_MS / 1000;
+    opus_encoder_ = std::make_unique<UplinkEncoder>(16000, 1, OPUS_FRAME_DURATION_MS);
     if (realtime_chat_enabled_) {
         ESP_LOGI(TAG, "Realtime chat enabled, setting opus encoder complexity to 0");
         opus_encoder_->SetComplexity(0);
@@ -368,26 +378,52 @@ void Application::Start() {
         ESP_LOGI(TAG, "WiFi board detected, setting opus encoder complexity to 3");
         opus_encoder_->SetComplexity(3);
     }
+    uplink_controller_.SetMaxComplexity(opus_encoder_->complexity());
+    opus_encoder_->SetBitrate(uplink_controller_.bitrate());
+#if CONFIG_USE_UPLINK_VAD_GATE
+    // Silence gated by the VAD encodes to DTX packets
+    opus_encoder_->SetDtx(true);
+#endif
 
     if (codec->input_sample_rate() != 16000) {
         input_resampler_.Configure(codec->input_sample_rate(), 16000);
         reference_resampler_.Configure(codec->input_sample_rate(), 16000);
     }
-    codec->Start();
+    playback_ring_ = std::make_unique<PcmRing>(codec->output_sample_rate() * AUDIO_PLAYBACK_RING_MS / 1000);
+    playback_pcm_.resize((AUDIO_CODEC_DMA_DESC_NUM - 1) * AUDIO_CODEC_DMA_FRAME_NUM);
+#if CONFIG_SPIRAM
+    cue_player_ = std::make_unique<CuePlayer>(codec->output_sample_rate());
+#else
+    cue_player_ = std::make_unique<CuePlayer>(codec->output_sample_rate(), encoder_worker_.get());
+#endif
+    audio_mixer_ = std::make_unique<AudioMixer>(codec->output_sample_rate(), playback_pcm_.size());
+    audio_mixer_->AddSource(kAudioSourceVoice, playback_ring_.get(), 0);
+    audio_mixer_->AddSource(kAudioSourceCue, &cue_player_->ring(), 1);
+    audio_mixer_->SetDuckGain(AUDIO_DUCK_GAIN_PERCENT);
 
+    // The tasks sleep until the I2S DMA has received or sent a buffer
 #if CONFIG_USE_AUDIO_PROCESSOR
     xTaskCreatePinnedToCore([](void* arg) {
         Application* app = (Application*)arg;
-        app->AudioLoop();
+        app->AudioInputLoop();
         vTaskDelete(NULL);
-    }, "audio_loop", 4096 * 2, this, 8, &audio_loop_task_handle_, 1);
+    }, "audio_input", 4096 * 2, this, 8, &audio_input_task_handle_, 1);
 #else
     xTaskCreate([](void* arg) {
         Application* app = (Application*)arg;
-        app->AudioLoop();
+        app->AudioInputLoop();
         vTaskDelete(NULL);
-    }, "audio_loop", 4096 * 2, this, 8, &audio_loop_task_handle_);
+    }, "audio_input", 4096 * 2, this, 8, &audio_input_task_handle_);
 #endif
+    xTaskCreate([](void* arg) {
+        Application* app = (Application*)arg;
+        app->AudioOutputLoop();
+        vTaskDelete(NULL);
+    }, "audio_output", 4096, this, 8, &audio_output_task_handle_);
+
+    codec->SetInputTask(audio_input_task_handle_);
+    codec->SetOutputTask(audio_output_task_handle_);
+    codec->Start();
 
     /* Wait for the network to be ready */
     board.StartNetwork();
@@ -412,11 +448,10 @@ void Application::Start() {
         Alert(Lang::Strings::ERROR, message.c_str(), "sad", Lang::Sounds::P3_EXCLAMATION);
     });
     protocol_->OnIncomingAudio([this](AudioStreamPacket&& packet) {
-        const int max_packets_in_queue = 600 / OPUS_FRAME_DURATION_MS;
-        std::lock_guard<std::mutex> lock(mutex_);
-        if (audio_decode_queue_.size() < max_packets_in_queue) {
-            audio_decode_queue_.emplace_back(std::move(packet));
-        }
+        // Packets are dropped if the queue is full
+        LatencyMonitor::GetInstance().OnAudioReceived();
+        std::lock_guard<std::mutex> lock(audio_decode_producer_mutex_);
+        audio_decode_queue_.Push(packet);
     });
     protocol_->OnAudioChannelOpened([this, codec, &board]() {
         board.SetPowerSaveMode(false);
@@ -425,6 +460,7 @@ void Application::Start() {
                 protocol_->server_sample_rate(), codec->output_sample_rate());
         }
         SetDecodeSampleRate(protocol_->server_sample_rate(), protocol_->server_frame_duration());
+        LatencyMonitor::GetInstance().Reset();
         auto& thing_manager = iot::ThingManager::GetInstance();
         protocol_->SendIotDescriptors(thing_manager.GetDescriptorsJson());
         std::string states;
@@ -440,119 +476,21 @@ void Application::Start() {
             SetDeviceState(kDeviceStateIdle);
         });
     });
-    protocol_->OnIncomingJson([this, display](const cJSON* root) {
-        // Parse JSON data
-        auto type = cJSON_GetObjectItem(root, "type");
-        if (strcmp(type->valuestring, "tts") == 0) {
-            auto state = cJSON_GetObjectItem(root, "state");
-            if (strcmp(state->valuestring, "start") == 0) {
-                Schedule([this]() {
-                    aborted_ = false;
-                    if (device_state_ == kDeviceStateIdle || device_state_ == kDeviceStateListening) {
-                        SetDeviceState(kDeviceStateSpeaking);
-                    }
-                });
-            } else if (strcmp(state->valuestring, "stop") == 0) {
-                Schedule([this]() {
-                    background_task_->WaitForCompletion();
-                    if (device_state_ == kDeviceStateSpeaking) {
-                        if (listening_mode_ == kListeningModeManualStop) {
-                            SetDeviceState(kDeviceStateIdle);
-                        } else {
-                            SetDeviceState(kDeviceStateListening);
-                        }
-                    }
-                });
-            } else if (strcmp(state->valuestring, "sentence_start") == 0) {
-                auto text = cJSON_GetObjectItem(root, "text");
-                if (text != NULL) {
-                    ESP_LOGI(TAG, "<< %s", text->valuestring);
-                    Schedule([this, display, message = std::string(text->valuestring)]() {
-                        display->SetChatMessage("assistant", message.c_str());
-                    });
-                }
-            }
-        } else if (strcmp(type->valuestring, "stt") == 0) {
-            auto text = cJSON_GetObjectItem(root, "text");
-            if (text != NULL) {
-                ESP_LOGI(TAG, ">> %s", text->valuestring);
-                Schedule([this, display, message = std::string(text->valuestring)]() {
-                    display->SetChatMessage("user", message.c_str());
-                });
-            }
-        } else if (strcmp(type->valuestring, "llm") == 0) {
-            auto emotion = cJSON_GetObjectItem(root, "emotion");
-            if (emotion != NULL) {
-                Schedule([this, display, emotion_str = std::string(emotion->valuestring)]() {
-                    display->SetEmotion(emotion_str.c_str());
-                });
-            }
-        } else if (strcmp(type->valuestring, "iot") == 0) {
-            auto commands = cJSON_GetObjectItem(root, "commands");
-            if (commands != NULL) {
-                auto& thing_manager = iot::ThingManager::GetInstance();
-                for (int i = 0; i < cJSON_GetArraySize(commands); ++i) {
-                    auto command = cJSON_GetArrayItem(commands, i);
-                    thing_manager.Invoke(command);
-                }
-            }
-        } else if (strcmp(type->valuestring, "system") == 0) {
-            auto command = cJSON_GetObjectItem(root, "command");
-            if (command != NULL) {
-                ESP_LOGI(TAG, "System command: %s", command->valuestring);
-                if (strcmp(command->valuestring, "reboot") == 0) {
-                    // Do a reboot if user requests a OTA update
-                    Schedule([this]() {
-                        Reboot();
-                    });
-                } else {
-                    ESP_LOGW(TAG, "Unknown system command: %s", command->valuestring);
-                }
-            }
-        } else if (strcmp(type->valuestring, "alert") == 0) {
-            auto status = cJSON_GetObjectItem(root, "status");
-            auto message = cJSON_GetObjectItem(root, "message");
-            auto emotion = cJSON_GetObjectItem(root, "emotion");
-            if (status != NULL && message != NULL && emotion != NULL) {
-                Alert(status->valuestring, message->valuestring, emotion->valuestring, Lang::Sounds::P3_VIBRATION);
-            } else {
-                ESP_LOGW(TAG, "Alert command requires status, message and emotion");
-            }
-        }
+    RegisterJsonHandlers();
+    protocol_->OnIncomingJson([this](const cJSON* root) {
+        json_router_.Dispatch(root);
     });
     bool protocol_started = protocol_->Start();
 
     audio_processor_->Initialize(codec);
-    audio_processor_->OnOutput([this](std::vector<int16_t>&& data) {
-        background_task_->Schedule([this, data = std::move(data)]() mutable {
-            if (protocol_->IsAudioChannelBusy()) {
-                return;
-            }
-            opus_encoder_->Encode(std::move(data), [this](std::vector<uint8_t>&& opus) {
-                AudioStreamPacket packet;
-                packet.payload = std::move(opus);
-                uint32_t last_output_timestamp_value = last_output_timestamp_.load();
-                {
-                    std::lock_guard<std::mutex> lock(timestamp_mutex_);
-                    if (!timestamp_queue_.empty()) {
-                        packet.timestamp = timestamp_queue_.front();
-                        timestamp_queue_.pop_front();
-                    } else {
-                        packet.timestamp = 0;
-                    }
-
-                    if (timestamp_queue_.size() > 3) { // 限制队列长度3
-                        timestamp_queue_.pop_front(); // 该包发送前先出队保持队列长度
-                        return;
-                    }
-                }
-                Schedule([this, last_output_timestamp_value, packet = std::move(packet)]() {
-                    protocol_->SendAudio(packet);
-                    // ESP_LOGI(TAG, "Send %zu bytes, timestamp %lu, last_ts %lu, qsize %zu",
-                    //     packet.payload.size(), packet.timestamp, last_output_timestamp_value, timestamp_queue_.size());
-                });
-            });
-        });
+    audio_processor_->OnOutput([this](std::vector<int16_t>&& data, bool speech, int64_t capture_time_us) {
+        // Called on the AFE task, a full encoder queue drops the chunk rather than stalling the AFE
+        LatencyMonitor::GetInstance().RecordSince(kLatencyMetricMicCapture, capture_time_us);
+        AudioFrame frame;
+        frame.pcm = std::move(data);
+        frame.time_us = capture_time_us;
+        frame.speech = speech;
+        encoder_worker_->Push(frame);
     });
     audio_processor_->OnVadStateChange([this](bool speaking) {
         if (device_state_ == kDeviceStateListening) {
@@ -561,6 +499,7 @@ void Application::Start() {
                     voice_detected_ = true;
                 } else {
                     voice_detected_ = false;
+                    LatencyMonitor::GetInstance().OnSpeechEnd();
                 }
                 auto led = Board::GetInstance().GetLed();
                 led->OnStateChanged();
@@ -573,21 +512,25 @@ void Application::Start() {
     wake_word_detect_.OnWakeWordDetected([this](const std::string& wake_word) {
         Schedule([this, &wake_word]() {
             if (device_state_ == kDeviceStateIdle) {
+                LatencyMonitor::GetInstance().OnWakeWordDetected();
                 SetDeviceState(kDeviceStateConnecting);
                 wake_word_detect_.EncodeWakeWordData();
 
-                if (!protocol_ || !protocol_->OpenAudioChannel()) {
+                if (!protocol_ || !OpenAudioChannel()) {
                     wake_word_detect_.StartDetection();
                     return;
                 }
                 
                 AudioStreamPacket packet;
                 // Encode and send the wake word data to the server
+                protocol_->BeginBatch();
                 while (wake_word_detect_.GetWakeWordOpus(packet.payload)) {
                     protocol_->SendAudio(packet);
+                    LatencyMonitor::GetInstance().OnAudioSent();
                 }
                 // Set the chat state to wake word detected
                 protocol_->SendWakeWordDetected(wake_word);
+                protocol_->EndBatch();
                 ESP_LOGI(TAG, "Wake word detected: %s", wake_word.c_str());
                 SetListeningMode(realtime_chat_enabled_ ? kListeningModeRealtime : kListeningModeAutoStop);
             } else if (device_state_ == kDeviceStateSpeaking) {
@@ -617,8 +560,142 @@ void Application::Start() {
     MainEventLoop();
 }
 
+// Handlers for the JSON messages from the server, they run on the protocol's receive task
+void Application::RegisterJsonHandlers() {
+    auto display = Board::GetInstance().GetDisplay();
+    json_router_.On("tts", "start", [this](const JsonMessage& message) {
+        Schedule([this]() {
+            aborted_ = false;
+            tts_stop_pending_ = false;
+            if (device_state_ == kDeviceStateIdle || device_state_ == kDeviceStateListening) {
+                SetDeviceState(kDeviceStateSpeaking);
+            }
+        });
+    });
+    json_router_.On("tts", "stop", [this](const JsonMessage& message) {
+        Schedule([this]() {
+            // Leaving Speaking would drop the tail still in the queues. The playback task
+            // reports when it has played out, the main loop keeps running meanwhile.
+            tts_stop_pending_ = true;
+            if (PlaybackDrained()) {
+                FinishSpeaking();
+            }
+        });
+    });
+    json_router_.On("tts", "sentence_start", [this, display](const JsonMessage& message) {
+        if (message.text != nullptr) {
+            ESP_LOGI(TAG, "<< %s", message.text);
+            Schedule([this, display, text = std::string(message.text)]() {
+                display->SetChatMessage("assistant", text.c_str());
+            });
+        }
+    });
+    json_router_.On("stt", [this, display](const JsonMessage& message) {
+        if (message.text != nullptr) {
+            // The server has finished recognizing, used as the end of speech without a local VAD
+            LatencyMonitor::GetInstance().OnSpeechEnd(false);
+            ESP_LOGI(TAG, ">> %s", message.text);
+            Schedule([this, display, text = std::string(message.text)]() {
+                display->SetChatMessage("user", text.c_str());
+            });
+        }
+    });
+    json_router_.On("llm", [this, display](const JsonMessage& message) {
+        if (message.emotion != nullptr) {
+            Schedule([this, display, emotion = std::string(message.emotion)]() {
+                display->SetEmotion(emotion.c_str());
+            });
+        }
+    });
+    json_router_.On("iot", [](const JsonMessage& message) {
+        if (message.commands != nullptr) {
+            auto& thing_manager = iot::ThingManager::GetInstance();
+            const cJSON* command;
+            cJSON_ArrayForEach(command, message.commands) {
+                thing_manager.Invoke(command);
+            }
+        }
+    });
+    json_router_.On("system", [this](const JsonMessage& message) {
+        if (message.command != nullptr) {
+            ESP_LOGI(TAG, "System command: %s", message.command);
+            if (strcmp(message.command, "reboot") == 0) {
+                // Do a reboot if user requests a OTA update
+                Schedule([this]() {
+                    Reboot();
+                });
+            } else {
+                ESP_LOGW(TAG, "Unknown system command: %s", message.command);
+            }
+        }
+    });
+    json_router_.On("alert", [this](const JsonMessage& message) {
+        if (message.status != nullptr && message.message != nullptr && message.emotion != nullptr) {
+            Alert(message.status, message.message, message.emotion, Lang::Sounds::P3_VIBRATION);
+        } else {
+            ESP_LOGW(TAG, "Alert command requires status, message and emotion");
+        }
+    });
+    json_router_.On("uplink", [this](const JsonMessage& message) {
+        // Optional receive report from the server, feeds the uplink controller
+        auto received = cJSON_GetObjectItem(message.root, "received");
+        auto lost = cJSON_GetObjectItem(message.root, "lost");
+        if (cJSON_IsNumber(received) && cJSON_IsNumber(lost)) {
+            uplink_controller_.OnReceiveReport(received->valueint, lost->valueint);
+        }
+    });
+}
+
+bool Application::OpenAudioChannel() {
+    int64_t start_time = esp_timer_get_time();
+    // The frame duration can only change when the hello renegotiates it
+    protocol_->RequestUplinkFrameDuration(uplink_controller_.frame_duration());
+    if (!protocol_->OpenAudioChannel()) {
+        return false;
+    }
+    opus_encoder_->SetFrameDuration(protocol_->uplink_frame_duration());
+    uplink_controller_.ResetWindow();
+    last_encoder_dropped_ = encoder_worker_->dropped();
+    // Recorded after the opened callback has reset the monitor, so it lands in this session
+    LatencyMonitor::GetInstance().RecordSince(kLatencyMetricChannelOpen, start_time);
+    return true;
+}
+
+// Sends the frames captured while the audio channel was connecting, in capture order
+void Application::SendUplinkPreroll() {
+    AudioStreamPacket packet;
+    int count = 0;
+    while (uplink_preroll_.Pop(packet)) {
+        protocol_->SendAudio(packet);
+        count++;
+    }
+    if (count > 0) {
+        LatencyMonitor::GetInstance().OnAudioSent();
+        ESP_LOGI(TAG, "Sent %d pre-roll frames", count);
+    }
+}
+
+// Runs on the main loop once per second while the audio channel is open
+void Application::EvaluateUplink() {
+    uint32_t dropped = encoder_worker_->dropped();
+    uplink_controller_.OnFrameDropped(dropped - last_encoder_dropped_);
+    last_encoder_dropped_ = dropped;
+    if (uplink_controller_.Evaluate(opus_encoder_->duration_ms())) {
+        opus_encoder_->SetBitrate(uplink_controller_.bitrate());
+        opus_encoder_->SetComplexity(uplink_controller_.complexity());
+    }
+}
+
 void Application::OnClockTimer() {
     clock_ticks_++;
+    // The playback task does not run while the output is off
+    CheckPlaybackDrained();
+
+    if (protocol_ && (device_state_ == kDeviceStateListening || device_state_ == kDeviceStateSpeaking)) {
+        Schedule([this]() {
+            EvaluateUplink();
+        });
+    }
 
     // Print the debug info every 10 seconds
     if (clock_ticks_ % 10 == 0) {
@@ -626,7 +703,32 @@ void Application::OnClockTimer() {
 
         int free_sram = heap_caps_get_free_size(MALLOC_CAP_INTERNAL);
         int min_free_sram = heap_caps_get_minimum_free_size(MALLOC_CAP_INTERNAL);
-        ESP_LOGI(TAG, "Free internal: %u minimal internal: %u", free_sram, min_free_sram);
+        ESP_LOGI(TAG, "Free internal: %u minimal internal: %u capture allocations: %lu", free_sram, min_free_sram,
+            GetCaptureAllocations());
+        // Maximums are per report interval, the high water mark is since boot
+        ESP_LOGI(TAG, "Main loop: high water %zu/%zu, max wait %lu us, max run %lu us, overflowed %lu, heap tasks %lu",
+            main_tasks_.high_water(), main_tasks_.capacity(), max_task_wait_us_, max_task_run_us_,
+            overflowed_tasks_.load(), InlineTask::heap_allocations());
+        max_task_wait_us_ = 0;
+        max_task_run_us_ = 0;
+        if (protocol_ && protocol_->IsAudioChannelOpened()) {
+            LatencyMonitor::GetInstance().PrintReport();
+            ESP_LOGI(TAG, "Encoder: %lu frames, %lu dropped, max %lu us, queue high water %zu, stack free %lu",
+                encoder_worker_->processed(), encoder_worker_->dropped(), encoder_worker_->max_process_time_us(),
+                encoder_worker_->high_water(), encoder_worker_->stack_free());
+            ESP_LOGI(TAG, "Uplink: %s", uplink_controller_.GetStatusJson().c_str());
+            ESP_LOGI(TAG, "Decoder: %lu frames, max %lu us, stack free %lu", decoder_worker_->processed(),
+                decoder_worker_->max_process_time_us(), decoder_worker_->stack_free());
+            ESP_LOGI(TAG, "Audio: %s", GetAudioStatsJson().c_str());
+        }
+
+#if CONFIG_KEEP_AUDIO_CHANNEL_WARM
+        if (protocol_ && device_state_ == kDeviceStateIdle) {
+            Schedule([this]() {
+                protocol_->KeepAlive();
+            });
+        }
+#endif
 
         // If we have synchronized server time, set the status to clock "HH:MM" if the device is idle
         if (ota_.HasServerTime()) {
@@ -644,158 +746,426 @@ void Application::OnClockTimer() {
 }
 
 // Add a async task to MainLoop
-void Application::Schedule(std::function<void()> callback) {
-    {
+void Application::ScheduleTask(InlineTask&& task) {
+    if (overflowing_ || !main_tasks_.Push(std::move(task))) {
         std::lock_guard<std::mutex> lock(mutex_);
-        main_tasks_.push_back(std::move(callback));
+        // Everything after the first overflow goes here too so that the order is kept
+        overflowing_ = true;
+        overflow_tasks_.push_back(std::move(task));
+        overflowed_tasks_++;
     }
     xEventGroupSetBits(event_group_, SCHEDULE_EVENT);
 }
 
+bool Application::ScheduleTaskFromISR(InlineTask&& task) {
+    if (!main_tasks_.Push(std::move(task))) {
+        return false;
+    }
+    BaseType_t higher_priority_task_woken = pdFALSE;
+    xEventGroupSetBitsFromISR(event_group_, SCHEDULE_EVENT, &higher_priority_task_woken);
+    portYIELD_FROM_ISR(higher_priority_task_woken);
+    return true;
+}
+
+void Application::RunTask(InlineTask& task, int64_t push_time_us) {
+    int64_t start_time = esp_timer_get_time();
+    task();
+    task.Reset();
+    int64_t end_time = esp_timer_get_time();
+    max_task_wait_us_ = std::max<uint32_t>(max_task_wait_us_, start_time - push_time_us);
+    max_task_run_us_ = std::max<uint32_t>(max_task_run_us_, end_time - start_time);
+}
+
 // The Main Event Loop controls the chat state and websocket connection
 // If other tasks need to access the websocket or chat state,
 // they should use Schedule to call this function
 void Application::MainEventLoop() {
+    InlineTask task;
+    int64_t push_time_us;
     while (true) {
         auto bits = xEventGroupWaitBits(event_group_, SCHEDULE_EVENT, pdTRUE, pdFALSE, portMAX_DELAY);
 
         if (bits & SCHEDULE_EVENT) {
-            std::unique_lock<std::mutex> lock(mutex_);
-            std::list<std::function<void()>> tasks = std::move(main_tasks_);
-            lock.unlock();
-            for (auto& task : tasks) {
-                task();
+            while (main_tasks_.Pop(task, &push_time_us)) {
+                RunTask(task, push_time_us);
+            }
+            if (overflowing_) {
+                std::unique_lock<std::mutex> lock(mutex_);
+                std::list<InlineTask> tasks = std::move(overflow_tasks_);
+                overflowing_ = false;
+                lock.unlock();
+                // Tasks pushed to main_tasks_ from now on are newer, they run on the next wakeup
+                ESP_LOGW(TAG, "Main task queue overflowed, %zu tasks", tasks.size());
+                for (auto& overflow_task : tasks) {
+                    overflow_task();
+                }
             }
         }
     }
 }
 
-// The Audio Loop is used to input and output audio data
-void Application::AudioLoop() {
+// Capture runs on the on_recv DMA events, a chunk is read once the DMA holds all of it
+void Application::AudioInputLoop() {
+    while (true) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        while (OnAudioInput()) {
+        }
+    }
+}
+
+// Playback runs on the on_sent DMA events, the free DMA space is refilled from the playback ring
+void Application::AudioOutputLoop() {
     auto codec = Board::GetInstance().GetAudioCodec();
     while (true) {
-        OnAudioInput();
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
         if (codec->output_enabled()) {
             OnAudioOutput();
+            WritePlayback();
+            CheckPlaybackDrained();
         }
     }
 }
 
-void Application::OnAudioOutput() {
-    if (busy_decoding_audio_) {
+// Runs on the playback task, writes only what the DMA can take without blocking
+void Application::WritePlayback() {
+    auto codec = Board::GetInstance().GetAudioCodec();
+    int space = codec->output_space();
+    if (space <= 0) {
         return;
     }
+    if (playing_ && codec->output_drained()) {
+        // The DMA is playing silence, that is an underrun unless the stream has ended
+        if (!playback_ring_->Empty() || !audio_decode_queue_.Empty() || !jitter_buffer_.Empty() ||
+            !decoder_worker_->Idle()) {
+            output_underruns_++;
+        }
+        playing_ = false;
+    }
 
+    size_t samples = audio_mixer_->Mix(playback_pcm_.data(), std::min<size_t>(space, playback_pcm_.size()));
+    if (samples > 0) {
+        codec->OutputData(playback_pcm_.data(), samples);
+        LatencyMonitor::GetInstance().OnAudioPlayed();
+        playing_ = true;
+        cue_player_->OnRingRead();
+    }
+}
+
+// Counters since boot, overruns are input DMA buffers dropped by the driver,
+// underruns are gaps in the playback while more audio was pending
+std::string Application::GetAudioStatsJson() const {
+    auto codec = Board::GetInstance().GetAudioCodec();
+    std::string json;
+    JsonWriter writer(json);
+    writer.BeginObject()
+        .Field("input_overruns", (int)codec->input_overruns())
+        .Field("output_underruns", (int)output_underruns_.load())
+        .Field("playback_ring", (int)playback_ring_->Size())
+        .EndObject();
+    return json;
+}
+
+// Runs on the decoder task. The ring is sized so that the decode-ahead never has to wait,
+// the frame is dropped if the ring was flushed after it was decoded.
+void Application::QueuePlayback(const std::vector<int16_t>& pcm, uint32_t clears) {
+    auto codec = Board::GetInstance().GetAudioCodec();
+    size_t written = 0;
+    while (!aborted_ && playback_ring_->clears() == clears && codec->output_enabled()) {
+        written += playback_ring_->Write(pcm.data() + written, pcm.size() - written);
+        if (written == pcm.size()) {
+            break;
+        }
+        vTaskDelay(pdMS_TO_TICKS(AUDIO_PLAYBACK_WAIT_MS));
+    }
+}
+
+void Application::OnAudioOutput() {
     auto now = std::chrono::steady_clock::now();
     auto codec = Board::GetInstance().GetAudioCodec();
     const int max_silence_seconds = 10;
 
-    std::unique_lock<std::mutex> lock(mutex_);
-    if (audio_decode_queue_.empty()) {
-        // Disable the output if there is no audio data for a long time
-        if (device_state_ == kDeviceStateIdle) {
-            auto duration = std::chrono::duration_cast<std::chrono::seconds>(now - last_output_time_).count();
-            if (duration > max_silence_seconds) {
-                codec->EnableOutput(false);
-            }
-        }
-        return;
+    // Move everything that has arrived into the jitter buffer, Pop() also applies any pending Clear()
+    AudioStreamPacket packet;
+    int64_t arrival_time;
+    while (!jitter_buffer_.Full() && audio_decode_queue_.Pop(packet, &arrival_time)) {
+        jitter_buffer_.Put(std::move(packet), arrival_time);
     }
 
     if (device_state_ == kDeviceStateListening) {
-        audio_decode_queue_.clear();
-        audio_decode_cv_.notify_all();
+        if (!jitter_buffer_.Empty()) {
+            jitter_buffer_.Reset();
+        }
         return;
     }
 
-    auto packet = std::move(audio_decode_queue_.front());
-    audio_decode_queue_.pop_front();
-    lock.unlock();
-    audio_decode_cv_.notify_all();
-
-    busy_decoding_audio_ = true;
-    background_task_->Schedule([this, codec, packet = std::move(packet)]() mutable {
-        busy_decoding_audio_ = false;
-        if (aborted_) {
+    // Decode ahead until the ring and the frames queued for the decoder cover the target,
+    // frames stay in the jitter buffer while the decoder queue is full
+    auto& latency_monitor = LatencyMonitor::GetInstance();
+    const int sample_rate = codec->output_sample_rate();
+    const int ahead_samples = sample_rate * CONFIG_AUDIO_DECODE_AHEAD_MS / 1000;
+    while (!decoder_worker_->Full()) {
+        int ready_samples = playback_ring_->Size() + decode_pending_ * decode_frame_samples_;
+        if (ready_samples >= ahead_samples) {
             return;
         }
 
-        std::vector<int16_t> pcm;
-        if (!opus_decoder_->Decode(std::move(packet.payload), pcm)) {
+        auto result = jitter_buffer_.Get(packet, esp_timer_get_time());
+        if (result == JitterBuffer::kJitterBufferEmpty) {
+            // Disable the output if there is no audio data for a long time
+            if (jitter_buffer_.Empty() && audio_mixer_->Empty() && cue_player_->Idle() && device_state_ == kDeviceStateIdle) {
+                auto duration = std::chrono::duration_cast<std::chrono::seconds>(now - last_output_time_).count();
+                if (duration > max_silence_seconds) {
+                    codec->EnableOutput(false);
+                }
+            }
             return;
         }
-        // Resample if the sample rate is different
-        if (opus_decoder_->sample_rate() != codec->output_sample_rate()) {
-            int target_size = output_resampler_.GetOutputSamples(pcm.size());
-            std::vector<int16_t> resampled(target_size);
-            output_resampler_.Process(pcm.data(), pcm.size(), resampled.data());
-            pcm = std::move(resampled);
+
+        latency_monitor.Record(kLatencyMetricDecodeQueueDepth,
+            audio_decode_queue_.Size() + jitter_buffer_.size() + decoder_worker_->Size());
+        latency_monitor.Record(kLatencyMetricPlaybackAhead, ready_samples * 1000 / sample_rate);
+
+        // Swap the vectors so their capacity keeps circulating
+        decode_frame_.opus.swap(packet.payload);
+        decode_frame_.timestamp = packet.timestamp;
+        decode_frame_.time_us = esp_timer_get_time();
+        decode_pending_++;
+        if (!decoder_worker_->Push(decode_frame_)) {
+            decode_pending_--;
         }
-        codec->OutputData(pcm);
+    }
+}
+
+// Runs on the encoder task
+void Application::EncodeAudio(AudioFrame& frame) {
+    if (protocol_->IsAudioChannelBusy()) {
+        uplink_controller_.OnFrameDropped();
+        return;
+    }
+#if CONFIG_USE_UPLINK_VAD_GATE
+    if (uplink_gate_reset_.exchange(false)) {
+        uplink_gate_.Reset();
+    }
+    if (listening_mode_ != kListeningModeManualStop) {
+        int64_t fetch_time = frame.time_us;
+        uplink_gate_.Process(std::move(frame.pcm), frame.speech, [this, fetch_time](std::vector<int16_t>&& pcm, bool open) {
+            EncodePcm(std::move(pcm), fetch_time, !open);
+        });
+        return;
+    }
+#endif
+    EncodePcm(std::move(frame.pcm), frame.time_us, false);
+}
+
+// Runs on the encoder task, gated chunks are silence that encodes to DTX packets
+void Application::EncodePcm(std::vector<int16_t>&& pcm, int64_t fetch_time, bool gated) {
+    int64_t encode_start_time = esp_timer_get_time();
+    opus_encoder_->Encode(std::move(pcm), gated, [this, fetch_time, encode_start_time](std::vector<uint8_t>&& opus, bool gated) {
+        auto& latency_monitor = LatencyMonitor::GetInstance();
+        latency_monitor.RecordSince(kLatencyMetricEncode, encode_start_time);
+        uplink_controller_.OnFrameEncoded(esp_timer_get_time() - encode_start_time);
+#if CONFIG_USE_UPLINK_VAD_GATE
+        uplink_gate_.OnPacket(opus.size(), gated);
+#endif
+        AudioStreamPacket packet;
+        packet.payload = std::move(opus);
+        uint32_t last_output_timestamp_value = last_output_timestamp_.load();
         {
             std::lock_guard<std::mutex> lock(timestamp_mutex_);
-            timestamp_queue_.push_back(packet.timestamp);
-            last_output_timestamp_ = packet.timestamp;
+            if (!timestamp_queue_.empty()) {
+                packet.timestamp = timestamp_queue_.front();
+                timestamp_queue_.pop_front();
+            } else {
+                packet.timestamp = 0;
+            }
+
+            if (timestamp_queue_.size() > 3) { // 限制队列长度3
+                timestamp_queue_.pop_front(); // 该包发送前先出队保持队列长度
+                return;
+            }
+        }
+        if (device_state_ == kDeviceStateConnecting) {
+            // Hold the frame until the channel opens. A full pre-roll drops the newest frames,
+            // the start of the utterance is what users lose otherwise
+            if (!uplink_preroll_.Push(packet)) {
+                ESP_LOGW(TAG, "Uplink pre-roll full, dropping %zu bytes", packet.size());
+            }
+            // The state may have turned to listening after the check above and the pre-roll
+            // been sent already. The main loop sends such a straggler, ahead of the frames
+            // the encoder schedules after it.
+            if (!preroll_drain_scheduled_.exchange(true)) {
+                Schedule([this]() {
+                    preroll_drain_scheduled_ = false;
+                    if (device_state_ == kDeviceStateListening) {
+                        SendUplinkPreroll();
+                    }
+                });
+            }
+            return;
+        }
+        Schedule([this, fetch_time, last_output_timestamp_value, packet = std::move(packet)]() {
+            int64_t send_start_time = esp_timer_get_time();
+            protocol_->SendAudio(packet);
+            uplink_controller_.OnFrameSent(esp_timer_get_time() - send_start_time);
+            auto& latency_monitor = LatencyMonitor::GetInstance();
+            latency_monitor.OnAudioSent();
+            latency_monitor.RecordSince(kLatencyMetricUplinkFrame, fetch_time);
+            // ESP_LOGI(TAG, "Send %zu bytes, timestamp %lu, last_ts %lu, qsize %zu",
+            //     packet.payload.size(), packet.timestamp, last_output_timestamp_value, timestamp_queue_.size());
+        });
+    });
+}
+
+// Runs on the decoder task
+void Application::DecodeAudio(AudioFrame& frame) {
+    if (aborted_) {
+        return;
+    }
+
+    // An empty payload makes the decoder conceal the lost frame (PLC)
+    uint32_t clears = playback_ring_->clears();
+    auto codec = Board::GetInstance().GetAudioCodec();
+    auto& latency_monitor = LatencyMonitor::GetInstance();
+    int64_t decode_start_time = esp_timer_get_time();
+    if (!opus_decoder_->Decode(std::move(frame.opus), decode_pcm_)) {
+        return;
+    }
+    latency_monitor.RecordSince(kLatencyMetricDecode, decode_start_time);
+    // Resample if the sample rate is different
+    if (opus_decoder_->sample_rate() != codec->output_sample_rate()) {
+        resample_pcm_.resize(output_resampler_.GetOutputSamples(decode_pcm_.size()));
+        output_resampler_.Process(decode_pcm_.data(), decode_pcm_.size(), resample_pcm_.data());
+        QueuePlayback(resample_pcm_, clears);
+    } else {
+        QueuePlayback(decode_pcm_, clears);
+    }
+    {
+        std::lock_guard<std::mutex> lock(timestamp_mutex_);
+        timestamp_queue_.push_back(frame.timestamp);
+        last_output_timestamp_ = frame.timestamp;
+    }
+    last_output_time_ = std::chrono::steady_clock::now();
+}
+
+// True when the received audio has been handed to the codec, or never will be because the
+// output is off. AbortSpeaking() flushes everything, so an aborted turn drains at once.
+bool Application::PlaybackDrained() {
+    auto codec = Board::GetInstance().GetAudioCodec();
+    return !codec->output_enabled() || (audio_decode_queue_.Empty() && jitter_buffer_.Empty() &&
+        decode_pending_ == 0 && playback_ring_->Empty());
+}
+
+// Called by the playback task and the clock timer, the main loop decides once it runs
+void Application::CheckPlaybackDrained() {
+    if (!tts_stop_pending_ || !PlaybackDrained() || drain_check_scheduled_.exchange(true)) {
+        return;
+    }
+    Schedule([this]() {
+        drain_check_scheduled_ = false;
+        // A tts start that ran in between has cancelled the stop
+        if (tts_stop_pending_ && PlaybackDrained()) {
+            FinishSpeaking();
         }
-        last_output_time_ = std::chrono::steady_clock::now();
     });
 }
 
-void Application::OnAudioInput() {
+// Runs on the main loop once the reply has played out after tts stop
+void Application::FinishSpeaking() {
+    tts_stop_pending_ = false;
+    auto& latency_monitor = LatencyMonitor::GetInstance();
+    if (latency_monitor.HasSamples()) {
+        latency_monitor.PrintReport();
+#if CONFIG_USE_LATENCY_REPORT
+        protocol_->SendLatencyReport(latency_monitor.GetMetricsJson(), uplink_controller_.GetStatusJson(),
+            GetAudioStatsJson());
+#endif
+    }
+    if (device_state_ == kDeviceStateSpeaking) {
+        if (listening_mode_ == kListeningModeManualStop) {
+            SetDeviceState(kDeviceStateIdle);
+        } else {
+            SetDeviceState(kDeviceStateListening);
+        }
+    }
+}
+
+void Application::WaitForAudioWorkers() {
+    encoder_worker_->WaitForIdle();
+    decoder_worker_->WaitForIdle();
+    // The decoded tail is still part of the turn, e.g. before listening starts again
+    auto codec = Board::GetInstance().GetAudioCodec();
+    while (playback_ring_ && !playback_ring_->Empty() && codec->output_enabled()) {
+        vTaskDelay(pdMS_TO_TICKS(AUDIO_PLAYBACK_WAIT_MS));
+    }
+}
+
+// Runs on the capture task, returns false until the DMA holds the next chunk
+bool Application::OnAudioInput() {
+    auto codec = Board::GetInstance().GetAudioCodec();
 #if CONFIG_USE_WAKE_WORD_DETECT
     if (wake_word_detect_.IsDetectionRunning()) {
-        std::vector<int16_t> data;
         int samples = wake_word_detect_.GetFeedSize();
         if (samples > 0) {
-            ReadAudio(data, 16000, samples);
-            wake_word_detect_.Feed(data);
-            return;
+            if (!codec->input_ready(samples * codec->input_sample_rate() / 16000)) {
+                return false;
+            }
+            int64_t capture_time = esp_timer_get_time();
+            ReadAudio(capture_data_, 16000, samples);
+            wake_word_detect_.Feed(capture_data_, capture_time);
+            return true;
         }
     }
 #endif
     if (audio_processor_->IsRunning()) {
-        std::vector<int16_t> data;
         int samples = audio_processor_->GetFeedSize();
         if (samples > 0) {
-            ReadAudio(data, 16000, samples);
-            audio_processor_->Feed(data);
-            return;
+            if (!codec->input_ready(samples * codec->input_sample_rate() / 16000)) {
+                return false;
+            }
+            int64_t capture_time = esp_timer_get_time();
+            ReadAudio(capture_data_, 16000, samples);
+            audio_processor_->Feed(capture_data_, capture_time);
+            return true;
         }
     }
 
-    vTaskDelay(pdMS_TO_TICKS(30));
+    // Nobody needs the input, drain the DMA so a consumer starts with fresh audio
+    // and the overrun counter only counts real losses
+    int available = codec->input_available();
+    if (available > 0) {
+        codec->InputData(capture_raw_.Reserve(available), available);
+    }
+    return false;
 }
 
+// All intermediate buffers are owned by the application and reused, so that
+// reading a frame does not touch the heap once the buffers have grown
 void Application::ReadAudio(std::vector<int16_t>& data, int sample_rate, int samples) {
     auto codec = Board::GetInstance().GetAudioCodec();
     if (codec->input_sample_rate() != sample_rate) {
-        data.resize(samples * codec->input_sample_rate() / sample_rate);
-        if (!codec->InputData(data)) {
+        int raw_samples = samples * codec->input_sample_rate() / sample_rate;
+        auto raw = capture_raw_.Reserve(raw_samples);
+        if (!codec->InputData(raw, raw_samples)) {
             return;
         }
         if (codec->input_channels() == 2) {
-            auto mic_channel = std::vector<int16_t>(data.size() / 2);
-            auto reference_channel = std::vector<int16_t>(data.size() / 2);
-            for (size_t i = 0, j = 0; i < mic_channel.size(); ++i, j += 2) {
-                mic_channel[i] = data[j];
-                reference_channel[i] = data[j + 1];
-            }
-            auto resampled_mic = std::vector<int16_t>(input_resampler_.GetOutputSamples(mic_channel.size()));
-            auto resampled_reference = std::vector<int16_t>(reference_resampler_.GetOutputSamples(reference_channel.size()));
-            input_resampler_.Process(mic_channel.data(), mic_channel.size(), resampled_mic.data());
-            reference_resampler_.Process(reference_channel.data(), reference_channel.size(), resampled_reference.data());
-            data.resize(resampled_mic.size() + resampled_reference.size());
-            for (size_t i = 0, j = 0; i < resampled_mic.size(); ++i, j += 2) {
-                data[j] = resampled_mic[i];
-                data[j + 1] = resampled_reference[i];
-            }
+            int channel_samples = raw_samples / 2;
+            auto mic = capture_mic_.Reserve(channel_samples);
+            auto reference = capture_reference_.Reserve(channel_samples);
+            PcmDeinterleave(raw, mic, reference, channel_samples);
+            int resampled_samples = input_resampler_.GetOutputSamples(channel_samples);
+            auto resampled_mic = capture_resampled_.Reserve(resampled_samples * 2);
+            auto resampled_reference = resampled_mic + resampled_samples;
+            input_resampler_.Process(mic, channel_samples, resampled_mic);
+            reference_resampler_.Process(reference, channel_samples, resampled_reference);
+            AudioFrameBuffer::Resize(data, resampled_samples * 2);
+            PcmInterleave(resampled_mic, resampled_reference, data.data(), resampled_samples);
         } else {
-            auto resampled = std::vector<int16_t>(input_resampler_.GetOutputSamples(data.size()));
-            input_resampler_.Process(data.data(), data.size(), resampled.data());
-            data = std::move(resampled);
+            AudioFrameBuffer::Resize(data, input_resampler_.GetOutputSamples(raw_samples));
+            input_resampler_.Process(raw, raw_samples, data.data());
         }
     } else {
-        data.resize(samples);
+        AudioFrameBuffer::Resize(data, samples);
         if (!codec->InputData(data)) {
             return;
         }
@@ -805,6 +1175,11 @@ void Application::ReadAudio(std::vector<int16_t>& data, int sample_rate, int sam
 void Application::AbortSpeaking(AbortReason reason) {
     ESP_LOGI(TAG, "Abort speaking");
     aborted_ = true;
+    // Stop at once, the queues and the decoded PCM are flushed without walking them.
+    // The frames already handed to the decoder are skipped because of aborted_.
+    audio_decode_queue_.Clear();
+    jitter_buffer_.Reset();
+    playback_ring_->Clear();
     protocol_->SendAbortSpeaking(reason);
 }
 
@@ -822,8 +1197,14 @@ void Application::SetDeviceState(DeviceState state) {
     auto previous_state = device_state_;
     device_state_ = state;
     ESP_LOGI(TAG, "STATE: %s", STATE_STRINGS[device_state_]);
-    // The state is changed, wait for all background tasks to finish
-    background_task_->WaitForCompletion();
+    // The state is changed, wait for the encoder and decoder to finish
+    WaitForAudioWorkers();
+#if CONFIG_USE_UPLINK_VAD_GATE
+    if (previous_state == kDeviceStateListening && uplink_gate_.packets() > 0) {
+        ESP_LOGI(TAG, "Uplink gate: %lu of %lu packets gated, %lu bytes sent, about %lu bytes saved",
+            uplink_gate_.gated_packets(), uplink_gate_.packets(), uplink_gate_.bytes_sent(), uplink_gate_.bytes_saved());
+    }
+#endif
 
     auto& board = Board::GetInstance();
     auto display = board.GetDisplay();
@@ -835,6 +1216,7 @@ void Application::SetDeviceState(DeviceState state) {
             display->SetStatus(Lang::Strings::STANDBY);
             display->SetEmotion("neutral");
             audio_processor_->Stop();
+            uplink_preroll_.Clear();
             
 #if CONFIG_USE_WAKE_WORD_DETECT
             wake_word_detect_.StartDetection();
@@ -846,16 +1228,41 @@ void Application::SetDeviceState(DeviceState state) {
             display->SetChatMessage("system", "");
             timestamp_queue_.clear();
             last_output_timestamp_ = 0;
+            // Capture while connecting, EncodeAudio holds the frames in the pre-roll.
+            // They are encoded before the hello, at the frame duration it will request.
+            uplink_preroll_.Clear();
+            opus_encoder_->SetFrameDuration(uplink_controller_.frame_duration());
+#if CONFIG_USE_UPLINK_VAD_GATE
+            // The turn starts here, its look-back carries on into listening
+            uplink_gate_reset_ = true;
+#endif
+            if (!audio_processor_->IsRunning()) {
+                opus_encoder_->ResetState();
+#if CONFIG_USE_WAKE_WORD_DETECT
+                wake_word_detect_.StopDetection();
+#endif
+                audio_processor_->Start();
+            }
             break;
         case kDeviceStateListening:
             display->SetStatus(Lang::Strings::LISTENING);
             display->SetEmotion("neutral");
             // Update the IoT states before sending the start listening command
             UpdateIotStates();
+#if CONFIG_USE_UPLINK_VAD_GATE
+            if (previous_state != kDeviceStateConnecting) {
+                uplink_gate_reset_ = true;
+            }
+#endif
 
-            // Make sure the audio processor is running
-            if (!audio_processor_->IsRunning()) {
-                // Send the start listening command
+            if (previous_state == kDeviceStateConnecting) {
+                // The audio processor has been running since connecting started
+                protocol_->BeginBatch();
+                protocol_->SendStartListening(listening_mode_);
+                SendUplinkPreroll();
+                protocol_->EndBatch();
+            } else if (!audio_processor_->IsRunning()) {
+                // Send the start listening command and start the audio processor
                 protocol_->SendStartListening(listening_mode_);
                 if (listening_mode_ == kListeningModeAutoStop && previous_state == kDeviceStateSpeaking) {
                     // FIXME: Wait for the speaker to empty the buffer
@@ -886,10 +1293,10 @@ void Application::SetDeviceState(DeviceState state) {
 }
 
 void Application::ResetDecoder() {
-    std::lock_guard<std::mutex> lock(mutex_);
     opus_decoder_->ResetState();
-    audio_decode_queue_.clear();
-    audio_decode_cv_.notify_all();
+    audio_decode_queue_.Clear();
+    jitter_buffer_.Reset();
+    playback_ring_->Clear();
     last_output_time_ = std::chrono::steady_clock::now();
     auto codec = Board::GetInstance().GetAudioCodec();
     codec->EnableOutput(true);
@@ -902,8 +1309,10 @@ void Application::SetDecodeSampleRate(int sample_rate, int frame_duration) {
 
     opus_decoder_.reset();
     opus_decoder_ = std::make_unique<OpusDecoderWrapper>(sample_rate, 1, frame_duration);
+    jitter_buffer_.SetFrameDuration(frame_duration);
 
     auto codec = Board::GetInstance().GetAudioCodec();
+    decode_frame_samples_ = codec->output_sample_rate() * frame_duration / 1000;
     if (opus_decoder_->sample_rate() != codec->output_sample_rate()) {
         ESP_LOGI(TAG, "Resampling audio from %d to %d", opus_decoder_->sample_rate(), codec->output_sample_rate());
         output_resampler_.Configure(opus_decoder_->sample_rate(), codec->output_sample_rate());
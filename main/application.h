@@ -12,15 +12,26 @@
 #include <vector>
 #include <condition_variable>
 #include <memory>
+#include <type_traits>
 
-#include <opus_encoder.h>
 #include <opus_decoder.h>
 #include <opus_resampler.h>
 
 #include "protocol.h"
+#include "json_message_router.h"
 #include "ota.h"
-#include "background_task.h"
+#include "audio_worker.h"
+#include "task_queue.h"
 #include "audio_processor.h"
+#include "audio_packet_ring.h"
+#include "jitter_buffer.h"
+#include "audio_frame_buffer.h"
+#include "pcm_ring.h"
+#include "audio_mixer.h"
+#include "cue_player.h"
+#include "uplink_encoder.h"
+#include "uplink_controller.h"
+#include "uplink_gate.h"
 
 #if CONFIG_USE_WAKE_WORD_DETECT
 #include "wake_word_detect.h"
@@ -44,7 +55,37 @@ enum DeviceState {
     kDeviceStateFatalError
 };
 
+// Tasks scheduled on the main loop beyond this spill into a locked overflow list
+#define MAIN_TASK_QUEUE_CAPACITY 32
+
 #define OPUS_FRAME_DURATION_MS 60
+#define AUDIO_DECODE_QUEUE_CAPACITY (600 / OPUS_FRAME_DURATION_MS)
+#define AUDIO_DECODE_MAX_PAYLOAD_SIZE 1024
+#define AUDIO_JITTER_BUFFER_CAPACITY 16
+#define AUDIO_JITTER_BUFFER_MIN_DELAY_MS 60
+#define AUDIO_JITTER_BUFFER_MAX_DELAY_MS 600
+
+// Encode and decode run on their own tasks, pinned apart on dual-core targets.
+// The encoder queue holds AFE chunks (32ms at 16kHz), the decoder queue Opus frames.
+#define AUDIO_ENCODER_QUEUE_CAPACITY 16
+#define AUDIO_ENCODER_TASK_STACK_SIZE (4096 * 8)
+#define AUDIO_ENCODER_TASK_PRIORITY 4
+#define AUDIO_ENCODER_TASK_CORE 0
+#define AUDIO_DECODER_QUEUE_CAPACITY 2
+#define AUDIO_DECODER_TASK_STACK_SIZE (4096 * 6)
+#define AUDIO_DECODER_TASK_PRIORITY 5
+#define AUDIO_DECODER_TASK_CORE 1
+// Encoded uplink frames held while the audio channel is connecting, about 3 seconds (6 at 120ms frames)
+#define UPLINK_PREROLL_CAPACITY (3000 / OPUS_FRAME_DURATION_MS)
+#define UPLINK_PREROLL_MAX_PAYLOAD_SIZE 512
+// Decoded PCM waiting for the I2S DMA. Frames are decoded ahead until the ring and the frames
+// queued for the decoder cover CONFIG_AUDIO_DECODE_AHEAD_MS, the ring has room for one more
+// frame of the longest duration on top so the decoder does not wait for the playback task.
+#define AUDIO_DECODE_MAX_FRAME_MS 120
+#define AUDIO_PLAYBACK_RING_MS (CONFIG_AUDIO_DECODE_AHEAD_MS + AUDIO_DECODE_MAX_FRAME_MS)
+#define AUDIO_PLAYBACK_WAIT_MS 10
+// Cues are mixed over speech, which is ducked to this level while a cue plays
+#define AUDIO_DUCK_GAIN_PERCENT 30
 
 class Application {
 public:
@@ -59,7 +100,22 @@ public:
     void Start();
     DeviceState GetDeviceState() const { return device_state_; }
     bool IsVoiceDetected() const { return voice_detected_; }
-    void Schedule(std::function<void()> callback);
+    // Runs the callback on the main loop, small captures are stored without allocating
+    template <typename F>
+    void Schedule(F&& callback) {
+        ScheduleTask(InlineTask(std::forward<F>(callback)));
+    }
+    // Same for ISR context, returns false if the queue is full. The capture must fit inline,
+    // and copying or destroying it must not run code that is unsafe in an ISR.
+    template <typename F>
+    bool ScheduleFromISR(F&& callback) {
+        using T = std::decay_t<F>;
+        static_assert(sizeof(T) <= InlineTask::kStorageSize && alignof(T) <= alignof(std::max_align_t),
+            "Capture too large for ISR scheduling");
+        static_assert(std::is_trivially_copyable_v<T>, "Capture must be trivially copyable for ISR scheduling");
+        static_assert(std::is_trivially_destructible_v<T>, "Capture must be trivially destructible for ISR scheduling");
+        return ScheduleTaskFromISR(InlineTask(std::forward<F>(callback)));
+    }
     void SetDeviceState(DeviceState state);
     void Alert(const char* status, const char* message, const char* emotion = "", const std::string_view& sound = "");
     void DismissAlert();
@@ -72,6 +128,8 @@ public:
     void WakeWordInvoke(const std::string& wake_word);
     void PlaySound(const std::string_view& sound);
     bool CanEnterSleepMode();
+    // Stays constant once the capture path has warmed up
+    uint32_t GetCaptureAllocations() const { return AudioFrameBuffer::allocations(); }
 
 private:
     Application();
@@ -82,9 +140,16 @@ private:
 #endif
     std::unique_ptr<AudioProcessor> audio_processor_;
     Ota ota_;
+    TaskQueue main_tasks_;
+    // Keeps the order once main_tasks_ has filled up, drained after it
     std::mutex mutex_;
-    std::list<std::function<void()>> main_tasks_;
+    std::list<InlineTask> overflow_tasks_;
+    std::atomic<bool> overflowing_{false};
+    std::atomic<uint32_t> overflowed_tasks_{0};
+    uint32_t max_task_wait_us_ = 0;
+    uint32_t max_task_run_us_ = 0;
     std::unique_ptr<Protocol> protocol_;
+    JsonMessageRouter json_router_;
     EventGroupHandle_t event_group_ = nullptr;
     esp_timer_handle_t clock_timer_handle_ = nullptr;
     volatile DeviceState device_state_ = kDeviceStateUnknown;
@@ -95,41 +160,101 @@ private:
     bool realtime_chat_enabled_ = false;
 #endif
     bool aborted_ = false;
+    // Set by tts stop until the reply has played out, then the main loop leaves Speaking
+    std::atomic<bool> tts_stop_pending_{false};
+    std::atomic<bool> drain_check_scheduled_{false};
     bool voice_detected_ = false;
-    bool busy_decoding_audio_ = false;
     int clock_ticks_ = 0;
     TaskHandle_t check_new_version_task_handle_ = nullptr;
 
-    // Audio encode / decode
-    TaskHandle_t audio_loop_task_handle_ = nullptr;
-    BackgroundTask* background_task_ = nullptr;
+    // Audio encode / decode, capture and playback are woken by the I2S DMA events
+    TaskHandle_t audio_input_task_handle_ = nullptr;
+    TaskHandle_t audio_output_task_handle_ = nullptr;
+    std::unique_ptr<AudioWorker> encoder_worker_;
+    std::unique_ptr<AudioWorker> decoder_worker_;
     std::chrono::steady_clock::time_point last_output_time_;
-    std::list<AudioStreamPacket> audio_decode_queue_;
-    std::condition_variable audio_decode_cv_;
+    // Single consumer is the playback task, producers are serialized by audio_decode_producer_mutex_
+    AudioPacketRing audio_decode_queue_;
+    std::mutex audio_decode_producer_mutex_;
+    // Owned by the playback task, reorders packets from audio_decode_queue_ before decoding
+    JitterBuffer jitter_buffer_;
+    // Written by the decoder task at the codec output rate, drained by the playback task
+    std::unique_ptr<PcmRing> playback_ring_;
+    std::vector<int16_t> playback_pcm_;
+    // Frames handed to the decoder and not yet in the ring, and their size at the output rate
+    std::atomic<int> decode_pending_{0};
+    std::atomic<int> decode_frame_samples_{0};
+    bool playing_ = false;
+    std::atomic<uint32_t> output_underruns_{0};
+    // Mixes the speech in playback_ring_ with the cues, both created in Start()
+    std::unique_ptr<CuePlayer> cue_player_;
+    std::unique_ptr<AudioMixer> audio_mixer_;
+
+    // Produced by the encoder task while connecting, drained by the main loop once listening
+    AudioPacketRing uplink_preroll_;
+    // A frame pushed after the state check can land once the pre-roll has been sent
+    std::atomic<bool> preroll_drain_scheduled_{false};
 
     // 新增：用于维护音频包的timestamp队列
     std::list<uint32_t> timestamp_queue_;
     std::mutex timestamp_mutex_;
     std::atomic<uint32_t> last_output_timestamp_ = 0;
 
-    std::unique_ptr<OpusEncoderWrapper> opus_encoder_;
+    std::unique_ptr<UplinkEncoder> opus_encoder_;
+    UplinkController uplink_controller_;
+    uint32_t last_encoder_dropped_ = 0;
+#if CONFIG_USE_UPLINK_VAD_GATE
+    // Owned by the encoder task, reset there when a listening turn starts
+    UplinkGate uplink_gate_;
+    std::atomic<bool> uplink_gate_reset_{false};
+#endif
     std::unique_ptr<OpusDecoderWrapper> opus_decoder_;
+    // Reused by the decode path so that steady-state playback does not allocate.
+    // decode_frame_ belongs to the playback task, the PCM buffers to the decoder task.
+    AudioFrame decode_frame_;
+    std::vector<int16_t> decode_pcm_;
+    std::vector<int16_t> resample_pcm_;
+
+    // Capture path buffers, reused every frame by the capture task
+    std::vector<int16_t> capture_data_;
+    AudioFrameBuffer capture_raw_;
+    AudioFrameBuffer capture_mic_;
+    AudioFrameBuffer capture_reference_;
+    AudioFrameBuffer capture_resampled_;
 
     OpusResampler input_resampler_;
     OpusResampler reference_resampler_;
     OpusResampler output_resampler_;
 
     void MainEventLoop();
-    void OnAudioInput();
+    void ScheduleTask(InlineTask&& task);
+    bool ScheduleTaskFromISR(InlineTask&& task);
+    void RunTask(InlineTask& task, int64_t push_time_us);
+    bool OnAudioInput();
     void OnAudioOutput();
+    void WritePlayback();
+    void QueuePlayback(const std::vector<int16_t>& pcm, uint32_t clears);
+    void EncodeAudio(AudioFrame& frame);
+    void EncodePcm(std::vector<int16_t>&& pcm, int64_t fetch_time, bool gated);
+    void DecodeAudio(AudioFrame& frame);
+    void WaitForAudioWorkers();
+    bool PlaybackDrained();
+    void CheckPlaybackDrained();
+    void FinishSpeaking();
     void ReadAudio(std::vector<int16_t>& data, int sample_rate, int samples);
     void ResetDecoder();
     void SetDecodeSampleRate(int sample_rate, int frame_duration);
+    bool OpenAudioChannel();
+    void SendUplinkPreroll();
+    void EvaluateUplink();
     void CheckNewVersion();
     void ShowActivationCode();
     void OnClockTimer();
+    void RegisterJsonHandlers();
     void SetListeningMode(ListeningMode mode);
-    void AudioLoop();
+    void AudioInputLoop();
+    void AudioOutputLoop();
+    std::string GetAudioStatsJson() const;
 };
 
 #endif // _APPLICATION_H_
@@ -15,17 +15,75 @@ AudioCodec::~AudioCodec() {
 }
 
 void AudioCodec::OutputData(std::vector<int16_t>& data) {
-    Write(data.data(), data.size());
+    OutputData(data.data(), data.size());
+}
+
+void AudioCodec::OutputData(const int16_t* data, int samples) {
+    Write(data, samples);
+    int space = output_space_.fetch_sub(samples, std::memory_order_relaxed);
+    if (space < samples) {
+        output_space_.fetch_add(samples - space, std::memory_order_relaxed);
+    }
 }
 
 bool AudioCodec::InputData(std::vector<int16_t>& data) {
-    int samples = Read(data.data(), data.size());
-    if (samples > 0) {
+    return InputData(data.data(), data.size());
+}
+
+bool AudioCodec::InputData(int16_t* data, int samples) {
+    int available = input_available_.fetch_sub(samples, std::memory_order_relaxed);
+    if (available < samples) {
+        input_available_.fetch_add(samples - available, std::memory_order_relaxed);
+    }
+    if (Read(data, samples) > 0) {
         return true;
     }
     return false;
 }
 
+// Returns true if a higher priority task was woken
+bool IRAM_ATTR AudioCodec::NotifyFromISR(TaskHandle_t task) {
+    if (task == nullptr) {
+        return false;
+    }
+    BaseType_t higher_priority_task_woken = pdFALSE;
+    vTaskNotifyGiveFromISR(task, &higher_priority_task_woken);
+    return higher_priority_task_woken == pdTRUE;
+}
+
+// Each event is one DMA buffer of AUDIO_CODEC_DMA_FRAME_NUM frames. The driver keeps at most
+// AUDIO_CODEC_DMA_DESC_NUM - 1 of them queued and drops the oldest one after that.
+bool IRAM_ATTR AudioCodec::OnRecv(i2s_chan_handle_t handle, i2s_event_data_t* event, void* user_ctx) {
+    auto codec = (AudioCodec*)user_ctx;
+    if (!codec->input_enabled_) {
+        return false;
+    }
+    int buffer_samples = AUDIO_CODEC_DMA_FRAME_NUM * codec->input_channels_;
+    if (codec->input_available_.load(std::memory_order_relaxed) < (AUDIO_CODEC_DMA_DESC_NUM - 1) * buffer_samples) {
+        codec->input_available_.fetch_add(buffer_samples, std::memory_order_relaxed);
+    }
+    return NotifyFromISR(codec->input_task_);
+}
+
+bool IRAM_ATTR AudioCodec::OnRecvOverflow(i2s_chan_handle_t handle, i2s_event_data_t* event, void* user_ctx) {
+    auto codec = (AudioCodec*)user_ctx;
+    if (codec->input_enabled_) {
+        codec->input_overruns_.fetch_add(1, std::memory_order_relaxed);
+    }
+    return false;
+}
+
+bool IRAM_ATTR AudioCodec::OnSent(i2s_chan_handle_t handle, i2s_event_data_t* event, void* user_ctx) {
+    auto codec = (AudioCodec*)user_ctx;
+    if (!codec->output_enabled_) {
+        return false;
+    }
+    if (codec->output_space_.load(std::memory_order_relaxed) < (AUDIO_CODEC_DMA_DESC_NUM - 1) * AUDIO_CODEC_DMA_FRAME_NUM) {
+        codec->output_space_.fetch_add(AUDIO_CODEC_DMA_FRAME_NUM, std::memory_order_relaxed);
+    }
+    return NotifyFromISR(codec->output_task_);
+}
+
 void AudioCodec::Start() {
     Settings settings("audio", false);
     output_volume_ = settings.GetInt("output_volume", output_volume_);
@@ -34,6 +92,15 @@ void AudioCodec::Start() {
         output_volume_ = 10;
     }
 
+    // The callbacks can only be registered before the channels are enabled
+    i2s_event_callbacks_t rx_callbacks = {};
+    rx_callbacks.on_recv = OnRecv;
+    rx_callbacks.on_recv_q_ovf = OnRecvOverflow;
+    ESP_ERROR_CHECK(i2s_channel_register_event_callback(rx_handle_, &rx_callbacks, this));
+    i2s_event_callbacks_t tx_callbacks = {};
+    tx_callbacks.on_sent = OnSent;
+    ESP_ERROR_CHECK(i2s_channel_register_event_callback(tx_handle_, &tx_callbacks, this));
+
     ESP_ERROR_CHECK(i2s_channel_enable(tx_handle_));
     ESP_ERROR_CHECK(i2s_channel_enable(rx_handle_));
 
@@ -3,8 +3,11 @@
 
 #include <freertos/FreeRTOS.h>
 #include <freertos/event_groups.h>
+#include <freertos/task.h>
 #include <driver/i2s_std.h>
 
+#include <algorithm>
+#include <atomic>
 #include <vector>
 #include <string>
 #include <functional>
@@ -25,7 +28,25 @@ public:
 
     void Start();
     void OutputData(std::vector<int16_t>& data);
+    void OutputData(const int16_t* data, int samples);
     bool InputData(std::vector<int16_t>& data);
+    bool InputData(int16_t* data, int samples);
+    // The I2S ISR gives the task a notification each time a DMA buffer has been received or
+    // sent while the direction is enabled. Set before Start().
+    inline void SetInputTask(TaskHandle_t task) { input_task_ = task; }
+    inline void SetOutputTask(TaskHandle_t task) { output_task_ = task; }
+
+    // Samples that can be read or written without blocking, counted from the DMA events
+    inline int input_available() const { return input_available_.load(std::memory_order_relaxed); }
+    inline int output_space() const { return output_space_.load(std::memory_order_relaxed); }
+    // A chunk larger than the DMA can hold is read as soon as the DMA is full
+    inline bool input_ready(int samples) const {
+        return input_available() >= std::min(samples, (AUDIO_CODEC_DMA_DESC_NUM - 1) * AUDIO_CODEC_DMA_FRAME_NUM * input_channels_);
+    }
+    // Every DMA buffer is free, the output is playing the cleared buffers
+    inline bool output_drained() const { return output_space() >= (AUDIO_CODEC_DMA_DESC_NUM - 1) * AUDIO_CODEC_DMA_FRAME_NUM; }
+    // Received DMA buffers dropped by the driver because they were not read in time
+    inline uint32_t input_overruns() const { return input_overruns_.load(std::memory_order_relaxed); }
 
     inline bool duplex() const { return duplex_; }
     inline bool input_reference() const { return input_reference_; }
@@ -53,6 +74,18 @@ protected:
 
     virtual int Read(int16_t* dest, int samples) = 0;
     virtual int Write(const int16_t* data, int samples) = 0;
+
+private:
+    TaskHandle_t input_task_ = nullptr;
+    TaskHandle_t output_task_ = nullptr;
+    std::atomic<int> input_available_{0};
+    std::atomic<int> output_space_{0};
+    std::atomic<uint32_t> input_overruns_{0};
+
+    static bool IRAM_ATTR NotifyFromISR(TaskHandle_t task);
+    static bool IRAM_ATTR OnRecv(i2s_chan_handle_t handle, i2s_event_data_t* event, void* user_ctx);
+    static bool IRAM_ATTR OnRecvOverflow(i2s_chan_handle_t handle, i2s_event_data_t* event, void* user_ctx);
+    static bool IRAM_ATTR OnSent(i2s_chan_handle_t handle, i2s_event_data_t* event, void* user_ctx);
 };
 
 #endif // _AUDIO_CODEC_H
@@ -8,6 +8,11 @@
 
 class NoAudioCodec : public AudioCodec {
 private:
+    std::vector<int32_t> read_buffer_;
+    std::vector<int32_t> write_buffer_;
+    int volume_factor_volume_ = -1;
+    int32_t volume_factor_ = 0;
+
     virtual int Write(const int16_t* data, int samples) override;
     virtual int Read(int16_t* dest, int samples) override;
 
@@ -0,0 +1,90 @@
+#include "pcm_kernels.h"
+
+#include <algorithm>
+
+int32_t PcmVolumeFactor(int volume) {
+    volume = std::clamp(volume, 0, 100);
+    // (volume / 100)^2 * 65536 in integer arithmetic
+    return (int32_t)((int64_t)volume * volume * 65536 / 10000);
+}
+
+void PcmScaleToInt32(const int16_t* __restrict in, int32_t* __restrict out, size_t samples, int32_t factor) {
+    size_t i = 0;
+    for (; i + 4 <= samples; i += 4) {
+        out[i] = in[i] * factor;
+        out[i + 1] = in[i + 1] * factor;
+        out[i + 2] = in[i + 2] * factor;
+        out[i + 3] = in[i + 3] * factor;
+    }
+    for (; i < samples; i++) {
+        out[i] = in[i] * factor;
+    }
+}
+
+static inline int16_t Narrow(int32_t value, int shift) {
+    return (int16_t)std::clamp<int32_t>(value >> shift, -INT16_MAX, INT16_MAX);
+}
+
+void PcmNarrowToInt16(const int32_t* __restrict in, int16_t* __restrict out, size_t samples, int shift) {
+    size_t i = 0;
+    for (; i + 4 <= samples; i += 4) {
+        out[i] = Narrow(in[i], shift);
+        out[i + 1] = Narrow(in[i + 1], shift);
+        out[i + 2] = Narrow(in[i + 2], shift);
+        out[i + 3] = Narrow(in[i + 3], shift);
+    }
+    for (; i < samples; i++) {
+        out[i] = Narrow(in[i], shift);
+    }
+}
+
+void PcmMixQ15(const int16_t* __restrict in, int32_t* __restrict acc, size_t samples, int32_t gain, int32_t step) {
+    size_t i = 0;
+    for (; i + 4 <= samples; i += 4) {
+        acc[i] += (in[i] * gain) >> 15;
+        acc[i + 1] += (in[i + 1] * (gain + step)) >> 15;
+        acc[i + 2] += (in[i + 2] * (gain + 2 * step)) >> 15;
+        acc[i + 3] += (in[i + 3] * (gain + 3 * step)) >> 15;
+        gain += 4 * step;
+    }
+    for (; i < samples; i++) {
+        acc[i] += (in[i] * gain) >> 15;
+        gain += step;
+    }
+}
+
+void PcmDeinterleave(const int16_t* __restrict in, int16_t* __restrict left, int16_t* __restrict right, size_t frames) {
+    size_t i = 0;
+    for (; i + 4 <= frames; i += 4, in += 8) {
+        left[i] = in[0];
+        right[i] = in[1];
+        left[i + 1] = in[2];
+        right[i + 1] = in[3];
+        left[i + 2] = in[4];
+        right[i + 2] = in[5];
+        left[i + 3] = in[6];
+        right[i + 3] = in[7];
+    }
+    for (; i < frames; i++, in += 2) {
+        left[i] = in[0];
+        right[i] = in[1];
+    }
+}
+
+void PcmInterleave(const int16_t* __restrict left, const int16_t* __restrict right, int16_t* __restrict out, size_t frames) {
+    size_t i = 0;
+    for (; i + 4 <= frames; i += 4, out += 8) {
+        out[0] = left[i];
+        out[1] = right[i];
+        out[2] = left[i + 1];
+        out[3] = right[i + 1];
+        out[4] = left[i + 2];
+        out[5] = right[i + 2];
+        out[6] = left[i + 3];
+        out[7] = right[i + 3];
+    }
+    for (; i < frames; i++, out += 2) {
+        out[0] = left[i];
+        out[1] = right[i];
+    }
+}
@@ -0,0 +1,31 @@
+#ifndef _PCM_KERNELS_H
+#define _PCM_KERNELS_H
+
+#include <cstddef>
+#include <cstdint>
+
+// Sample conversion kernels shared by the codecs and the capture path.
+// The loops are branch-free and unrolled by four so that GCC maps the clamps
+// to MIN/MAX (Xtensa) or min/max (RISC-V) and keeps the pointers in registers.
+// Buffers must not overlap.
+
+// 0-100 user volume to a Q16 gain with a square-law curve, 65536 is unity
+int32_t PcmVolumeFactor(int volume);
+
+// out = in * factor for a Q16 factor in [0, 65536]. The product of an int16
+// sample and such a factor always fits in int32, so no saturation is needed.
+void PcmScaleToInt32(const int16_t* in, int32_t* out, size_t samples, int32_t factor);
+
+// out = clamp(in >> shift, -INT16_MAX, INT16_MAX)
+void PcmNarrowToInt16(const int32_t* in, int16_t* out, size_t samples, int shift);
+
+// acc += (in * gain) >> 15 for a Q15 gain in [0, 32768] that changes by `step` after every
+// sample, so a ramp is applied without a division. Each term stays in int16 range, several
+// sources can be summed into acc and saturated with PcmNarrowToInt16(acc, out, n, 0).
+void PcmMixQ15(const int16_t* in, int32_t* acc, size_t samples, int32_t gain, int32_t step);
+
+// Stereo frames <-> two mono channels, `frames` is the number of samples per channel
+void PcmDeinterleave(const int16_t* in, int16_t* left, int16_t* right, size_t frames);
+void PcmInterleave(const int16_t* left, const int16_t* right, int16_t* out, size_t frames);
+
+#endif // _PCM_KERNELS_H
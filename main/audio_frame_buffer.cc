@@ -0,0 +1,39 @@
+#include "audio_frame_buffer.h"
+
+#include <esp_log.h>
+#include <esp_heap_caps.h>
+#include <cassert>
+
+#define TAG "AudioFrameBuffer"
+
+std::atomic<uint32_t> AudioFrameBuffer::allocations_{0};
+
+AudioFrameBuffer::~AudioFrameBuffer() {
+    if (data_ != nullptr) {
+        heap_caps_free(data_);
+    }
+}
+
+int16_t* AudioFrameBuffer::Reserve(size_t samples) {
+    if (samples <= capacity_) {
+        return data_;
+    }
+
+    if (data_ != nullptr) {
+        heap_caps_free(data_);
+    }
+    // Internal memory, the capture path touches every sample of every frame
+    data_ = (int16_t*)heap_caps_aligned_alloc(16, samples * sizeof(int16_t), MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    assert(data_ != nullptr);
+    capacity_ = samples;
+    allocations_++;
+    ESP_LOGD(TAG, "Grow to %zu samples", samples);
+    return data_;
+}
+
+void AudioFrameBuffer::Resize(std::vector<int16_t>& buffer, size_t samples) {
+    if (samples > buffer.capacity()) {
+        allocations_++;
+    }
+    buffer.resize(samples);
+}
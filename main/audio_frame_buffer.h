@@ -0,0 +1,36 @@
+#ifndef AUDIO_FRAME_BUFFER_H
+#define AUDIO_FRAME_BUFFER_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Grow-only, 16-byte aligned sample buffer for the capture path. Every growth
+// is counted, so once the capture path has warmed up allocations() stays
+// constant and any per-frame heap traffic shows up as a moving counter.
+class AudioFrameBuffer {
+public:
+    AudioFrameBuffer() = default;
+    ~AudioFrameBuffer();
+    AudioFrameBuffer(const AudioFrameBuffer&) = delete;
+    AudioFrameBuffer& operator=(const AudioFrameBuffer&) = delete;
+
+    // Returns a buffer of at least `samples` samples, previous content is not kept
+    int16_t* Reserve(size_t samples);
+
+    inline int16_t* data() { return data_; }
+    inline size_t capacity() const { return capacity_; }
+
+    // Resizes a vector that is reused across frames, counting its growth as well
+    static void Resize(std::vector<int16_t>& buffer, size_t samples);
+    static uint32_t allocations() { return allocations_; }
+
+private:
+    int16_t* data_ = nullptr;
+    size_t capacity_ = 0;
+
+    static std::atomic<uint32_t> allocations_;
+};
+
+#endif // AUDIO_FRAME_BUFFER_H
@@ -0,0 +1,91 @@
+#include "audio_mixer.h"
+#include "pcm_kernels.h"
+
+#include <algorithm>
+#include <climits>
+#include <cstdlib>
+#include <cstring>
+
+// Time for a full-scale gain change, e.g. ducking in or out
+#define AUDIO_MIXER_RAMP_MS 20
+
+static inline int32_t PercentToQ15(int percent) {
+    return std::clamp(percent, 0, 100) * 32768 / 100;
+}
+
+AudioMixer::AudioMixer(int sample_rate, size_t max_samples)
+    : source_pcm_(max_samples), mix_(max_samples) {
+    ramp_step_ = std::max(1, 32768 / (sample_rate * AUDIO_MIXER_RAMP_MS / 1000));
+}
+
+void AudioMixer::AddSource(AudioSource source, PcmRing* ring, int priority) {
+    sources_[source].ring = ring;
+    sources_[source].priority = priority;
+}
+
+void AudioMixer::SetGain(AudioSource source, int percent) {
+    sources_[source].gain = PercentToQ15(percent);
+}
+
+void AudioMixer::SetDuckGain(int percent) {
+    duck_gain_ = PercentToQ15(percent);
+}
+
+bool AudioMixer::Empty() const {
+    for (int i = 0; i < kAudioSourceCount; i++) {
+        if (!Empty((AudioSource)i)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+size_t AudioMixer::Mix(int16_t* dest, size_t samples) {
+    samples = std::min(samples, mix_.size());
+
+    // The highest priority with data ducks the others, the longest source sets the length
+    size_t available[kAudioSourceCount];
+    int top_priority = INT_MIN;
+    size_t mixed = 0;
+    for (int i = 0; i < kAudioSourceCount; i++) {
+        auto& source = sources_[i];
+        available[i] = source.ring != nullptr ? std::min(source.ring->Size(), samples) : 0;
+        if (available[i] > 0) {
+            top_priority = std::max(top_priority, source.priority);
+            mixed = std::max(mixed, available[i]);
+        }
+    }
+    if (mixed == 0) {
+        return 0;
+    }
+
+    memset(mix_.data(), 0, mixed * sizeof(int32_t));
+    int32_t duck_gain = duck_gain_;
+    for (int i = 0; i < kAudioSourceCount; i++) {
+        auto& source = sources_[i];
+        int32_t target = source.gain;
+        if (source.priority < top_priority) {
+            target = target * duck_gain >> 15;
+        }
+        if (available[i] == 0) {
+            // An idle source starts again from silence, no ramp needed
+            source.current_gain = target;
+            continue;
+        }
+
+        size_t n = source.ring->Read(source_pcm_.data(), available[i]);
+        int32_t change = target - source.current_gain;
+        size_t ramp = std::min(n, (size_t)((std::abs(change) + ramp_step_ - 1) / ramp_step_));
+        if (ramp > 0) {
+            int32_t step = change / (int32_t)ramp;
+            PcmMixQ15(source_pcm_.data(), mix_.data(), ramp, source.current_gain, step);
+            // The rounding left over is dropped when the ramp ends in this buffer
+            source.current_gain = ramp < n ? target : source.current_gain + step * (int32_t)ramp;
+        }
+        if (ramp < n) {
+            PcmMixQ15(source_pcm_.data() + ramp, mix_.data() + ramp, n - ramp, source.current_gain, 0);
+        }
+    }
+    PcmNarrowToInt16(mix_.data(), dest, mixed, 0);
+    return mixed;
+}
@@ -0,0 +1,58 @@
+#ifndef AUDIO_MIXER_H
+#define AUDIO_MIXER_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "pcm_ring.h"
+
+enum AudioSource {
+    kAudioSourceVoice,  // Downlink speech, written by the decoder task
+    kAudioSourceCue,    // Built-in P3 sounds, written by the cue player
+    kAudioSourceCount,
+};
+
+// Mixes the PCM sources in front of AudioCodec::OutputData, all at the codec output rate.
+// Every source has its own ring and its own decoder, so a short cue plays over speech
+// instead of waiting for it. While a source has data, the sources with a lower priority
+// are ducked. Gains are Q15 and ramp over AUDIO_MIXER_RAMP_MS so that ducking does not
+// click, the sum is saturated to int16.
+//
+// Mix() must be called from the playback task only, the gains may be set from any task.
+class AudioMixer {
+public:
+    AudioMixer(int sample_rate, size_t max_samples);
+    AudioMixer(const AudioMixer&) = delete;
+    AudioMixer& operator=(const AudioMixer&) = delete;
+
+    // The ring is not owned, it must outlive the mixer
+    void AddSource(AudioSource source, PcmRing* ring, int priority);
+    // 0-100 percent
+    void SetGain(AudioSource source, int percent);
+    // Gain applied on top to the sources below the highest playing priority
+    void SetDuckGain(int percent);
+
+    // Returns the number of samples mixed into dest, 0 when no source has data.
+    // A source that has less data than the others is padded with silence.
+    size_t Mix(int16_t* dest, size_t samples);
+    bool Empty() const;
+    inline bool Empty(AudioSource source) const { return sources_[source].ring == nullptr || sources_[source].ring->Empty(); }
+
+private:
+    struct Source {
+        PcmRing* ring = nullptr;
+        int priority = 0;
+        std::atomic<int32_t> gain{32768};  // Q15, set by SetGain()
+        int32_t current_gain = 32768;      // Q15, ramped towards the target by Mix()
+    };
+
+    Source sources_[kAudioSourceCount];
+    std::atomic<int32_t> duck_gain_{32768};
+    int32_t ramp_step_;  // Largest Q15 gain change per sample
+    std::vector<int16_t> source_pcm_;
+    std::vector<int32_t> mix_;
+};
+
+#endif // AUDIO_MIXER_H
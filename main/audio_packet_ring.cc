@@ -0,0 +1,96 @@
+#include "audio_packet_ring.h"
+
+#include <esp_log.h>
+#include <esp_heap_caps.h>
+#include <esp_timer.h>
+#include <cassert>
+#include <cstring>
+
+#define TAG "AudioPacketRing"
+
+AudioPacketRing::AudioPacketRing(size_t capacity, size_t max_payload_size)
+    : capacity_(capacity), max_payload_size_(max_payload_size) {
+    slots_ = (Slot*)heap_caps_calloc(capacity_, sizeof(Slot), MALLOC_CAP_8BIT);
+    // Prefer PSRAM for the payload slab, internal SRAM is the scarcer resource
+    slab_ = (uint8_t*)heap_caps_malloc(capacity_ * max_payload_size_, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    if (slab_ == nullptr) {
+        slab_ = (uint8_t*)heap_caps_malloc(capacity_ * max_payload_size_, MALLOC_CAP_8BIT);
+    }
+    assert(slots_ != nullptr && slab_ != nullptr);
+    ESP_LOGI(TAG, "Created ring with %zu slots of %zu bytes", capacity_, max_payload_size_);
+}
+
+AudioPacketRing::~AudioPacketRing() {
+    heap_caps_free(slab_);
+    heap_caps_free(slots_);
+}
+
+bool AudioPacketRing::Push(const AudioStreamPacket& packet) {
+    return Push(packet.timestamp, packet.data(), packet.size(), packet.sequence);
+}
+
+bool AudioPacketRing::Push(uint32_t timestamp, const uint8_t* payload, size_t size, uint32_t sequence) {
+    if (size > max_payload_size_) {
+        ESP_LOGW(TAG, "Payload too large: %zu > %zu", size, max_payload_size_);
+        return false;
+    }
+
+    size_t head = head_.load(std::memory_order_relaxed);
+    if (head - tail_.load(std::memory_order_acquire) >= capacity_) {
+        return false;
+    }
+
+    auto& slot = slots_[head % capacity_];
+    slot.push_time_us = esp_timer_get_time();
+    slot.timestamp = timestamp;
+    slot.sequence = sequence;
+    slot.size = size;
+    memcpy(SlotPayload(head), payload, size);
+    head_.store(head + 1, std::memory_order_release);
+    return true;
+}
+
+// Apply a pending Clear() by jumping the tail forward, consumer side only
+size_t AudioPacketRing::ConsumerTail() {
+    size_t tail = tail_.load(std::memory_order_relaxed);
+    size_t flush_until = flush_until_.load(std::memory_order_acquire);
+    if ((ptrdiff_t)(flush_until - tail) > 0) {
+        tail = flush_until;
+        tail_.store(tail, std::memory_order_release);
+    }
+    return tail;
+}
+
+bool AudioPacketRing::Pop(AudioStreamPacket& packet, int64_t* push_time_us) {
+    size_t tail = ConsumerTail();
+    if (head_.load(std::memory_order_acquire) == tail) {
+        return false;
+    }
+
+    auto& slot = slots_[tail % capacity_];
+    packet.timestamp = slot.timestamp;
+    packet.sequence = slot.sequence;
+    if (push_time_us != nullptr) {
+        *push_time_us = slot.push_time_us;
+    }
+    auto payload = SlotPayload(tail);
+    packet.payload.assign(payload, payload + slot.size);
+    packet.Borrow(nullptr, 0);
+    tail_.store(tail + 1, std::memory_order_release);
+    return true;
+}
+
+void AudioPacketRing::Clear() {
+    flush_until_.store(head_.load(std::memory_order_acquire), std::memory_order_release);
+}
+
+size_t AudioPacketRing::Size() const {
+    // Load order matters: head is read last so it is never behind flush_until
+    size_t flush_until = flush_until_.load(std::memory_order_acquire);
+    size_t tail = tail_.load(std::memory_order_acquire);
+    size_t head = head_.load(std::memory_order_acquire);
+    if ((ptrdiff_t)(flush_until - tail) > 0) {
+        tail = flush_until;
+    }
+    return head - tail;
+}
@@ -0,0 +1,60 @@
+#ifndef AUDIO_PACKET_RING_H
+#define AUDIO_PACKET_RING_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+#include "protocol.h"
+
+// Fixed-capacity, lock-free single-producer / single-consumer packet queue.
+// Payloads are copied into a slab allocated once in the constructor, so
+// neither side touches the heap or takes a lock in steady state.
+class AudioPacketRing {
+public:
+    AudioPacketRing(size_t capacity, size_t max_payload_size);
+    ~AudioPacketRing();
+    AudioPacketRing(const AudioPacketRing&) = delete;
+    AudioPacketRing& operator=(const AudioPacketRing&) = delete;
+
+    // Producer side, returns false if the ring is full or the payload is too large
+    bool Push(const AudioStreamPacket& packet);
+    bool Push(uint32_t timestamp, const uint8_t* payload, size_t size, uint32_t sequence = 0);
+
+    // Consumer side, optionally returns the time (esp_timer_get_time) the packet was pushed.
+    // The payload is copied into packet.payload, which keeps its capacity across calls.
+    bool Pop(AudioStreamPacket& packet, int64_t* push_time_us = nullptr);
+
+    // May be called from any thread, drops everything pushed so far.
+    // The slots are reclaimed when the consumer next calls Pop().
+    void Clear();
+
+    size_t Size() const;
+    inline bool Empty() const { return Size() == 0; }
+    inline bool Full() const { return Size() >= capacity_; }
+    inline size_t capacity() const { return capacity_; }
+    inline size_t max_payload_size() const { return max_payload_size_; }
+
+private:
+    struct Slot {
+        int64_t push_time_us;
+        uint32_t timestamp;
+        uint32_t sequence;
+        uint32_t size;
+    };
+
+    const size_t capacity_;
+    const size_t max_payload_size_;
+    Slot* slots_ = nullptr;
+    uint8_t* slab_ = nullptr;
+
+    // Free-running counters, the slot index is counter % capacity_
+    std::atomic<size_t> head_{0};  // Written by the producer only
+    std::atomic<size_t> tail_{0};  // Written by the consumer only
+    std::atomic<size_t> flush_until_{0};
+
+    size_t ConsumerTail();
+    inline uint8_t* SlotPayload(size_t index) { return slab_ + (index % capacity_) * max_payload_size_; }
+};
+
+#endif // AUDIO_PACKET_RING_H
@@ -2,9 +2,6 @@
 #define AFE_AUDIO_PROCESSOR_H
 
 #include <esp_afe_sr_models.h>
-#include <freertos/FreeRTOS.h>
-#include <freertos/task.h>
-#include <freertos/event_groups.h>
 
 #include <string>
 #include <vector>
@@ -12,31 +9,30 @@
 
 #include "audio_processor.h"
 #include "audio_codec.h"
+#include "afe_pipeline.h"
 
+// Uplink consumer of the shared AFE pipeline, runs noise suppression and VAD
 class AfeAudioProcessor : public AudioProcessor {
 public:
     AfeAudioProcessor();
     ~AfeAudioProcessor();
 
     void Initialize(AudioCodec* codec) override;
-    void Feed(const std::vector<int16_t>& data) override;
+    void Feed(const std::vector<int16_t>& data, int64_t capture_time_us) override;
     void Start() override;
     void Stop() override;
     bool IsRunning() override;
-    void OnOutput(std::function<void(std::vector<int16_t>&& data)> callback) override;
+    void OnOutput(std::function<void(std::vector<int16_t>&& data, bool speech, int64_t capture_time_us)> callback) override;
     void OnVadStateChange(std::function<void(bool speaking)> callback) override;
     size_t GetFeedSize() override;
 
 private:
-    EventGroupHandle_t event_group_ = nullptr;
-    esp_afe_sr_iface_t* afe_iface_ = nullptr;
-    esp_afe_sr_data_t* afe_data_ = nullptr;
-    std::function<void(std::vector<int16_t>&& data)> output_callback_;
+    AfePipeline& pipeline_;
+    std::function<void(std::vector<int16_t>&& data, bool speech, int64_t capture_time_us)> output_callback_;
     std::function<void(bool speaking)> vad_state_change_callback_;
-    AudioCodec* codec_ = nullptr;
     bool is_speaking_ = false;
 
-    void AudioProcessorTask();
+    void OnFetch(const afe_fetch_result_t* res);
 };
 
 #endif 
\ No newline at end of file
@@ -0,0 +1,248 @@
+#include "afe_pipeline.h"
+#include "latency_monitor.h"
+
+#include <esp_log.h>
+#include <esp_heap_caps.h>
+#include <esp_timer.h>
+#include <model_path.h>
+#include <cstring>
+#include <string>
+
+// Data older than this is left over from before the pipeline went idle
+#define AFE_STALE_FEED_US 200000
+
+static const char* TAG = "AfePipeline";
+
+AfePipeline::~AfePipeline() {
+    if (afe_data_ != nullptr) {
+        afe_iface_->destroy(afe_data_);
+    }
+}
+
+void AfePipeline::Initialize(AudioCodec* codec) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (afe_data_ != nullptr) {
+        return;
+    }
+    codec_ = codec;
+    int64_t start_time = esp_timer_get_time();
+    size_t internal_before = heap_caps_get_free_size(MALLOC_CAP_INTERNAL);
+    size_t psram_before = heap_caps_get_free_size(MALLOC_CAP_SPIRAM);
+
+    int ref_num = codec_->input_reference() ? 1 : 0;
+    std::string input_format;
+    for (int i = 0; i < codec_->input_channels() - ref_num; i++) {
+        input_format.push_back('M');
+    }
+    for (int i = 0; i < ref_num; i++) {
+        input_format.push_back('R');
+    }
+
+    models_ = esp_srmodel_init("model");
+#if CONFIG_USE_WAKE_WORD_DETECT
+    wakenet_model_ = esp_srmodel_filter(models_, ESP_WN_PREFIX, NULL);
+#endif
+    char* ns_model_name = esp_srmodel_filter(models_, ESP_NSNET_PREFIX, NULL);
+
+    // WakeNet needs the SR front end, without it the voice communication one is enough
+    afe_config_t* afe_config = afe_config_init(input_format.c_str(), models_,
+        wakenet_model_ != nullptr ? AFE_TYPE_SR : AFE_TYPE_VC, AFE_MODE_HIGH_PERF);
+    afe_config->wakenet_init = wakenet_model_ != nullptr;
+    afe_config->aec_init = ref_num > 0;
+#ifdef CONFIG_USE_DEVICE_AEC
+    afe_config->aec_mode = AEC_MODE_VOIP_HIGH_PERF;
+#else
+    afe_config->aec_mode = AEC_MODE_SR_HIGH_PERF;
+#endif
+#if CONFIG_USE_AUDIO_PROCESSOR
+    afe_config->ns_init = ns_model_name != nullptr;
+    afe_config->ns_model_name = ns_model_name;
+    afe_config->afe_ns_mode = AFE_NS_MODE_NET;
+#ifdef CONFIG_USE_DEVICE_AEC
+    afe_config->vad_init = false;
+#else
+    afe_config->vad_init = true;
+    afe_config->vad_mode = VAD_MODE_0;
+    afe_config->vad_min_noise_ms = 100;
+#endif
+#else
+    afe_config->ns_init = false;
+    afe_config->vad_init = false;
+#endif
+    afe_config->afe_perferred_core = 1;
+    afe_config->afe_perferred_priority = 1;
+    afe_config->agc_init = false;
+    afe_config->memory_alloc_mode = AFE_MEMORY_ALLOC_MORE_PSRAM;
+
+    available_stages_ = (afe_config->wakenet_init ? AFE_STAGE_WAKENET : 0) |
+        (afe_config->aec_init ? AFE_STAGE_AEC : 0) |
+        (afe_config->ns_init ? AFE_STAGE_NS : 0) |
+        (afe_config->vad_init ? AFE_STAGE_VAD : 0);
+
+    afe_iface_ = esp_afe_handle_from_config(afe_config);
+    afe_data_ = afe_iface_->create_from_config(afe_config);
+    // Every stage starts switched off until a consumer needs it
+    applied_stages_ = available_stages_;
+    ApplyStages(0);
+
+    ESP_LOGI(TAG, "AFE created in %lld ms, stages 0x%lx, %u KB internal and %u KB PSRAM",
+        (esp_timer_get_time() - start_time) / 1000, available_stages_,
+        (unsigned)((internal_before - heap_caps_get_free_size(MALLOC_CAP_INTERNAL)) / 1024),
+        (unsigned)((psram_before - heap_caps_get_free_size(MALLOC_CAP_SPIRAM)) / 1024));
+
+    xTaskCreate([](void* arg) {
+        auto this_ = (AfePipeline*)arg;
+        this_->FetchTask();
+        vTaskDelete(NULL);
+    }, "afe_fetch", 4096, this, 3, NULL);
+}
+
+void AfePipeline::OnFetch(AfeConsumer consumer, std::function<void(const afe_fetch_result_t* result)> callback) {
+    std::lock_guard<std::mutex> lock(callbacks_mutex_);
+    callbacks_[consumer] = callback;
+}
+
+uint32_t AfePipeline::StagesFor(uint32_t consumers) const {
+    uint32_t stages = 0;
+    if (consumers & (1 << kAfeConsumerWakeWord)) {
+        stages |= AFE_STAGE_WAKENET | AFE_STAGE_AEC;
+    }
+    if (consumers & (1 << kAfeConsumerUplink)) {
+        stages |= AFE_STAGE_NS | AFE_STAGE_VAD;
+#ifdef CONFIG_USE_DEVICE_AEC
+        stages |= AFE_STAGE_AEC;
+#endif
+    }
+    return stages & available_stages_;
+}
+
+void AfePipeline::Enable(AfeConsumer consumer, bool enable) {
+    uint32_t bit = 1 << consumer;
+    uint32_t previous;
+    if (enable) {
+        previous = enabled_consumers_.fetch_or(bit);
+        if (previous & bit) {
+            return;
+        }
+        enable_times_[consumer] = esp_timer_get_time();
+        if (previous == 0 && afe_data_ != nullptr &&
+            esp_timer_get_time() - last_feed_time_.load() > AFE_STALE_FEED_US) {
+            afe_iface_->reset_buffer(afe_data_);
+            // The chunks fed so far were dropped, the next one fetched is the next one fed
+            realign_chunk_ = fed_chunks_.load();
+            realign_.store(true, std::memory_order_release);
+        }
+    } else {
+        previous = enabled_consumers_.fetch_and(~bit);
+        if ((previous & bit) == 0) {
+            return;
+        }
+        enable_times_[consumer] = 0;
+    }
+    requested_stages_ = StagesFor(enabled_consumers_.load());
+}
+
+bool AfePipeline::IsEnabled(AfeConsumer consumer) const {
+    return enabled_consumers_.load() & (1 << consumer);
+}
+
+void AfePipeline::Feed(const std::vector<int16_t>& data, int64_t capture_time_us) {
+    if (afe_data_ == nullptr) {
+        return;
+    }
+    last_feed_time_ = esp_timer_get_time();
+    // Stored before the feed, the fetch task may deliver the chunk right after it
+    uint32_t chunk = fed_chunks_.load(std::memory_order_relaxed);
+    capture_times_[chunk % kCaptureTimes] = capture_time_us;
+    fed_chunks_.store(chunk + 1, std::memory_order_release);
+    afe_iface_->feed(afe_data_, data.data());
+}
+
+size_t AfePipeline::GetFeedSize() {
+    if (afe_data_ == nullptr) {
+        return 0;
+    }
+    return afe_iface_->get_feed_chunksize(afe_data_) * codec_->input_channels();
+}
+
+// Runs on the fetch task, switching stages while fetch is not running
+void AfePipeline::ApplyStages(uint32_t stages) {
+    uint32_t changed = stages ^ applied_stages_;
+    if (changed & AFE_STAGE_WAKENET) {
+        if (stages & AFE_STAGE_WAKENET) {
+            afe_iface_->enable_wakenet(afe_data_);
+        } else {
+            afe_iface_->disable_wakenet(afe_data_);
+        }
+    }
+    if (changed & AFE_STAGE_AEC) {
+        if (stages & AFE_STAGE_AEC) {
+            afe_iface_->enable_aec(afe_data_);
+        } else {
+            afe_iface_->disable_aec(afe_data_);
+        }
+    }
+    if (changed & AFE_STAGE_NS) {
+        if (stages & AFE_STAGE_NS) {
+            afe_iface_->enable_ns(afe_data_);
+        } else {
+            afe_iface_->disable_ns(afe_data_);
+        }
+    }
+    if (changed & AFE_STAGE_VAD) {
+        if (stages & AFE_STAGE_VAD) {
+            afe_iface_->reset_vad(afe_data_);
+            afe_iface_->enable_vad(afe_data_);
+        } else {
+            afe_iface_->disable_vad(afe_data_);
+        }
+    }
+    applied_stages_ = stages;
+}
+
+// Runs on the fetch task, finds the chunk the fetched samples end in
+void AfePipeline::UpdateCaptureTime(size_t samples, size_t feed_size) {
+    if (realign_.exchange(false, std::memory_order_acquire)) {
+        fetched_samples_ = (uint64_t)realign_chunk_ * feed_size;
+    }
+    fetched_samples_ += samples;
+    uint32_t chunk = (uint32_t)((fetched_samples_ - 1) / feed_size);
+    uint32_t fed_chunks = fed_chunks_.load(std::memory_order_acquire);
+    if (chunk < fed_chunks && fed_chunks - chunk < kCaptureTimes) {
+        fetch_capture_time_ = capture_times_[chunk % kCaptureTimes];
+    } else {
+        fetch_capture_time_ = esp_timer_get_time();
+    }
+}
+
+void AfePipeline::FetchTask() {
+    auto fetch_size = afe_iface_->get_fetch_chunksize(afe_data_);
+    auto feed_size = afe_iface_->get_feed_chunksize(afe_data_);
+    ESP_LOGI(TAG, "AFE fetch task started, feed size: %d fetch size: %d", feed_size, fetch_size);
+
+    while (true) {
+        auto res = afe_iface_->fetch_with_delay(afe_data_, portMAX_DELAY);
+        uint32_t stages = requested_stages_.load();
+        if (stages != applied_stages_) {
+            ApplyStages(stages);
+        }
+        if (res == nullptr || res->ret_value == ESP_FAIL) {
+            if (res != nullptr) {
+                ESP_LOGI(TAG, "Error code: %d", res->ret_value);
+            }
+            continue;
+        }
+        UpdateCaptureTime(res->data_size / sizeof(int16_t), feed_size);
+        std::lock_guard<std::mutex> lock(callbacks_mutex_);
+        for (int i = 0; i < kAfeConsumerCount; i++) {
+            if (!IsEnabled((AfeConsumer)i) || !callbacks_[i]) {
+                continue;
+            }
+            int64_t enable_time = enable_times_[i].exchange(0);
+            if (enable_time != 0) {
+                LatencyMonitor::GetInstance().RecordSince(kLatencyMetricAfeSwitch, enable_time);
+            }
+            callbacks_[i](res);
+        }
+    }
+}
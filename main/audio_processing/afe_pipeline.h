@@ -0,0 +1,97 @@
+#ifndef AFE_PIPELINE_H
+#define AFE_PIPELINE_H
+
+#include <esp_afe_sr_models.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <vector>
+
+#include "audio_codec.h"
+
+enum AfeConsumer {
+    kAfeConsumerWakeWord,   // WakeNet, AEC when a reference channel exists
+    kAfeConsumerUplink,     // NS and VAD, AEC with CONFIG_USE_DEVICE_AEC
+    kAfeConsumerCount,
+};
+
+#define AFE_STAGE_WAKENET (1 << 0)
+#define AFE_STAGE_AEC (1 << 1)
+#define AFE_STAGE_NS (1 << 2)
+#define AFE_STAGE_VAD (1 << 3)
+
+// A single AFE instance shared by wake word detection and the uplink audio processor.
+// The models are loaded once and one fetch task fans the results out to the enabled
+// consumers. Enabling a consumer switches the AFE stages it needs on the next chunk,
+// the buffers are only reset when the pipeline has been idle.
+class AfePipeline {
+public:
+    static AfePipeline& GetInstance() {
+        static AfePipeline instance;
+        return instance;
+    }
+    AfePipeline(const AfePipeline&) = delete;
+    AfePipeline& operator=(const AfePipeline&) = delete;
+
+    // Creates the AFE on the first call, later calls do nothing
+    void Initialize(AudioCodec* codec);
+    // Called on the fetch task while the consumer is enabled. Waits for a callback in progress,
+    // so the consumer may be destroyed once OnFetch(consumer, nullptr) returns. Must not be
+    // called from a callback.
+    void OnFetch(AfeConsumer consumer, std::function<void(const afe_fetch_result_t* result)> callback);
+    void Enable(AfeConsumer consumer, bool enable);
+    bool IsEnabled(AfeConsumer consumer) const;
+    // capture_time_us is esp_timer_get_time() when data was read from the codec
+    void Feed(const std::vector<int16_t>& data, int64_t capture_time_us);
+    size_t GetFeedSize();
+    // Capture time of the input the chunk being delivered ends with, for the fetch callbacks.
+    // Falls back to the fetch time once the chunk is no longer in the capture time window.
+    inline int64_t fetch_capture_time() const { return fetch_capture_time_; }
+    inline srmodel_list_t* models() const { return models_; }
+    inline char* wakenet_model() const { return wakenet_model_; }
+
+private:
+    AfePipeline() = default;
+    ~AfePipeline();
+
+    std::mutex mutex_;
+    AudioCodec* codec_ = nullptr;
+    srmodel_list_t* models_ = nullptr;
+    char* wakenet_model_ = nullptr;
+    esp_afe_sr_iface_t* afe_iface_ = nullptr;
+    esp_afe_sr_data_t* afe_data_ = nullptr;
+    // Stages the AFE was created with, only these can be switched
+    uint32_t available_stages_ = 0;
+    // Requested by Enable, applied by the fetch task before it delivers the next chunk
+    std::atomic<uint32_t> requested_stages_{0};
+    uint32_t applied_stages_ = 0;
+    std::atomic<uint32_t> enabled_consumers_{0};
+    // Set by the consumers while the fetch task runs, held while the callbacks are called
+    std::mutex callbacks_mutex_;
+    std::function<void(const afe_fetch_result_t* result)> callbacks_[kAfeConsumerCount];
+    // Time a consumer was enabled, cleared by its first chunk to record the switch latency
+    std::atomic<int64_t> enable_times_[kAfeConsumerCount] = {};
+    std::atomic<int64_t> last_feed_time_{0};
+
+    // Capture times of the last chunks fed, indexed by the chunk count. The AFE output keeps
+    // the sample count of its input, so the fetch task maps the samples it has fetched back
+    // to the chunk they were fed in.
+    static constexpr size_t kCaptureTimes = 32;
+    int64_t capture_times_[kCaptureTimes] = {};
+    std::atomic<uint32_t> fed_chunks_{0};
+    // Set by Enable when the AFE buffer is reset, the fetch task realigns on realign_chunk_
+    uint32_t realign_chunk_ = 0;
+    std::atomic<bool> realign_{false};
+    uint64_t fetched_samples_ = 0;
+    int64_t fetch_capture_time_ = 0;
+
+    uint32_t StagesFor(uint32_t consumers) const;
+    void ApplyStages(uint32_t stages);
+    void UpdateCaptureTime(size_t samples, size_t feed_size);
+    void FetchTask();
+};
+
+#endif // AFE_PIPELINE_H
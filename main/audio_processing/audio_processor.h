@@ -12,11 +12,14 @@ public:
     virtual ~AudioProcessor() = default;
     
     virtual void Initialize(AudioCodec* codec) = 0;
-    virtual void Feed(const std::vector<int16_t>& data) = 0;
+    // capture_time_us is esp_timer_get_time() when data was read from the codec
+    virtual void Feed(const std::vector<int16_t>& data, int64_t capture_time_us) = 0;
     virtual void Start() = 0;
     virtual void Stop() = 0;
     virtual bool IsRunning() = 0;
-    virtual void OnOutput(std::function<void(std::vector<int16_t>&& data)> callback) = 0;
+    // speech is the VAD result for the chunk, always true for processors without VAD.
+    // capture_time_us is the capture time of the input the chunk ends with.
+    virtual void OnOutput(std::function<void(std::vector<int16_t>&& data, bool speech, int64_t capture_time_us)> callback) = 0;
     virtual void OnVadStateChange(std::function<void(bool speaking)> callback) = 0;
     virtual size_t GetFeedSize() = 0;
 };
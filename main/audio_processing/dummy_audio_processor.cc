@@ -7,12 +7,12 @@ void DummyAudioProcessor::Initialize(AudioCodec* codec) {
     codec_ = codec;
 }
 
-void DummyAudioProcessor::Feed(const std::vector<int16_t>& data) {
+void DummyAudioProcessor::Feed(const std::vector<int16_t>& data, int64_t capture_time_us) {
     if (!is_running_ || !output_callback_) {
         return;
     }
     // 直接将输入数据传递给输出回调
-    output_callback_(std::vector<int16_t>(data));
+    output_callback_(std::vector<int16_t>(data), true, capture_time_us);
 }
 
 void DummyAudioProcessor::Start() {
@@ -27,7 +27,7 @@ bool DummyAudioProcessor::IsRunning() {
     return is_running_;
 }
 
-void DummyAudioProcessor::OnOutput(std::function<void(std::vector<int16_t>&& data)> callback) {
+void DummyAudioProcessor::OnOutput(std::function<void(std::vector<int16_t>&& data, bool speech, int64_t capture_time_us)> callback) {
     output_callback_ = callback;
 }
 
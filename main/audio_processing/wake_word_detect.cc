@@ -4,73 +4,76 @@
 #include <esp_log.h>
 #include <model_path.h>
 #include <arpa/inet.h>
+#include <esp_timer.h>
 #include <sstream>
-
-#define DETECTION_RUNNING_EVENT 1
+#include <chrono>
+#include <cstring>
+#include <algorithm>
+
+// About 2 seconds of 16 kHz mono PCM, a power of two so the free-running counters wrap cleanly
+#define WAKE_WORD_PCM_SAMPLES 32768
+#define WAKE_WORD_OPUS_PACKETS (2000 / OPUS_FRAME_DURATION_MS)
+#define WAKE_WORD_FRAME_SAMPLES (16000 * OPUS_FRAME_DURATION_MS / 1000)
+#define WAKE_WORD_ENCODE_TASK_STACK_SIZE (4096 * 8)
+// The encode task needs a few ms for the frames left after detection, it never takes this long
+#define WAKE_WORD_OPUS_WAIT_MS 1000
 
 static const char* TAG = "WakeWordDetect";
 
 WakeWordDetect::WakeWordDetect()
-    : afe_data_(nullptr),
-      wake_word_pcm_(),
-      wake_word_opus_() {
-
-    event_group_ = xEventGroupCreate();
+    : pipeline_(AfePipeline::GetInstance()) {
 }
 
 WakeWordDetect::~WakeWordDetect() {
-    if (afe_data_ != nullptr) {
-        afe_iface_->destroy(afe_data_);
-    }
+    pipeline_.Enable(kAfeConsumerWakeWord, false);
+    pipeline_.OnFetch(kAfeConsumerWakeWord, nullptr);
 
+    if (wake_word_encode_task_ != nullptr) {
+        vTaskDelete(wake_word_encode_task_);
+    }
     if (wake_word_encode_task_stack_ != nullptr) {
         heap_caps_free(wake_word_encode_task_stack_);
     }
-
-    vEventGroupDelete(event_group_);
+    if (wake_word_pcm_ != nullptr) {
+        heap_caps_free(wake_word_pcm_);
+    }
 }
 
 void WakeWordDetect::Initialize(AudioCodec* codec) {
-    codec_ = codec;
-    int ref_num = codec_->input_reference() ? 1 : 0;
-
-    srmodel_list_t *models = esp_srmodel_init("model");
+    pipeline_.Initialize(codec);
+    auto models = pipeline_.models();
     for (int i = 0; i < models->num; i++) {
         ESP_LOGI(TAG, "Model %d: %s", i, models->model_name[i]);
-        if (strstr(models->model_name[i], ESP_WN_PREFIX) != NULL) {
-            wakenet_model_ = models->model_name[i];
-            auto words = esp_srmodel_get_wake_words(models, wakenet_model_);
-            // split by ";" to get all wake words
-            std::stringstream ss(words);
-            std::string word;
-            while (std::getline(ss, word, ';')) {
-                wake_words_.push_back(word);
-            }
+    }
+    if (pipeline_.wakenet_model() != nullptr) {
+        auto words = esp_srmodel_get_wake_words(models, pipeline_.wakenet_model());
+        // split by ";" to get all wake words
+        std::stringstream ss(words);
+        std::string word;
+        while (std::getline(ss, word, ';')) {
+            wake_words_.push_back(word);
         }
     }
 
-    std::string input_format;
-    for (int i = 0; i < codec_->input_channels() - ref_num; i++) {
-        input_format.push_back('M');
-    }
-    for (int i = 0; i < ref_num; i++) {
-        input_format.push_back('R');
+    wake_word_pcm_ = (int16_t*)heap_caps_malloc(WAKE_WORD_PCM_SAMPLES * sizeof(int16_t), MALLOC_CAP_SPIRAM);
+    if (wake_word_pcm_ == nullptr) {
+        wake_word_pcm_ = (int16_t*)heap_caps_malloc(WAKE_WORD_PCM_SAMPLES * sizeof(int16_t), MALLOC_CAP_8BIT);
     }
-    afe_config_t* afe_config = afe_config_init(input_format.c_str(), models, AFE_TYPE_SR, AFE_MODE_HIGH_PERF);
-    afe_config->aec_init = codec_->input_reference();
-    afe_config->aec_mode = AEC_MODE_SR_HIGH_PERF;
-    afe_config->afe_perferred_core = 1;
-    afe_config->afe_perferred_priority = 1;
-    afe_config->memory_alloc_mode = AFE_MEMORY_ALLOC_MORE_PSRAM;
-    
-    afe_iface_ = esp_afe_handle_from_config(afe_config);
-    afe_data_ = afe_iface_->create_from_config(afe_config);
-
-    xTaskCreate([](void* arg) {
+    assert(wake_word_pcm_ != nullptr);
+    opus_ring_.resize(WAKE_WORD_OPUS_PACKETS);
+    wake_word_encoder_ = std::make_unique<UplinkEncoder>(16000, 1, OPUS_FRAME_DURATION_MS);
+    wake_word_encoder_->SetComplexity(0); // 0 is the fastest
+
+    wake_word_encode_task_stack_ = (StackType_t*)heap_caps_malloc(WAKE_WORD_ENCODE_TASK_STACK_SIZE, MALLOC_CAP_SPIRAM);
+    wake_word_encode_task_ = xTaskCreateStatic([](void* arg) {
         auto this_ = (WakeWordDetect*)arg;
-        this_->AudioDetectionTask();
+        this_->WakeWordEncodeTask();
         vTaskDelete(NULL);
-    }, "audio_detection", 4096, this, 3, nullptr);
+    }, "encode_detect_packets", WAKE_WORD_ENCODE_TASK_STACK_SIZE, this, 2, wake_word_encode_task_stack_, &wake_word_encode_task_buffer_);
+
+    pipeline_.OnFetch(kAfeConsumerWakeWord, [this](const afe_fetch_result_t* res) {
+        OnFetch(res);
+    });
 }
 
 void WakeWordDetect::OnWakeWordDetected(std::function<void(const std::string& wake_word)> callback) {
@@ -78,109 +81,135 @@ void WakeWordDetect::OnWakeWordDetected(std::function<void(const std::string& wa
 }
 
 void WakeWordDetect::StartDetection() {
-    xEventGroupSetBits(event_group_, DETECTION_RUNNING_EVENT);
+    if (!IsDetectionRunning()) {
+        // The audio from before detection stopped does not belong to the next wake word
+        pcm_discard_position_.store(pcm_write_position_.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    }
+    pipeline_.Enable(kAfeConsumerWakeWord, true);
 }
 
 void WakeWordDetect::StopDetection() {
-    xEventGroupClearBits(event_group_, DETECTION_RUNNING_EVENT);
-    if (afe_data_ != nullptr) {
-        afe_iface_->reset_buffer(afe_data_);
-    }
+    pipeline_.Enable(kAfeConsumerWakeWord, false);
 }
 
 bool WakeWordDetect::IsDetectionRunning() {
-    return xEventGroupGetBits(event_group_) & DETECTION_RUNNING_EVENT;
+    return pipeline_.IsEnabled(kAfeConsumerWakeWord);
 }
 
-void WakeWordDetect::Feed(const std::vector<int16_t>& data) {
-    if (afe_data_ == nullptr) {
-        return;
-    }
-    afe_iface_->feed(afe_data_, data.data());
+void WakeWordDetect::Feed(const std::vector<int16_t>& data, int64_t capture_time_us) {
+    pipeline_.Feed(data, capture_time_us);
 }
 
 size_t WakeWordDetect::GetFeedSize() {
-    if (afe_data_ == nullptr) {
-        return 0;
-    }
-    return afe_iface_->get_feed_chunksize(afe_data_) * codec_->input_channels();
+    return pipeline_.GetFeedSize();
 }
 
-void WakeWordDetect::AudioDetectionTask() {
-    auto fetch_size = afe_iface_->get_fetch_chunksize(afe_data_);
-    auto feed_size = afe_iface_->get_feed_chunksize(afe_data_);
-    ESP_LOGI(TAG, "Audio detection task started, feed size: %d fetch size: %d",
-        feed_size, fetch_size);
+// Called on the AFE fetch task while detection runs
+void WakeWordDetect::OnFetch(const afe_fetch_result_t* res) {
+    // Store the wake word data for voice recognition, like who is speaking
+    StoreWakeWordData((uint16_t*)res->data, res->data_size / sizeof(uint16_t));
 
-    while (true) {
-        xEventGroupWaitBits(event_group_, DETECTION_RUNNING_EVENT, pdFALSE, pdTRUE, portMAX_DELAY);
+    if (res->wakeup_state == WAKENET_DETECTED) {
+        StopDetection();
+        last_detected_wake_word_ = wake_words_[res->wake_word_index - 1];
 
-        auto res = afe_iface_->fetch_with_delay(afe_data_, portMAX_DELAY);
-        if (res == nullptr || res->ret_value == ESP_FAIL) {
-            continue;;
+        if (wake_word_detected_callback_) {
+            wake_word_detected_callback_(last_detected_wake_word_);
         }
+    }
+}
 
-        // Store the wake word data for voice recognition, like who is speaking
-        StoreWakeWordData((uint16_t*)res->data, res->data_size / sizeof(uint16_t));
-
-        if (res->wakeup_state == WAKENET_DETECTED) {
-            StopDetection();
-            last_detected_wake_word_ = wake_words_[res->wake_word_index - 1];
+void WakeWordDetect::StoreWakeWordData(uint16_t* data, size_t samples) {
+    // Runs on the AFE fetch task, the only writer of the PCM ring
+    uint32_t position = pcm_write_position_.load(std::memory_order_relaxed);
+    size_t offset = position & (WAKE_WORD_PCM_SAMPLES - 1);
+    size_t first = std::min(samples, (size_t)WAKE_WORD_PCM_SAMPLES - offset);
+    memcpy(wake_word_pcm_ + offset, data, first * sizeof(int16_t));
+    memcpy(wake_word_pcm_, data + first, (samples - first) * sizeof(int16_t));
+    pcm_write_position_.store(position + samples, std::memory_order_release);
+    xTaskNotifyGive(wake_word_encode_task_);
+}
 
-            if (wake_word_detected_callback_) {
-                wake_word_detected_callback_(last_detected_wake_word_);
+void WakeWordDetect::WakeWordEncodeTask() {
+    while (true) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        EncodePendingFrames();
+
+        if (snapshot_requested_.exchange(false)) {
+            // Hand the encoded wake word audio over in order, followed by an empty end marker
+            std::lock_guard<std::mutex> lock(wake_word_mutex_);
+            for (size_t i = 0; i < opus_ring_count_; i++) {
+                wake_word_opus_.emplace_back();
+                wake_word_opus_.back().swap(opus_ring_[(opus_ring_start_ + i) % opus_ring_.size()]);
             }
+            opus_ring_count_ = 0;
+            ESP_LOGI(TAG, "Wake word opus ready: %zu packets in %lld ms", wake_word_opus_.size(),
+                (esp_timer_get_time() - snapshot_request_time_) / 1000);
+            wake_word_opus_.push_back(std::vector<uint8_t>());
+            wake_word_cv_.notify_all();
         }
     }
 }
 
-void WakeWordDetect::StoreWakeWordData(uint16_t* data, size_t samples) {
-    // store audio data to wake_word_pcm_
-    wake_word_pcm_.emplace_back(std::vector<int16_t>(data, data + samples));
-    // keep about 2 seconds of data, detect duration is 32ms (sample_rate == 16000, chunksize == 512)
-    while (wake_word_pcm_.size() > 2000 / 32) {
-        wake_word_pcm_.pop_front();
+// Encodes every complete frame in the PCM ring, the partial frame waits for more samples
+void WakeWordDetect::EncodePendingFrames() {
+    uint32_t write_position = pcm_write_position_.load(std::memory_order_acquire);
+    uint32_t discard_position = pcm_discard_position_.load(std::memory_order_relaxed);
+    if ((int32_t)(discard_position - pcm_read_position_) > 0) {
+        pcm_read_position_ = discard_position;
+        wake_word_encoder_->ResetState();
+        opus_ring_count_ = 0;
+    }
+    if (write_position - pcm_read_position_ > WAKE_WORD_PCM_SAMPLES) {
+        // The encoder fell behind and the oldest samples have been overwritten
+        ESP_LOGW(TAG, "Wake word encoder overrun, skipping %lu samples",
+            write_position - pcm_read_position_ - WAKE_WORD_PCM_SAMPLES);
+        pcm_read_position_ = write_position - WAKE_WORD_PCM_SAMPLES;
+    }
+
+    while (write_position - pcm_read_position_ >= WAKE_WORD_FRAME_SAMPLES) {
+        size_t offset = pcm_read_position_ & (WAKE_WORD_PCM_SAMPLES - 1);
+        size_t first = std::min((size_t)WAKE_WORD_FRAME_SAMPLES, (size_t)WAKE_WORD_PCM_SAMPLES - offset);
+        encode_pcm_.resize(WAKE_WORD_FRAME_SAMPLES);
+        memcpy(encode_pcm_.data(), wake_word_pcm_ + offset, first * sizeof(int16_t));
+        memcpy(encode_pcm_.data() + first, wake_word_pcm_, (WAKE_WORD_FRAME_SAMPLES - first) * sizeof(int16_t));
+        pcm_read_position_ += WAKE_WORD_FRAME_SAMPLES;
+
+        // When the ring is full the next slot holds the oldest packet, which is overwritten
+        bool full = opus_ring_count_ == opus_ring_.size();
+        size_t index = (opus_ring_start_ + opus_ring_count_) % opus_ring_.size();
+        bool encoded = wake_word_encoder_->EncodeFrame(encode_pcm_.data(), opus_ring_[index]);
+        if (full) {
+            opus_ring_start_ = (opus_ring_start_ + 1) % opus_ring_.size();
+            opus_ring_count_--;
+        }
+        if (encoded) {
+            opus_ring_count_++;
+        }
     }
 }
 
 void WakeWordDetect::EncodeWakeWordData() {
-    wake_word_opus_.clear();
-    if (wake_word_encode_task_stack_ == nullptr) {
-        wake_word_encode_task_stack_ = (StackType_t*)heap_caps_malloc(4096 * 8, MALLOC_CAP_SPIRAM);
+    {
+        std::lock_guard<std::mutex> lock(wake_word_mutex_);
+        wake_word_opus_.clear();
     }
-    wake_word_encode_task_ = xTaskCreateStatic([](void* arg) {
-        auto this_ = (WakeWordDetect*)arg;
-        {
-            auto start_time = esp_timer_get_time();
-            auto encoder = std::make_unique<OpusEncoderWrapper>(16000, 1, OPUS_FRAME_DURATION_MS);
-            encoder->SetComplexity(0); // 0 is the fastest
-
-            for (auto& pcm: this_->wake_word_pcm_) {
-                encoder->Encode(std::move(pcm), [this_](std::vector<uint8_t>&& opus) {
-                    std::lock_guard<std::mutex> lock(this_->wake_word_mutex_);
-                    this_->wake_word_opus_.emplace_back(std::move(opus));
-                    this_->wake_word_cv_.notify_all();
-                });
-            }
-            this_->wake_word_pcm_.clear();
-
-            auto end_time = esp_timer_get_time();
-            ESP_LOGI(TAG, "Encode wake word opus %zu packets in %lld ms",
-                this_->wake_word_opus_.size(), (end_time - start_time) / 1000);
-
-            std::lock_guard<std::mutex> lock(this_->wake_word_mutex_);
-            this_->wake_word_opus_.push_back(std::vector<uint8_t>());
-            this_->wake_word_cv_.notify_all();
-        }
-        vTaskDelete(NULL);
-    }, "encode_detect_packets", 4096 * 8, this, 2, wake_word_encode_task_stack_, &wake_word_encode_task_buffer_);
+    // Detection has stopped, so at most the frames of the last fetch are left to encode
+    snapshot_request_time_ = esp_timer_get_time();
+    snapshot_requested_ = true;
+    xTaskNotifyGive(wake_word_encode_task_);
 }
 
 bool WakeWordDetect::GetWakeWordOpus(std::vector<uint8_t>& opus) {
     std::unique_lock<std::mutex> lock(wake_word_mutex_);
-    wake_word_cv_.wait(lock, [this]() {
+    if (!wake_word_cv_.wait_for(lock, std::chrono::milliseconds(WAKE_WORD_OPUS_WAIT_MS), [this]() {
         return !wake_word_opus_.empty();
-    });
+    })) {
+        // Do not hold the main loop, the wake word is sent without its audio
+        ESP_LOGW(TAG, "Timed out waiting for the wake word opus");
+        opus.clear();
+        return false;
+    }
     opus.swap(wake_word_opus_.front());
     wake_word_opus_.pop_front();
     return !opus.empty();
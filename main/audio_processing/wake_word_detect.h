@@ -8,7 +8,9 @@
 #include <esp_afe_sr_models.h>
 #include <esp_nsn_models.h>
 
-#include <list>
+#include <atomic>
+#include <deque>
+#include <memory>
 #include <string>
 #include <vector>
 #include <functional>
@@ -16,14 +18,17 @@
 #include <condition_variable>
 
 #include "audio_codec.h"
+#include "afe_pipeline.h"
+#include "uplink_encoder.h"
 
+// Wake word consumer of the shared AFE pipeline
 class WakeWordDetect {
 public:
     WakeWordDetect();
     ~WakeWordDetect();
 
     void Initialize(AudioCodec* codec);
-    void Feed(const std::vector<int16_t>& data);
+    void Feed(const std::vector<int16_t>& data, int64_t capture_time_us);
     void OnWakeWordDetected(std::function<void(const std::string& wake_word)> callback);
     void StartDetection();
     void StopDetection();
@@ -34,25 +39,40 @@ public:
     const std::string& GetLastDetectedWakeWord() const { return last_detected_wake_word_; }
 
 private:
-    esp_afe_sr_iface_t* afe_iface_ = nullptr;
-    esp_afe_sr_data_t* afe_data_ = nullptr;
-    char* wakenet_model_ = NULL;
+    AfePipeline& pipeline_;
     std::vector<std::string> wake_words_;
-    EventGroupHandle_t event_group_;
     std::function<void(const std::string& wake_word)> wake_word_detected_callback_;
-    AudioCodec* codec_ = nullptr;
     std::string last_detected_wake_word_;
 
+    // The detected audio is encoded continuously while detection runs. The detection task
+    // writes PCM into a PSRAM ring, the encode task turns it into Opus packets and keeps
+    // the last 2 seconds of them, so they are ready as soon as the wake word is detected.
     TaskHandle_t wake_word_encode_task_ = nullptr;
     StaticTask_t wake_word_encode_task_buffer_;
     StackType_t* wake_word_encode_task_stack_ = nullptr;
-    std::list<std::vector<int16_t>> wake_word_pcm_;
-    std::list<std::vector<uint8_t>> wake_word_opus_;
+    std::unique_ptr<UplinkEncoder> wake_word_encoder_;
+    int16_t* wake_word_pcm_ = nullptr;
+    // Free-running sample counters, the ring index is counter % WAKE_WORD_PCM_SAMPLES
+    std::atomic<uint32_t> pcm_write_position_{0};
+    std::atomic<uint32_t> pcm_discard_position_{0};
+    uint32_t pcm_read_position_ = 0;
+    std::vector<int16_t> encode_pcm_;
+    // Ring of the latest Opus packets, used on the encode task only. Frames are encoded
+    // straight into the slot they replace, so a slot allocates once and then keeps its
+    // capacity. The slots handed over with a wake word start empty again.
+    std::vector<std::vector<uint8_t>> opus_ring_;
+    size_t opus_ring_start_ = 0;
+    size_t opus_ring_count_ = 0;
+    std::atomic<bool> snapshot_requested_{false};
+    int64_t snapshot_request_time_ = 0;
+    std::deque<std::vector<uint8_t>> wake_word_opus_;
     std::mutex wake_word_mutex_;
     std::condition_variable wake_word_cv_;
 
     void StoreWakeWordData(uint16_t* data, size_t size);
-    void AudioDetectionTask();
+    void OnFetch(const afe_fetch_result_t* res);
+    void WakeWordEncodeTask();
+    void EncodePendingFrames();
 };
 
 #endif
@@ -0,0 +1,162 @@
+#include "audio_worker.h"
+
+#include <esp_log.h>
+#include <esp_heap_caps.h>
+#include <esp_timer.h>
+
+#include <algorithm>
+
+#define TAG "AudioWorker"
+
+struct AudioWorker::Task {
+    const char* name;
+    std::mutex mutex;
+    std::condition_variable condition_variable;
+    std::vector<AudioWorker*> workers;
+    size_t next = 0;  // The worker served first on the next turn
+
+    TaskHandle_t handle = nullptr;
+    StaticTask_t buffer;
+    StackType_t* stack = nullptr;
+
+    ~Task() {
+        if (handle != nullptr) {
+            vTaskDelete(handle);
+        }
+        heap_caps_free(stack);
+    }
+
+    // The caller holds mutex, returns nullptr if no worker has a frame queued
+    AudioWorker* NextReady() {
+        for (size_t i = 0; i < workers.size(); i++) {
+            size_t index = (next + i) % workers.size();
+            if (workers[index]->count_ > 0) {
+                next = (index + 1) % workers.size();
+                return workers[index];
+            }
+        }
+        return nullptr;
+    }
+
+    void Loop() {
+        ESP_LOGI(TAG, "%s started", name);
+        AudioWorker* worker = nullptr;
+        AudioFrame frame;
+        while (true) {
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                if (worker != nullptr) {
+                    worker->busy_ = false;
+                }
+                condition_variable.notify_all();
+                condition_variable.wait(lock, [this, &worker]() {
+                    worker = NextReady();
+                    return worker != nullptr;
+                });
+                // The slot gets the buffers of the previous frame back
+                std::swap(frame, worker->slots_[worker->head_]);
+                worker->head_ = (worker->head_ + 1) % worker->slots_.size();
+                worker->count_--;
+                worker->busy_ = true;
+            }
+
+            int64_t start_time = esp_timer_get_time();
+            worker->handler_(frame);
+            uint32_t elapsed_us = esp_timer_get_time() - start_time;
+            if (elapsed_us > worker->max_process_time_us_) {
+                worker->max_process_time_us_ = elapsed_us;
+            }
+            worker->processed_++;
+        }
+    }
+};
+
+AudioWorker::AudioWorker(const char* name, size_t queue_capacity, uint32_t stack_size, UBaseType_t priority,
+    int core_id, uint32_t stack_caps, std::function<void(AudioFrame& frame)> handler)
+    : name_(name), handler_(handler), task_(std::make_shared<Task>()), slots_(queue_capacity) {
+    task_->name = name;
+    task_->workers.push_back(this);
+    task_->stack = (StackType_t*)heap_caps_malloc(stack_size, stack_caps);
+    if (task_->stack == nullptr) {
+        task_->stack = (StackType_t*)heap_caps_malloc(stack_size, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    }
+    assert(task_->stack != nullptr);
+
+#if CONFIG_FREERTOS_UNICORE
+    core_id = -1;
+#endif
+    task_->handle = xTaskCreateStaticPinnedToCore([](void* arg) {
+        Task* task = (Task*)arg;
+        task->Loop();
+    }, name, stack_size, task_.get(), priority, task_->stack, &task_->buffer, core_id < 0 ? tskNO_AFFINITY : core_id);
+}
+
+AudioWorker::AudioWorker(AudioWorker& host, const char* name, size_t queue_capacity,
+    std::function<void(AudioFrame& frame)> handler)
+    : name_(name), handler_(handler), task_(host.task_), slots_(queue_capacity) {
+    std::lock_guard<std::mutex> lock(task_->mutex);
+    task_->workers.push_back(this);
+    ESP_LOGI(TAG, "%s runs on %s", name, task_->name);
+}
+
+AudioWorker::~AudioWorker() {
+    std::unique_lock<std::mutex> lock(task_->mutex);
+    if (task_.use_count() > 1) {
+        // The task goes on for the other workers, it must be done with this one
+        task_->condition_variable.wait(lock, [this]() { return !busy_; });
+    }
+    auto& workers = task_->workers;
+    workers.erase(std::find(workers.begin(), workers.end(), this));
+    task_->next = 0;
+    lock.unlock();
+    // The last worker deletes the task
+    task_.reset();
+}
+
+bool AudioWorker::Push(AudioFrame& frame) {
+    std::lock_guard<std::mutex> lock(task_->mutex);
+    if (count_ >= slots_.size()) {
+        dropped_++;
+        return false;
+    }
+    std::swap(slots_[(head_ + count_) % slots_.size()], frame);
+    count_++;
+    if (count_ > high_water_) {
+        high_water_ = count_;
+    }
+    task_->condition_variable.notify_all();
+    return true;
+}
+
+void AudioWorker::Clear() {
+    std::lock_guard<std::mutex> lock(task_->mutex);
+    head_ = (head_ + count_) % slots_.size();
+    count_ = 0;
+    task_->condition_variable.notify_all();
+}
+
+void AudioWorker::WaitForIdle() {
+    std::unique_lock<std::mutex> lock(task_->mutex);
+    task_->condition_variable.wait(lock, [this]() {
+        return count_ == 0 && !busy_;
+    });
+}
+
+bool AudioWorker::Full() {
+    std::lock_guard<std::mutex> lock(task_->mutex);
+    return count_ >= slots_.size();
+}
+
+size_t AudioWorker::Size() {
+    std::lock_guard<std::mutex> lock(task_->mutex);
+    return count_;
+}
+
+bool AudioWorker::Idle() {
+    std::lock_guard<std::mutex> lock(task_->mutex);
+    return count_ == 0 && !busy_;
+}
+
+uint32_t AudioWorker::stack_free() const {
+    return uxTaskGetStackHighWaterMark(task_->handle) * sizeof(StackType_t);
+}
@@ -0,0 +1,82 @@
+#ifndef AUDIO_WORKER_H
+#define AUDIO_WORKER_H
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string_view>
+#include <vector>
+
+// One unit of work for an AudioWorker, only the fields the handler needs are filled
+struct AudioFrame {
+    std::vector<int16_t> pcm;
+    std::vector<uint8_t> opus;
+    uint32_t timestamp = 0;
+    int64_t time_us = 0;  // esp_timer_get_time() when the frame was captured or produced
+    bool speech = true;   // VAD result of an uplink frame
+    std::string_view sound;  // Flash-mapped P3 asset of a cue
+};
+
+// A dedicated task that runs a handler on audio frames taken from a bounded queue.
+// The queue slots are allocated once and frames are swapped in and out of them, so the
+// buffers keep circulating between the producer, the queue and the task without
+// allocating. A full queue rejects the frame and counts it as dropped, producers that
+// must not lose frames check Full() first.
+//
+// Several workers may share one task, each keeping its own queue and handler. The task
+// takes the queued frames of its workers in turn and is deleted with the last of them.
+class AudioWorker {
+public:
+    // core_id < 0 lets the scheduler pick a core, stack_caps selects the stack memory
+    // (falls back to internal RAM if the allocation fails)
+    AudioWorker(const char* name, size_t queue_capacity, uint32_t stack_size, UBaseType_t priority,
+        int core_id, uint32_t stack_caps, std::function<void(AudioFrame& frame)> handler);
+    // Runs on the task of host instead of a task of its own, saves a stack where there is no PSRAM
+    AudioWorker(AudioWorker& host, const char* name, size_t queue_capacity, std::function<void(AudioFrame& frame)> handler);
+    ~AudioWorker();
+    AudioWorker(const AudioWorker&) = delete;
+    AudioWorker& operator=(const AudioWorker&) = delete;
+
+    // Swaps the frame into the queue, the caller gets an old buffer back to reuse
+    bool Push(AudioFrame& frame);
+    // Drops the queued frames, the one being processed is finished
+    void Clear();
+    // Blocks until the queue is empty and the handler is not running
+    void WaitForIdle();
+
+    bool Full();
+    size_t Size();
+    // Nothing queued and the handler is not running
+    bool Idle();
+    inline uint32_t processed() const { return processed_; }
+    inline uint32_t dropped() const { return dropped_; }
+    inline size_t high_water() const { return high_water_; }
+    inline uint32_t max_process_time_us() const { return max_process_time_us_; }
+    // Least free stack of the task since it started, in bytes
+    uint32_t stack_free() const;
+
+private:
+    // The task, its stack and the lock shared by the workers that run on it
+    struct Task;
+
+    const char* name_;
+    std::function<void(AudioFrame& frame)> handler_;
+    std::shared_ptr<Task> task_;
+    std::vector<AudioFrame> slots_;
+    size_t head_ = 0;
+    size_t count_ = 0;
+    bool busy_ = false;
+
+    std::atomic<uint32_t> processed_{0};
+    std::atomic<uint32_t> dropped_{0};
+    std::atomic<size_t> high_water_{0};
+    std::atomic<uint32_t> max_process_time_us_{0};
+};
+
+#endif // AUDIO_WORKER_H
@@ -0,0 +1,78 @@
+#include "cue_pcm_cache.h"
+
+#include <esp_log.h>
+#include <esp_heap_caps.h>
+
+#define TAG "CuePcmCache"
+
+CuePcmCache::CuePcmCache(size_t budget_bytes) : budget_bytes_(budget_bytes) {
+}
+
+CuePcmCache::~CuePcmCache() {
+    for (auto& entry : entries_) {
+        heap_caps_free(entry.pcm);
+    }
+}
+
+const int16_t* CuePcmCache::Find(const void* key, size_t& samples) {
+    for (auto it = entries_.begin(); it != entries_.end(); ++it) {
+        if (it->key == key) {
+            entries_.splice(entries_.begin(), entries_, it);
+            samples = it->samples;
+            hits_++;
+            return it->pcm;
+        }
+    }
+    misses_++;
+    return nullptr;
+}
+
+int16_t* CuePcmCache::Reserve(size_t max_samples) {
+    size_t bytes = max_samples * sizeof(int16_t);
+    if (bytes == 0 || bytes > budget_bytes_) {
+        return nullptr;
+    }
+    Evict(bytes);
+    // PSRAM only, a cue is played rarely enough that it is decoded again rather than kept in internal SRAM
+    auto pcm = (int16_t*)heap_caps_malloc(bytes, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    if (pcm == nullptr) {
+        ESP_LOGW(TAG, "Failed to allocate %zu bytes", bytes);
+        return nullptr;
+    }
+    used_bytes_ += bytes;
+    reserved_bytes_ = bytes;
+    return pcm;
+}
+
+void CuePcmCache::Commit(const void* key, int16_t* pcm, size_t samples) {
+    size_t bytes = samples * sizeof(int16_t);
+    used_bytes_ -= reserved_bytes_;
+    reserved_bytes_ = 0;
+    if (bytes == 0) {
+        heap_caps_free(pcm);
+        return;
+    }
+    // Give back what the frames that failed to decode did not use, the block shrinks in place
+    auto shrunk = (int16_t*)heap_caps_realloc(pcm, bytes, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    if (shrunk != nullptr) {
+        pcm = shrunk;
+    }
+    used_bytes_ += bytes;
+    entries_.push_front({key, pcm, samples});
+    ESP_LOGI(TAG, "Cached %zu samples, %zu of %zu bytes used", samples, used_bytes_, budget_bytes_);
+}
+
+void CuePcmCache::Abort(int16_t* pcm) {
+    used_bytes_ -= reserved_bytes_;
+    reserved_bytes_ = 0;
+    heap_caps_free(pcm);
+}
+
+void CuePcmCache::Evict(size_t bytes) {
+    while (!entries_.empty() && used_bytes_ + bytes > budget_bytes_) {
+        auto& entry = entries_.back();
+        used_bytes_ -= entry.samples * sizeof(int16_t);
+        heap_caps_free(entry.pcm);
+        entries_.pop_back();
+    }
+}
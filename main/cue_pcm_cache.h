@@ -0,0 +1,49 @@
+#ifndef CUE_PCM_CACHE_H
+#define CUE_PCM_CACHE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <list>
+
+// Decoded PCM of the built-in cues, already resampled to the codec output rate.
+// The assets are mapped from flash and never move, so the asset pointer is the key.
+// Entries live in PSRAM and the least recently played cue is evicted when the budget
+// is exceeded. Used by the cue task only, not thread safe.
+class CuePcmCache {
+public:
+    explicit CuePcmCache(size_t budget_bytes);
+    ~CuePcmCache();
+    CuePcmCache(const CuePcmCache&) = delete;
+    CuePcmCache& operator=(const CuePcmCache&) = delete;
+
+    // Returns nullptr on a miss, a hit becomes the most recently used entry
+    const int16_t* Find(const void* key, size_t& samples);
+
+    // Returns a buffer of max_samples to decode into, nullptr if it does not fit the budget.
+    // Commit() inserts it with the samples actually decoded, Abort() frees it.
+    int16_t* Reserve(size_t max_samples);
+    void Commit(const void* key, int16_t* pcm, size_t samples);
+    void Abort(int16_t* pcm);
+
+    inline size_t used_bytes() const { return used_bytes_; }
+    inline uint32_t hits() const { return hits_; }
+    inline uint32_t misses() const { return misses_; }
+
+private:
+    struct Entry {
+        const void* key;
+        int16_t* pcm;
+        size_t samples;
+    };
+
+    size_t budget_bytes_;
+    size_t used_bytes_ = 0;  // Including the reserved buffer
+    size_t reserved_bytes_ = 0;
+    std::list<Entry> entries_;  // Most recently used first
+    uint32_t hits_ = 0;
+    uint32_t misses_ = 0;
+
+    void Evict(size_t bytes);
+};
+
+#endif // CUE_PCM_CACHE_H
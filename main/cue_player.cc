@@ -0,0 +1,214 @@
+#include "cue_player.h"
+#include "protocol.h"
+
+#include <esp_log.h>
+#include <esp_heap_caps.h>
+#include <arpa/inet.h>
+#include <algorithm>
+#include <cstring>
+
+#define TAG "CuePlayer"
+
+// The assets are encoded at 16000Hz, 60ms frame duration
+#define CUE_SAMPLE_RATE 16000
+#define CUE_FRAME_DURATION_MS 60
+// Enough for the activation sentence followed by its digits
+#define CUE_QUEUE_CAPACITY 8
+// Two frames, the worker tops the ring up whenever a frame fits
+#define CUE_RING_MS 120
+// Opus needs a deep stack, it may live in PSRAM like the encoder's
+#define CUE_TASK_STACK_SIZE (4096 * 6)
+#define CUE_TASK_PRIORITY 5
+
+CuePlayer::CuePlayer(int output_sample_rate, AudioWorker* host)
+    : ring_(output_sample_rate * CUE_RING_MS / 1000),
+      decoder_(CUE_SAMPLE_RATE, 1, CUE_FRAME_DURATION_MS)
+#if CONFIG_USE_CUE_PCM_CACHE
+      , cache_(CONFIG_CUE_PCM_CACHE_SIZE_KB * 1024)
+#endif
+{
+    frame_samples_ = CUE_SAMPLE_RATE * CUE_FRAME_DURATION_MS / 1000;
+    if (output_sample_rate != CUE_SAMPLE_RATE) {
+        resampler_.Configure(CUE_SAMPLE_RATE, output_sample_rate);
+        resample_ = true;
+        frame_samples_ = resampler_.GetOutputSamples(frame_samples_);
+    }
+    // The queue only holds requests to pump, the cues wait in cues_
+    auto handler = [this](AudioFrame& frame) { Pump(); };
+    if (host != nullptr) {
+        worker_ = std::make_unique<AudioWorker>(*host, "audio_cue", 2, handler);
+    } else {
+        worker_ = std::make_unique<AudioWorker>("audio_cue", 2, CUE_TASK_STACK_SIZE,
+            CUE_TASK_PRIORITY, -1, MALLOC_CAP_SPIRAM, handler);
+    }
+}
+
+CuePlayer::~CuePlayer() {
+    // Let a turn in progress see the flush and end, so the task is done with this player
+    Stop();
+    worker_->WaitForIdle();
+    worker_.reset();
+    Finish(false);
+}
+
+bool CuePlayer::Play(const std::string_view& sound) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (cues_.size() >= CUE_QUEUE_CAPACITY) {
+            ESP_LOGW(TAG, "Too many cues waiting, dropping %zu bytes", sound.size());
+            return false;
+        }
+        cues_.push_back(sound);
+    }
+    // A request already queued picks the cue up as well
+    if (!worker_->Full()) {
+        AudioFrame frame;
+        worker_->Push(frame);
+    }
+    return true;
+}
+
+void CuePlayer::Stop() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        cues_.clear();
+        ring_.Clear();
+    }
+    worker_->Clear();
+    // Nothing reads an empty ring, a cue waiting for room is woken here to see the flush
+    if (waiting_for_room_.exchange(false)) {
+        AudioFrame frame;
+        worker_->Push(frame);
+    }
+}
+
+bool CuePlayer::Idle() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!cues_.empty()) {
+            return false;
+        }
+    }
+    // A cue in progress always leaves a request queued or the handler running
+    return worker_->Idle() && !waiting_for_room_ && ring_.Empty();
+}
+
+// Runs on the playback task
+void CuePlayer::OnRingRead() {
+    if (waiting_for_room_ && ring_.Free() >= frame_samples_ && waiting_for_room_.exchange(false)) {
+        AudioFrame frame;
+        worker_->Push(frame);
+    }
+}
+
+// Runs on the worker task, writes as much as the ring takes and leaves the rest to the
+// turn that OnRingRead() queues
+void CuePlayer::Pump() {
+    while (true) {
+        if (Playing() && ring_.clears() != clears_) {
+            // Stop() flushed the ring, the rest of the cue goes too
+            Finish(false);
+        }
+        if (!Playing() && !Start()) {
+            return;
+        }
+        if (!Continue()) {
+            waiting_for_room_ = true;
+            // The reader may have made room before it could see the flag
+            if (ring_.Free() < frame_samples_ || !waiting_for_room_.exchange(false)) {
+                return;
+            }
+            continue;
+        }
+        Finish(ring_.clears() == clears_);
+    }
+}
+
+// Takes the next cue, returns false if none is waiting
+bool CuePlayer::Start() {
+    std::string_view sound;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (cues_.empty()) {
+            return false;
+        }
+        sound = cues_.front();
+        cues_.pop_front();
+        clears_ = ring_.clears();
+    }
+
+#if CONFIG_USE_CUE_PCM_CACHE
+    cached_ = cache_.Find(sound.data(), cached_samples_);
+    if (cached_ != nullptr) {
+        return true;
+    }
+    // Walk the headers to size the buffer, the cue is decoded straight into it
+    size_t frames = 0;
+    for (const char* p = sound.data(); p < sound.data() + sound.size(); frames++) {
+        p += sizeof(BinaryProtocol3) + ntohs(((const BinaryProtocol3*)p)->payload_size);
+    }
+    cache_key_ = sound.data();
+    cache_capacity_ = frames * frame_samples_;
+    cache_pcm_ = cache_.Reserve(cache_capacity_);
+    cache_samples_ = 0;
+#endif
+
+    frames_ = sound;
+    decoder_.ResetState();
+    return true;
+}
+
+// Returns true when the cue is done, false when the ring is full
+bool CuePlayer::Continue() {
+    if (cached_samples_ > 0) {
+        // A cached cue costs a copy
+        size_t written = ring_.Write(cached_, cached_samples_);
+        cached_ += written;
+        cached_samples_ -= written;
+        return cached_samples_ == 0;
+    }
+
+    while (!frames_.empty() && ring_.clears() == clears_) {
+        if (ring_.Free() < frame_samples_) {
+            return false;
+        }
+        auto p3 = (const BinaryProtocol3*)frames_.data();
+        auto payload_size = ntohs(p3->payload_size);
+        frames_.remove_prefix(std::min(frames_.size(), sizeof(BinaryProtocol3) + payload_size));
+
+        opus_.assign(p3->payload, p3->payload + payload_size);
+        if (!decoder_.Decode(std::move(opus_), pcm_)) {
+            continue;
+        }
+        auto& pcm = resample_ ? resampled_ : pcm_;
+        if (resample_) {
+            resampled_.resize(resampler_.GetOutputSamples(pcm_.size()));
+            resampler_.Process(pcm_.data(), pcm_.size(), resampled_.data());
+        }
+#if CONFIG_USE_CUE_PCM_CACHE
+        if (cache_pcm_ != nullptr && cache_samples_ + pcm.size() <= cache_capacity_) {
+            memcpy(cache_pcm_ + cache_samples_, pcm.data(), pcm.size() * sizeof(int16_t));
+            cache_samples_ += pcm.size();
+        }
+#endif
+        ring_.Write(pcm.data(), pcm.size());
+    }
+    return true;
+}
+
+// A cue stopped halfway is not cached, its PCM is incomplete
+void CuePlayer::Finish(bool complete) {
+    frames_ = {};
+    cached_ = nullptr;
+    cached_samples_ = 0;
+#if CONFIG_USE_CUE_PCM_CACHE
+    if (cache_pcm_ != nullptr) {
+        if (complete) {
+            cache_.Commit(cache_key_, cache_pcm_, cache_samples_);
+        } else {
+            cache_.Abort(cache_pcm_);
+        }
+        cache_pcm_ = nullptr;
+    }
+#endif
+}
@@ -0,0 +1,85 @@
+#ifndef CUE_PLAYER_H
+#define CUE_PLAYER_H
+
+#include <opus_decoder.h>
+#include <opus_resampler.h>
+
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string_view>
+#include <vector>
+
+#include "audio_worker.h"
+#include "pcm_ring.h"
+#if CONFIG_USE_CUE_PCM_CACHE
+#include "cue_pcm_cache.h"
+#endif
+
+// Plays the built-in P3 sounds (16 kHz, 60 ms Opus frames) into the cue source of the mixer.
+// Cues have their own decoder, so they neither wait for the speech queue nor reconfigure the
+// speech decoder, and Play() returns at once. Queued cues are played one after another. With
+// CONFIG_USE_CUE_PCM_CACHE a cue is decoded once and later plays are a copy of the cached PCM
+// into the ring.
+//
+// A cue is decoded a few frames at a time, as far as the ring has room, so it never holds
+// its task for long. That lets it share the task of another worker where there is no PSRAM.
+// When the ring is full the worker returns and the reader of the ring wakes it through
+// OnRingRead() once a frame fits again.
+class CuePlayer {
+public:
+    // With a host the cues are decoded on the host's task instead of a task of their own
+    explicit CuePlayer(int output_sample_rate, AudioWorker* host = nullptr);
+    ~CuePlayer();
+    CuePlayer(const CuePlayer&) = delete;
+    CuePlayer& operator=(const CuePlayer&) = delete;
+
+    // The asset must stay mapped, returns false if too many cues are waiting
+    bool Play(const std::string_view& sound);
+    // Drops the queued cues and the decoded PCM
+    void Stop();
+    // Nothing queued, being decoded or left to play
+    bool Idle();
+    // Called by the reader after taking samples from the ring
+    void OnRingRead();
+    inline PcmRing& ring() { return ring_; }
+
+private:
+    PcmRing ring_;
+    OpusDecoderWrapper decoder_;
+    OpusResampler resampler_;
+    bool resample_ = false;
+    size_t frame_samples_;  // One decoded frame at the output rate
+    std::vector<uint8_t> opus_;
+    std::vector<int16_t> pcm_;
+    std::vector<int16_t> resampled_;
+
+    std::mutex mutex_;
+    std::deque<std::string_view> cues_;  // Waiting to start
+    // Set by the worker when the ring is full, the first reader to see room clears it
+    std::atomic<bool> waiting_for_room_{false};
+
+    // The cue being played, used on the worker task only
+    std::string_view frames_;            // P3 frames not decoded yet
+    const int16_t* cached_ = nullptr;    // Or the cached PCM not written yet
+    size_t cached_samples_ = 0;
+    uint32_t clears_ = 0;
+#if CONFIG_USE_CUE_PCM_CACHE
+    CuePcmCache cache_;
+    const void* cache_key_ = nullptr;
+    int16_t* cache_pcm_ = nullptr;       // Filled while the cue is decoded
+    size_t cache_capacity_ = 0;
+    size_t cache_samples_ = 0;
+#endif
+    // Declared last, the task is done with this player before the buffers go
+    std::unique_ptr<AudioWorker> worker_;
+
+    inline bool Playing() const { return !frames_.empty() || cached_samples_ > 0; }
+    void Pump();
+    bool Start();
+    bool Continue();
+    void Finish(bool complete);
+};
+
+#endif // CUE_PLAYER_H
@@ -0,0 +1,208 @@
+#include "jitter_buffer.h"
+
+#include <esp_log.h>
+#include <algorithm>
+
+#define TAG "JitterBuffer"
+
+// Stop concealing after this many missing frames in a row and jump to the next buffered one
+#define MAX_CONSECUTIVE_LOST_FRAMES 3
+
+JitterBuffer::JitterBuffer(size_t capacity, int min_delay_ms, int max_delay_ms)
+    : slots_(capacity), min_delay_ms_(min_delay_ms), max_delay_ms_(max_delay_ms), target_delay_ms_(min_delay_ms) {
+}
+
+void JitterBuffer::SetFrameDuration(int frame_duration_ms) {
+    if (frame_duration_ms_ != frame_duration_ms) {
+        frame_duration_ms_ = frame_duration_ms;
+        Reset();
+    }
+}
+
+void JitterBuffer::Reset() {
+    reset_requested_ = true;
+}
+
+void JitterBuffer::ApplyReset() {
+    if (lost_frames_ > 0 || late_packets_ > 0 || underruns_ > 0) {
+        ESP_LOGI(TAG, "Stream stats: lost %lu, late %lu, underruns %lu, target delay %d ms",
+            lost_frames_, late_packets_, underruns_, target_delay_ms_);
+    }
+    // Keep the payload buffers so that their capacity is reused by the next stream
+    for (auto& slot : slots_) {
+        slot.filled = false;
+    }
+    count_ = 0;
+    index_source_ = kIndexSourceNone;
+    playing_ = false;
+    drained_ = false;
+    consecutive_lost_ = 0;
+    last_timestamp_ = 0;
+    has_min_transit_ = false;
+    lost_frames_ = 0;
+    late_packets_ = 0;
+    underruns_ = 0;
+    // The learned delay is kept, network conditions usually outlive a single utterance
+    reset_requested_ = false;
+}
+
+uint32_t JitterBuffer::PacketIndex(const AudioStreamPacket& packet) {
+    IndexSource source;
+    uint32_t raw_index;
+    if (packet.sequence != 0) {
+        source = kIndexSourceSequence;
+        raw_index = packet.sequence;
+    } else if (packet.timestamp != 0) {
+        int frame_duration = frame_duration_ms_;
+        source = kIndexSourceTimestamp;
+        raw_index = (packet.timestamp + frame_duration / 2) / frame_duration;
+    } else {
+        source = kIndexSourceArrival;
+        raw_index = last_raw_index_ + 1;
+    }
+
+    if (source != index_source_) {
+        // A new kind of stream continues right after what is already buffered
+        uint32_t anchor = count_ > 0 ? highest_index_ + 1 : next_index_;
+        index_offset_ = anchor - raw_index;
+        index_source_ = source;
+        has_min_transit_ = false;
+    }
+    last_raw_index_ = raw_index;
+    return raw_index + index_offset_;
+}
+
+void JitterBuffer::UpdateDelay(uint32_t index, int64_t arrival_time_us) {
+    int frame_duration = frame_duration_ms_;
+    int64_t arrival_ms = arrival_time_us / 1000;
+    if (!has_min_transit_) {
+        delay_anchor_index_ = index;
+        min_transit_ms_ = arrival_ms;
+        has_min_transit_ = true;
+    }
+
+    // Transit time up to a constant offset, the smallest one seen is the zero-delay reference
+    int64_t transit_ms = arrival_ms - (int64_t)(int32_t)(index - delay_anchor_index_) * frame_duration;
+    if (transit_ms < min_transit_ms_) {
+        min_transit_ms_ = transit_ms;
+    }
+    int delay_ms = (int)std::min<int64_t>(transit_ms - min_transit_ms_, max_delay_ms_);
+
+    // Grow at once, decay by 1/64 per packet (a few seconds at 60ms frames)
+    peak_delay_ms_ = std::max(delay_ms, peak_delay_ms_ - (peak_delay_ms_ + 63) / 64);
+    target_delay_ms_ = std::clamp(peak_delay_ms_ + frame_duration, min_delay_ms_, max_delay_ms_);
+}
+
+void JitterBuffer::Put(AudioStreamPacket&& packet, int64_t arrival_time_us) {
+    if (reset_requested_) {
+        ApplyReset();
+    }
+
+    int32_t capacity = slots_.size();
+    uint32_t index = PacketIndex(packet);
+    int32_t distance = index - next_index_;
+    if (distance >= capacity && count_ > 0 && (int32_t)(index - highest_index_) < capacity) {
+        // Playout fell behind, drop the oldest frames to make room
+        while ((int32_t)(index - next_index_) >= capacity) {
+            auto& slot = SlotAt(next_index_++);
+            if (slot.filled) {
+                slot.filled = false;
+                count_--;
+                late_packets_++;
+            }
+        }
+        distance = index - next_index_;
+    } else if (distance < -capacity || distance >= capacity) {
+        // The stream restarted or jumped, continue right after what is buffered
+        ESP_LOGW(TAG, "Discontinuity of %ld frames, re-anchoring", distance);
+        uint32_t anchor = count_ > 0 ? highest_index_ + 1 : next_index_;
+        index_offset_ += anchor - index;
+        index = anchor;
+        distance = index - next_index_;
+        has_min_transit_ = false;
+    }
+
+    if (distance < 0) {
+        if (playing_ || drained_ || (int32_t)(highest_index_ - index) >= capacity) {
+            late_packets_++;
+            return;
+        }
+        // Reordered before playout started, move the start back
+        next_index_ = index;
+        distance = 0;
+    }
+    auto& slot = SlotAt(index);
+    if (slot.filled) {
+        return;
+    }
+
+    if (count_ == 0) {
+        highest_index_ = index;
+        if (!playing_) {
+            buffering_since_us_ = arrival_time_us;
+        }
+    } else if ((int32_t)(index - highest_index_) > 0) {
+        highest_index_ = index;
+    }
+    if (drained_ && index == next_index_) {
+        // Playout ran dry in the middle of the stream
+        underruns_++;
+    }
+    drained_ = false;
+
+    slot.filled = true;
+    // Swap so that the slot keeps a payload buffer and the caller gets one back
+    std::swap(slot.packet, packet);
+    count_++;
+    UpdateDelay(index, arrival_time_us);
+}
+
+JitterBuffer::Result JitterBuffer::Get(AudioStreamPacket& packet, int64_t now_us) {
+    if (reset_requested_) {
+        ApplyReset();
+    }
+
+    if (count_ == 0) {
+        if (playing_) {
+            playing_ = false;
+            drained_ = true;
+        }
+        return kJitterBufferEmpty;
+    }
+
+    int frame_duration = frame_duration_ms_;
+    if (!playing_) {
+        int buffered_ms = count_ * frame_duration;
+        int waited_ms = (now_us - buffering_since_us_) / 1000;
+        if (buffered_ms < target_delay_ms_ && waited_ms < target_delay_ms_) {
+            return kJitterBufferEmpty;
+        }
+        playing_ = true;
+    }
+
+    if (!SlotAt(next_index_).filled && ++consecutive_lost_ > MAX_CONSECUTIVE_LOST_FRAMES) {
+        // A long gap, skip to the next buffered frame instead of concealing it all
+        while (!SlotAt(next_index_).filled) {
+            next_index_++;
+        }
+    }
+
+    auto& slot = SlotAt(next_index_);
+    next_index_++;
+    if (!slot.filled) {
+        lost_frames_++;
+        packet.payload.clear();
+        packet.Borrow(nullptr, 0);
+        packet.sequence = 0;
+        packet.timestamp = last_timestamp_ != 0 ? last_timestamp_ + frame_duration : 0;
+        last_timestamp_ = packet.timestamp;
+        return kJitterBufferFrameLost;
+    }
+
+    std::swap(packet, slot.packet);
+    slot.filled = false;
+    count_--;
+    consecutive_lost_ = 0;
+    last_timestamp_ = packet.timestamp;
+    return kJitterBufferFrame;
+}
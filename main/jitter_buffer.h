@@ -0,0 +1,95 @@
+#ifndef JITTER_BUFFER_H
+#define JITTER_BUFFER_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "protocol.h"
+
+// Reorders downlink audio packets and absorbs network jitter before decoding.
+// Packets are ordered by transport sequence, then by timestamp, then by arrival.
+// The target delay follows the measured arrival delay: it grows at once when a
+// packet is late and shrinks slowly while the network is steady. A frame that is
+// still missing at playout time is reported as lost so the caller can conceal it.
+//
+// Put() and Get() must be called from the same (consumer) task.
+class JitterBuffer {
+public:
+    enum Result {
+        kJitterBufferEmpty,      // Nothing to play, still buffering or drained
+        kJitterBufferFrame,      // The next frame is returned
+        kJitterBufferFrameLost,  // The next frame is missing and should be concealed
+    };
+
+    JitterBuffer(size_t capacity, int min_delay_ms, int max_delay_ms);
+
+    void SetFrameDuration(int frame_duration_ms);
+    void Put(AudioStreamPacket&& packet, int64_t arrival_time_us);
+    Result Get(AudioStreamPacket& packet, int64_t now_us);
+
+    // May be called from any thread, applied by the consumer on the next Put() or Get()
+    void Reset();
+
+    inline bool Empty() const { return count_ == 0 || reset_requested_; }
+    inline bool Full() const { return count_ >= slots_.size(); }
+    inline size_t size() const { return count_; }
+    inline size_t capacity() const { return slots_.size(); }
+    inline int target_delay_ms() const { return target_delay_ms_; }
+    inline uint32_t lost_frames() const { return lost_frames_; }
+    inline uint32_t late_packets() const { return late_packets_; }
+    inline uint32_t underruns() const { return underruns_; }
+
+private:
+    enum IndexSource {
+        kIndexSourceNone,
+        kIndexSourceSequence,
+        kIndexSourceTimestamp,
+        kIndexSourceArrival,
+    };
+
+    struct Slot {
+        bool filled = false;
+        AudioStreamPacket packet;
+    };
+
+    std::vector<Slot> slots_;
+    const int min_delay_ms_;
+    const int max_delay_ms_;
+    std::atomic<int> frame_duration_ms_{60};
+    std::atomic<bool> reset_requested_{false};
+    std::atomic<size_t> count_{0};
+
+    // Mapping from packet fields to a contiguous playout index
+    IndexSource index_source_ = kIndexSourceNone;
+    uint32_t last_raw_index_ = 0;
+    uint32_t index_offset_ = 0;
+    uint32_t next_index_ = 0;
+    uint32_t highest_index_ = 0;
+    uint32_t last_timestamp_ = 0;
+
+    // Playout state
+    bool playing_ = false;
+    bool drained_ = false;
+    int64_t buffering_since_us_ = 0;
+    int consecutive_lost_ = 0;
+
+    // Delay estimation
+    bool has_min_transit_ = false;
+    uint32_t delay_anchor_index_ = 0;
+    int64_t min_transit_ms_ = 0;
+    int peak_delay_ms_ = 0;
+    int target_delay_ms_ = 0;
+
+    uint32_t lost_frames_ = 0;
+    uint32_t late_packets_ = 0;
+    uint32_t underruns_ = 0;
+
+    void ApplyReset();
+    uint32_t PacketIndex(const AudioStreamPacket& packet);
+    void UpdateDelay(uint32_t index, int64_t arrival_time_us);
+    inline Slot& SlotAt(uint32_t index) { return slots_[index % slots_.size()]; }
+};
+
+#endif // JITTER_BUFFER_H
@@ -0,0 +1,172 @@
+#include "latency_monitor.h"
+
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <cJSON.h>
+
+#define TAG "LatencyMonitor"
+
+static const char* const kMetricNames[kLatencyMetricCount] = {
+    "wake_to_uplink_ms",
+    "speech_end_to_downlink_ms",
+    "speech_end_to_output_ms",
+    "uplink_frame_ms",
+    "encode_ms",
+    "decode_ms",
+    "decode_queue_depth",
+    "channel_open_ms",
+    "afe_switch_ms",
+    "playback_ahead_ms",
+    "mic_capture_ms",
+};
+
+LatencyMonitor::LatencyMonitor() {
+    Reset();
+}
+
+void LatencyMonitor::Record(LatencyMetric metric, uint32_t value) {
+    auto& histogram = histograms_[metric];
+    int bucket = value == 0 ? 0 : 32 - __builtin_clz(value);
+    if (bucket >= kBucketCount) {
+        bucket = kBucketCount - 1;
+    }
+    histogram.buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+    histogram.sum.fetch_add(value, std::memory_order_relaxed);
+
+    uint32_t current = histogram.min.load(std::memory_order_relaxed);
+    while (value < current && !histogram.min.compare_exchange_weak(current, value, std::memory_order_relaxed)) {
+    }
+    current = histogram.max.load(std::memory_order_relaxed);
+    while (value > current && !histogram.max.compare_exchange_weak(current, value, std::memory_order_relaxed)) {
+    }
+    // Counted last so that a reader never sees a count without its sample
+    histogram.count.fetch_add(1, std::memory_order_release);
+}
+
+void LatencyMonitor::RecordSince(LatencyMetric metric, int64_t start_time_us) {
+    int64_t elapsed_us = esp_timer_get_time() - start_time_us;
+    Record(metric, elapsed_us > 0 ? (uint32_t)(elapsed_us / 1000) : 0);
+}
+
+void LatencyMonitor::OnWakeWordDetected() {
+    wake_word_time_.store(esp_timer_get_time(), std::memory_order_relaxed);
+}
+
+void LatencyMonitor::OnSpeechEnd(bool overwrite) {
+    int64_t now = esp_timer_get_time();
+    if (overwrite) {
+        speech_end_time_.store(now, std::memory_order_relaxed);
+        speech_end_output_time_.store(now, std::memory_order_relaxed);
+    } else {
+        int64_t expected = 0;
+        speech_end_time_.compare_exchange_strong(expected, now, std::memory_order_relaxed);
+        expected = 0;
+        speech_end_output_time_.compare_exchange_strong(expected, now, std::memory_order_relaxed);
+    }
+}
+
+void LatencyMonitor::OnAudioSent() {
+    int64_t wake_word_time = wake_word_time_.exchange(0, std::memory_order_relaxed);
+    if (wake_word_time != 0) {
+        RecordSince(kLatencyMetricWakeToUplink, wake_word_time);
+    }
+}
+
+void LatencyMonitor::OnAudioReceived() {
+    int64_t speech_end_time = speech_end_time_.exchange(0, std::memory_order_relaxed);
+    if (speech_end_time != 0) {
+        RecordSince(kLatencyMetricSpeechEndToDownlink, speech_end_time);
+    }
+}
+
+void LatencyMonitor::OnAudioPlayed() {
+    int64_t speech_end_time = speech_end_output_time_.exchange(0, std::memory_order_relaxed);
+    if (speech_end_time != 0) {
+        RecordSince(kLatencyMetricSpeechEndToOutput, speech_end_time);
+    }
+}
+
+void LatencyMonitor::Reset() {
+    for (auto& histogram : histograms_) {
+        histogram.count.store(0, std::memory_order_relaxed);
+        for (auto& bucket : histogram.buckets) {
+            bucket.store(0, std::memory_order_relaxed);
+        }
+        histogram.min.store(UINT32_MAX, std::memory_order_relaxed);
+        histogram.max.store(0, std::memory_order_relaxed);
+        histogram.sum.store(0, std::memory_order_relaxed);
+    }
+}
+
+bool LatencyMonitor::HasSamples() const {
+    for (auto& histogram : histograms_) {
+        if (histogram.count.load(std::memory_order_acquire) > 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Upper bound of the bucket holding the given percentile, capped at the maximum seen
+uint32_t LatencyMonitor::Percentile(const Histogram& histogram, uint32_t count, int percent) {
+    uint32_t rank = (count * percent + 99) / 100;
+    uint32_t seen = 0;
+    uint32_t max = histogram.max.load(std::memory_order_relaxed);
+    for (int i = 0; i < kBucketCount; i++) {
+        seen += histogram.buckets[i].load(std::memory_order_relaxed);
+        if (seen >= rank && i < kBucketCount - 1) {
+            uint32_t upper = i == 0 ? 0 : (1u << i) - 1;
+            return upper < max ? upper : max;
+        }
+    }
+    // The last bucket is open-ended
+    return max;
+}
+
+std::string LatencyMonitor::GetMetricsJson() const {
+    cJSON* root = cJSON_CreateObject();
+    for (int i = 0; i < kLatencyMetricCount; i++) {
+        auto& histogram = histograms_[i];
+        uint32_t count = histogram.count.load(std::memory_order_acquire);
+        if (count == 0) {
+            continue;
+        }
+        cJSON* metric = cJSON_CreateObject();
+        cJSON_AddNumberToObject(metric, "count", count);
+        cJSON_AddNumberToObject(metric, "min", histogram.min.load(std::memory_order_relaxed));
+        cJSON_AddNumberToObject(metric, "max", histogram.max.load(std::memory_order_relaxed));
+        cJSON_AddNumberToObject(metric, "avg", histogram.sum.load(std::memory_order_relaxed) / count);
+        cJSON_AddNumberToObject(metric, "p50", Percentile(histogram, count, 50));
+        cJSON_AddNumberToObject(metric, "p90", Percentile(histogram, count, 90));
+        cJSON* buckets = cJSON_CreateArray();
+        for (auto& bucket : histogram.buckets) {
+            cJSON_AddItemToArray(buckets, cJSON_CreateNumber(bucket.load(std::memory_order_relaxed)));
+        }
+        cJSON_AddItemToObject(metric, "buckets", buckets);
+        cJSON_AddItemToObject(root, kMetricNames[i], metric);
+    }
+
+    std::string json;
+    char* str = cJSON_PrintUnformatted(root);
+    if (str != nullptr) {
+        json = str;
+        cJSON_free(str);
+    }
+    cJSON_Delete(root);
+    return json;
+}
+
+void LatencyMonitor::PrintReport() const {
+    for (int i = 0; i < kLatencyMetricCount; i++) {
+        auto& histogram = histograms_[i];
+        uint32_t count = histogram.count.load(std::memory_order_acquire);
+        if (count == 0) {
+            continue;
+        }
+        ESP_LOGI(TAG, "%s: count %lu min %lu avg %lu p50 %lu p90 %lu max %lu", kMetricNames[i], count,
+            histogram.min.load(std::memory_order_relaxed),
+            (uint32_t)(histogram.sum.load(std::memory_order_relaxed) / count),
+            Percentile(histogram, count, 50), Percentile(histogram, count, 90),
+            histogram.max.load(std::memory_order_relaxed));
+    }
+}
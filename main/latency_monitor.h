@@ -0,0 +1,77 @@
+#ifndef LATENCY_MONITOR_H
+#define LATENCY_MONITOR_H
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+enum LatencyMetric {
+    kLatencyMetricWakeToUplink,         // Wake word detected -> first uplink frame sent (ms)
+    kLatencyMetricSpeechEndToDownlink,  // End of speech -> first TTS packet received (ms)
+    kLatencyMetricSpeechEndToOutput,    // End of speech -> first TTS frame played (ms)
+    kLatencyMetricUplinkFrame,          // Mic capture -> encoded frame sent (ms)
+    kLatencyMetricEncode,               // Opus encode time per frame (ms)
+    kLatencyMetricDecode,               // Opus decode time per frame (ms)
+    kLatencyMetricDecodeQueueDepth,     // Frames waiting to be decoded when one is played
+    kLatencyMetricChannelOpen,          // OpenAudioChannel call, connect and hello included (ms)
+    kLatencyMetricAfeSwitch,            // AFE consumer enabled -> first chunk delivered to it (ms)
+    kLatencyMetricPlaybackAhead,        // Decoded PCM ready to play when a frame is handed to the decoder (ms)
+    kLatencyMetricMicCapture,           // Mic capture (I2S read) -> audio processor output (ms)
+    kLatencyMetricCount,
+};
+
+// Measures the voice pipeline with monotonic timestamps (esp_timer_get_time) and
+// aggregates per-session latencies into power-of-two histograms. All methods may be
+// called from any task, the counters are relaxed atomics and never allocate.
+class LatencyMonitor {
+public:
+    static LatencyMonitor& GetInstance() {
+        static LatencyMonitor instance;
+        return instance;
+    }
+    LatencyMonitor(const LatencyMonitor&) = delete;
+    LatencyMonitor& operator=(const LatencyMonitor&) = delete;
+
+    void Record(LatencyMetric metric, uint32_t value);
+    void RecordSince(LatencyMetric metric, int64_t start_time_us);
+
+    // Session events, the end-to-end metrics are recorded on the first matching event after them
+    void OnWakeWordDetected();
+    // With overwrite set the latest end of speech wins (local VAD), otherwise the first one does
+    void OnSpeechEnd(bool overwrite = true);
+    void OnAudioSent();
+    void OnAudioReceived();
+    void OnAudioPlayed();
+
+    // Starts a new session and clears the histograms, pending session events are kept
+    // because the wake word is detected before the audio channel opens
+    void Reset();
+    bool HasSamples() const;
+    // {"wake_to_uplink_ms":{"count":..,"min":..,"max":..,"avg":..,"p50":..,"p90":..,"buckets":[..]},..}
+    std::string GetMetricsJson() const;
+    void PrintReport() const;
+
+private:
+    // Bucket 0 holds 0, bucket i holds [2^(i-1), 2^i), the last one everything above
+    static constexpr int kBucketCount = 16;
+
+    struct Histogram {
+        std::atomic<uint32_t> buckets[kBucketCount];
+        std::atomic<uint32_t> count;
+        std::atomic<uint32_t> min;
+        std::atomic<uint32_t> max;
+        std::atomic<uint64_t> sum;
+    };
+
+    Histogram histograms_[kLatencyMetricCount];
+    std::atomic<int64_t> wake_word_time_{0};
+    std::atomic<int64_t> speech_end_time_{0};
+    std::atomic<int64_t> speech_end_output_time_{0};
+
+    LatencyMonitor();
+    ~LatencyMonitor() = default;
+
+    static uint32_t Percentile(const Histogram& histogram, uint32_t count, int percent);
+};
+
+#endif // LATENCY_MONITOR_H
@@ -0,0 +1,79 @@
+#include "pcm_ring.h"
+
+#include <esp_log.h>
+#include <esp_heap_caps.h>
+#include <cassert>
+#include <cstring>
+#include <algorithm>
+
+#define TAG "PcmRing"
+
+PcmRing::PcmRing(size_t min_capacity) {
+    capacity_ = 1;
+    while (capacity_ < min_capacity) {
+        capacity_ <<= 1;
+    }
+    // Prefer PSRAM like the packet rings, internal SRAM is the scarcer resource
+    buffer_ = (int16_t*)heap_caps_malloc(capacity_ * sizeof(int16_t), MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    if (buffer_ == nullptr) {
+        buffer_ = (int16_t*)heap_caps_malloc(capacity_ * sizeof(int16_t), MALLOC_CAP_8BIT);
+    }
+    assert(buffer_ != nullptr);
+    ESP_LOGI(TAG, "Created ring with %zu samples", capacity_);
+}
+
+PcmRing::~PcmRing() {
+    heap_caps_free(buffer_);
+}
+
+size_t PcmRing::Write(const int16_t* data, size_t samples) {
+    size_t head = head_.load(std::memory_order_relaxed);
+    size_t used = head - tail_.load(std::memory_order_acquire);
+    samples = std::min(samples, capacity_ - used);
+
+    size_t offset = head & (capacity_ - 1);
+    size_t first = std::min(samples, capacity_ - offset);
+    memcpy(buffer_ + offset, data, first * sizeof(int16_t));
+    memcpy(buffer_, data + first, (samples - first) * sizeof(int16_t));
+    head_.store(head + samples, std::memory_order_release);
+    return samples;
+}
+
+// Apply a pending Clear() by jumping the tail forward, consumer side only
+size_t PcmRing::ConsumerTail() {
+    size_t tail = tail_.load(std::memory_order_relaxed);
+    size_t flush_until = flush_until_.load(std::memory_order_acquire);
+    if ((ptrdiff_t)(flush_until - tail) > 0) {
+        tail = flush_until;
+        tail_.store(tail, std::memory_order_release);
+    }
+    return tail;
+}
+
+size_t PcmRing::Read(int16_t* dest, size_t samples) {
+    size_t tail = ConsumerTail();
+    samples = std::min(samples, head_.load(std::memory_order_acquire) - tail);
+
+    size_t offset = tail & (capacity_ - 1);
+    size_t first = std::min(samples, capacity_ - offset);
+    memcpy(dest, buffer_ + offset, first * sizeof(int16_t));
+    memcpy(dest + first, buffer_, (samples - first) * sizeof(int16_t));
+    tail_.store(tail + samples, std::memory_order_release);
+    return samples;
+}
+
+void PcmRing::Clear() {
+    flush_until_.store(head_.load(std::memory_order_acquire), std::memory_order_release);
+    clears_.fetch_add(1, std::memory_order_acq_rel);
+}
+
+size_t PcmRing::Size() const {
+    // Load order matters: head is read last so it is never behind flush_until
+    size_t flush_until = flush_until_.load(std::memory_order_acquire);
+    size_t tail = tail_.load(std::memory_order_acquire);
+    size_t head = head_.load(std::memory_order_acquire);
+    if ((ptrdiff_t)(flush_until - tail) > 0) {
+        tail = flush_until;
+    }
+    return head - tail;
+}
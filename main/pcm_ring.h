@@ -0,0 +1,47 @@
+#ifndef PCM_RING_H
+#define PCM_RING_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+// Fixed-capacity, lock-free single-producer / single-consumer ring of PCM samples.
+// The capacity is rounded up to a power of two so the free-running counters wrap
+// cleanly, the buffer is allocated once in the constructor.
+class PcmRing {
+public:
+    explicit PcmRing(size_t min_capacity);
+    ~PcmRing();
+    PcmRing(const PcmRing&) = delete;
+    PcmRing& operator=(const PcmRing&) = delete;
+
+    // Producer side, returns the number of samples written (less than samples if full)
+    size_t Write(const int16_t* data, size_t samples);
+    // Consumer side, returns the number of samples read (less than samples if empty)
+    size_t Read(int16_t* dest, size_t samples);
+
+    // May be called from any thread, drops everything written so far in constant time.
+    // The samples are reclaimed when the consumer next calls Read().
+    void Clear();
+
+    size_t Size() const;
+    inline size_t Free() const { return capacity_ - Size(); }
+    inline bool Empty() const { return Size() == 0; }
+    inline size_t capacity() const { return capacity_; }
+    // Incremented by every Clear(), lets a waiting producer notice the flush
+    inline uint32_t clears() const { return clears_.load(std::memory_order_acquire); }
+
+private:
+    size_t capacity_;
+    int16_t* buffer_ = nullptr;
+
+    // Free-running counters, the sample index is counter & (capacity_ - 1)
+    std::atomic<size_t> head_{0};  // Written by the producer only
+    std::atomic<size_t> tail_{0};  // Written by the consumer only
+    std::atomic<size_t> flush_until_{0};
+    std::atomic<uint32_t> clears_{0};
+
+    size_t ConsumerTail();
+};
+
+#endif // PCM_RING_H
@@ -0,0 +1,73 @@
+#include "binary_protocol4.h"
+
+BinaryProtocol4Writer::BinaryProtocol4Writer(std::string& buffer) : buffer_(buffer) {
+}
+
+void BinaryProtocol4Writer::AppendVarint(uint32_t value) {
+    while (value >= 0x80) {
+        buffer_ += (char)((value & 0x7f) | 0x80);
+        value >>= 7;
+    }
+    buffer_ += (char)value;
+}
+
+void BinaryProtocol4Writer::AddAudio(const uint8_t* payload, size_t size, uint32_t timestamp, uint32_t sequence) {
+    uint8_t header = kBinaryProtocol4Audio | BINARY_PROTOCOL4_HAS_SEQUENCE;
+    if (timestamp != 0) {
+        header |= BINARY_PROTOCOL4_HAS_TIMESTAMP;
+    }
+    buffer_ += (char)header;
+    if (timestamp != 0) {
+        AppendVarint(timestamp);
+    }
+    AppendVarint(sequence);
+    AppendVarint(size);
+    buffer_.append((const char*)payload, size);
+}
+
+void BinaryProtocol4Writer::AddJson(std::string_view json) {
+    buffer_ += (char)kBinaryProtocol4Json;
+    AppendVarint(json.size());
+    buffer_.append(json.data(), json.size());
+}
+
+BinaryProtocol4Reader::BinaryProtocol4Reader(const uint8_t* data, size_t size) : data_(data), size_(size) {
+}
+
+bool BinaryProtocol4Reader::ReadVarint(uint32_t& value) {
+    value = 0;
+    for (int shift = 0; shift < 35; shift += 7) {
+        if (offset_ >= size_) {
+            return false;
+        }
+        uint8_t byte = data_[offset_++];
+        value |= (uint32_t)(byte & 0x7f) << shift;
+        if ((byte & 0x80) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool BinaryProtocol4Reader::Next(BinaryProtocol4Record& record) {
+    if (error_ || offset_ >= size_) {
+        return false;
+    }
+    uint8_t header = data_[offset_++];
+    record.type = header & 0x0f;
+    record.has_timestamp = header & BINARY_PROTOCOL4_HAS_TIMESTAMP;
+    record.has_sequence = header & BINARY_PROTOCOL4_HAS_SEQUENCE;
+    record.timestamp = 0;
+    record.sequence = 0;
+    uint32_t payload_size;
+    if ((record.has_timestamp && !ReadVarint(record.timestamp)) ||
+        (record.has_sequence && !ReadVarint(record.sequence)) ||
+        !ReadVarint(payload_size) || payload_size > size_ - offset_) {
+        error_ = true;
+        return false;
+    }
+    record.payload = data_ + offset_;
+    record.payload_size = payload_size;
+    offset_ += payload_size;
+    return true;
+}
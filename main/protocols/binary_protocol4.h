@@ -0,0 +1,71 @@
+#ifndef BINARY_PROTOCOL4_H
+#define BINARY_PROTOCOL4_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+/*
+ * Binary framing v4. A binary message is a sequence of records:
+ *
+ *   |flags:4 type:4|[timestamp varint]|[sequence varint]|payload_size varint|payload|
+ *
+ * Integers are unsigned LEB128 varints. A single Opus frame without timestamp or sequence
+ * costs 2 header bytes, with both about 8. Audio and JSON control records may be mixed
+ * in one message, receivers handle them in order.
+ */
+enum BinaryProtocol4Type {
+    kBinaryProtocol4Audio = 0,  // Opus frame
+    kBinaryProtocol4Json = 1,   // UTF-8 JSON control message, same content as a text frame
+};
+
+#define BINARY_PROTOCOL4_HAS_TIMESTAMP 0x10
+#define BINARY_PROTOCOL4_HAS_SEQUENCE 0x20
+
+struct BinaryProtocol4Record {
+    uint8_t type = kBinaryProtocol4Audio;
+    bool has_timestamp = false;
+    bool has_sequence = false;
+    uint32_t timestamp = 0;
+    uint32_t sequence = 0;
+    const uint8_t* payload = nullptr;
+    size_t payload_size = 0;
+};
+
+// Appends records to a caller-owned buffer. The caller clears the buffer once the message
+// is sent, so it keeps its capacity across messages.
+class BinaryProtocol4Writer {
+public:
+    explicit BinaryProtocol4Writer(std::string& buffer);
+
+    // A timestamp of 0 is left out, it means unknown
+    void AddAudio(const uint8_t* payload, size_t size, uint32_t timestamp, uint32_t sequence);
+    void AddJson(std::string_view json);
+    inline size_t size() const { return buffer_.size(); }
+
+private:
+    std::string& buffer_;
+
+    void AppendVarint(uint32_t value);
+};
+
+// Iterates the records of a received message, the payloads point into the message
+class BinaryProtocol4Reader {
+public:
+    BinaryProtocol4Reader(const uint8_t* data, size_t size);
+
+    // Returns false at the end of the message or on a malformed record
+    bool Next(BinaryProtocol4Record& record);
+    inline bool error() const { return error_; }
+
+private:
+    const uint8_t* data_;
+    size_t size_;
+    size_t offset_ = 0;
+    bool error_ = false;
+
+    bool ReadVarint(uint32_t& value);
+};
+
+#endif // BINARY_PROTOCOL4_H
@@ -0,0 +1,99 @@
+#include "json_message_router.h"
+
+#include <esp_log.h>
+#include <cstring>
+
+#define TAG "JsonMessageRouter"
+
+// FNV-1a, never 0 so that 0 can mean "any state"
+uint32_t JsonMessageRouter::Hash(const char* str) {
+    uint32_t hash = 2166136261u;
+    for (; *str != '\0'; str++) {
+        hash = (hash ^ (uint8_t)*str) * 16777619u;
+    }
+    return hash != 0 ? hash : 1;
+}
+
+void JsonMessageRouter::On(const char* type, Handler handler) {
+    routes_.push_back({Hash(type), 0, type, nullptr, std::move(handler)});
+}
+
+void JsonMessageRouter::On(const char* type, const char* state, Handler handler) {
+    // Routes with a state are matched before the catch-all route of the same type
+    routes_.insert(routes_.begin(), {Hash(type), Hash(state), type, state, std::move(handler)});
+}
+
+static inline const char* StringValue(const cJSON* item) {
+    return cJSON_IsString(item) ? item->valuestring : nullptr;
+}
+
+bool JsonMessageRouter::Dispatch(const cJSON* root) const {
+    if (!cJSON_IsObject(root)) {
+        ESP_LOGW(TAG, "Message is not an object");
+        return false;
+    }
+
+    JsonMessage message;
+    message.root = root;
+    for (const cJSON* item = root->child; item != nullptr; item = item->next) {
+        const char* key = item->string;
+        if (key == nullptr) {
+            continue;
+        }
+        switch (key[0]) {
+            case 't':
+                if (strcmp(key, "type") == 0) {
+                    message.type = StringValue(item);
+                } else if (strcmp(key, "text") == 0) {
+                    message.text = StringValue(item);
+                }
+                break;
+            case 's':
+                if (strcmp(key, "state") == 0) {
+                    message.state = StringValue(item);
+                } else if (strcmp(key, "status") == 0) {
+                    message.status = StringValue(item);
+                }
+                break;
+            case 'e':
+                if (strcmp(key, "emotion") == 0) {
+                    message.emotion = StringValue(item);
+                }
+                break;
+            case 'c':
+                if (strcmp(key, "command") == 0) {
+                    message.command = StringValue(item);
+                } else if (strcmp(key, "commands") == 0) {
+                    message.commands = item;
+                }
+                break;
+            case 'm':
+                if (strcmp(key, "message") == 0) {
+                    message.message = StringValue(item);
+                }
+                break;
+        }
+    }
+
+    if (message.type == nullptr) {
+        ESP_LOGE(TAG, "Missing message type");
+        return false;
+    }
+
+    uint32_t type_hash = Hash(message.type);
+    uint32_t state_hash = message.state != nullptr ? Hash(message.state) : 0;
+    for (auto& route : routes_) {
+        if (route.type_hash != type_hash || (route.state_hash != 0 && route.state_hash != state_hash)) {
+            continue;
+        }
+        // Confirm the match, the hashes may collide
+        if (strcmp(route.type, message.type) != 0 ||
+            (route.state != nullptr && (message.state == nullptr || strcmp(route.state, message.state) != 0))) {
+            continue;
+        }
+        route.handler(message);
+        return true;
+    }
+    ESP_LOGD(TAG, "No route for message type %s", message.type);
+    return false;
+}
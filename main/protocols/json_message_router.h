@@ -0,0 +1,52 @@
+#ifndef JSON_MESSAGE_ROUTER_H
+#define JSON_MESSAGE_ROUTER_H
+
+#include <cJSON.h>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+// The top-level fields of an incoming message, extracted in a single pass over the
+// object so that handlers do not look them up again. Missing or non-string fields are
+// nullptr, root is there for anything else.
+struct JsonMessage {
+    const cJSON* root = nullptr;
+    const char* type = nullptr;
+    const char* state = nullptr;
+    const char* text = nullptr;
+    const char* emotion = nullptr;
+    const char* command = nullptr;
+    const char* status = nullptr;
+    const char* message = nullptr;
+    const cJSON* commands = nullptr;
+};
+
+// Dispatches incoming server JSON by message type and, optionally, state. Routes are
+// registered once at startup. Type and state strings are interned as hashes when they
+// are registered, so dispatch compares one hash per route instead of chains of strcmp.
+class JsonMessageRouter {
+public:
+    using Handler = std::function<void(const JsonMessage& message)>;
+
+    // A route without a state matches every state that has no route of its own
+    void On(const char* type, Handler handler);
+    void On(const char* type, const char* state, Handler handler);
+
+    // Returns false if no route matched
+    bool Dispatch(const cJSON* root) const;
+
+private:
+    struct Route {
+        uint32_t type_hash;
+        uint32_t state_hash;  // 0 matches any state
+        const char* type;
+        const char* state;
+        Handler handler;
+    };
+
+    std::vector<Route> routes_;
+
+    static uint32_t Hash(const char* str);
+};
+
+#endif // JSON_MESSAGE_ROUTER_H
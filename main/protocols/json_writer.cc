@@ -0,0 +1,110 @@
+#include "json_writer.h"
+
+#include <cstdio>
+
+JsonWriter::JsonWriter(std::string& buffer) : buffer_(buffer) {
+    buffer_.clear();
+}
+
+void JsonWriter::Separator() {
+    if (need_comma_) {
+        buffer_ += ',';
+    }
+}
+
+JsonWriter& JsonWriter::BeginObject() {
+    Separator();
+    buffer_ += '{';
+    need_comma_ = false;
+    return *this;
+}
+
+JsonWriter& JsonWriter::EndObject() {
+    buffer_ += '}';
+    need_comma_ = true;
+    return *this;
+}
+
+JsonWriter& JsonWriter::BeginArray() {
+    Separator();
+    buffer_ += '[';
+    need_comma_ = false;
+    return *this;
+}
+
+JsonWriter& JsonWriter::EndArray() {
+    buffer_ += ']';
+    need_comma_ = true;
+    return *this;
+}
+
+JsonWriter& JsonWriter::Key(std::string_view key) {
+    Separator();
+    AppendEscaped(key);
+    buffer_ += ':';
+    // The value follows the key without a comma
+    need_comma_ = false;
+    return *this;
+}
+
+JsonWriter& JsonWriter::String(std::string_view value) {
+    Separator();
+    AppendEscaped(value);
+    need_comma_ = true;
+    return *this;
+}
+
+JsonWriter& JsonWriter::Int(int64_t value) {
+    Separator();
+    char number[24];
+    int length = snprintf(number, sizeof(number), "%lld", (long long)value);
+    buffer_.append(number, length);
+    need_comma_ = true;
+    return *this;
+}
+
+JsonWriter& JsonWriter::Bool(bool value) {
+    Separator();
+    buffer_ += value ? "true" : "false";
+    need_comma_ = true;
+    return *this;
+}
+
+JsonWriter& JsonWriter::Raw(std::string_view json) {
+    Separator();
+    buffer_ += json;
+    need_comma_ = true;
+    return *this;
+}
+
+void JsonWriter::AppendEscaped(std::string_view value) {
+    static const char kHex[] = "0123456789abcdef";
+    buffer_ += '"';
+    // Copy runs of plain characters at once, only quotes, backslashes and control characters
+    // are escaped. UTF-8 sequences pass through unchanged.
+    size_t run_start = 0;
+    for (size_t i = 0; i < value.size(); i++) {
+        unsigned char c = value[i];
+        if (c >= 0x20 && c != '"' && c != '\\') {
+            continue;
+        }
+        buffer_.append(value.data() + run_start, i - run_start);
+        run_start = i + 1;
+        switch (c) {
+            case '"': buffer_ += "\\\""; break;
+            case '\\': buffer_ += "\\\\"; break;
+            case '\n': buffer_ += "\\n"; break;
+            case '\r': buffer_ += "\\r"; break;
+            case '\t': buffer_ += "\\t"; break;
+            case '\b': buffer_ += "\\b"; break;
+            case '\f': buffer_ += "\\f"; break;
+            default: {
+                char escaped[] = {'\\', 'u', '0', '0', kHex[c >> 4], kHex[c & 0xf]};
+                buffer_.append(escaped, sizeof(escaped));
+                break;
+            }
+        }
+    }
+    buffer_.append(value.data() + run_start, value.size() - run_start);
+    buffer_ += '"';
+}
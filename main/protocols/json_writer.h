@@ -0,0 +1,43 @@
+#ifndef JSON_WRITER_H
+#define JSON_WRITER_H
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+// Streams compact JSON into a caller-owned string. The string is cleared but keeps its
+// capacity, so a buffer reused across messages stops reallocating once it has grown to
+// the largest message. Strings are escaped, commas are inserted automatically.
+//
+//   JsonWriter writer(buffer);
+//   writer.BeginObject().Field("type", "listen").Field("state", "start").EndObject();
+class JsonWriter {
+public:
+    explicit JsonWriter(std::string& buffer);
+
+    JsonWriter& BeginObject();
+    JsonWriter& EndObject();
+    JsonWriter& BeginArray();
+    JsonWriter& EndArray();
+    JsonWriter& Key(std::string_view key);
+
+    JsonWriter& String(std::string_view value);
+    JsonWriter& Int(int64_t value);
+    JsonWriter& Bool(bool value);
+    // Inserts an already serialized JSON value as is
+    JsonWriter& Raw(std::string_view json);
+
+    inline JsonWriter& Field(std::string_view key, std::string_view value) { return Key(key).String(value); }
+    inline JsonWriter& Field(std::string_view key, const char* value) { return Key(key).String(value); }
+    inline JsonWriter& Field(std::string_view key, int value) { return Key(key).Int(value); }
+    inline JsonWriter& Field(std::string_view key, bool value) { return Key(key).Bool(value); }
+
+private:
+    std::string& buffer_;
+    bool need_comma_ = false;
+
+    void Separator();
+    void AppendEscaped(std::string_view value);
+};
+
+#endif // JSON_WRITER_H
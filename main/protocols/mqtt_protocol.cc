@@ -2,6 +2,7 @@
 #include "board.h"
 #include "application.h"
 #include "settings.h"
+#include "json_writer.h"
 
 #include <esp_log.h>
 #include <ml307_mqtt.h>
@@ -113,6 +114,8 @@ bool MqttProtocol::SendText(const std::string& text) {
     if (publish_topic_.empty()) {
         return false;
     }
+    // Control messages such as stop listening follow the audio sent before them
+    FlushPackedAudio();
     if (!mqtt_->Publish(publish_topic_, text)) {
         ESP_LOGE(TAG, "Failed to publish message: %s", text.c_str());
         SetError(Lang::Strings::SERVER_ERROR);
@@ -127,42 +130,131 @@ void MqttProtocol::SendAudio(const AudioStreamPacket& packet) {
         return;
     }
 
-    std::string nonce(aes_nonce_);
-    *(uint16_t*)&nonce[2] = htons(packet.payload.size());
-    *(uint32_t*)&nonce[8] = htonl(packet.timestamp);
-    *(uint32_t*)&nonce[12] = htonl(++local_sequence_);
-
-    std::string encrypted;
-    encrypted.resize(aes_nonce_.size() + packet.payload.size());
-    memcpy(encrypted.data(), nonce.data(), nonce.size());
+#if CONFIG_USE_MQTT_UDP_PACKING
+    if (udp_pack_) {
+        const size_t frame_header_size = 6;
+        if (aes_nonce_.size() + pack_buffer_.size() + frame_header_size + packet.size() > MQTT_UDP_PACK_MAX_SIZE) {
+            FlushPackedAudioLocked();
+        }
+        uint8_t frame_header[frame_header_size];
+        uint16_t payload_size = htons(packet.size());
+        uint32_t timestamp = htonl(packet.timestamp);
+        memcpy(frame_header, &payload_size, sizeof(payload_size));
+        memcpy(frame_header + 2, &timestamp, sizeof(timestamp));
+        pack_buffer_.append((const char*)frame_header, frame_header_size);
+        pack_buffer_.append((const char*)packet.data(), packet.size());
+        pack_frames_++;
+
+        // The first frame waits at most the latency budget, a batch is already late and
+        // is only limited by the datagram size
+        int max_frames = batching_ ? 255 : 1 + CONFIG_MQTT_UDP_PACK_LATENCY_MS / uplink_frame_duration_;
+        if (pack_frames_ >= max_frames) {
+            FlushPackedAudioLocked();
+        }
+        return;
+    }
+#endif
 
-    size_t nc_off = 0;
-    uint8_t stream_block[16] = {0};
-    if (mbedtls_aes_crypt_ctr(&aes_ctx_, packet.payload.size(), &nc_off, (uint8_t*)nonce.c_str(), stream_block,
-        (uint8_t*)packet.payload.data(), (uint8_t*)&encrypted[nonce.size()]) != 0) {
+    if (!BuildAudioDatagram(0, packet.data(), packet.size(), packet.timestamp, ++local_sequence_)) {
         ESP_LOGE(TAG, "Failed to encrypt audio data");
         return;
     }
 
     busy_sending_audio_ = true;
-    udp_->Send(encrypted);
+    udp_->Send(send_buffer_);
     busy_sending_audio_ = false;
 }
 
+void MqttProtocol::FlushPackedAudio() {
+    std::lock_guard<std::mutex> lock(channel_mutex_);
+    FlushPackedAudioLocked();
+}
+
+/*
+ * The caller holds channel_mutex_.
+ *
+ * The header is also the AES-CTR counter block and the counter advances once per 16 bytes,
+ * so a datagram covers sequence .. sequence + size / 16 in the last word. The frames of a
+ * packed datagram take consecutive sequence numbers from the header one, so with the
+ * sequence alone the next datagram would reuse part of this keystream. Every packed frame
+ * carries its own timestamp, so the header timestamp holds a count of the packed datagrams
+ * sent in this session instead, which keeps the counter blocks of two datagrams apart.
+ */
+void MqttProtocol::FlushPackedAudioLocked() {
+    if (pack_frames_ == 0) {
+        return;
+    }
+    if (udp_ != nullptr) {
+        if (BuildAudioDatagram(pack_frames_, (const uint8_t*)pack_buffer_.data(), pack_buffer_.size(),
+                ++pack_datagrams_, local_sequence_ + 1)) {
+            busy_sending_audio_ = true;
+            udp_->Send(send_buffer_);
+            busy_sending_audio_ = false;
+        } else {
+            ESP_LOGE(TAG, "Failed to encrypt audio data");
+        }
+        local_sequence_ += pack_frames_;
+    }
+    pack_frames_ = 0;
+    pack_buffer_.clear();
+}
+
+void MqttProtocol::BeginBatch() {
+    std::lock_guard<std::mutex> lock(channel_mutex_);
+    batching_ = true;
+}
+
+void MqttProtocol::EndBatch() {
+    std::lock_guard<std::mutex> lock(channel_mutex_);
+    batching_ = false;
+    FlushPackedAudioLocked();
+}
+
+/*
+ * Writes the nonce header and the ciphertext straight into send_buffer_, which keeps its
+ * capacity across frames. The caller holds channel_mutex_ and Udp::Send copies the datagram
+ * out before returning, so a single buffer is enough.
+ *
+ * A single-frame datagram of more than 16 bytes shares counter blocks with the next frame's
+ * whenever their timestamps are equal. That is how the v3 format is defined and the server
+ * decrypts with the same counters, so it is kept as is, only packed datagrams avoid it.
+ */
+bool MqttProtocol::BuildAudioDatagram(uint8_t frames, const uint8_t* payload, size_t size, uint32_t timestamp, uint32_t sequence) {
+    size_t header_size = aes_nonce_.size();
+    send_buffer_.resize(header_size + size);
+    auto datagram = (uint8_t*)send_buffer_.data();
+    memcpy(datagram, aes_nonce_.data(), header_size);
+    if (frames > 0) {
+        // The flags byte carries the frame count of a packed datagram
+        datagram[0] = MQTT_UDP_TYPE_PACKED_AUDIO;
+        datagram[1] = frames;
+    }
+    *(uint16_t*)&datagram[2] = htons(size);
+    *(uint32_t*)&datagram[8] = htonl(timestamp);
+    *(uint32_t*)&datagram[12] = htonl(sequence);
+
+    // mbedtls advances the counter block, so it works on a copy of the header
+    uint8_t counter[16];
+    memcpy(counter, datagram, sizeof(counter));
+    size_t nc_off = 0;
+    uint8_t stream_block[16] = {0};
+    return mbedtls_aes_crypt_ctr(&aes_ctx_, size, &nc_off, counter, stream_block,
+        payload, datagram + header_size) == 0;
+}
+
 void MqttProtocol::CloseAudioChannel() {
     {
         std::lock_guard<std::mutex> lock(channel_mutex_);
+        FlushPackedAudioLocked();
         if (udp_ != nullptr) {
             delete udp_;
             udp_ = nullptr;
         }
     }
 
-    std::string message = "{";
-    message += "\"session_id\":\"" + session_id_ + "\",";
-    message += "\"type\":\"goodbye\"";
-    message += "}";
-    SendText(message);
+    JsonWriter writer(message_buffer_);
+    writer.BeginObject().Field("session_id", session_id_).Field("type", "goodbye").EndObject();
+    SendText(message_buffer_);
 
     if (on_audio_channel_closed_ != nullptr) {
         on_audio_channel_closed_();
@@ -180,20 +272,31 @@ bool MqttProtocol::OpenAudioChannel() {
     busy_sending_audio_ = false;
     error_occurred_ = false;
     session_id_ = "";
+    udp_pack_ = false;
     xEventGroupClearBits(event_group_handle_, MQTT_PROTOCOL_SERVER_HELLO_EVENT);
 
     // 发送 hello 消息申请 UDP 通道
-    std::string message = "{";
-    message += "\"type\":\"hello\",";
-    message += "\"version\": 3,";
-    message += "\"transport\":\"udp\",";
+    uplink_frame_duration_ = requested_uplink_frame_duration_;
+    JsonWriter writer(message_buffer_);
+    writer.BeginObject().Field("type", "hello").Field("version", 3).Field("transport", "udp");
+#if CONFIG_USE_SERVER_AEC || CONFIG_USE_MQTT_UDP_PACKING
+    writer.Key("features").BeginObject();
 #if CONFIG_USE_SERVER_AEC
-    message += "\"features\":{\"aec\":true},";
+    writer.Field("aec", true);
+#endif
+#if CONFIG_USE_MQTT_UDP_PACKING
+    writer.Field("udp_pack", true);
+#endif
+    writer.EndObject();
 #endif
-    message += "\"audio_params\":{";
-    message += "\"format\":\"opus\", \"sample_rate\":16000, \"channels\":1, \"frame_duration\":" + std::to_string(OPUS_FRAME_DURATION_MS);
-    message += "}}";
-    if (!SendText(message)) {
+    writer.Key("audio_params").BeginObject()
+        .Field("format", "opus")
+        .Field("sample_rate", 16000)
+        .Field("channels", 1)
+        .Field("frame_duration", uplink_frame_duration_)
+        .EndObject();
+    writer.EndObject();
+    if (!SendText(message_buffer_)) {
         return false;
     }
 
@@ -205,33 +308,38 @@ bool MqttProtocol::OpenAudioChannel() {
         return false;
     }
 
-    std::lock_guard<std::mutex> lock(channel_mutex_);
+    std::unique_lock<std::mutex> lock(channel_mutex_);
     if (udp_ != nullptr) {
         delete udp_;
     }
+    batching_ = false;
+    pack_frames_ = 0;
+    pack_buffer_.clear();
     udp_ = Board::GetInstance().CreateUdp();
     udp_->OnMessage([this](const std::string& data) {
         /*
          * UDP Encrypted OPUS Packet Format:
          * |type 1u|flags 1u|payload_len 2u|ssrc 4u|timestamp 4u|sequence 4u|
          * |payload payload_len|
+         *
+         * A packed datagram has type 0x02, the frame count in flags, a datagram count in
+         * place of the timestamp and the sequence of its first frame. The payload holds
+         * |payload_len 2u|timestamp 4u|payload| per frame.
          */
-        if (data.size() < sizeof(aes_nonce_)) {
+        if (data.size() < aes_nonce_.size()) {
             ESP_LOGE(TAG, "Invalid audio packet size: %zu", data.size());
             return;
         }
-        if (data[0] != 0x01) {
+        bool packed = data[0] == MQTT_UDP_TYPE_PACKED_AUDIO;
+        if (data[0] != MQTT_UDP_TYPE_AUDIO && !packed) {
             ESP_LOGE(TAG, "Invalid audio packet type: %x", data[0]);
             return;
         }
         uint32_t timestamp = ntohl(*(uint32_t*)&data[8]);
         uint32_t sequence = ntohl(*(uint32_t*)&data[12]);
-        if (sequence < remote_sequence_) {
-            ESP_LOGW(TAG, "Received audio packet with old sequence: %lu, expected: %lu", sequence, remote_sequence_);
-            return;
-        }
+        // Out-of-order packets are passed on, the jitter buffer reorders them by sequence
         if (sequence != remote_sequence_ + 1) {
-            ESP_LOGW(TAG, "Received audio packet with wrong sequence: %lu, expected: %lu", sequence, remote_sequence_ + 1);
+            ESP_LOGD(TAG, "Received audio packet with sequence: %lu, expected: %lu", sequence, remote_sequence_ + 1);
         }
 
         size_t decrypted_size = data.size() - aes_nonce_.size();
@@ -239,23 +347,54 @@ bool MqttProtocol::OpenAudioChannel() {
         uint8_t stream_block[16] = {0};
         auto nonce = (uint8_t*)data.data();
         auto encrypted = (uint8_t*)data.data() + aes_nonce_.size();
-        AudioStreamPacket packet;
-        packet.timestamp = timestamp;
-        packet.payload.resize(decrypted_size);
-        int ret = mbedtls_aes_crypt_ctr(&aes_ctx_, decrypted_size, &nc_off, nonce, stream_block, encrypted, (uint8_t*)packet.payload.data());
+        // Decrypt into a buffer that is reused across datagrams and lend it to the receiver
+        decrypt_buffer_.resize(decrypted_size);
+        int ret = mbedtls_aes_crypt_ctr(&aes_ctx_, decrypted_size, &nc_off, nonce, stream_block, encrypted, decrypt_buffer_.data());
         if (ret != 0) {
             ESP_LOGE(TAG, "Failed to decrypt audio data, ret: %d", ret);
             return;
         }
-        if (on_incoming_audio_ != nullptr) {
+        if (packed) {
+            // Unpack into the same path as single frames, the last one updates remote_sequence_
+            size_t offset = 0;
+            sequence--;
+            while (offset + 6 <= decrypted_size) {
+                uint16_t payload_size;
+                memcpy(&payload_size, decrypt_buffer_.data() + offset, sizeof(payload_size));
+                memcpy(&timestamp, decrypt_buffer_.data() + offset + 2, sizeof(timestamp));
+                payload_size = ntohs(payload_size);
+                offset += 6;
+                if (offset + payload_size > decrypted_size) {
+                    ESP_LOGE(TAG, "Invalid packed audio frame size: %u", payload_size);
+                    break;
+                }
+                sequence++;
+                if (on_incoming_audio_ != nullptr) {
+                    AudioStreamPacket packet;
+                    packet.timestamp = ntohl(timestamp);
+                    packet.sequence = sequence;
+                    packet.Borrow(decrypt_buffer_.data() + offset, payload_size);
+                    on_incoming_audio_(std::move(packet));
+                }
+                offset += payload_size;
+            }
+        } else if (on_incoming_audio_ != nullptr) {
+            AudioStreamPacket packet;
+            packet.timestamp = timestamp;
+            packet.sequence = sequence;
+            packet.Borrow(decrypt_buffer_.data(), decrypt_buffer_.size());
             on_incoming_audio_(std::move(packet));
         }
-        remote_sequence_ = sequence;
+        if ((int32_t)(sequence - remote_sequence_) > 0) {
+            remote_sequence_ = sequence;
+        }
         last_incoming_time_ = std::chrono::steady_clock::now();
     });
 
     udp_->Connect(udp_server_, udp_port_);
 
+    // Not under channel_mutex_, the callback sends the IoT descriptors through SendText()
+    lock.unlock();
     if (on_audio_channel_opened_ != nullptr) {
         on_audio_channel_opened_();
     }
@@ -288,6 +427,14 @@ void MqttProtocol::ParseServerHello(const cJSON* root) {
         }
     }
 
+#if CONFIG_USE_MQTT_UDP_PACKING
+    auto features = cJSON_GetObjectItem(root, "features");
+    if (features != nullptr) {
+        udp_pack_ = cJSON_IsTrue(cJSON_GetObjectItem(features, "udp_pack"));
+    }
+    ESP_LOGI(TAG, "UDP packing: %s", udp_pack_ ? "on" : "off");
+#endif
+
     auto udp = cJSON_GetObjectItem(root, "udp");
     if (udp == nullptr) {
         ESP_LOGE(TAG, "UDP is not specified");
@@ -301,10 +448,15 @@ void MqttProtocol::ParseServerHello(const cJSON* root) {
     // auto encryption = cJSON_GetObjectItem(udp, "encryption")->valuestring;
     // ESP_LOGI(TAG, "UDP server: %s, port: %d, encryption: %s", udp_server_.c_str(), udp_port_, encryption);
     aes_nonce_ = DecodeHexString(nonce);
+    if (aes_nonce_.size() != 16) {
+        ESP_LOGE(TAG, "Invalid nonce size: %u", (unsigned)aes_nonce_.size());
+        return;
+    }
     mbedtls_aes_init(&aes_ctx_);
     mbedtls_aes_setkey_enc(&aes_ctx_, (const unsigned char*)DecodeHexString(key).c_str(), 128);
     local_sequence_ = 0;
     remote_sequence_ = 0;
+    pack_datagrams_ = 0;
     xEventGroupSetBits(event_group_handle_, MQTT_PROTOCOL_SERVER_HELLO_EVENT);
 }
 
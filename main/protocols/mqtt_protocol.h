@@ -14,12 +14,18 @@
 #include <string>
 #include <map>
 #include <mutex>
+#include <vector>
 
 #define MQTT_PING_INTERVAL_SECONDS 90
 #define MQTT_RECONNECT_INTERVAL_MS 10000
 
 #define MQTT_PROTOCOL_SERVER_HELLO_EVENT (1 << 0)
 
+#define MQTT_UDP_TYPE_AUDIO 0x01
+#define MQTT_UDP_TYPE_PACKED_AUDIO 0x02
+// Packed datagrams stay below a typical path MTU
+#define MQTT_UDP_PACK_MAX_SIZE 1200
+
 class MqttProtocol : public Protocol {
 public:
     MqttProtocol();
@@ -30,6 +36,8 @@ public:
     bool OpenAudioChannel() override;
     void CloseAudioChannel() override;
     bool IsAudioChannelOpened() const override;
+    void BeginBatch() override;
+    void EndBatch() override;
 
 private:
     EventGroupHandle_t event_group_handle_;
@@ -49,8 +57,21 @@ private:
     int udp_port_;
     uint32_t local_sequence_;
     uint32_t remote_sequence_;
+    std::string send_buffer_;
+    std::vector<uint8_t> decrypt_buffer_;
+    // Multi-frame packing, used once the server hello accepts udp_pack
+    bool udp_pack_ = false;
+    bool batching_ = false;
+    int pack_frames_ = 0;
+    uint32_t pack_datagrams_ = 0;  // Sent in place of the header timestamp of a packed datagram
+    // Plaintext of the packed datagram being built, |payload_len 2u|timestamp 4u|payload| per frame
+    std::string pack_buffer_;
 
     bool StartMqttClient(bool report_error=false);
+    // frames is 0 for a single-frame datagram, otherwise payload holds that many packed frames
+    bool BuildAudioDatagram(uint8_t frames, const uint8_t* payload, size_t size, uint32_t timestamp, uint32_t sequence);
+    void FlushPackedAudio();
+    void FlushPackedAudioLocked();
     void ParseServerHello(const cJSON* root);
     std::string DecodeHexString(const std::string& hex_string);
 
@@ -1,4 +1,5 @@
 #include "protocol.h"
+#include "json_writer.h"
 
 #include <esp_log.h>
 
@@ -32,37 +33,51 @@ void Protocol::SetError(const std::string& message) {
 }
 
 void Protocol::SendAbortSpeaking(AbortReason reason) {
-    std::string message = "{\"session_id\":\"" + session_id_ + "\",\"type\":\"abort\"";
+    JsonWriter writer(message_buffer_);
+    writer.BeginObject().Field("session_id", session_id_).Field("type", "abort");
     if (reason == kAbortReasonWakeWordDetected) {
-        message += ",\"reason\":\"wake_word_detected\"";
+        writer.Field("reason", "wake_word_detected");
     }
-    message += "}";
-    SendText(message);
+    writer.EndObject();
+    SendText(message_buffer_);
 }
 
 void Protocol::SendWakeWordDetected(const std::string& wake_word) {
-    std::string json = "{\"session_id\":\"" + session_id_ + 
-                      "\",\"type\":\"listen\",\"state\":\"detect\",\"text\":\"" + wake_word + "\"}";
-    SendText(json);
+    JsonWriter writer(message_buffer_);
+    writer.BeginObject()
+        .Field("session_id", session_id_)
+        .Field("type", "listen")
+        .Field("state", "detect")
+        .Field("text", wake_word)
+        .EndObject();
+    SendText(message_buffer_);
 }
 
 void Protocol::SendStartListening(ListeningMode mode) {
-    std::string message = "{\"session_id\":\"" + session_id_ + "\"";
-    message += ",\"type\":\"listen\",\"state\":\"start\"";
+    const char* mode_string = "manual";
     if (mode == kListeningModeRealtime) {
-        message += ",\"mode\":\"realtime\"";
+        mode_string = "realtime";
     } else if (mode == kListeningModeAutoStop) {
-        message += ",\"mode\":\"auto\"";
-    } else {
-        message += ",\"mode\":\"manual\"";
+        mode_string = "auto";
     }
-    message += "}";
-    SendText(message);
+    JsonWriter writer(message_buffer_);
+    writer.BeginObject()
+        .Field("session_id", session_id_)
+        .Field("type", "listen")
+        .Field("state", "start")
+        .Field("mode", mode_string)
+        .EndObject();
+    SendText(message_buffer_);
 }
 
 void Protocol::SendStopListening() {
-    std::string message = "{\"session_id\":\"" + session_id_ + "\",\"type\":\"listen\",\"state\":\"stop\"}";
-    SendText(message);
+    JsonWriter writer(message_buffer_);
+    writer.BeginObject()
+        .Field("session_id", session_id_)
+        .Field("type", "listen")
+        .Field("state", "stop")
+        .EndObject();
+    SendText(message_buffer_);
 }
 
 void Protocol::SendIotDescriptors(const std::string& descriptors) {
@@ -78,6 +93,7 @@ void Protocol::SendIotDescriptors(const std::string& descriptors) {
         return;
     }
 
+    // One message per descriptor, each one is serialized on its own
     int arraySize = cJSON_GetArraySize(root);
     for (int i = 0; i < arraySize; ++i) {
         cJSON* descriptor = cJSON_GetArrayItem(root, i);
@@ -86,33 +102,47 @@ void Protocol::SendIotDescriptors(const std::string& descriptors) {
             continue;
         }
 
-        cJSON* messageRoot = cJSON_CreateObject();
-        cJSON_AddStringToObject(messageRoot, "session_id", session_id_.c_str());
-        cJSON_AddStringToObject(messageRoot, "type", "iot");
-        cJSON_AddBoolToObject(messageRoot, "update", true);
-
-        cJSON* descriptorArray = cJSON_CreateArray();
-        cJSON_AddItemToArray(descriptorArray, cJSON_Duplicate(descriptor, 1));
-        cJSON_AddItemToObject(messageRoot, "descriptors", descriptorArray);
-
-        char* message = cJSON_PrintUnformatted(messageRoot);
-        if (message == nullptr) {
+        char* descriptor_json = cJSON_PrintUnformatted(descriptor);
+        if (descriptor_json == nullptr) {
             ESP_LOGE(TAG, "Failed to print JSON message for IoT descriptor at index %d", i);
-            cJSON_Delete(messageRoot);
             continue;
         }
 
-        SendText(std::string(message));
-        cJSON_free(message);
-        cJSON_Delete(messageRoot);
+        JsonWriter writer(message_buffer_);
+        writer.BeginObject()
+            .Field("session_id", session_id_)
+            .Field("type", "iot")
+            .Field("update", true)
+            .Key("descriptors").BeginArray().Raw(descriptor_json).EndArray()
+            .EndObject();
+        cJSON_free(descriptor_json);
+        SendText(message_buffer_);
     }
 
     cJSON_Delete(root);
 }
 
 void Protocol::SendIotStates(const std::string& states) {
-    std::string message = "{\"session_id\":\"" + session_id_ + "\",\"type\":\"iot\",\"update\":true,\"states\":" + states + "}";
-    SendText(message);
+    JsonWriter writer(message_buffer_);
+    writer.BeginObject()
+        .Field("session_id", session_id_)
+        .Field("type", "iot")
+        .Field("update", true)
+        .Key("states").Raw(states)
+        .EndObject();
+    SendText(message_buffer_);
+}
+
+void Protocol::SendLatencyReport(const std::string& metrics, const std::string& uplink, const std::string& audio) {
+    JsonWriter writer(message_buffer_);
+    writer.BeginObject()
+        .Field("session_id", session_id_)
+        .Field("type", "latency")
+        .Key("metrics").Raw(metrics)
+        .Key("uplink").Raw(uplink)
+        .Key("audio").Raw(audio)
+        .EndObject();
+    SendText(message_buffer_);
 }
 
 bool Protocol::IsTimeout() const {
@@ -126,6 +156,15 @@ bool Protocol::IsTimeout() const {
     return timeout;
 }
 
+void Protocol::KeepAlive() {
+}
+
+void Protocol::BeginBatch() {
+}
+
+void Protocol::EndBatch() {
+}
+
 bool Protocol::IsAudioChannelBusy() const {
     return busy_sending_audio_;
 }
@@ -9,7 +9,21 @@
 
 struct AudioStreamPacket {
     uint32_t timestamp = 0;
+    uint32_t sequence = 0;  // Transport sequence number, 0 if unknown
     std::vector<uint8_t> payload;
+    // When set, used instead of payload without copying. The owner keeps it valid:
+    // network buffers only for the duration of the incoming audio callback,
+    // flash-mapped assets for the whole lifetime of the firmware.
+    const uint8_t* borrowed_payload = nullptr;
+    size_t borrowed_size = 0;
+
+    inline const uint8_t* data() const { return borrowed_payload != nullptr ? borrowed_payload : payload.data(); }
+    inline size_t size() const { return borrowed_payload != nullptr ? borrowed_size : payload.size(); }
+    inline bool empty() const { return size() == 0; }
+    inline void Borrow(const uint8_t* data, size_t size) {
+        borrowed_payload = data;
+        borrowed_size = size;
+    }
 };
 
 struct BinaryProtocol2 {
@@ -52,6 +66,13 @@ public:
     inline const std::string& session_id() const {
         return session_id_;
     }
+    inline int uplink_frame_duration() const {
+        return uplink_frame_duration_;
+    }
+    // Announced by the next hello, a warm channel is only reused if it was opened with this duration
+    inline void RequestUplinkFrameDuration(int duration_ms) {
+        requested_uplink_frame_duration_ = duration_ms;
+    }
 
     void OnIncomingAudio(std::function<void(AudioStreamPacket&& packet)> callback);
     void OnIncomingJson(std::function<void(const cJSON* root)> callback);
@@ -65,12 +86,19 @@ public:
     virtual bool IsAudioChannelOpened() const = 0;
     virtual bool IsAudioChannelBusy() const;
     virtual void SendAudio(const AudioStreamPacket& packet) = 0;
+    // Audio and control messages sent in between may be coalesced into fewer transport
+    // messages, e.g. when replaying buffered frames. Batches do not nest.
+    virtual void BeginBatch();
+    virtual void EndBatch();
+    // Called periodically from the main loop while the device is idle
+    virtual void KeepAlive();
     virtual void SendWakeWordDetected(const std::string& wake_word);
     virtual void SendStartListening(ListeningMode mode);
     virtual void SendStopListening();
     virtual void SendAbortSpeaking(AbortReason reason);
     virtual void SendIotDescriptors(const std::string& descriptors);
     virtual void SendIotStates(const std::string& states);
+    virtual void SendLatencyReport(const std::string& metrics, const std::string& uplink, const std::string& audio);
 
 protected:
     std::function<void(const cJSON* root)> on_incoming_json_;
@@ -81,9 +109,13 @@ protected:
 
     int server_sample_rate_ = 24000;
     int server_frame_duration_ = 60;
+    int uplink_frame_duration_ = 60;
+    int requested_uplink_frame_duration_ = 60;
     bool error_occurred_ = false;
     bool busy_sending_audio_ = false;
     std::string session_id_;
+    // Reused by every outgoing JSON message, Send* are called from the main loop
+    std::string message_buffer_;
     std::chrono::time_point<std::chrono::steady_clock> last_incoming_time_;
 
     virtual bool SendText(const std::string& text) = 0;
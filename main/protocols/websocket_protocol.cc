@@ -3,6 +3,7 @@
 #include "system_info.h"
 #include "application.h"
 #include "settings.h"
+#include "json_writer.h"
 
 #include <cstring>
 #include <cJSON.h>
@@ -33,35 +34,41 @@ void WebsocketProtocol::SendAudio(const AudioStreamPacket& packet) {
         return;
     }
 
-    if (version_ == 2) {
+    if (binary_version_ == 4) {
+        BinaryProtocol4Writer writer(send_buffer_);
+        writer.AddAudio(packet.data(), packet.size(), packet.timestamp, ++local_sequence_);
+        if (!batching_ || send_buffer_.size() >= WEBSOCKET_BATCH_MAX_SIZE) {
+            FlushBinary();
+        }
+    } else if (version_ == 2) {
         std::string serialized;
-        serialized.resize(sizeof(BinaryProtocol2) + packet.payload.size());
+        serialized.resize(sizeof(BinaryProtocol2) + packet.size());
         auto bp2 = (BinaryProtocol2*)serialized.data();
         bp2->version = htons(version_);
         bp2->type = 0;
         bp2->reserved = 0;
         bp2->timestamp = htonl(packet.timestamp);
-        bp2->payload_size = htonl(packet.payload.size());
-        memcpy(bp2->payload, packet.payload.data(), packet.payload.size());
+        bp2->payload_size = htonl(packet.size());
+        memcpy(bp2->payload, packet.data(), packet.size());
 
         busy_sending_audio_ = true;
         websocket_->Send(serialized.data(), serialized.size(), true);
         busy_sending_audio_ = false;
     } else if (version_ == 3) {
         std::string serialized;
-        serialized.resize(sizeof(BinaryProtocol3) + packet.payload.size());
+        serialized.resize(sizeof(BinaryProtocol3) + packet.size());
         auto bp3 = (BinaryProtocol3*)serialized.data();
         bp3->type = 0;
         bp3->reserved = 0;
-        bp3->payload_size = htons(packet.payload.size());
-        memcpy(bp3->payload, packet.payload.data(), packet.payload.size());
+        bp3->payload_size = htons(packet.size());
+        memcpy(bp3->payload, packet.data(), packet.size());
 
         busy_sending_audio_ = true;
         websocket_->Send(serialized.data(), serialized.size(), true);
         busy_sending_audio_ = false;
     } else {
         busy_sending_audio_ = true;
-        websocket_->Send(packet.payload.data(), packet.payload.size(), true);
+        websocket_->Send(packet.data(), packet.size(), true);
         busy_sending_audio_ = false;
     }
 }
@@ -71,6 +78,21 @@ bool WebsocketProtocol::SendText(const std::string& text) {
         return false;
     }
 
+    if (binary_version_ == 4) {
+        // Control messages share the binary stream, so they stay in order with the audio
+        BinaryProtocol4Writer writer(send_buffer_);
+        writer.AddJson(text);
+        if (batching_ && send_buffer_.size() < WEBSOCKET_BATCH_MAX_SIZE) {
+            return true;
+        }
+        if (!FlushBinary()) {
+            ESP_LOGE(TAG, "Failed to send text: %s", text.c_str());
+            SetError(Lang::Strings::SERVER_ERROR);
+            return false;
+        }
+        return true;
+    }
+
     if (!websocket_->Send(text)) {
         ESP_LOGE(TAG, "Failed to send text: %s", text.c_str());
         SetError(Lang::Strings::SERVER_ERROR);
@@ -80,18 +102,94 @@ bool WebsocketProtocol::SendText(const std::string& text) {
     return true;
 }
 
+bool WebsocketProtocol::FlushBinary() {
+    if (send_buffer_.empty()) {
+        return true;
+    }
+    busy_sending_audio_ = true;
+    bool sent = websocket_->Send(send_buffer_.data(), send_buffer_.size(), true);
+    busy_sending_audio_ = false;
+    send_buffer_.clear();
+    return sent;
+}
+
+void WebsocketProtocol::BeginBatch() {
+    batching_ = true;
+}
+
+void WebsocketProtocol::EndBatch() {
+    batching_ = false;
+    if (websocket_ != nullptr && !FlushBinary()) {
+        ESP_LOGE(TAG, "Failed to send batch");
+        SetError(Lang::Strings::SERVER_ERROR);
+    }
+}
+
 bool WebsocketProtocol::IsAudioChannelOpened() const {
-    return websocket_ != nullptr && websocket_->IsConnected() && !error_occurred_ && !IsTimeout();
+    return channel_opened_ && websocket_ != nullptr && websocket_->IsConnected() && !error_occurred_ && !IsTimeout();
 }
 
 void WebsocketProtocol::CloseAudioChannel() {
+#if CONFIG_KEEP_AUDIO_CHANNEL_WARM
+    if (channel_opened_ && websocket_ != nullptr && websocket_->IsConnected() && !error_occurred_) {
+        // Park the connection, the next OpenAudioChannel reuses it without a handshake.
+        // Tell the server the turn is over, it may still be sending the end of a reply.
+        ESP_LOGI(TAG, "Keeping websocket connection warm");
+        SendStopListening();
+        channel_opened_ = false;
+        parked_time_ = std::chrono::steady_clock::now();
+        last_heartbeat_time_ = parked_time_;
+        if (on_audio_channel_closed_ != nullptr) {
+            on_audio_channel_closed_();
+        }
+        return;
+    }
+#endif
     if (websocket_ != nullptr) {
         delete websocket_;
         websocket_ = nullptr;
     }
+    channel_opened_ = false;
+}
+
+void WebsocketProtocol::KeepAlive() {
+#if CONFIG_KEEP_AUDIO_CHANNEL_WARM
+    const int kHeartbeatIntervalSeconds = 30;
+    if (channel_opened_ || websocket_ == nullptr) {
+        return;
+    }
+    auto now = std::chrono::steady_clock::now();
+    if (!websocket_->IsConnected() ||
+        now - parked_time_ > std::chrono::seconds(CONFIG_KEEP_AUDIO_CHANNEL_WARM_SECONDS)) {
+        ESP_LOGI(TAG, "Closing warm websocket connection");
+        delete websocket_;
+        websocket_ = nullptr;
+        return;
+    }
+    if (now - last_heartbeat_time_ >= std::chrono::seconds(kHeartbeatIntervalSeconds)) {
+        // A ping frame keeps NAT mappings and server idle timers alive at a few bytes each
+        websocket_->Ping();
+        last_heartbeat_time_ = now;
+    }
+#endif
 }
 
 bool WebsocketProtocol::OpenAudioChannel() {
+#if CONFIG_KEEP_AUDIO_CHANNEL_WARM
+    // A new uplink frame duration needs a new hello, the pre-roll is already encoded with it
+    if (websocket_ != nullptr && websocket_->IsConnected() && !error_occurred_ &&
+        requested_uplink_frame_duration_ == uplink_frame_duration_) {
+        ESP_LOGI(TAG, "Reusing warm websocket connection, session: %s", session_id_.c_str());
+        busy_sending_audio_ = false;
+        channel_opened_ = true;
+        // The server is silent while the connection is parked, restart the timeout now
+        last_incoming_time_ = std::chrono::steady_clock::now();
+        if (on_audio_channel_opened_ != nullptr) {
+            on_audio_channel_opened_();
+        }
+        return true;
+    }
+#endif
     if (websocket_ != nullptr) {
         delete websocket_;
     }
@@ -106,6 +204,10 @@ bool WebsocketProtocol::OpenAudioChannel() {
 
     busy_sending_audio_ = false;
     error_occurred_ = false;
+    // Legacy framing until the server hello accepts v4
+    binary_version_ = version_;
+    local_sequence_ = 0;
+    send_buffer_.clear();
 
     websocket_ = Board::GetInstance().CreateWebSocket();
     
@@ -121,57 +223,63 @@ bool WebsocketProtocol::OpenAudioChannel() {
     websocket_->SetHeader("Client-Id", Board::GetInstance().GetUuid().c_str());
 
     websocket_->OnData([this](const char* data, size_t len, bool binary) {
-        if (binary) {
+        if (binary && !channel_opened_) {
+            // A late reply to a parked connection must not start speaking again
+            return;
+        }
+        if (binary && binary_version_ == 4) {
+            BinaryProtocol4Reader reader((const uint8_t*)data, len);
+            BinaryProtocol4Record record;
+            while (reader.Next(record)) {
+                if (record.type == kBinaryProtocol4Json) {
+                    HandleJson((const char*)record.payload, record.payload_size);
+                } else if (record.type == kBinaryProtocol4Audio && on_incoming_audio_ != nullptr) {
+                    AudioStreamPacket packet;
+                    packet.timestamp = record.timestamp;
+                    packet.sequence = record.sequence;
+                    packet.Borrow(record.payload, record.payload_size);
+                    on_incoming_audio_(std::move(packet));
+                }
+            }
+            if (reader.error()) {
+                ESP_LOGE(TAG, "Malformed binary message, %u bytes", (unsigned)len);
+            }
+        } else if (binary) {
             if (on_incoming_audio_ != nullptr) {
+                // The payload is borrowed from the websocket buffer, the receiver copies it if needed
+                AudioStreamPacket packet;
                 if (version_ == 2) {
                     BinaryProtocol2* bp2 = (BinaryProtocol2*)data;
                     bp2->version = ntohs(bp2->version);
                     bp2->type = ntohs(bp2->type);
                     bp2->timestamp = ntohl(bp2->timestamp);
                     bp2->payload_size = ntohl(bp2->payload_size);
-                    auto payload = (uint8_t*)bp2->payload;
-                    on_incoming_audio_(AudioStreamPacket{
-                        .timestamp = bp2->timestamp,
-                        .payload = std::vector<uint8_t>(payload, payload + bp2->payload_size)
-                    });
+                    packet.timestamp = bp2->timestamp;
+                    packet.Borrow(bp2->payload, bp2->payload_size);
                 } else if (version_ == 3) {
                     BinaryProtocol3* bp3 = (BinaryProtocol3*)data;
                     bp3->type = bp3->type;
                     bp3->payload_size = ntohs(bp3->payload_size);
-                    auto payload = (uint8_t*)bp3->payload;
-                    on_incoming_audio_(AudioStreamPacket{
-                        .timestamp = 0,
-                        .payload = std::vector<uint8_t>(payload, payload + bp3->payload_size)
-                    });
+                    packet.Borrow(bp3->payload, bp3->payload_size);
                 } else {
-                    on_incoming_audio_(AudioStreamPacket{
-                        .timestamp = 0,
-                        .payload = std::vector<uint8_t>((uint8_t*)data, (uint8_t*)data + len)
-                    });
+                    packet.Borrow((const uint8_t*)data, len);
                 }
+                on_incoming_audio_(std::move(packet));
             }
         } else {
-            // Parse JSON data
-            auto root = cJSON_Parse(data);
-            auto type = cJSON_GetObjectItem(root, "type");
-            if (type != NULL) {
-                if (strcmp(type->valuestring, "hello") == 0) {
-                    ParseServerHello(root);
-                } else {
-                    if (on_incoming_json_ != nullptr) {
-                        on_incoming_json_(root);
-                    }
-                }
-            } else {
-                ESP_LOGE(TAG, "Missing message type, data: %s", data);
-            }
-            cJSON_Delete(root);
+            HandleJson(data, len);
         }
         last_incoming_time_ = std::chrono::steady_clock::now();
     });
 
     websocket_->OnDisconnected([this]() {
         ESP_LOGI(TAG, "Websocket disconnected");
+        // A parked connection is already closed for the application, KeepAlive or the
+        // next OpenAudioChannel releases it
+        if (!channel_opened_) {
+            return;
+        }
+        channel_opened_ = false;
         if (on_audio_channel_closed_ != nullptr) {
             on_audio_channel_closed_();
         }
@@ -186,17 +294,26 @@ bool WebsocketProtocol::OpenAudioChannel() {
 
     // Send hello message to describe the client
     // keys: message type, version, audio_params (format, sample_rate, channels)
-    std::string message = "{";
-    message += "\"type\":\"hello\",";
-    message += "\"version\": " + std::to_string(version_) + ",";
+    uplink_frame_duration_ = requested_uplink_frame_duration_;
+    JsonWriter writer(message_buffer_);
+#if CONFIG_USE_WEBSOCKET_PROTOCOL_V4
+    // Offer v4 framing, the server accepts it by answering with version 4
+    writer.BeginObject().Field("type", "hello").Field("version", 4);
+#else
+    writer.BeginObject().Field("type", "hello").Field("version", version_);
+#endif
 #if CONFIG_USE_SERVER_AEC
-    message += "\"features\":{\"aec\":true},";
+    writer.Key("features").BeginObject().Field("aec", true).EndObject();
 #endif
-    message += "\"transport\":\"websocket\",";
-    message += "\"audio_params\":{";
-    message += "\"format\":\"opus\", \"sample_rate\":16000, \"channels\":1, \"frame_duration\":" + std::to_string(OPUS_FRAME_DURATION_MS);
-    message += "}}";
-    if (!SendText(message)) {
+    writer.Field("transport", "websocket");
+    writer.Key("audio_params").BeginObject()
+        .Field("format", "opus")
+        .Field("sample_rate", 16000)
+        .Field("channels", 1)
+        .Field("frame_duration", uplink_frame_duration_)
+        .EndObject();
+    writer.EndObject();
+    if (!SendText(message_buffer_)) {
         return false;
     }
 
@@ -208,6 +325,8 @@ bool WebsocketProtocol::OpenAudioChannel() {
         return false;
     }
 
+    channel_opened_ = true;
+    last_incoming_time_ = std::chrono::steady_clock::now();
     if (on_audio_channel_opened_ != nullptr) {
         on_audio_channel_opened_();
     }
@@ -215,6 +334,31 @@ bool WebsocketProtocol::OpenAudioChannel() {
     return true;
 }
 
+void WebsocketProtocol::HandleJson(const char* data, size_t len) {
+    // The message is not null-terminated
+    auto root = cJSON_ParseWithLength(data, len);
+    if (root == nullptr) {
+        ESP_LOGE(TAG, "Failed to parse json message");
+        return;
+    }
+    auto type = cJSON_GetObjectItem(root, "type");
+    if (type != NULL) {
+        if (strcmp(type->valuestring, "hello") == 0) {
+            ParseServerHello(root);
+        } else if (!channel_opened_) {
+            // Only the server hello is expected before the channel opens, or while it is parked
+            ESP_LOGW(TAG, "Dropping %s message, the audio channel is closed", type->valuestring);
+        } else {
+            if (on_incoming_json_ != nullptr) {
+                on_incoming_json_(root);
+            }
+        }
+    } else {
+        ESP_LOGE(TAG, "Missing message type, data: %.*s", (int)len, data);
+    }
+    cJSON_Delete(root);
+}
+
 void WebsocketProtocol::ParseServerHello(const cJSON* root) {
     auto transport = cJSON_GetObjectItem(root, "transport");
     if (transport == nullptr || strcmp(transport->valuestring, "websocket") != 0) {
@@ -240,5 +384,13 @@ void WebsocketProtocol::ParseServerHello(const cJSON* root) {
         }
     }
 
+#if CONFIG_USE_WEBSOCKET_PROTOCOL_V4
+    auto version = cJSON_GetObjectItem(root, "version");
+    if (cJSON_IsNumber(version) && version->valueint == 4) {
+        binary_version_ = 4;
+    }
+    ESP_LOGI(TAG, "Binary protocol version: %d", binary_version_);
+#endif
+
     xEventGroupSetBits(event_group_handle_, WEBSOCKET_PROTOCOL_SERVER_HELLO_EVENT);
 }
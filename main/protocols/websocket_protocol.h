@@ -3,12 +3,18 @@
 
 
 #include "protocol.h"
+#include "binary_protocol4.h"
 
 #include <web_socket.h>
 #include <freertos/FreeRTOS.h>
 #include <freertos/event_groups.h>
 
+#include <atomic>
+#include <chrono>
+
 #define WEBSOCKET_PROTOCOL_SERVER_HELLO_EVENT (1 << 0)
+// A v4 batch is sent once it grows past this size
+#define WEBSOCKET_BATCH_MAX_SIZE 4096
 
 class WebsocketProtocol : public Protocol {
 public:
@@ -20,13 +26,29 @@ public:
     bool OpenAudioChannel() override;
     void CloseAudioChannel() override;
     bool IsAudioChannelOpened() const override;
+    void KeepAlive() override;
+    void BeginBatch() override;
+    void EndBatch() override;
 
 private:
     EventGroupHandle_t event_group_handle_;
     WebSocket* websocket_ = nullptr;
     int version_ = 1;
+    // Framing in use, version_ or 4 once the server hello accepts it
+    int binary_version_ = 1;
+    uint32_t local_sequence_ = 0;
+    bool batching_ = false;
+    // Outgoing v4 message, reused across messages
+    std::string send_buffer_;
+    // False while the connection is kept warm between conversations
+    // Read by the receive task, which drops what a parked connection receives
+    std::atomic<bool> channel_opened_{false};
+    std::chrono::time_point<std::chrono::steady_clock> parked_time_;
+    std::chrono::time_point<std::chrono::steady_clock> last_heartbeat_time_;
 
     void ParseServerHello(const cJSON* root);
+    void HandleJson(const char* data, size_t len);
+    bool FlushBinary();
     bool SendText(const std::string& text) override;
 };
 
@@ -0,0 +1,74 @@
+#include "task_queue.h"
+
+#include <esp_timer.h>
+#include <cassert>
+
+std::atomic<uint32_t> InlineTask::heap_allocations_{0};
+
+TaskQueue::TaskQueue(size_t capacity)
+    : slots_(new Slot[capacity]), mask_(capacity - 1) {
+    assert(capacity > 0 && (capacity & (capacity - 1)) == 0);
+    for (size_t i = 0; i < capacity; i++) {
+        slots_[i].sequence.store(i, std::memory_order_relaxed);
+    }
+}
+
+TaskQueue::~TaskQueue() {
+    delete[] slots_;
+}
+
+bool TaskQueue::Push(InlineTask&& task) {
+    size_t position = head_.load(std::memory_order_relaxed);
+    Slot* slot;
+    while (true) {
+        slot = &slots_[position & mask_];
+        size_t sequence = slot->sequence.load(std::memory_order_acquire);
+        ptrdiff_t diff = (ptrdiff_t)(sequence - position);
+        if (diff == 0) {
+            // The slot is free for this position, claim it
+            if (head_.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+                break;
+            }
+        } else if (diff < 0) {
+            // The consumer has not released this slot yet, the queue is full
+            return false;
+        } else {
+            position = head_.load(std::memory_order_relaxed);
+        }
+    }
+
+    slot->push_time_us = esp_timer_get_time();
+    slot->task = std::move(task);
+    // Publish the slot to the consumer
+    slot->sequence.store(position + 1, std::memory_order_release);
+
+    size_t size = position + 1 - tail_.load(std::memory_order_relaxed);
+    size_t high_water = high_water_.load(std::memory_order_relaxed);
+    while (size > high_water && !high_water_.compare_exchange_weak(high_water, size, std::memory_order_relaxed)) {
+    }
+    return true;
+}
+
+bool TaskQueue::Pop(InlineTask& task, int64_t* push_time_us) {
+    size_t position = tail_.load(std::memory_order_relaxed);
+    Slot* slot = &slots_[position & mask_];
+    if (slot->sequence.load(std::memory_order_acquire) != position + 1) {
+        // Empty, or the producer that claimed this slot has not published it yet
+        return false;
+    }
+
+    task = std::move(slot->task);
+    if (push_time_us != nullptr) {
+        *push_time_us = slot->push_time_us;
+    }
+    tail_.store(position + 1, std::memory_order_relaxed);
+    // Hand the slot back to the producers for the next lap
+    slot->sequence.store(position + mask_ + 1, std::memory_order_release);
+    return true;
+}
+
+size_t TaskQueue::Size() const {
+    size_t tail = tail_.load(std::memory_order_relaxed);
+    size_t head = head_.load(std::memory_order_relaxed);
+    return head >= tail ? head - tail : 0;
+}
@@ -0,0 +1,140 @@
+#ifndef TASK_QUEUE_H
+#define TASK_QUEUE_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+// A move-only void() callable with inline storage. Callables that fit (most lambdas
+// capturing `this`, a few scalars, a string or a packet) are stored in place; larger
+// ones fall back to the heap and are counted, so the fallback shows up in the stats.
+class InlineTask {
+public:
+    static constexpr size_t kStorageSize = 48;
+
+    InlineTask() = default;
+
+    template <typename F, typename = std::enable_if_t<!std::is_same_v<std::decay_t<F>, InlineTask>>>
+    InlineTask(F&& callable) {
+        using T = std::decay_t<F>;
+        if constexpr (sizeof(T) <= kStorageSize && alignof(T) <= alignof(std::max_align_t)) {
+            new (storage_) T(std::forward<F>(callable));
+            ops_ = &kInlineOps<T>;
+        } else {
+            *(T**)storage_ = new T(std::forward<F>(callable));
+            ops_ = &kHeapOps<T>;
+            heap_allocations_.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    InlineTask(InlineTask&& other) noexcept {
+        MoveFrom(other);
+    }
+
+    InlineTask& operator=(InlineTask&& other) noexcept {
+        if (this != &other) {
+            Reset();
+            MoveFrom(other);
+        }
+        return *this;
+    }
+
+    InlineTask(const InlineTask&) = delete;
+    InlineTask& operator=(const InlineTask&) = delete;
+
+    ~InlineTask() {
+        Reset();
+    }
+
+    void operator()() {
+        ops_->invoke(storage_);
+    }
+
+    explicit operator bool() const { return ops_ != nullptr; }
+
+    void Reset() {
+        if (ops_ != nullptr) {
+            ops_->destroy(storage_);
+            ops_ = nullptr;
+        }
+    }
+
+    static uint32_t heap_allocations() { return heap_allocations_.load(std::memory_order_relaxed); }
+
+private:
+    struct Ops {
+        void (*invoke)(void* storage);
+        // Move-constructs into dst and destroys the source
+        void (*relocate)(void* dst, void* src);
+        void (*destroy)(void* storage);
+    };
+
+    template <typename T>
+    static constexpr Ops kInlineOps = {
+        [](void* storage) { (*(T*)storage)(); },
+        [](void* dst, void* src) {
+            new (dst) T(std::move(*(T*)src));
+            ((T*)src)->~T();
+        },
+        [](void* storage) { ((T*)storage)->~T(); },
+    };
+
+    template <typename T>
+    static constexpr Ops kHeapOps = {
+        [](void* storage) { (**(T**)storage)(); },
+        [](void* dst, void* src) { *(T**)dst = *(T**)src; },
+        [](void* storage) { delete *(T**)storage; },
+    };
+
+    alignas(std::max_align_t) unsigned char storage_[kStorageSize];
+    const Ops* ops_ = nullptr;
+
+    static std::atomic<uint32_t> heap_allocations_;
+
+    void MoveFrom(InlineTask& other) {
+        ops_ = other.ops_;
+        if (ops_ != nullptr) {
+            ops_->relocate(storage_, other.storage_);
+            other.ops_ = nullptr;
+        }
+    }
+};
+
+// Fixed-capacity multi-producer / single-consumer queue of InlineTasks.
+// Push() is lock-free (a bounded ring with per-slot sequence numbers), so it may be
+// called from any task, an esp_timer callback or an ISR. It fails only when the queue
+// is full. Pop() must be called from the consumer task only.
+class TaskQueue {
+public:
+    // capacity must be a power of two
+    explicit TaskQueue(size_t capacity);
+    ~TaskQueue();
+    TaskQueue(const TaskQueue&) = delete;
+    TaskQueue& operator=(const TaskQueue&) = delete;
+
+    bool Push(InlineTask&& task);
+    // Optionally returns the time (esp_timer_get_time) the task was pushed
+    bool Pop(InlineTask& task, int64_t* push_time_us = nullptr);
+
+    size_t Size() const;
+    inline size_t capacity() const { return mask_ + 1; }
+    inline size_t high_water() const { return high_water_.load(std::memory_order_relaxed); }
+
+private:
+    struct Slot {
+        std::atomic<size_t> sequence;
+        int64_t push_time_us;
+        InlineTask task;
+    };
+
+    Slot* slots_;
+    const size_t mask_;
+    std::atomic<size_t> head_{0};  // Next position to claim, shared by the producers
+    std::atomic<size_t> tail_{0};  // Next position to read, consumer only
+    std::atomic<size_t> high_water_{0};
+};
+
+#endif // TASK_QUEUE_H
@@ -0,0 +1,141 @@
+#include "uplink_controller.h"
+#include "json_writer.h"
+
+#include <esp_log.h>
+#include <opus.h>
+
+#define TAG "UplinkController"
+
+// Clean windows needed before stepping back up
+#define UPLINK_STEP_UP_WINDOWS 10
+// Server reports below this many frames are too small to judge loss
+#define UPLINK_MIN_REPORTED_FRAMES 10
+
+// Ordered from best quality to most robust. OPUS_AUTO is about 17 kbps for 16 kHz mono
+// 60 ms frames. 120 ms frames halve the per-packet transport overhead on weak links.
+const UplinkController::Level UplinkController::kLevels[] = {
+    {OPUS_AUTO, 60},
+    {12000, 60},
+    {9000, 60},
+    {8000, 120},
+    {6000, 120},
+};
+const int UplinkController::kLevelCount = sizeof(kLevels) / sizeof(kLevels[0]);
+
+void UplinkController::SetMaxComplexity(int complexity) {
+    max_complexity_ = complexity;
+    complexity_ = complexity;
+}
+
+void UplinkController::UpdateMax(std::atomic<uint32_t>& max, uint32_t value) {
+    uint32_t current = max.load(std::memory_order_relaxed);
+    while (value > current && !max.compare_exchange_weak(current, value, std::memory_order_relaxed)) {
+    }
+}
+
+void UplinkController::OnFrameSent(int64_t send_time_us) {
+    frames_sent_.fetch_add(1, std::memory_order_relaxed);
+    UpdateMax(max_send_time_us_, send_time_us > 0 ? (uint32_t)send_time_us : 0);
+}
+
+void UplinkController::OnFrameDropped(uint32_t count) {
+    frames_dropped_.fetch_add(count, std::memory_order_relaxed);
+}
+
+void UplinkController::OnFrameEncoded(int64_t encode_time_us) {
+    UpdateMax(max_encode_time_us_, encode_time_us > 0 ? (uint32_t)encode_time_us : 0);
+}
+
+void UplinkController::OnReceiveReport(uint32_t received, uint32_t lost) {
+    reported_received_.fetch_add(received, std::memory_order_relaxed);
+    reported_lost_.fetch_add(lost, std::memory_order_relaxed);
+}
+
+void UplinkController::ResetWindow() {
+    frames_sent_ = 0;
+    max_send_time_us_ = 0;
+    frames_dropped_ = 0;
+    max_encode_time_us_ = 0;
+    reported_received_ = 0;
+    reported_lost_ = 0;
+}
+
+bool UplinkController::Evaluate(int frame_duration_ms) {
+    uint32_t sent = frames_sent_.exchange(0);
+    uint32_t max_send_time_us = max_send_time_us_.exchange(0);
+    uint32_t dropped = frames_dropped_.exchange(0);
+    uint32_t max_encode_time_us = max_encode_time_us_.exchange(0);
+    uint32_t received = reported_received_.exchange(0);
+    uint32_t lost = reported_lost_.exchange(0);
+    if (sent == 0 && dropped == 0 && received == 0 && lost == 0) {
+        // Nothing was sent, e.g. while speaking, the window says nothing about the link
+        return false;
+    }
+
+    uint32_t frame_us = frame_duration_ms * 1000;
+    const char* reason = nullptr;
+    if (dropped > 0) {
+        reason = "drops";
+    } else if (max_send_time_us > frame_us / 2) {
+        // A send blocking for half a frame means the socket buffer is backing up
+        reason = "send_time";
+    } else if (received + lost >= UPLINK_MIN_REPORTED_FRAMES && lost * 20 > received + lost) {
+        reason = "server_loss";
+    }
+
+    bool changed = false;
+    if (reason != nullptr) {
+        clean_windows_ = 0;
+        last_reason_ = reason;
+        if (level_ < kLevelCount - 1) {
+            level_++;
+            step_downs_++;
+            changed = true;
+            ESP_LOGW(TAG, "Step down to level %d (%s): sent %lu dropped %lu max send %lu us lost %lu/%lu",
+                level_, reason, sent, dropped, max_send_time_us, lost, received + lost);
+        }
+    } else if (++clean_windows_ >= UPLINK_STEP_UP_WINDOWS) {
+        clean_windows_ = 0;
+        if (level_ > 0) {
+            level_--;
+            step_ups_++;
+            changed = true;
+            ESP_LOGI(TAG, "Step up to level %d", level_);
+        }
+        if (complexity_ < max_complexity_ && max_encode_time_us < frame_us / 6) {
+            complexity_++;
+            changed = true;
+        }
+    }
+
+    // Encoding has to keep up with capture, shed complexity when a frame takes a third of its duration
+    if (max_encode_time_us > frame_us / 3 && complexity_ > 0) {
+        complexity_--;
+        changed = true;
+        ESP_LOGW(TAG, "Encode took %lu us, complexity down to %d", max_encode_time_us, complexity_);
+    }
+    return changed;
+}
+
+int UplinkController::bitrate() const {
+    return kLevels[level_].bitrate;
+}
+
+int UplinkController::frame_duration() const {
+    return kLevels[level_].frame_duration_ms;
+}
+
+std::string UplinkController::GetStatusJson() const {
+    std::string json;
+    JsonWriter writer(json);
+    writer.BeginObject()
+        .Field("level", level_)
+        .Field("bitrate", bitrate())
+        .Field("frame_duration", frame_duration())
+        .Field("complexity", complexity_)
+        .Field("step_downs", (int)step_downs_)
+        .Field("step_ups", (int)step_ups_)
+        .Field("reason", last_reason_)
+        .EndObject();
+    return json;
+}
@@ -0,0 +1,66 @@
+#ifndef UPLINK_CONTROLLER_H
+#define UPLINK_CONTROLLER_H
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+// Adapts the uplink Opus encoder to the transport. Every evaluation window it looks at
+// the time spent in SendAudio, frames dropped because the channel was busy or the encoder
+// queue was full, and loss reported by the server. Congestion steps the bitrate down one
+// level, a run of clean windows steps it back up. Complexity is shed when encoding cannot
+// keep up. The frame duration of a level is only applied when the next hello renegotiates it.
+class UplinkController {
+public:
+    UplinkController() = default;
+
+    // The board's preferred complexity, the controller never goes above it
+    void SetMaxComplexity(int complexity);
+
+    // May be called from any task
+    void OnFrameSent(int64_t send_time_us);
+    void OnFrameDropped(uint32_t count = 1);
+    void OnFrameEncoded(int64_t encode_time_us);
+    void OnReceiveReport(uint32_t received, uint32_t lost);
+
+    // Called from the main loop once per window while the audio channel is open.
+    // Returns true if the bitrate or complexity should be applied to the encoder.
+    bool Evaluate(int frame_duration_ms);
+    // Starts a fresh window, the level is kept across sessions
+    void ResetWindow();
+
+    int bitrate() const;
+    int frame_duration() const;
+    inline int complexity() const { return complexity_; }
+    inline int level() const { return level_; }
+    // {"level":..,"bitrate":..,"frame_duration":..,"complexity":..,"step_downs":..,"step_ups":..,"reason":".."}
+    std::string GetStatusJson() const;
+
+private:
+    struct Level {
+        int bitrate;
+        int frame_duration_ms;
+    };
+    static const Level kLevels[];
+    static const int kLevelCount;
+
+    int level_ = 0;
+    int complexity_ = 0;
+    int max_complexity_ = 0;
+    int clean_windows_ = 0;
+    uint32_t step_downs_ = 0;
+    uint32_t step_ups_ = 0;
+    const char* last_reason_ = "none";
+
+    // Current window, written by the producers and drained by Evaluate
+    std::atomic<uint32_t> frames_sent_{0};
+    std::atomic<uint32_t> max_send_time_us_{0};
+    std::atomic<uint32_t> frames_dropped_{0};
+    std::atomic<uint32_t> max_encode_time_us_{0};
+    std::atomic<uint32_t> reported_received_{0};
+    std::atomic<uint32_t> reported_lost_{0};
+
+    static void UpdateMax(std::atomic<uint32_t>& max, uint32_t value);
+};
+
+#endif // UPLINK_CONTROLLER_H
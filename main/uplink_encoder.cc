@@ -0,0 +1,112 @@
+#include "uplink_encoder.h"
+
+#include <esp_log.h>
+#include <algorithm>
+#include <cassert>
+
+#define TAG "UplinkEncoder"
+
+UplinkEncoder::UplinkEncoder(int sample_rate, int channels, int duration_ms)
+    : sample_rate_(sample_rate), channels_(channels), duration_ms_(duration_ms) {
+    int error;
+    encoder_ = opus_encoder_create(sample_rate, channels, OPUS_APPLICATION_VOIP, &error);
+    assert(encoder_ != nullptr);
+    frame_size_ = sample_rate_ / 1000 * channels_ * duration_ms_;
+    opus_encoder_ctl(encoder_, OPUS_SET_DTX(0));
+    opus_encoder_ctl(encoder_, OPUS_SET_COMPLEXITY(complexity_));
+}
+
+UplinkEncoder::~UplinkEncoder() {
+    if (encoder_ != nullptr) {
+        opus_encoder_destroy(encoder_);
+    }
+}
+
+void UplinkEncoder::SetComplexity(int complexity) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (opus_encoder_ctl(encoder_, OPUS_SET_COMPLEXITY(complexity)) == OPUS_OK) {
+        complexity_ = complexity;
+    }
+}
+
+void UplinkEncoder::SetBitrate(int bitrate) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (opus_encoder_ctl(encoder_, OPUS_SET_BITRATE(bitrate)) == OPUS_OK) {
+        bitrate_ = bitrate;
+    }
+}
+
+void UplinkEncoder::SetFrameDuration(int duration_ms) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    duration_ms_ = duration_ms;
+    frame_size_ = sample_rate_ / 1000 * channels_ * duration_ms_;
+}
+
+void UplinkEncoder::SetDtx(bool enable) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    opus_encoder_ctl(encoder_, OPUS_SET_DTX(enable ? 1 : 0));
+}
+
+void UplinkEncoder::Encode(std::vector<int16_t>&& pcm, bool gated,
+        std::function<void(std::vector<uint8_t>&& opus, bool gated)> handler) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!pcm.empty()) {
+        if (!in_runs_.empty() && in_runs_.back().gated == gated) {
+            in_runs_.back().samples += pcm.size();
+        } else {
+            in_runs_.push_back({pcm.size(), gated});
+        }
+    }
+    if (in_buffer_.empty()) {
+        in_buffer_ = std::move(pcm);
+    } else {
+        in_buffer_.insert(in_buffer_.end(), pcm.begin(), pcm.end());
+    }
+
+    size_t offset = 0;
+    while (in_buffer_.size() - offset >= frame_size_) {
+        bool frame_gated = true;
+        for (size_t needed = frame_size_; needed > 0;) {
+            auto& run = in_runs_.front();
+            size_t taken = std::min(needed, run.samples);
+            frame_gated = frame_gated && run.gated;
+            run.samples -= taken;
+            needed -= taken;
+            if (run.samples == 0) {
+                in_runs_.pop_front();
+            }
+        }
+
+        uint8_t packet[kMaxPacketSize];
+        int ret = opus_encode(encoder_, in_buffer_.data() + offset, frame_size_ / channels_, packet, sizeof(packet));
+        offset += frame_size_;
+        if (ret < 0) {
+            ESP_LOGE(TAG, "Failed to encode audio, error code: %d", ret);
+            continue;
+        }
+        if (handler != nullptr) {
+            handler(std::vector<uint8_t>(packet, packet + ret), frame_gated);
+        }
+    }
+    in_buffer_.erase(in_buffer_.begin(), in_buffer_.begin() + offset);
+}
+
+bool UplinkEncoder::EncodeFrame(const int16_t* pcm, std::vector<uint8_t>& opus) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    opus.resize(kMaxPacketSize);
+    int ret = opus_encode(encoder_, pcm, frame_size_ / channels_, opus.data(), opus.size());
+    if (ret < 0) {
+        ESP_LOGE(TAG, "Failed to encode audio, error code: %d", ret);
+        opus.clear();
+        return false;
+    }
+    opus.resize(ret);
+    return true;
+}
+
+void UplinkEncoder::ResetState() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    opus_encoder_ctl(encoder_, OPUS_RESET_STATE);
+    in_buffer_.clear();
+    in_runs_.clear();
+}
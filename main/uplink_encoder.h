@@ -0,0 +1,63 @@
+#ifndef UPLINK_ENCODER_H
+#define UPLINK_ENCODER_H
+
+#include <opus.h>
+
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <vector>
+
+// Opus encoder for the uplink. Bitrate and frame duration may change at runtime, so the
+// uplink controller can adapt them to the network. All methods may be called from any task.
+class UplinkEncoder {
+public:
+    UplinkEncoder(int sample_rate, int channels, int duration_ms);
+    ~UplinkEncoder();
+    UplinkEncoder(const UplinkEncoder&) = delete;
+    UplinkEncoder& operator=(const UplinkEncoder&) = delete;
+
+    void SetComplexity(int complexity);
+    // OPUS_AUTO lets libopus pick the bitrate from the sample rate and frame size
+    void SetBitrate(int bitrate);
+    // Takes effect from the next frame, must be a valid Opus frame duration
+    void SetFrameDuration(int duration_ms);
+    void SetDtx(bool enable);
+
+    // Buffers pcm and calls handler once per complete frame. Samples carry over between calls,
+    // so a frame may span chunks from both sides of the uplink gate. It is reported gated only
+    // if all of its samples came from gated chunks.
+    void Encode(std::vector<int16_t>&& pcm, bool gated,
+        std::function<void(std::vector<uint8_t>&& opus, bool gated)> handler);
+    // Encodes exactly one frame into opus, which keeps its capacity across calls.
+    // Not for use together with Encode(), the samples it buffers are left alone.
+    bool EncodeFrame(const int16_t* pcm, std::vector<uint8_t>& opus);
+    void ResetState();
+
+    inline int sample_rate() const { return sample_rate_; }
+    inline int complexity() const { return complexity_; }
+    inline int bitrate() const { return bitrate_; }
+    inline int duration_ms() const { return duration_ms_; }
+
+private:
+    static constexpr size_t kMaxPacketSize = 1000;
+
+    std::mutex mutex_;
+    OpusEncoder* encoder_ = nullptr;
+    int sample_rate_;
+    int channels_;
+    int complexity_ = 0;
+    int bitrate_ = OPUS_AUTO;
+    int duration_ms_;
+    size_t frame_size_;
+    std::vector<int16_t> in_buffer_;
+    // The samples of in_buffer_ in runs of the same gated flag, oldest first
+    struct Run {
+        size_t samples;
+        bool gated;
+    };
+    std::deque<Run> in_runs_;
+};
+
+#endif // UPLINK_ENCODER_H
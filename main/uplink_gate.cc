@@ -0,0 +1,77 @@
+#include "uplink_gate.h"
+
+#include <algorithm>
+
+UplinkGate::UplinkGate(int sample_rate, int hangover_ms, int lookback_ms)
+    : hangover_samples_((size_t)sample_rate * hangover_ms / 1000),
+      lookback_samples_((size_t)sample_rate * lookback_ms / 1000) {
+}
+
+void UplinkGate::Process(std::vector<int16_t>&& pcm, bool speech, const Emit& emit) {
+    size_t samples = pcm.size();
+    bool open = speech || hangover_left_ > 0;
+    if (speech) {
+        hangover_left_ = hangover_samples_;
+    } else {
+        hangover_left_ -= std::min(hangover_left_, samples);
+    }
+
+    if (open) {
+        if (!open_) {
+            // Speech started, the held frames are its onset
+            for (auto& chunk : held_) {
+                emit(std::move(chunk), true);
+            }
+            held_.clear();
+            held_samples_ = 0;
+            open_ = true;
+        }
+        emit(std::move(pcm), true);
+        return;
+    }
+
+    open_ = false;
+    held_.push_back(std::move(pcm));
+    held_samples_ += samples;
+    // Release the frames that fell out of the look-back as silence
+    while (!held_.empty() && held_samples_ - held_.front().size() >= lookback_samples_) {
+        auto chunk = std::move(held_.front());
+        held_.pop_front();
+        held_samples_ -= chunk.size();
+        std::fill(chunk.begin(), chunk.end(), 0);
+        emit(std::move(chunk), false);
+    }
+}
+
+void UplinkGate::Reset() {
+    held_.clear();
+    held_samples_ = 0;
+    hangover_left_ = 0;
+    open_ = true;
+    packets_ = 0;
+    gated_packets_ = 0;
+    bytes_sent_ = 0;
+    gated_bytes_ = 0;
+}
+
+void UplinkGate::OnPacket(size_t size, bool gated) {
+    packets_.fetch_add(1, std::memory_order_relaxed);
+    bytes_sent_.fetch_add(size, std::memory_order_relaxed);
+    if (gated) {
+        gated_packets_.fetch_add(1, std::memory_order_relaxed);
+        gated_bytes_.fetch_add(size, std::memory_order_relaxed);
+    }
+}
+
+uint32_t UplinkGate::bytes_saved() const {
+    uint32_t packets = packets_.load(std::memory_order_relaxed);
+    uint32_t gated_packets = gated_packets_.load(std::memory_order_relaxed);
+    uint32_t gated_bytes = gated_bytes_.load(std::memory_order_relaxed);
+    uint32_t open_packets = packets - gated_packets;
+    if (open_packets == 0) {
+        return 0;
+    }
+    uint32_t open_bytes = bytes_sent_.load(std::memory_order_relaxed) - gated_bytes;
+    uint32_t estimated = (uint32_t)((uint64_t)open_bytes * gated_packets / open_packets);
+    return estimated > gated_bytes ? estimated - gated_bytes : 0;
+}
@@ -0,0 +1,51 @@
+#ifndef UPLINK_GATE_H
+#define UPLINK_GATE_H
+
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <vector>
+
+// Transmission gate for the uplink, driven by the per-frame VAD of the audio processor.
+// The gate opens on speech and closes after the hangover. While it is closed, frames are
+// held for the look-back time so that the onset the VAD reports late can still be sent in
+// full when speech starts. Frames that leave the look-back while the gate is closed are
+// zeroed, with Opus DTX on they encode to a few bytes and keep the stream timing intact.
+// DTX on digital silence stands in for comfort noise, the decoder on the server generates it
+// from the DTX packets. No low-level noise is fed to the encoder.
+// Runs on the encoder task only, the statistics may be read from any task.
+class UplinkGate {
+public:
+    using Emit = std::function<void(std::vector<int16_t>&& pcm, bool open)>;
+
+    UplinkGate(int sample_rate, int hangover_ms, int lookback_ms);
+
+    // Emits zero or more chunks in capture order
+    void Process(std::vector<int16_t>&& pcm, bool speech, const Emit& emit);
+    // Drops the held frames and starts a new session, the statistics are cleared
+    void Reset();
+
+    // Called with each encoded packet and whether its frame was gated
+    void OnPacket(size_t size, bool gated);
+    inline uint32_t packets() const { return packets_.load(std::memory_order_relaxed); }
+    inline uint32_t gated_packets() const { return gated_packets_.load(std::memory_order_relaxed); }
+    inline uint32_t bytes_sent() const { return bytes_sent_.load(std::memory_order_relaxed); }
+    // Estimated from the average size of the packets sent with the gate open
+    uint32_t bytes_saved() const;
+
+private:
+    const size_t hangover_samples_;
+    const size_t lookback_samples_;
+    size_t hangover_left_ = 0;
+    bool open_ = true;
+    std::deque<std::vector<int16_t>> held_;
+    size_t held_samples_ = 0;
+
+    std::atomic<uint32_t> packets_{0};
+    std::atomic<uint32_t> gated_packets_{0};
+    std::atomic<uint32_t> bytes_sent_{0};
+    std::atomic<uint32_t> gated_bytes_{0};
+};
+
+#endif // UPLINK_GATE_H
@@ -0,0 +1,149 @@
+# 仅用于测试的最小 MQTT 3.1.1 broker
+# 支持 CONNECT、PUBLISH（QoS 0/1/2）、SUBSCRIBE、UNSUBSCRIBE、PINGREQ、DISCONNECT。
+# 服务器下发的消息直接推送给对应的客户端，不需要设备订阅主题。
+import asyncio
+import logging
+import struct
+
+logger = logging.getLogger("mqtt")
+
+CONNECT = 1
+CONNACK = 2
+PUBLISH = 3
+PUBACK = 4
+PUBREC = 5
+PUBREL = 6
+PUBCOMP = 7
+SUBSCRIBE = 8
+SUBACK = 9
+UNSUBSCRIBE = 10
+UNSUBACK = 11
+PINGREQ = 12
+PINGRESP = 13
+DISCONNECT = 14
+
+
+def encode_remaining_length(length):
+    encoded = bytearray()
+    while True:
+        byte = length % 128
+        length //= 128
+        if length > 0:
+            byte |= 0x80
+        encoded.append(byte)
+        if length == 0:
+            return bytes(encoded)
+
+
+def read_string(data, offset):
+    length = struct.unpack_from(">H", data, offset)[0]
+    offset += 2
+    return data[offset:offset + length].decode("utf-8"), offset + length
+
+
+class MqttClient:
+    def __init__(self, writer):
+        self.writer = writer
+        self.client_id = ""
+        self.username = ""
+        self.peer = writer.get_extra_info("peername")
+
+    def send_packet(self, packet_type, flags, body):
+        header = bytes([(packet_type << 4) | flags]) + encode_remaining_length(len(body))
+        self.writer.write(header + body)
+
+    async def publish(self, topic, payload):
+        if isinstance(payload, str):
+            payload = payload.encode("utf-8")
+        topic_bytes = topic.encode("utf-8")
+        self.send_packet(PUBLISH, 0, struct.pack(">H", len(topic_bytes)) + topic_bytes + payload)
+        await self.writer.drain()
+
+    def close(self):
+        self.writer.close()
+
+
+class MqttBroker:
+    """on_connect(client)、on_message(client, topic, payload)、on_disconnect(client) 由服务器提供"""
+
+    def __init__(self, on_connect=None, on_message=None, on_disconnect=None):
+        self.on_connect = on_connect
+        self.on_message = on_message
+        self.on_disconnect = on_disconnect
+
+    async def handle(self, reader, writer):
+        client = MqttClient(writer)
+        connected = False
+        try:
+            while True:
+                first = await reader.readexactly(1)
+                remaining = 0
+                multiplier = 1
+                while True:
+                    byte = (await reader.readexactly(1))[0]
+                    remaining += (byte & 0x7f) * multiplier
+                    multiplier *= 128
+                    if byte & 0x80 == 0:
+                        break
+                body = await reader.readexactly(remaining)
+                packet_type = first[0] >> 4
+                flags = first[0] & 0x0f
+
+                if packet_type == CONNECT:
+                    self._parse_connect(client, body)
+                    # Session present 0, return code 0 (accepted)
+                    client.send_packet(CONNACK, 0, b"\x00\x00")
+                    connected = True
+                    logger.info("Client connected: %s from %s", client.client_id, client.peer)
+                    if self.on_connect is not None:
+                        await self.on_connect(client)
+                elif packet_type == PUBLISH:
+                    qos = (flags >> 1) & 0x03
+                    topic, offset = read_string(body, 0)
+                    if qos > 0:
+                        packet_id = body[offset:offset + 2]
+                        offset += 2
+                        client.send_packet(PUBACK if qos == 1 else PUBREC, 0, packet_id)
+                    if self.on_message is not None:
+                        await self.on_message(client, topic, body[offset:])
+                elif packet_type == PUBREL:
+                    client.send_packet(PUBCOMP, 0, body[:2])
+                elif packet_type == SUBSCRIBE:
+                    packet_id = body[:2]
+                    offset = 2
+                    granted = bytearray()
+                    while offset < len(body):
+                        topic, offset = read_string(body, offset)
+                        offset += 1
+                        granted.append(0)
+                        logger.info("Client %s subscribed to %s", client.client_id, topic)
+                    client.send_packet(SUBACK, 0, packet_id + bytes(granted))
+                elif packet_type == UNSUBSCRIBE:
+                    client.send_packet(UNSUBACK, 0, body[:2])
+                elif packet_type == PINGREQ:
+                    client.send_packet(PINGRESP, 0, b"")
+                elif packet_type == DISCONNECT:
+                    break
+                else:
+                    logger.warning("Unsupported packet type %d", packet_type)
+                await writer.drain()
+        except (asyncio.IncompleteReadError, ConnectionError):
+            pass
+        finally:
+            logger.info("Client disconnected: %s", client.client_id)
+            if connected and self.on_disconnect is not None:
+                await self.on_disconnect(client)
+            writer.close()
+
+    def _parse_connect(self, client, body):
+        _, offset = read_string(body, 0)
+        # protocol level 1 byte, connect flags 1 byte, keep alive 2 bytes
+        connect_flags = body[offset + 1]
+        offset += 4
+        client.client_id, offset = read_string(body, offset)
+        if connect_flags & 0x04:
+            # will topic and will message
+            _, offset = read_string(body, offset)
+            _, offset = read_string(body, offset)
+        if connect_flags & 0x80:
+            client.username, offset = read_string(body, offset)
@@ -0,0 +1,131 @@
+# 在单个方向上模拟网络损伤：抖动、丢包、乱序和带宽限制
+import asyncio
+import inspect
+import random
+
+
+class NetEm:
+    """
+    按模拟的到达时间投递消息。
+
+    ordered=True 用于 TCP（WebSocket、MQTT）：不会乱序也不会丢包，
+    丢包表现为一次重传延迟，后面的消息排在它之后（队头阻塞）。
+    ordered=False 用于 UDP：真正丢包，抖动和乱序会改变到达顺序。
+    """
+
+    def __init__(self, rng: random.Random, jitter_ms=0, loss=0.0, reorder=0.0,
+                 bandwidth_kbps=0, ordered=True, rto_ms=200, frame_ms=60, max_queue_ms=2000):
+        self.rng = rng
+        self.jitter = jitter_ms / 1000
+        self.loss = loss
+        self.reorder = reorder
+        self.bandwidth_bps = bandwidth_kbps * 1000
+        self.ordered = ordered
+        self.rto = rto_ms / 1000
+        self.reorder_delay = frame_ms * 2 / 1000
+        self.max_queue = max_queue_ms / 1000
+        self.next_free = 0.0
+        self.last_delivery = 0.0
+        self.queue = None
+        self.pump_task = None
+        # 统计
+        self.submitted = 0
+        self.dropped = 0
+        self.retransmitted = 0
+        self.reordered = 0
+        self.bytes = 0
+
+    @property
+    def impaired(self):
+        return self.jitter > 0 or self.loss > 0 or self.reorder > 0 or self.bandwidth_bps > 0
+
+    def submit(self, size, deliver):
+        """deliver 在到达时间被调用，可以是协程函数。返回 False 表示被丢弃"""
+        self.submitted += 1
+        if not self.impaired:
+            self.bytes += size
+            self._run(deliver)
+            return True
+
+        loop = asyncio.get_running_loop()
+        now = loop.time()
+        start = now
+        if self.bandwidth_bps > 0:
+            start = max(now, self.next_free)
+            if start - now > self.max_queue:
+                # 瓶颈队列已满，尾部丢弃
+                self.dropped += 1
+                return False
+            self.next_free = start + size * 8 / self.bandwidth_bps
+        arrival = start
+        if self.jitter > 0:
+            arrival += self.rng.uniform(0, self.jitter)
+
+        lost = self.loss > 0 and self.rng.random() < self.loss
+        if self.ordered:
+            if lost:
+                self.retransmitted += 1
+                arrival += self.rto
+            arrival = max(arrival, self.last_delivery)
+            self.last_delivery = arrival
+        else:
+            if lost:
+                self.dropped += 1
+                return False
+            if self.reorder > 0 and self.rng.random() < self.reorder:
+                self.reordered += 1
+                arrival += self.reorder_delay
+
+        self.bytes += size
+        if self.ordered:
+            self._enqueue(arrival, deliver)
+        else:
+            loop.call_at(arrival, self._run, deliver)
+        return True
+
+    def account(self, size):
+        """直接处理的消息也计入统计"""
+        self.submitted += 1
+        self.bytes += size
+
+    def close(self):
+        if self.pump_task is not None:
+            self.pump_task.cancel()
+            self.pump_task = None
+
+    def stats(self):
+        return {
+            "messages": self.submitted,
+            "dropped": self.dropped,
+            "retransmitted": self.retransmitted,
+            "reordered": self.reordered,
+            "bytes": self.bytes,
+        }
+
+    def _run(self, deliver):
+        result = deliver()
+        if inspect.isawaitable(result):
+            return asyncio.ensure_future(result)
+        return None
+
+    # asyncio 的定时器在同一时刻不保证先后顺序，有序通道用一个任务按队列投递
+    def _enqueue(self, arrival, deliver):
+        if self.queue is None:
+            self.queue = asyncio.Queue()
+            self.pump_task = asyncio.ensure_future(self._pump())
+        self.queue.put_nowait((arrival, deliver))
+
+    async def _pump(self):
+        loop = asyncio.get_running_loop()
+        while True:
+            arrival, deliver = await self.queue.get()
+            delay = arrival - loop.time()
+            if delay > 0:
+                await asyncio.sleep(delay)
+            try:
+                result = deliver()
+                if inspect.isawaitable(result):
+                    await result
+            except Exception:
+                # 连接已关闭，丢弃剩余消息
+                pass
@@ -0,0 +1,796 @@
+#!/usr/bin/env python3
+# 本地小智测试服务器，用于在没有云端的情况下测试 WebsocketProtocol 和 MqttProtocol 的延迟与吞吐
+# 支持 WebSocket（协议版本 1/2/3/4）和 MQTT+UDP（AES-CTR，含多帧合并），
+# 可以注入抖动、丢包、乱序和带宽限制，每个会话结束时输出延迟报告。
+import argparse
+import asyncio
+import json
+import logging
+import os
+import random
+import socket
+import ssl
+import struct
+import time
+import uuid
+
+from cryptography.hazmat.primitives.ciphers import Cipher, algorithms, modes
+
+from mqtt_broker import MqttBroker
+from netem import NetEm
+
+logger = logging.getLogger("server")
+
+SAMPLE_RATE = 16000
+P3_FRAME_MS = 60
+
+UDP_TYPE_AUDIO = 0x01
+UDP_TYPE_PACKED_AUDIO = 0x02
+UDP_HEADER_SIZE = 16
+
+WS_V4_AUDIO = 0
+WS_V4_JSON = 1
+WS_V4_HAS_TIMESTAMP = 0x10
+WS_V4_HAS_SEQUENCE = 0x20
+
+
+def load_p3(path):
+    """读取 P3 文件，返回 Opus 帧列表。p3格式: [1字节类型, 1字节保留, 2字节长度, Opus数据]"""
+    frames = []
+    with open(path, "rb") as f:
+        while True:
+            header = f.read(4)
+            if len(header) < 4:
+                break
+            _, _, data_len = struct.unpack(">BBH", header)
+            data = f.read(data_len)
+            if len(data) < data_len:
+                break
+            frames.append(data)
+    return frames
+
+
+def now_ms():
+    return time.monotonic() * 1000
+
+
+def local_ip():
+    s = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+    try:
+        s.connect(("10.255.255.255", 1))
+        return s.getsockname()[0]
+    except OSError:
+        return "127.0.0.1"
+    finally:
+        s.close()
+
+
+def encode_varint(value):
+    encoded = bytearray()
+    while value >= 0x80:
+        encoded.append((value & 0x7f) | 0x80)
+        value >>= 7
+    encoded.append(value)
+    return bytes(encoded)
+
+
+def decode_varint(data, offset):
+    value = 0
+    shift = 0
+    while True:
+        if offset >= len(data) or shift > 28:
+            raise ValueError("truncated varint")
+        byte = data[offset]
+        offset += 1
+        value |= (byte & 0x7f) << shift
+        if byte & 0x80 == 0:
+            return value, offset
+        shift += 7
+
+
+def parse_v4_records(data):
+    """解析 v4 二进制帧，返回 (type, timestamp, sequence, payload) 列表"""
+    records = []
+    offset = 0
+    while offset < len(data):
+        header = data[offset]
+        offset += 1
+        timestamp = sequence = None
+        if header & WS_V4_HAS_TIMESTAMP:
+            timestamp, offset = decode_varint(data, offset)
+        if header & WS_V4_HAS_SEQUENCE:
+            sequence, offset = decode_varint(data, offset)
+        size, offset = decode_varint(data, offset)
+        if offset + size > len(data):
+            raise ValueError("truncated record")
+        records.append((header & 0x0f, timestamp, sequence, data[offset:offset + size]))
+        offset += size
+    return records
+
+
+def v4_audio_record(payload, timestamp, sequence):
+    header = WS_V4_AUDIO | WS_V4_HAS_SEQUENCE
+    if timestamp:
+        header |= WS_V4_HAS_TIMESTAMP
+    record = bytes([header])
+    if timestamp:
+        record += encode_varint(timestamp)
+    return record + encode_varint(sequence) + encode_varint(len(payload)) + payload
+
+
+def v4_json_record(text):
+    payload = text.encode("utf-8")
+    return bytes([WS_V4_JSON]) + encode_varint(len(payload)) + payload
+
+
+class UplinkTracker:
+    """按序号统计上行帧的接收、丢失、乱序和到达抖动"""
+
+    def __init__(self, frame_ms):
+        self.frame_ms = frame_ms
+        self.frames = 0
+        self.bytes = 0
+        self.base_sequence = None
+        self.highest_sequence = None
+        self.reordered = 0
+        self.duplicates = 0
+        self.seen = set()
+        self.last_arrival = None
+        self.last_sequence = None
+        self.jitter = 0.0
+        self.max_gap_ms = 0.0
+        self.reported_received = 0
+        self.reported_lost = 0
+
+    @property
+    def has_sequence(self):
+        return self.base_sequence is not None
+
+    @property
+    def lost(self):
+        if self.highest_sequence is None:
+            return 0
+        return max(0, self.highest_sequence - self.base_sequence + 1 - len(self.seen))
+
+    def add(self, size, sequence, arrival_ms):
+        self.frames += 1
+        self.bytes += size
+        if self.last_arrival is not None:
+            gap = arrival_ms - self.last_arrival
+            self.max_gap_ms = max(self.max_gap_ms, gap)
+            # RFC 3550 的到达间隔抖动，只比较相邻序号
+            if sequence is None or sequence == (self.last_sequence or 0) + 1:
+                self.jitter += (abs(gap - self.frame_ms) - self.jitter) / 16
+        self.last_arrival = arrival_ms
+        self.last_sequence = sequence
+        if sequence is None or sequence == 0:
+            return
+        if sequence in self.seen:
+            self.duplicates += 1
+            return
+        self.seen.add(sequence)
+        if self.base_sequence is None:
+            self.base_sequence = sequence
+            self.highest_sequence = sequence
+        elif sequence > self.highest_sequence:
+            self.highest_sequence = sequence
+        else:
+            self.reordered += 1
+
+    def take_report(self):
+        """返回上次报告以来的 (received, lost)"""
+        received = len(self.seen) - self.reported_received
+        lost = self.lost - self.reported_lost
+        self.reported_received = len(self.seen)
+        self.reported_lost = self.lost
+        return received, max(0, lost)
+
+    def summary(self):
+        return {
+            "frames": self.frames,
+            "bytes": self.bytes,
+            "lost": self.lost,
+            "reordered": self.reordered,
+            "duplicates": self.duplicates,
+            "jitter_ms": round(self.jitter, 1),
+            "max_gap_ms": round(self.max_gap_ms, 1),
+        }
+
+
+class Turn:
+    def __init__(self, mode, frame_ms, start_ms):
+        self.mode = mode
+        self.start_ms = start_ms
+        self.uplink = UplinkTracker(frame_ms)
+        self.first_uplink_ms = None
+        self.end_ms = None
+        self.end_reason = None
+        self.tts_start_ms = None
+        self.tts_stop_ms = None
+        self.tts_frames = 0
+        self.tts_dropped = 0
+        self.aborted = False
+
+    def summary(self):
+        def delta(a, b):
+            return None if a is None or b is None else round(a - b, 1)
+        return {
+            "mode": self.mode,
+            "listen_to_first_uplink_ms": delta(self.first_uplink_ms, self.start_ms),
+            "uplink": self.uplink.summary(),
+            "end_reason": self.end_reason,
+            "listen_duration_ms": delta(self.end_ms, self.start_ms),
+            "end_to_tts_start_ms": delta(self.tts_start_ms, self.end_ms),
+            "tts_frames": self.tts_frames,
+            "tts_dropped": self.tts_dropped,
+            "tts_send_ms": delta(self.tts_stop_ms, self.tts_start_ms),
+            "aborted": self.aborted,
+        }
+
+
+class Session:
+    """与传输无关的会话逻辑：hello、listen、abort、iot、latency，以及脚本化的 TTS 回复"""
+
+    def __init__(self, server, channel, transport):
+        self.server = server
+        self.args = server.args
+        self.channel = channel
+        self.transport = transport
+        self.id = uuid.uuid4().hex[:16]
+        self.open_ms = now_ms()
+        self.hello_ms = None
+        self.frame_ms = 60
+        self.turns = []
+        self.turn = None
+        self.idle_uplink = UplinkTracker(self.frame_ms)
+        self.wake_words = []
+        self.detect_ms = None
+        self.iot_descriptors = 0
+        self.iot_states = 0
+        self.device_reports = []
+        self.tts_task = None
+        self.report_task = None
+        self.tts_sequence = 0
+        self.closed = False
+
+    # 设备 → 服务器
+
+    async def on_json(self, message):
+        msg_type = message.get("type")
+        if msg_type == "hello":
+            await self.on_hello(message)
+        elif msg_type == "listen":
+            await self.on_listen(message)
+        elif msg_type == "abort":
+            logger.info("[%s] Abort: %s", self.id, message.get("reason"))
+            await self.stop_tts(aborted=True)
+        elif msg_type == "iot":
+            if "descriptors" in message:
+                self.iot_descriptors += 1
+            if "states" in message:
+                self.iot_states += 1
+        elif msg_type == "latency":
+            self.device_reports.append(message)
+            logger.info("[%s] Device latency report: %s", self.id,
+                        json.dumps(message.get("metrics", {}), ensure_ascii=False))
+        elif msg_type == "goodbye":
+            await self.close()
+        else:
+            logger.info("[%s] Unhandled message: %s", self.id, message)
+
+    async def on_hello(self, message):
+        self.hello_ms = now_ms()
+        audio_params = message.get("audio_params", {})
+        self.frame_ms = audio_params.get("frame_duration", 60)
+        self.idle_uplink.frame_ms = self.frame_ms
+        hello = {
+            "type": "hello",
+            "transport": self.transport,
+            "session_id": self.id,
+            "audio_params": {
+                "format": "opus",
+                "sample_rate": SAMPLE_RATE,
+                "channels": 1,
+                "frame_duration": P3_FRAME_MS,
+            },
+        }
+        self.channel.accept_hello(message, hello)
+        logger.info("[%s] Hello: %s", self.id, json.dumps(message, ensure_ascii=False))
+        await self.channel.send_json(hello, hello=True)
+        if self.report_task is None:
+            self.report_task = asyncio.ensure_future(self.uplink_report_loop())
+
+    async def on_listen(self, message):
+        state = message.get("state")
+        if state == "detect":
+            self.detect_ms = now_ms()
+            self.wake_words.append(message.get("text", ""))
+            logger.info("[%s] Wake word: %s", self.id, message.get("text"))
+        elif state == "start":
+            # 设备在说话时重新开始监听，相当于打断
+            await self.stop_tts(aborted=True)
+            self.turn = Turn(message.get("mode", "auto"), self.frame_ms, now_ms())
+            self.turns.append(self.turn)
+            logger.info("[%s] Listen start, mode: %s", self.id, self.turn.mode)
+        elif state == "stop":
+            if self.turn is not None and self.turn.end_ms is None:
+                self.end_turn("listen_stop")
+
+    def on_audio(self, payload, timestamp, sequence):
+        arrival = now_ms()
+        turn = self.turn
+        if turn is None or turn.end_ms is not None:
+            # 唤醒词音频或回复期间的音频
+            self.idle_uplink.add(len(payload), sequence, arrival)
+            return
+        if turn.first_uplink_ms is None:
+            turn.first_uplink_ms = arrival
+        turn.uplink.add(len(payload), sequence, arrival)
+        # 模拟服务器端 VAD：收到足够长的音频后认为用户说完了
+        if turn.mode != "manual" and turn.uplink.frames * self.frame_ms >= self.args.turn_ms:
+            self.end_turn("speech_end")
+
+    # 服务器 → 设备
+
+    def end_turn(self, reason):
+        turn = self.turn
+        turn.end_ms = now_ms()
+        turn.end_reason = reason
+        logger.info("[%s] Turn end (%s) after %d frames", self.id, reason, turn.uplink.frames)
+        self.tts_task = asyncio.ensure_future(self.reply(turn))
+
+    async def reply(self, turn):
+        await asyncio.sleep(self.args.think_ms / 1000)
+        index = len(self.turns) - 1
+        frames = self.server.tts_scripts[index % len(self.server.tts_scripts)]
+        await self.channel.send_json({"session_id": self.id, "type": "stt", "text": f"测试第 {index + 1} 轮"})
+        await self.channel.send_json({"session_id": self.id, "type": "llm", "emotion": "happy", "text": "😀"})
+        turn.tts_start_ms = now_ms()
+        await self.channel.send_json({"session_id": self.id, "type": "tts", "state": "start"})
+        await self.channel.send_json({"session_id": self.id, "type": "tts", "state": "sentence_start",
+                                      "text": f"这是第 {index + 1} 轮的测试回复"})
+        # 先突发发送若干帧，之后按实时速度发送
+        loop = asyncio.get_running_loop()
+        start = loop.time()
+        for i, frame in enumerate(frames):
+            if i >= self.args.tts_burst:
+                due = start + (i - self.args.tts_burst) * P3_FRAME_MS / 1000
+                delay = due - loop.time()
+                if delay > 0:
+                    await asyncio.sleep(delay)
+            self.tts_sequence += 1
+            if self.channel.send_audio(frame, i * P3_FRAME_MS + 1, self.tts_sequence):
+                turn.tts_frames += 1
+            else:
+                turn.tts_dropped += 1
+        turn.tts_stop_ms = now_ms()
+        await self.channel.send_json({"session_id": self.id, "type": "tts", "state": "stop"})
+        self.tts_task = None
+
+    async def stop_tts(self, aborted):
+        if self.tts_task is None:
+            return
+        self.tts_task.cancel()
+        self.tts_task = None
+        if self.turn is not None:
+            self.turn.aborted = aborted
+            self.turn.tts_stop_ms = now_ms()
+        await self.channel.send_json({"session_id": self.id, "type": "tts", "state": "stop"})
+
+    async def uplink_report_loop(self):
+        # 与云端一样每秒报告上行收包情况，设备据此调整码率
+        while True:
+            await asyncio.sleep(1)
+            turn = self.turn
+            if turn is None or turn.end_ms is not None or not turn.uplink.has_sequence:
+                continue
+            received, lost = turn.uplink.take_report()
+            if received or lost:
+                await self.channel.send_json({"session_id": self.id, "type": "uplink",
+                                              "received": received, "lost": lost})
+
+    async def close(self):
+        if self.closed:
+            return
+        self.closed = True
+        for task in (self.tts_task, self.report_task):
+            if task is not None:
+                task.cancel()
+        self.channel.close()
+        self.server.write_report(self.report())
+
+    def report(self):
+        return {
+            "session_id": self.id,
+            "transport": self.transport,
+            "framing": self.channel.describe(),
+            "duration_ms": round(now_ms() - self.open_ms, 1),
+            "connect_to_hello_ms": None if self.hello_ms is None else round(self.hello_ms - self.open_ms, 1),
+            "wake_words": self.wake_words,
+            "idle_uplink": self.idle_uplink.summary(),
+            "turns": [turn.summary() for turn in self.turns],
+            "iot": {"descriptors": self.iot_descriptors, "states": self.iot_states},
+            "network": self.channel.network_stats(),
+            "device_latency_reports": self.device_reports,
+        }
+
+
+class WebsocketChannel:
+    """WebSocket 传输，协议版本 1/2/3 由 Protocol-Version 请求头决定，hello 中请求 4 时可升级"""
+
+    def __init__(self, server, websocket, version):
+        self.server = server
+        self.websocket = websocket
+        self.version = version
+        self.binary_version = version
+        self.session = None
+        self.downlink = server.make_netem(ordered=True, direction="down")
+        self.uplink = server.make_netem(ordered=True, direction="up")
+
+    def describe(self):
+        return {"protocol_version": self.version, "binary_version": self.binary_version}
+
+    def network_stats(self):
+        return {"downlink": self.downlink.stats(), "uplink": self.uplink.stats()}
+
+    def accept_hello(self, client_hello, hello):
+        if client_hello.get("version") == 4 and not self.server.args.no_v4:
+            hello["version"] = 4
+        else:
+            hello["version"] = self.version
+
+    async def send_json(self, message, hello=False):
+        text = json.dumps(message, ensure_ascii=False)
+        if hello:
+            # 设备收到 hello 之后才切换到 v4
+            await self.websocket.send(text)
+            if message.get("version") == 4:
+                self.binary_version = 4
+            return
+        if self.binary_version == 4:
+            data = v4_json_record(text)
+        else:
+            data = text
+        self.downlink.submit(len(data), lambda: self.websocket.send(data))
+
+    def send_audio(self, payload, timestamp, sequence):
+        if self.binary_version == 4:
+            data = v4_audio_record(payload, timestamp, sequence)
+        elif self.binary_version == 3:
+            data = struct.pack(">BBH", 0, 0, len(payload)) + payload
+        elif self.binary_version == 2:
+            data = struct.pack(">HHIII", self.version, 0, 0, timestamp, len(payload)) + payload
+        else:
+            data = payload
+        return self.downlink.submit(len(data), lambda: self.websocket.send(data))
+
+    async def on_message(self, message):
+        if isinstance(message, str):
+            deliver = lambda: self.session.on_json(json.loads(message))
+        else:
+            deliver = lambda: self.on_binary(message)
+        if self.uplink.impaired:
+            self.uplink.submit(len(message), deliver)
+        else:
+            # 不经过队列，保持消息的处理顺序
+            self.uplink.account(len(message))
+            await deliver()
+
+    async def on_binary(self, data):
+        if self.binary_version == 4:
+            try:
+                records = parse_v4_records(data)
+            except ValueError as e:
+                logger.error("Malformed v4 message (%s), %d bytes", e, len(data))
+                return
+            for record_type, timestamp, sequence, payload in records:
+                if record_type == WS_V4_JSON:
+                    await self.session.on_json(json.loads(payload))
+                elif record_type == WS_V4_AUDIO:
+                    self.session.on_audio(payload, timestamp, sequence)
+        elif self.binary_version == 3:
+            _, _, size = struct.unpack_from(">BBH", data)
+            self.session.on_audio(data[4:4 + size], None, None)
+        elif self.binary_version == 2:
+            _, msg_type, _, timestamp, size = struct.unpack_from(">HHIII", data)
+            payload = data[16:16 + size]
+            if msg_type == 1:
+                await self.session.on_json(json.loads(payload))
+            else:
+                self.session.on_audio(payload, timestamp, None)
+        else:
+            self.session.on_audio(data, None, None)
+
+    def close(self):
+        self.downlink.close()
+        self.uplink.close()
+
+
+class UdpChannel:
+    """MQTT 传输控制消息，UDP 传输 AES-CTR 加密的音频"""
+
+    def __init__(self, server, client):
+        self.server = server
+        self.client = client
+        self.key = os.urandom(16)
+        self.ssrc = os.urandom(4)
+        self.nonce = bytes([UDP_TYPE_AUDIO, 0, 0, 0]) + self.ssrc + bytes(8)
+        self.address = None
+        self.udp_pack = False
+        self.packed_datagrams = 0
+        self.session = None
+        self.downlink = server.make_netem(ordered=False, direction="down")
+        self.uplink = server.make_netem(ordered=False, direction="up")
+        self.control_down = server.make_netem(ordered=True, direction="down")
+
+    def describe(self):
+        return {"udp_pack": self.udp_pack, "packed_datagrams": self.packed_datagrams}
+
+    def network_stats(self):
+        return {"downlink": self.downlink.stats(), "uplink": self.uplink.stats(),
+                "control": self.control_down.stats()}
+
+    def accept_hello(self, client_hello, hello):
+        self.udp_pack = bool(client_hello.get("features", {}).get("udp_pack")) and not self.server.args.no_udp_pack
+        if self.udp_pack:
+            hello["features"] = {"udp_pack": True}
+        hello["udp"] = {
+            "server": self.server.public_host,
+            "port": self.server.args.udp_port,
+            "key": self.key.hex(),
+            "nonce": self.nonce.hex(),
+        }
+        self.server.udp_sessions[self.ssrc] = self.session
+
+    async def send_json(self, message, hello=False):
+        text = json.dumps(message, ensure_ascii=False)
+        topic = f"devices/p2p/{self.client.client_id}"
+        self.control_down.submit(len(text), lambda: self.client.publish(topic, text))
+
+    def crypt(self, header, data):
+        cipher = Cipher(algorithms.AES(self.key), modes.CTR(header))
+        context = cipher.encryptor()
+        return context.update(data) + context.finalize()
+
+    def send_audio(self, payload, timestamp, sequence):
+        if self.address is None:
+            # 设备还没有发过 UDP 包，不知道它的地址
+            return False
+        header = bytearray(self.nonce)
+        struct.pack_into(">H", header, 2, len(payload))
+        struct.pack_into(">II", header, 8, timestamp, sequence)
+        datagram = bytes(header) + self.crypt(bytes(header), payload)
+        address = self.address
+        return self.downlink.submit(len(datagram), lambda: self.server.udp_transport.sendto(datagram, address))
+
+    def on_datagram(self, data, address):
+        self.address = address
+        self.uplink.submit(len(data), lambda: self.on_audio_datagram(data))
+
+    def on_audio_datagram(self, data):
+        header = data[:UDP_HEADER_SIZE]
+        packet_type, frames = header[0], header[1]
+        timestamp, sequence = struct.unpack_from(">II", header, 8)
+        payload = self.crypt(header, data[UDP_HEADER_SIZE:])
+        if packet_type == UDP_TYPE_AUDIO:
+            self.session.on_audio(payload, timestamp, sequence)
+        elif packet_type == UDP_TYPE_PACKED_AUDIO:
+            # |payload_len 2u|timestamp 4u|payload| per frame, consecutive sequence numbers.
+            # 头部的 timestamp 字段是合并包计数（让 AES-CTR 计数器不重叠），不是音频时间戳
+            self.packed_datagrams += 1
+            offset = 0
+            for i in range(frames):
+                if offset + 6 > len(payload):
+                    logger.error("Truncated packed datagram")
+                    break
+                size, frame_timestamp = struct.unpack_from(">HI", payload, offset)
+                offset += 6
+                self.session.on_audio(payload[offset:offset + size], frame_timestamp, sequence + i)
+                offset += size
+        else:
+            logger.error("Invalid audio packet type: %x", packet_type)
+
+    def close(self):
+        self.server.udp_sessions.pop(self.ssrc, None)
+        self.downlink.close()
+        self.uplink.close()
+        self.control_down.close()
+
+
+class UdpServerProtocol(asyncio.DatagramProtocol):
+    def __init__(self, server):
+        self.server = server
+
+    def datagram_received(self, data, address):
+        if len(data) < UDP_HEADER_SIZE:
+            return
+        session = self.server.udp_sessions.get(bytes(data[4:8]))
+        if session is None:
+            logger.warning("Datagram from unknown ssrc %s", data[4:8].hex())
+            return
+        session.channel.on_datagram(data, address)
+
+
+class TestServer:
+    def __init__(self, args):
+        self.args = args
+        self.public_host = args.public_host or local_ip()
+        self.rng = random.Random(args.seed)
+        self.udp_sessions = {}
+        self.mqtt_sessions = {}
+        self.udp_transport = None
+        self.report_file = open(args.report, "a", encoding="utf-8") if args.report else None
+        self.tts_scripts = [load_p3(path) for path in args.tts]
+        for path, frames in zip(args.tts, self.tts_scripts):
+            logger.info("TTS script %s: %d frames (%d ms)", path, len(frames), len(frames) * P3_FRAME_MS)
+
+    def make_netem(self, ordered, direction):
+        if direction == "down":
+            return NetEm(self.rng, self.args.jitter_ms, self.args.loss, self.args.reorder,
+                         self.args.bandwidth_kbps, ordered=ordered, rto_ms=self.args.rto_ms)
+        return NetEm(self.rng, self.args.up_jitter_ms, self.args.up_loss, self.args.up_reorder,
+                     self.args.up_bandwidth_kbps, ordered=ordered, rto_ms=self.args.rto_ms)
+
+    def write_report(self, report):
+        text = json.dumps(report, ensure_ascii=False)
+        logger.info("Session report: %s", json.dumps(report, ensure_ascii=False, indent=2))
+        if self.report_file is not None:
+            self.report_file.write(text + "\n")
+            self.report_file.flush()
+
+    # WebSocket
+
+    async def handle_websocket(self, websocket):
+        request = getattr(websocket, "request", None)
+        headers = request.headers if request is not None else websocket.request_headers
+        version = int(headers.get("Protocol-Version", "1"))
+        logger.info("Websocket connected: device %s, version %d", headers.get("Device-Id"), version)
+        channel = WebsocketChannel(self, websocket, version)
+        session = Session(self, channel, "websocket")
+        channel.session = session
+        try:
+            async for message in websocket:
+                await channel.on_message(message)
+        except Exception as e:
+            logger.info("Websocket closed: %s", e)
+        finally:
+            await session.close()
+
+    # MQTT + UDP
+
+    async def on_mqtt_message(self, client, topic, payload):
+        try:
+            message = json.loads(payload)
+        except ValueError:
+            logger.error("Invalid json from %s: %r", client.client_id, payload[:100])
+            return
+        session = self.mqtt_sessions.get(client)
+        if message.get("type") == "hello":
+            if session is not None:
+                await session.close()
+            channel = UdpChannel(self, client)
+            session = Session(self, channel, "udp")
+            channel.session = session
+            self.mqtt_sessions[client] = session
+        if session is None:
+            logger.warning("Message without session from %s: %s", client.client_id, message.get("type"))
+            return
+        await session.on_json(message)
+        if session.closed:
+            self.mqtt_sessions.pop(client, None)
+
+    async def on_mqtt_disconnect(self, client):
+        session = self.mqtt_sessions.pop(client, None)
+        if session is not None:
+            await session.close()
+
+    # OTA：下发连接参数，让设备连接到本服务器
+
+    async def handle_ota(self, reader, writer):
+        try:
+            request_line = (await reader.readline()).decode()
+            headers = {}
+            while True:
+                line = (await reader.readline()).decode().strip()
+                if not line:
+                    break
+                name, _, value = line.partition(":")
+                headers[name.strip().lower()] = value.strip()
+            length = int(headers.get("content-length", "0"))
+            if length:
+                await reader.readexactly(length)
+            user_agent = headers.get("user-agent", "")
+            response = {
+                "firmware": {"version": user_agent.partition("/")[2], "url": ""},
+                "server_time": {"timestamp": int(time.time() * 1000), "timezone_offset": 480},
+            }
+            if self.args.ota_transport == "mqtt":
+                response["mqtt"] = {
+                    "endpoint": f"{self.public_host}:{self.args.mqtt_port}",
+                    "client_id": headers.get("client-id", "test-client"),
+                    "username": "test",
+                    "password": "test",
+                    "publish_topic": "device-server",
+                }
+            else:
+                response["websocket"] = {
+                    "url": f"ws://{self.public_host}:{self.args.ws_port}/xiaozhi/v1/",
+                    "token": "test-token",
+                    "version": self.args.ws_version,
+                }
+            body = json.dumps(response).encode()
+            logger.info("OTA %s from %s", request_line.strip(), user_agent)
+            writer.write(b"HTTP/1.1 200 OK\r\nContent-Type: application/json\r\n"
+                         b"Content-Length: " + str(len(body)).encode() + b"\r\nConnection: close\r\n\r\n" + body)
+            await writer.drain()
+        finally:
+            writer.close()
+
+    async def run(self):
+        try:
+            from websockets.asyncio.server import serve
+        except ImportError:
+            from websockets import serve
+
+        loop = asyncio.get_running_loop()
+        broker = MqttBroker(on_message=self.on_mqtt_message, on_disconnect=self.on_mqtt_disconnect)
+        mqtt_ssl = None
+        if self.args.mqtt_certfile:
+            mqtt_ssl = ssl.create_default_context(ssl.Purpose.CLIENT_AUTH)
+            mqtt_ssl.load_cert_chain(self.args.mqtt_certfile, self.args.mqtt_keyfile)
+        mqtt_server = await asyncio.start_server(broker.handle, self.args.host, self.args.mqtt_port, ssl=mqtt_ssl)
+        self.udp_transport, _ = await loop.create_datagram_endpoint(
+            lambda: UdpServerProtocol(self), local_addr=(self.args.host, self.args.udp_port))
+        ota_server = await asyncio.start_server(self.handle_ota, self.args.host, self.args.ota_port)
+
+        logger.info("OTA:       http://%s:%d/xiaozhi/ota/ (%s)", self.public_host, self.args.ota_port, self.args.ota_transport)
+        logger.info("Websocket: ws://%s:%d/xiaozhi/v1/", self.public_host, self.args.ws_port)
+        logger.info("MQTT:      %s:%d, UDP port %d", self.public_host, self.args.mqtt_port, self.args.udp_port)
+        async with serve(self.handle_websocket, self.args.host, self.args.ws_port, max_size=None):
+            async with mqtt_server, ota_server:
+                await asyncio.Future()
+
+
+def main():
+    default_tts = os.path.join(os.path.dirname(os.path.abspath(__file__)), "..", "..", "main", "assets", "common", "success.p3")
+    parser = argparse.ArgumentParser(description="本地小智测试服务器（WebSocket 与 MQTT+UDP）")
+    parser.add_argument("--host", default="0.0.0.0", help="监听地址")
+    parser.add_argument("--public-host", help="下发给设备的服务器地址，默认自动检测本机局域网 IP")
+    parser.add_argument("--ws-port", type=int, default=8000)
+    parser.add_argument("--ws-version", type=int, default=1, choices=[1, 2, 3], help="OTA 下发的 WebSocket 协议版本")
+    parser.add_argument("--no-v4", action="store_true", help="不接受设备请求的 v4 二进制帧")
+    parser.add_argument("--mqtt-port", type=int, default=1883)
+    parser.add_argument("--mqtt-certfile", help="MQTT 使用 TLS 时的证书")
+    parser.add_argument("--mqtt-keyfile", help="MQTT 使用 TLS 时的私钥")
+    parser.add_argument("--udp-port", type=int, default=8884)
+    parser.add_argument("--no-udp-pack", action="store_true", help="不接受设备请求的 UDP 多帧合并")
+    parser.add_argument("--ota-port", type=int, default=8002)
+    parser.add_argument("--ota-transport", choices=["websocket", "mqtt"], default="websocket", help="OTA 下发的连接方式")
+    parser.add_argument("--tts", nargs="+", default=[default_tts], help="TTS 回复使用的 P3 文件，按轮次循环")
+    parser.add_argument("--tts-burst", type=int, default=5, help="TTS 开始时突发发送的帧数，之后按实时速度发送")
+    parser.add_argument("--turn-ms", type=int, default=3000, help="自动模式下收到多长的音频后认为用户说完")
+    parser.add_argument("--think-ms", type=int, default=300, help="用户说完到开始回复的模拟处理时间")
+    parser.add_argument("--jitter-ms", type=float, default=0, help="下行附加延迟的最大值，均匀分布")
+    parser.add_argument("--loss", type=float, default=0, help="下行丢包率（TCP 上表现为重传延迟）")
+    parser.add_argument("--reorder", type=float, default=0, help="下行乱序概率，仅 UDP")
+    parser.add_argument("--bandwidth-kbps", type=float, default=0, help="下行带宽限制，0 表示不限制")
+    parser.add_argument("--up-jitter-ms", type=float, default=0, help="上行附加延迟的最大值")
+    parser.add_argument("--up-loss", type=float, default=0, help="上行丢包率")
+    parser.add_argument("--up-reorder", type=float, default=0, help="上行乱序概率，仅 UDP")
+    parser.add_argument("--up-bandwidth-kbps", type=float, default=0, help="上行带宽限制")
+    parser.add_argument("--rto-ms", type=float, default=200, help="TCP 丢包后的重传延迟")
+    parser.add_argument("--seed", type=int, default=1, help="随机数种子，相同的种子得到相同的损伤序列")
+    parser.add_argument("--report", help="会话报告追加写入的文件（每行一个 JSON）")
+    parser.add_argument("-v", "--verbose", action="store_true")
+    args = parser.parse_args()
+
+    logging.basicConfig(level=logging.DEBUG if args.verbose else logging.INFO,
+                        format="%(asctime)s %(name)s %(levelname)s %(message)s")
+    try:
+        asyncio.run(TestServer(args).run())
+    except KeyboardInterrupt:
+        pass
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,147 @@
+// AudioPacketRing against the std::list decode queue it replaced in Application. The old
+// queue shared mutex_ with Schedule() and MainEventLoop(), so a third thread keeps taking
+// that mutex the way scheduled tasks do. The new queue keeps the producer mutex the two
+// producers share, the consumer pops without a lock. The Pop() tail is the number that
+// matters to the audio loop, the threaded throughput depends on the number of host cores.
+#include "audio_packet_ring.h"
+#include "bench_util.h"
+#include "test_util.h"
+
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <list>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+static const size_t kCapacity = 10;  // AUDIO_DECODE_QUEUE_CAPACITY at 60 ms frames
+static const size_t kPayloadSize = 120;
+
+// OnIncomingAudio and OnAudioOutput before the ring
+class ListQueue {
+public:
+    explicit ListQueue(std::mutex& mutex) : mutex_(mutex) {}
+
+    bool Push(AudioStreamPacket&& packet) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (queue_.size() >= kCapacity) {
+            return false;
+        }
+        queue_.emplace_back(std::move(packet));
+        return true;
+    }
+
+    bool Pop(AudioStreamPacket& packet) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (queue_.empty()) {
+            return false;
+        }
+        packet = std::move(queue_.front());
+        queue_.pop_front();
+        return true;
+    }
+
+private:
+    std::mutex& mutex_;
+    std::list<AudioStreamPacket> queue_;
+};
+
+class RingQueue {
+public:
+    explicit RingQueue(std::mutex& mutex) : ring_(kCapacity, 1024) {}
+
+    bool Push(AudioStreamPacket&& packet) {
+        std::lock_guard<std::mutex> lock(producer_mutex_);
+        return ring_.Push(packet);
+    }
+
+    bool Pop(AudioStreamPacket& packet) {
+        return ring_.Pop(packet);
+    }
+
+private:
+    std::mutex producer_mutex_;
+    AudioPacketRing ring_;
+};
+
+// A packet as the protocol hands it to OnIncomingAudio, payload freshly allocated
+static AudioStreamPacket MakePacket(const uint8_t* payload, uint32_t sequence) {
+    AudioStreamPacket packet;
+    packet.sequence = sequence;
+    packet.payload.assign(payload, payload + kPayloadSize);
+    return packet;
+}
+
+template <typename Queue>
+static void Run(const char* name, int packets) {
+    std::mutex mutex;
+    Queue queue(mutex);
+    uint8_t payload[kPayloadSize];
+    for (size_t i = 0; i < kPayloadSize; i++) {
+        payload[i] = (uint8_t)i;
+    }
+
+    // One thread, no contention: the cost of a push and a pop
+    AudioStreamPacket out;
+    double single_ns = MeasureNs(packets, [&](int i) {
+        CHECK(queue.Push(MakePacket(payload, i + 1)));
+        CHECK(queue.Pop(out));
+    });
+
+    // Network producer, audio consumer and a thread scheduling tasks under mutex
+    std::atomic<bool> done{false};
+    std::thread scheduler([&]() {
+        std::list<std::function<void()>> tasks;
+        while (!done.load(std::memory_order_relaxed)) {
+            std::lock_guard<std::mutex> lock(mutex);
+            tasks.emplace_back([]() {});
+            tasks.pop_front();
+        }
+    });
+    std::thread producer([&]() {
+        for (int i = 1; i <= packets; i++) {
+            auto packet = MakePacket(payload, i);
+            while (!queue.Push(std::move(packet))) {
+                std::this_thread::yield();
+            }
+        }
+    });
+
+    // Time spent in each Pop() that returned a packet
+    std::vector<int64_t> pop_ns;
+    pop_ns.reserve(packets);
+    auto start = std::chrono::steady_clock::now();
+    for (uint32_t expected = 1; expected <= (uint32_t)packets;) {
+        auto before = std::chrono::steady_clock::now();
+        bool popped = queue.Pop(out);
+        auto after = std::chrono::steady_clock::now();
+        if (!popped) {
+            std::this_thread::yield();
+            continue;
+        }
+        CHECK_EQ(out.sequence, expected);
+        CHECK_EQ(out.size(), kPayloadSize);
+        pop_ns.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(after - before).count());
+        expected++;
+    }
+    double total_ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+    producer.join();
+    done = true;
+    scheduler.join();
+
+    std::sort(pop_ns.begin(), pop_ns.end());
+    printf("%s\n", name);
+    PrintResult("  push + pop, one thread", single_ns, "packet");
+    PrintResult("  producer -> consumer, with scheduler", total_ns / packets, "packet");
+    PrintResult("  consumer Pop() p50", pop_ns[pop_ns.size() / 2], "pop");
+    PrintResult("  consumer Pop() p99", pop_ns[pop_ns.size() * 99 / 100], "pop");
+    PrintResult("  consumer Pop() max", pop_ns.back(), "pop");
+}
+
+int main(int argc, char** argv) {
+    int packets = BenchIterations(argc, argv, 5000);
+    Run<ListQueue>("std::list + shared mutex", packets);
+    Run<RingQueue>("AudioPacketRing", packets);
+    return 0;
+}
@@ -0,0 +1,145 @@
+// JsonMessageRouter against the strcmp chain it replaced in Application, replaying the
+// messages of a session recorded from scripts/test_server (data/test_server_session.jsonl).
+// Messages are parsed once up front, only the dispatch is measured. The handlers do the
+// same field reads on both sides.
+#include "json_message_router.h"
+#include "bench_util.h"
+#include "test_util.h"
+
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+
+static size_t sink = 0;
+
+static void Use(const char* value) {
+    if (value != nullptr) {
+        sink += strlen(value);
+    }
+}
+
+// The incoming JSON callback before the router, field lookups by name in each branch
+__attribute__((noipa)) static void OldDispatch(const cJSON* root) {
+    auto type = cJSON_GetObjectItem(root, "type");
+    if (strcmp(type->valuestring, "tts") == 0) {
+        auto state = cJSON_GetObjectItem(root, "state");
+        if (strcmp(state->valuestring, "start") == 0) {
+            sink += 1;
+        } else if (strcmp(state->valuestring, "stop") == 0) {
+            sink += 2;
+        } else if (strcmp(state->valuestring, "sentence_start") == 0) {
+            auto text = cJSON_GetObjectItem(root, "text");
+            if (text != NULL) {
+                Use(text->valuestring);
+            }
+        }
+    } else if (strcmp(type->valuestring, "stt") == 0) {
+        auto text = cJSON_GetObjectItem(root, "text");
+        if (text != NULL) {
+            Use(text->valuestring);
+        }
+    } else if (strcmp(type->valuestring, "llm") == 0) {
+        auto emotion = cJSON_GetObjectItem(root, "emotion");
+        if (emotion != NULL) {
+            Use(emotion->valuestring);
+        }
+    } else if (strcmp(type->valuestring, "iot") == 0) {
+        auto commands = cJSON_GetObjectItem(root, "commands");
+        if (commands != NULL) {
+            sink += cJSON_GetArraySize(commands);
+        }
+    } else if (strcmp(type->valuestring, "system") == 0) {
+        auto command = cJSON_GetObjectItem(root, "command");
+        if (command != NULL) {
+            Use(command->valuestring);
+        }
+    } else if (strcmp(type->valuestring, "alert") == 0) {
+        auto status = cJSON_GetObjectItem(root, "status");
+        auto message = cJSON_GetObjectItem(root, "message");
+        auto emotion = cJSON_GetObjectItem(root, "emotion");
+        if (status != NULL && message != NULL && emotion != NULL) {
+            Use(message->valuestring);
+        }
+    }
+}
+
+// The routes Application::RegisterJsonHandlers registers
+static void RegisterRoutes(JsonMessageRouter& router) {
+    router.On("tts", "start", [](const JsonMessage& message) { sink += 1; });
+    router.On("tts", "stop", [](const JsonMessage& message) { sink += 2; });
+    router.On("tts", "sentence_start", [](const JsonMessage& message) { Use(message.text); });
+    router.On("stt", [](const JsonMessage& message) { Use(message.text); });
+    router.On("llm", [](const JsonMessage& message) { Use(message.emotion); });
+    router.On("iot", [](const JsonMessage& message) {
+        if (message.commands != nullptr) {
+            sink += cJSON_GetArraySize(message.commands);
+        }
+    });
+    router.On("system", [](const JsonMessage& message) { Use(message.command); });
+    router.On("alert", [](const JsonMessage& message) {
+        if (message.status != nullptr && message.emotion != nullptr) {
+            Use(message.message);
+        }
+    });
+    router.On("uplink", [](const JsonMessage& message) {
+        auto received = cJSON_GetObjectItem(message.root, "received");
+        sink += cJSON_IsNumber(received) ? received->valueint : 0;
+    });
+}
+
+int main(int argc, char** argv) {
+    int iterations = BenchIterations(argc, argv, 2000);
+    std::ifstream file(HOST_TEST_DATA_DIR "/test_server_session.jsonl");
+    CHECK(file.is_open());
+    std::vector<std::string> lines;
+    std::vector<cJSON*> messages;
+    std::string line;
+    while (std::getline(file, line)) {
+        cJSON* root = cJSON_Parse(line.c_str());
+        CHECK(root != nullptr);
+        // The protocol handles the hello itself, it never reaches the application
+        if (strcmp(cJSON_GetObjectItem(root, "type")->valuestring, "hello") == 0) {
+            cJSON_Delete(root);
+            continue;
+        }
+        lines.push_back(line);
+        messages.push_back(root);
+    }
+    CHECK(!messages.empty());
+
+    JsonMessageRouter router;
+    RegisterRoutes(router);
+    for (auto root : messages) {
+        CHECK(router.Dispatch(root));
+    }
+
+    size_t count = messages.size();
+    double parse_ns = MeasureNs(iterations, [&](int i) {
+        for (auto& json : lines) {
+            cJSON* root = cJSON_Parse(json.c_str());
+            sink += root->child != nullptr;
+            cJSON_Delete(root);
+        }
+    });
+    double old_ns = MeasureNs(iterations, [&](int i) {
+        for (auto root : messages) {
+            OldDispatch(root);
+        }
+    });
+    double router_ns = MeasureNs(iterations, [&](int i) {
+        for (auto root : messages) {
+            router.Dispatch(root);
+        }
+    });
+
+    printf("%zu messages from the recorded session\n", count);
+    PrintResult("cJSON parse, for scale", parse_ns / count, "message");
+    PrintResult("strcmp chain", old_ns / count, "message");
+    PrintResult("JsonMessageRouter", router_ns / count, "message");
+
+    for (auto root : messages) {
+        cJSON_Delete(root);
+    }
+    return sink != 0 ? 0 : 1;
+}
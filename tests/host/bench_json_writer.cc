@@ -0,0 +1,152 @@
+// JsonWriter against the std::string concatenation it replaced in Protocol, per outgoing
+// control message. A counting operator new gives the heap allocations and the bytes they
+// request, the writer reuses one buffer across messages like Protocol::message_buffer_.
+#include "json_writer.h"
+#include "bench_util.h"
+#include "test_util.h"
+
+#include <cstdlib>
+#include <new>
+#include <string>
+
+static size_t allocations = 0;
+static size_t allocated_bytes = 0;
+
+void* operator new(size_t size) {
+    allocations++;
+    allocated_bytes += size;
+    void* p = malloc(size);
+    if (p == nullptr) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void operator delete(void* p) noexcept {
+    free(p);
+}
+
+void operator delete(void* p, size_t size) noexcept {
+    free(p);
+}
+
+static const std::string kSessionId = "dfa87585fcde483c";
+static const std::string kWakeWord = "你好小智";
+static const std::string kStates = "[{\"name\":\"Speaker\",\"state\":{\"volume\":70}},"
+    "{\"name\":\"Screen\",\"state\":{\"brightness\":80,\"theme\":\"light\"}},"
+    "{\"name\":\"Battery\",\"state\":{\"level\":95,\"charging\":false}}]";
+static size_t sink = 0;
+
+// The old bodies of SendStartListening, SendWakeWordDetected, SendAbortSpeaking and SendIotStates
+__attribute__((noipa)) static void OldListenStart(std::string& out) {
+    std::string message = "{\"session_id\":\"" + kSessionId + "\"";
+    message += ",\"type\":\"listen\",\"state\":\"start\"";
+    message += ",\"mode\":\"auto\"";
+    message += "}";
+    out.swap(message);
+}
+
+__attribute__((noipa)) static void OldWakeWord(std::string& out) {
+    std::string json = "{\"session_id\":\"" + kSessionId +
+        "\",\"type\":\"listen\",\"state\":\"detect\",\"text\":\"" + kWakeWord + "\"}";
+    out.swap(json);
+}
+
+__attribute__((noipa)) static void OldAbort(std::string& out) {
+    std::string message = "{\"session_id\":\"" + kSessionId + "\",\"type\":\"abort\"";
+    message += ",\"reason\":\"wake_word_detected\"";
+    message += "}";
+    out.swap(message);
+}
+
+__attribute__((noipa)) static void OldIotStates(std::string& out) {
+    std::string message = "{\"session_id\":\"" + kSessionId + "\",\"type\":\"iot\",\"update\":true,\"states\":" + kStates + "}";
+    out.swap(message);
+}
+
+static void NewListenStart(std::string& buffer) {
+    JsonWriter writer(buffer);
+    writer.BeginObject()
+        .Field("session_id", kSessionId)
+        .Field("type", "listen")
+        .Field("state", "start")
+        .Field("mode", "auto")
+        .EndObject();
+}
+
+static void NewWakeWord(std::string& buffer) {
+    JsonWriter writer(buffer);
+    writer.BeginObject()
+        .Field("session_id", kSessionId)
+        .Field("type", "listen")
+        .Field("state", "detect")
+        .Field("text", kWakeWord)
+        .EndObject();
+}
+
+static void NewAbort(std::string& buffer) {
+    JsonWriter writer(buffer);
+    writer.BeginObject().Field("session_id", kSessionId).Field("type", "abort");
+    writer.Field("reason", "wake_word_detected");
+    writer.EndObject();
+}
+
+static void NewIotStates(std::string& buffer) {
+    JsonWriter writer(buffer);
+    writer.BeginObject()
+        .Field("session_id", kSessionId)
+        .Field("type", "iot")
+        .Field("update", true)
+        .Key("states").Raw(kStates)
+        .EndObject();
+}
+
+// Per message: ns, heap allocations and bytes requested from the heap
+template <typename F>
+static void Measure(const char* name, int iterations, std::string& buffer, F&& build) {
+    size_t start_allocations = allocations;
+    size_t start_bytes = allocated_bytes;
+    double ns = MeasureNs(iterations, [&](int i) {
+        build(buffer);
+        sink += buffer.size();
+    });
+    // MeasureNs adds a tenth for warm-up
+    double runs = iterations + iterations / 10;
+    printf("%-44s %10.1f ns/message  %5.2f allocations  %7.1f bytes allocated\n", name, ns,
+        (allocations - start_allocations) / runs, (allocated_bytes - start_bytes) / runs);
+}
+
+int main(int argc, char** argv) {
+    int iterations = BenchIterations(argc, argv, 100000);
+
+    struct Message {
+        const char* name;
+        void (*old_build)(std::string&);
+        void (*new_build)(std::string&);
+    } messages[] = {
+        {"listen start", OldListenStart, NewListenStart},
+        {"listen detect", OldWakeWord, NewWakeWord},
+        {"abort", OldAbort, NewAbort},
+        {"iot states", OldIotStates, NewIotStates},
+    };
+
+    // Both sides must produce the same message
+    for (auto& message : messages) {
+        std::string old_message;
+        std::string new_message;
+        message.old_build(old_message);
+        message.new_build(new_message);
+        CHECK(old_message == new_message);
+    }
+
+    std::string buffer;
+    for (auto& message : messages) {
+        std::string name = std::string(message.name) + ", concatenation";
+        std::string old_message;
+        Measure(name.c_str(), iterations, old_message, message.old_build);
+        name = std::string(message.name) + ", JsonWriter";
+        Measure(name.c_str(), iterations, buffer, message.new_build);
+    }
+    printf("%zu bytes in the reused buffer\n", buffer.capacity());
+    return sink != 0 ? 0 : 1;
+}
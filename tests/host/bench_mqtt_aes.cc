@@ -0,0 +1,148 @@
+// AES-CTR cost of the MQTT+UDP audio datagrams. Builds each datagram the way SendAudio did
+// before, with a nonce copy and a ciphertext string per frame, and the way BuildAudioDatagram
+// does now, into a reused buffer. Also decrypts like the UDP receive callback and gives the
+// raw cipher throughput per payload size.
+//
+// The mbedtls shim in stubs/ runs on the OpenSSL block cipher, so these are host numbers for
+// the framing and buffer handling around the cipher. On the target the blocks go through the
+// AES peripheral (CONFIG_MBEDTLS_HARDWARE_AES).
+#include <arpa/inet.h>
+#include <mbedtls/aes.h>
+
+#include "bench_util.h"
+#include "test_util.h"
+
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+#include <string>
+#include <vector>
+
+static size_t allocations = 0;
+
+void* operator new(size_t size) {
+    allocations++;
+    void* p = malloc(size);
+    if (p == nullptr) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void operator delete(void* p) noexcept {
+    free(p);
+}
+
+void operator delete(void* p, size_t size) noexcept {
+    free(p);
+}
+
+static const size_t kFrameSize = 120;  // A 60 ms Opus frame at 16 kHz
+static mbedtls_aes_context aes_ctx;
+static std::string aes_nonce;
+static uint32_t local_sequence = 0;
+static size_t sink = 0;
+
+// SendAudio before the reused buffer
+__attribute__((noipa)) static std::string OldDatagram(const uint8_t* payload, size_t size, uint32_t timestamp) {
+    std::string nonce(aes_nonce);
+    *(uint16_t*)&nonce[2] = htons(size);
+    *(uint32_t*)&nonce[8] = htonl(timestamp);
+    *(uint32_t*)&nonce[12] = htonl(++local_sequence);
+
+    std::string encrypted;
+    encrypted.resize(aes_nonce.size() + size);
+    memcpy(encrypted.data(), nonce.data(), nonce.size());
+
+    size_t nc_off = 0;
+    uint8_t stream_block[16] = {0};
+    CHECK(mbedtls_aes_crypt_ctr(&aes_ctx, size, &nc_off, (uint8_t*)nonce.c_str(), stream_block,
+        payload, (uint8_t*)&encrypted[nonce.size()]) == 0);
+    return encrypted;
+}
+
+// MqttProtocol::BuildAudioDatagram
+__attribute__((noipa)) static void NewDatagram(const uint8_t* payload, size_t size, uint32_t timestamp, std::string& send_buffer) {
+    size_t header_size = aes_nonce.size();
+    send_buffer.resize(header_size + size);
+    auto datagram = (uint8_t*)send_buffer.data();
+    memcpy(datagram, aes_nonce.data(), header_size);
+    *(uint16_t*)&datagram[2] = htons(size);
+    *(uint32_t*)&datagram[8] = htonl(timestamp);
+    *(uint32_t*)&datagram[12] = htonl(++local_sequence);
+
+    uint8_t counter[16];
+    memcpy(counter, datagram, sizeof(counter));
+    size_t nc_off = 0;
+    uint8_t stream_block[16] = {0};
+    CHECK(mbedtls_aes_crypt_ctr(&aes_ctx, size, &nc_off, counter, stream_block,
+        payload, datagram + header_size) == 0);
+}
+
+// The UDP receive callback, into the reused decrypt_buffer_
+__attribute__((noipa)) static void Decrypt(const std::string& data, std::vector<uint8_t>& decrypt_buffer) {
+    size_t decrypted_size = data.size() - aes_nonce.size();
+    uint8_t counter[16];
+    memcpy(counter, data.data(), sizeof(counter));
+    size_t nc_off = 0;
+    uint8_t stream_block[16] = {0};
+    decrypt_buffer.resize(decrypted_size);
+    CHECK(mbedtls_aes_crypt_ctr(&aes_ctx, decrypted_size, &nc_off, counter, stream_block,
+        (const uint8_t*)data.data() + aes_nonce.size(), decrypt_buffer.data()) == 0);
+}
+
+template <typename F>
+static void Measure(const char* name, int iterations, size_t bytes, F&& body) {
+    size_t start_allocations = allocations;
+    double ns = MeasureNs(iterations, body);
+    double runs = iterations + iterations / 10;
+    printf("%-44s %10.1f ns/datagram  %7.1f MB/s  %4.2f allocations\n", name, ns,
+        bytes * 1e3 / ns, (allocations - start_allocations) / runs);
+}
+
+int main(int argc, char** argv) {
+    int iterations = BenchIterations(argc, argv, 20000);
+    const uint8_t key[16] = {0x2b, 0x7e, 0x15, 0x16, 0x28, 0xae, 0xd2, 0xa6, 0xab, 0xf7, 0x15, 0x88, 0x09, 0xcf, 0x4f, 0x3c};
+    mbedtls_aes_init(&aes_ctx);
+    CHECK(mbedtls_aes_setkey_enc(&aes_ctx, key, 128) == 0);
+    aes_nonce.assign("\x01\x00\x00\x00\x12\x34\x56\x78\x00\x00\x00\x00\x00\x00\x00\x00", 16);
+
+    std::vector<uint8_t> payload(1024);
+    for (size_t i = 0; i < payload.size(); i++) {
+        payload[i] = (uint8_t)(i * 31);
+    }
+
+    // Both builds produce the same datagram and it decrypts back to the payload
+    std::string send_buffer;
+    std::vector<uint8_t> decrypt_buffer;
+    local_sequence = 0;
+    std::string old_datagram = OldDatagram(payload.data(), kFrameSize, 960);
+    local_sequence = 0;
+    NewDatagram(payload.data(), kFrameSize, 960, send_buffer);
+    CHECK(old_datagram == send_buffer);
+    Decrypt(send_buffer, decrypt_buffer);
+    CHECK(decrypt_buffer == std::vector<uint8_t>(payload.begin(), payload.begin() + kFrameSize));
+
+    Measure("send, nonce and ciphertext strings", iterations, kFrameSize, [&](int i) {
+        sink += OldDatagram(payload.data(), kFrameSize, i).size();
+    });
+    Measure("send, reused buffer", iterations, kFrameSize, [&](int i) {
+        NewDatagram(payload.data(), kFrameSize, i, send_buffer);
+        sink += send_buffer.size();
+    });
+    Measure("receive, reused buffer", iterations, kFrameSize, [&](int i) {
+        Decrypt(send_buffer, decrypt_buffer);
+        sink += decrypt_buffer[i % kFrameSize];
+    });
+
+    // Packed datagrams carry several frames, larger payloads amortise the framing
+    for (size_t size : {40, 120, 480, 1024}) {
+        char name[64];
+        snprintf(name, sizeof(name), "send, reused buffer, %zu byte payload", size);
+        Measure(name, iterations, size, [&](int i) {
+            NewDatagram(payload.data(), size, i, send_buffer);
+            sink += send_buffer.size();
+        });
+    }
+    return sink != 0 ? 0 : 1;
+}
@@ -0,0 +1,131 @@
+// pcm_kernels against the scalar loops they replaced in NoAudioCodec and ReadAudio,
+// per DMA buffer of AUDIO_CODEC_DMA_FRAME_NUM samples
+#include "pcm_kernels.h"
+#include "bench_util.h"
+#include "test_util.h"
+
+#include <climits>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+static const int kSamples = 240;
+static int64_t sink = 0;
+
+// The old loops are kept out of line like the library kernels, so neither side is specialised
+// for the constant arguments of the benchmark
+#define OLD_LOOP __attribute__((noipa))
+
+// NoAudioCodec::Write before pcm_kernels, a pow() and a buffer per call
+OLD_LOOP static void OldScale(const int16_t* data, int samples, int output_volume, std::vector<int32_t>& out) {
+    std::vector<int32_t> buffer(samples);
+    int32_t volume_factor = pow(double(output_volume) / 100.0, 2) * 65536;
+    for (int i = 0; i < samples; i++) {
+        int64_t temp = int64_t(data[i]) * volume_factor;
+        if (temp > INT32_MAX) {
+            buffer[i] = INT32_MAX;
+        } else if (temp < INT32_MIN) {
+            buffer[i] = INT32_MIN;
+        } else {
+            buffer[i] = static_cast<int32_t>(temp);
+        }
+    }
+    out.swap(buffer);
+}
+
+// NoAudioCodec::Read
+OLD_LOOP static void OldNarrow(const int32_t* bit32_buffer, int16_t* dest, int samples) {
+    for (int i = 0; i < samples; i++) {
+        int32_t value = bit32_buffer[i] >> 12;
+        dest[i] = (value > INT16_MAX) ? INT16_MAX : (value < -INT16_MAX) ? -INT16_MAX : (int16_t)value;
+    }
+}
+
+// ReadAudio
+OLD_LOOP static void OldDeinterleave(const int16_t* raw, int16_t* mic, int16_t* reference, int channel_samples) {
+    for (int i = 0, j = 0; i < channel_samples; ++i, j += 2) {
+        mic[i] = raw[j];
+        reference[i] = raw[j + 1];
+    }
+}
+
+OLD_LOOP static void OldInterleave(const int16_t* resampled_mic, const int16_t* resampled_reference, int16_t* data, int resampled_samples) {
+    for (int i = 0, j = 0; i < resampled_samples; ++i, j += 2) {
+        data[j] = resampled_mic[i];
+        data[j + 1] = resampled_reference[i];
+    }
+}
+
+static void Compare(const char* name, double old_ns, double new_ns) {
+    printf("%-24s %8.2f -> %6.2f ns/sample  (%.1fx)\n", name, old_ns / kSamples, new_ns / kSamples, old_ns / new_ns);
+}
+
+int main(int argc, char** argv) {
+    int iterations = BenchIterations(argc, argv, 20000);
+    std::vector<int16_t> pcm(kSamples * 2);
+    std::vector<int32_t> wide(kSamples);
+    for (int i = 0; i < kSamples * 2; i++) {
+        pcm[i] = (int16_t)((i * 7919) % 65536 - 32768);
+    }
+    for (int i = 0; i < kSamples; i++) {
+        wide[i] = (int32_t)((uint32_t)i * 2654435761u);
+    }
+
+    // The results must match before the speed is worth comparing
+    std::vector<int32_t> old_wide;
+    std::vector<int32_t> new_wide(kSamples);
+    std::vector<int16_t> old_pcm(kSamples * 2);
+    std::vector<int16_t> new_pcm(kSamples * 2);
+    OldScale(pcm.data(), kSamples, 70, old_wide);
+    PcmScaleToInt32(pcm.data(), new_wide.data(), kSamples, PcmVolumeFactor(70));
+    CHECK(old_wide == new_wide);
+    OldNarrow(wide.data(), old_pcm.data(), kSamples);
+    PcmNarrowToInt16(wide.data(), new_pcm.data(), kSamples, 12);
+    CHECK(old_pcm == new_pcm);
+
+    std::vector<int16_t> left(kSamples);
+    std::vector<int16_t> right(kSamples);
+    int32_t factor = PcmVolumeFactor(70);
+
+    double old_ns = MeasureNs(iterations, [&](int i) {
+        OldScale(pcm.data(), kSamples, 70, old_wide);
+        sink += old_wide[i % kSamples];
+    });
+    double new_ns = MeasureNs(iterations, [&](int i) {
+        PcmScaleToInt32(pcm.data(), new_wide.data(), kSamples, factor);
+        sink += new_wide[i % kSamples];
+    });
+    Compare("volume scale", old_ns, new_ns);
+
+    old_ns = MeasureNs(iterations, [&](int i) {
+        OldNarrow(wide.data(), old_pcm.data(), kSamples);
+        sink += old_pcm[i % kSamples];
+    });
+    new_ns = MeasureNs(iterations, [&](int i) {
+        PcmNarrowToInt16(wide.data(), new_pcm.data(), kSamples, 12);
+        sink += new_pcm[i % kSamples];
+    });
+    Compare("32 -> 16 bit narrow", old_ns, new_ns);
+
+    old_ns = MeasureNs(iterations, [&](int i) {
+        OldDeinterleave(pcm.data(), left.data(), right.data(), kSamples);
+        sink += left[i % kSamples];
+    });
+    new_ns = MeasureNs(iterations, [&](int i) {
+        PcmDeinterleave(pcm.data(), left.data(), right.data(), kSamples);
+        sink += left[i % kSamples];
+    });
+    Compare("deinterleave", old_ns, new_ns);
+
+    old_ns = MeasureNs(iterations, [&](int i) {
+        OldInterleave(left.data(), right.data(), old_pcm.data(), kSamples);
+        sink += old_pcm[i % kSamples];
+    });
+    new_ns = MeasureNs(iterations, [&](int i) {
+        PcmInterleave(left.data(), right.data(), new_pcm.data(), kSamples);
+        sink += new_pcm[i % kSamples];
+    });
+    Compare("interleave", old_ns, new_ns);
+
+    return sink != 0 ? 0 : 1;
+}
@@ -0,0 +1,150 @@
+// Per-frame cost of the protocol send and receive paths, over in-memory transports.
+// The numbers cover framing, encryption and copies, not the network stack.
+#include "mqtt_protocol.h"
+#include "websocket_protocol.h"
+#include "bench_util.h"
+#include "mock_transports.h"
+#include "test_util.h"
+
+#include <board.h>
+#include <settings.h>
+#include <arpa/inet.h>
+#include <cstring>
+
+// 60 ms of Opus at 16 kbps
+static const size_t kFrameSize = 120;
+static size_t sink = 0;
+
+static MockWebSocket* OpenWebsocket(WebsocketProtocol& protocol, int server_version) {
+    Settings settings("websocket", true);
+    settings.SetString("url", "wss://example.com/xiaozhi/v1/");
+    settings.SetInt("version", 3);
+    MockWebSocket* websocket = nullptr;
+    Board::GetInstance().SetWebSocketFactory([&]() {
+        websocket = new MockWebSocket();
+        websocket->server = [server_version](MockWebSocket& websocket, const MockWebSocket::Frame& frame) {
+            websocket.Receive("{\"type\":\"hello\",\"transport\":\"websocket\",\"version\":" +
+                std::to_string(server_version) + "}", false);
+        };
+        return websocket;
+    });
+    protocol.OnIncomingAudio([](AudioStreamPacket&& packet) { sink += packet.size(); });
+    CHECK(protocol.OpenAudioChannel());
+    websocket->keep_sent = false;
+    return websocket;
+}
+
+static MockUdp* OpenMqtt(MqttProtocol& protocol, bool udp_pack) {
+    Settings settings("mqtt", true);
+    settings.SetString("endpoint", "mqtt.example.com");
+    settings.SetString("publish_topic", "device-server");
+    MockUdp* udp = nullptr;
+    Board::GetInstance().SetMqttFactory([udp_pack]() {
+        auto mqtt = new MockMqtt();
+        mqtt->server = [udp_pack](MockMqtt& mqtt, const std::string& payload) {
+            mqtt.Receive(std::string("{\"type\":\"hello\",\"transport\":\"udp\",\"features\":{\"udp_pack\":") +
+                (udp_pack ? "true" : "false") + "},\"udp\":{\"server\":\"192.0.2.1\",\"port\":8888," +
+                "\"key\":\"00112233445566778899AABBCCDDEEFF\",\"nonce\":\"01000000DEADBEEF0000000000000000\"}}");
+        };
+        return mqtt;
+    });
+    Board::GetInstance().SetUdpFactory([&]() {
+        udp = new MockUdp();
+        udp->keep_sent = false;
+        return udp;
+    });
+    protocol.OnIncomingAudio([](AudioStreamPacket&& packet) { sink += packet.size(); });
+    CHECK(protocol.Start());
+    CHECK(protocol.OpenAudioChannel());
+    return udp;
+}
+
+static AudioStreamPacket Packet() {
+    AudioStreamPacket packet;
+    packet.payload.assign(kFrameSize, 0x5a);
+    return packet;
+}
+
+static void BenchWebsocket(int iterations) {
+    auto packet = Packet();
+    {
+        WebsocketProtocol protocol;
+        auto websocket = OpenWebsocket(protocol, 3);
+        PrintResult("websocket v3 send", MeasureNs(iterations, [&](int i) {
+            packet.timestamp = i;
+            protocol.SendAudio(packet);
+        }));
+
+        std::string message(sizeof(BinaryProtocol3) + kFrameSize, 0x5a);
+        auto bp3 = (BinaryProtocol3*)message.data();
+        bp3->type = 0;
+        PrintResult("websocket v3 receive", MeasureNs(iterations, [&](int i) {
+            // The receiver rewrites the header in place, as in the websocket buffer
+            bp3->payload_size = htons(kFrameSize);
+            websocket->Receive(message, true);
+        }));
+    }
+    {
+        WebsocketProtocol protocol;
+        auto websocket = OpenWebsocket(protocol, 4);
+        PrintResult("websocket v4 send", MeasureNs(iterations, [&](int i) {
+            packet.timestamp = i * 60;
+            protocol.SendAudio(packet);
+        }));
+        PrintResult("websocket v4 send, batches of 10", MeasureNs(iterations, [&](int i) {
+            if (i % 10 == 0) {
+                protocol.BeginBatch();
+            }
+            packet.timestamp = i * 60;
+            protocol.SendAudio(packet);
+            if (i % 10 == 9) {
+                protocol.EndBatch();
+            }
+        }));
+
+        std::string message;
+        BinaryProtocol4Writer writer(message);
+        writer.AddAudio(packet.data(), packet.size(), 60000, 1000);
+        PrintResult("websocket v4 receive", MeasureNs(iterations, [&](int i) {
+            websocket->Receive(message, true);
+        }));
+    }
+}
+
+static void BenchMqtt(int iterations) {
+    auto packet = Packet();
+    {
+        MqttProtocol protocol;
+        auto udp = OpenMqtt(protocol, false);
+        size_t bytes = udp->bytes_sent;
+        PrintResult("mqtt+udp send, AES-CTR", MeasureNs(iterations, [&](int i) {
+            packet.timestamp = i * 60;
+            protocol.SendAudio(packet);
+        }));
+        printf("%-44s %10.1f bytes/frame\n", "  on the wire", (double)(udp->bytes_sent - bytes) / (iterations + iterations / 10));
+
+        std::string datagram(16 + kFrameSize, 0x5a);
+        datagram[0] = MQTT_UDP_TYPE_AUDIO;
+        PrintResult("mqtt+udp receive, AES-CTR", MeasureNs(iterations, [&](int i) {
+            *(uint32_t*)&datagram[12] = htonl(i + 1);
+            udp->Receive(datagram);
+        }));
+    }
+    {
+        MqttProtocol protocol;
+        auto udp = OpenMqtt(protocol, true);
+        size_t bytes = udp->bytes_sent;
+        PrintResult("mqtt+udp send, packed", MeasureNs(iterations, [&](int i) {
+            packet.timestamp = i * 60;
+            protocol.SendAudio(packet);
+        }));
+        printf("%-44s %10.1f bytes/frame\n", "  on the wire", (double)(udp->bytes_sent - bytes) / (iterations + iterations / 10));
+    }
+}
+
+int main(int argc, char** argv) {
+    int iterations = BenchIterations(argc, argv, 20000);
+    BenchWebsocket(iterations);
+    BenchMqtt(iterations);
+    return sink != 0 ? 0 : 1;
+}
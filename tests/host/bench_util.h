@@ -0,0 +1,31 @@
+#ifndef _BENCH_UTIL_H
+#define _BENCH_UTIL_H
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+
+// Benchmarks run a short pass under ctest, pass an iteration count for stable numbers
+static inline int BenchIterations(int argc, char** argv, int default_iterations) {
+    return argc > 1 ? atoi(argv[1]) : default_iterations;
+}
+
+// Runs body iterations times after a tenth as many warm-up runs, returns ns per iteration
+template <typename F>
+static double MeasureNs(int iterations, F&& body) {
+    for (int i = 0; i < iterations / 10; i++) {
+        body(i);
+    }
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; i++) {
+        body(i);
+    }
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    return std::chrono::duration<double, std::nano>(elapsed).count() / iterations;
+}
+
+static inline void PrintResult(const char* name, double ns, const char* unit = "frame") {
+    printf("%-44s %10.1f ns/%s\n", name, ns, unit);
+}
+
+#endif // _BENCH_UTIL_H
@@ -0,0 +1,51 @@
+# Records the JSON messages a scripts/test_server session sends to the device, one per line.
+# The session runs over WebSocket v1 with the given number of auto-mode turns.
+#
+#   python scripts/test_server/test_server.py --host 127.0.0.1 --public-host 127.0.0.1 \
+#       --turn-ms 1800 --think-ms 200
+#   python tests/host/data/record_session.py 8000 tests/host/data/test_server_session.jsonl 3
+import asyncio
+import json
+import sys
+
+import websockets
+
+
+async def main(port, out_path, turns):
+    messages = []
+    headers = {"Protocol-Version": "1", "Device-Id": "02:00:00:00:00:01",
+               "Client-Id": "00000000-0000-4000-8000-000000000000"}
+    async with websockets.connect(f"ws://127.0.0.1:{port}/xiaozhi/v1/", additional_headers=headers) as ws:
+        await ws.send(json.dumps({"type": "hello", "version": 1, "transport": "websocket",
+                                  "audio_params": {"format": "opus", "sample_rate": 16000, "channels": 1,
+                                                   "frame_duration": 60}}))
+
+        async def reader(done):
+            async for frame in ws:
+                if isinstance(frame, str):
+                    messages.append(frame)
+                    message = json.loads(frame)
+                    if message.get("type") == "tts" and message.get("state") == "stop":
+                        done.set()
+
+        for _ in range(turns):
+            done = asyncio.Event()
+            task = asyncio.ensure_future(reader(done))
+            await ws.send(json.dumps({"session_id": "", "type": "listen", "state": "start", "mode": "auto"}))
+            # Stand-in uplink audio at the real-time pace, until the reply ends
+            while not done.is_set():
+                await ws.send(bytes(40))
+                try:
+                    await asyncio.wait_for(done.wait(), 0.06)
+                except asyncio.TimeoutError:
+                    pass
+            task.cancel()
+
+    with open(out_path, "w") as f:
+        for message in messages:
+            f.write(message + "\n")
+    print(len(messages), "messages")
+
+
+if __name__ == "__main__":
+    asyncio.run(main(int(sys.argv[1]), sys.argv[2], int(sys.argv[3])))
@@ -0,0 +1,144 @@
+#ifndef _MOCK_TRANSPORTS_H
+#define _MOCK_TRANSPORTS_H
+
+// In-memory transports for the protocol tests. Every message the device sends is recorded
+// and passed to an optional server callback, which can answer through Receive().
+#include <mqtt.h>
+#include <udp.h>
+#include <web_socket.h>
+
+#include <functional>
+#include <map>
+#include <string>
+#include <vector>
+
+class MockWebSocket : public WebSocket {
+public:
+    struct Frame {
+        std::string data;
+        bool binary;
+    };
+
+    std::map<std::string, std::string> headers;
+    std::vector<Frame> sent;
+    // Benchmarks only count what is sent
+    bool keep_sent = true;
+    size_t bytes_sent = 0;
+    std::string uri;
+    bool connected = false;
+    int pings = 0;
+    // Called after each frame the device sends
+    std::function<void(MockWebSocket& websocket, const Frame& frame)> server;
+    // Cleared by the destructor, so a test can tell that the protocol released the socket
+    bool* alive = nullptr;
+
+    ~MockWebSocket() {
+        if (alive != nullptr) {
+            *alive = false;
+        }
+    }
+
+    void SetHeader(const char* key, const char* value) override { headers[key] = value; }
+    bool Connect(const char* uri) override {
+        this->uri = uri;
+        connected = true;
+        return true;
+    }
+    bool Send(const std::string& data) override { return Record({data, false}); }
+    bool Send(const void* data, size_t len, bool binary = false, bool fin = true) override {
+        return Record({std::string((const char*)data, len), binary});
+    }
+    void Ping() override { pings++; }
+    void Close() override { connected = false; }
+    bool IsConnected() const override { return connected; }
+
+    // The receiver may rewrite the buffer in place, as it does with the websocket buffer
+    void Receive(std::string data, bool binary) { on_data_(data.data(), data.size(), binary); }
+    void Disconnect() {
+        connected = false;
+        if (on_disconnected_) {
+            on_disconnected_();
+        }
+    }
+
+private:
+    bool Record(const Frame& frame) {
+        if (!connected) {
+            return false;
+        }
+        bytes_sent += frame.data.size();
+        if (!keep_sent) {
+            return true;
+        }
+        sent.push_back(frame);
+        if (server) {
+            server(*this, sent.back());
+        }
+        return true;
+    }
+};
+
+class MockMqtt : public Mqtt {
+public:
+    std::string broker_address;
+    int broker_port = 0;
+    bool connected = false;
+    std::vector<std::pair<std::string, std::string>> published;
+    // Called after each message the device publishes
+    std::function<void(MockMqtt& mqtt, const std::string& payload)> server;
+
+    bool Connect(const std::string broker_address, int broker_port, const std::string client_id,
+            const std::string username, const std::string password) override {
+        this->broker_address = broker_address;
+        this->broker_port = broker_port;
+        connected = true;
+        return true;
+    }
+    void Disconnect() override { connected = false; }
+    bool Publish(const std::string topic, const std::string payload, int qos = 0) override {
+        published.emplace_back(topic, payload);
+        if (server) {
+            server(*this, payload);
+        }
+        return true;
+    }
+    bool Subscribe(const std::string topic, int qos = 0) override { return true; }
+    bool Unsubscribe(const std::string topic) override { return true; }
+    bool IsConnected() override { return connected; }
+
+    void Receive(const std::string& payload) { on_message_callback_("devices/test", payload); }
+};
+
+class MockUdp : public Udp {
+public:
+    std::string host;
+    int port = 0;
+    std::vector<std::string> sent;
+    bool keep_sent = true;
+    size_t bytes_sent = 0;
+    bool* alive = nullptr;
+
+    ~MockUdp() {
+        if (alive != nullptr) {
+            *alive = false;
+        }
+    }
+
+    bool Connect(const std::string& host, int port) override {
+        this->host = host;
+        this->port = port;
+        return true;
+    }
+    void Disconnect() override {}
+    int Send(const std::string& data) override {
+        bytes_sent += data.size();
+        if (keep_sent) {
+            sent.push_back(data);
+        }
+        return data.size();
+    }
+
+    void Receive(const std::string& data) { message_callback_(data); }
+};
+
+#endif // _MOCK_TRANSPORTS_H
@@ -0,0 +1,38 @@
+#ifndef _HOST_APPLICATION_H
+#define _HOST_APPLICATION_H
+
+// Host shim, scheduled callbacks wait until the test runs the main loop once
+#include <functional>
+#include <mutex>
+#include <vector>
+
+class Application {
+public:
+    static Application& GetInstance() {
+        static Application instance;
+        return instance;
+    }
+
+    template <typename F>
+    void Schedule(F&& callback) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        tasks_.emplace_back(std::forward<F>(callback));
+    }
+
+    void RunScheduled() {
+        std::vector<std::function<void()>> tasks;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            tasks.swap(tasks_);
+        }
+        for (auto& task : tasks) {
+            task();
+        }
+    }
+
+private:
+    std::mutex mutex_;
+    std::vector<std::function<void()>> tasks_;
+};
+
+#endif // _HOST_APPLICATION_H
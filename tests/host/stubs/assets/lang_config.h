@@ -0,0 +1,16 @@
+#ifndef _HOST_LANG_CONFIG_H
+#define _HOST_LANG_CONFIG_H
+
+// Host shim of the generated header, only the strings the protocols report
+namespace Lang {
+    constexpr const char* CODE = "en-US";
+
+    namespace Strings {
+        constexpr const char* SERVER_NOT_FOUND = "SERVER_NOT_FOUND";
+        constexpr const char* SERVER_NOT_CONNECTED = "SERVER_NOT_CONNECTED";
+        constexpr const char* SERVER_TIMEOUT = "SERVER_TIMEOUT";
+        constexpr const char* SERVER_ERROR = "SERVER_ERROR";
+    }
+}
+
+#endif // _HOST_LANG_CONFIG_H
@@ -0,0 +1,34 @@
+#ifndef _HOST_BOARD_H
+#define _HOST_BOARD_H
+
+// Host shim, the tests install factories that return their mock transports
+#include <mqtt.h>
+#include <udp.h>
+#include <web_socket.h>
+
+#include <functional>
+#include <string>
+
+class Board {
+public:
+    static Board& GetInstance() {
+        static Board instance;
+        return instance;
+    }
+
+    void SetWebSocketFactory(std::function<WebSocket*()> factory) { websocket_factory_ = std::move(factory); }
+    void SetMqttFactory(std::function<Mqtt*()> factory) { mqtt_factory_ = std::move(factory); }
+    void SetUdpFactory(std::function<Udp*()> factory) { udp_factory_ = std::move(factory); }
+
+    WebSocket* CreateWebSocket() { return websocket_factory_(); }
+    Mqtt* CreateMqtt() { return mqtt_factory_(); }
+    Udp* CreateUdp() { return udp_factory_(); }
+    std::string GetUuid() { return "00000000-0000-4000-8000-000000000000"; }
+
+private:
+    std::function<WebSocket*()> websocket_factory_;
+    std::function<Mqtt*()> mqtt_factory_;
+    std::function<Udp*()> udp_factory_;
+};
+
+#endif // _HOST_BOARD_H
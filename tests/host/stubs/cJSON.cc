@@ -0,0 +1,341 @@
+#include "cJSON.h"
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <strings.h>
+
+namespace {
+
+struct Parser {
+    const char* p;
+    const char* end;
+
+    void SkipWhitespace() {
+        while (p < end && (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r')) {
+            p++;
+        }
+    }
+
+    bool Literal(const char* word) {
+        size_t len = strlen(word);
+        if ((size_t)(end - p) < len || strncmp(p, word, len) != 0) {
+            return false;
+        }
+        p += len;
+        return true;
+    }
+
+    static void AppendUtf8(std::string& out, unsigned code) {
+        if (code < 0x80) {
+            out += (char)code;
+        } else if (code < 0x800) {
+            out += (char)(0xC0 | (code >> 6));
+            out += (char)(0x80 | (code & 0x3F));
+        } else if (code < 0x10000) {
+            out += (char)(0xE0 | (code >> 12));
+            out += (char)(0x80 | ((code >> 6) & 0x3F));
+            out += (char)(0x80 | (code & 0x3F));
+        } else {
+            out += (char)(0xF0 | (code >> 18));
+            out += (char)(0x80 | ((code >> 12) & 0x3F));
+            out += (char)(0x80 | ((code >> 6) & 0x3F));
+            out += (char)(0x80 | (code & 0x3F));
+        }
+    }
+
+    bool Hex4(unsigned& code) {
+        if (end - p < 4) {
+            return false;
+        }
+        char digits[5] = {p[0], p[1], p[2], p[3], 0};
+        char* digits_end;
+        code = strtoul(digits, &digits_end, 16);
+        p += 4;
+        return digits_end == digits + 4;
+    }
+
+    char* String() {
+        if (p >= end || *p != '"') {
+            return nullptr;
+        }
+        p++;
+        std::string out;
+        while (p < end && *p != '"') {
+            if (*p != '\\') {
+                out += *p++;
+                continue;
+            }
+            if (++p >= end) {
+                return nullptr;
+            }
+            char escape = *p++;
+            switch (escape) {
+                case '"': case '\\': case '/': out += escape; break;
+                case 'b': out += '\b'; break;
+                case 'f': out += '\f'; break;
+                case 'n': out += '\n'; break;
+                case 'r': out += '\r'; break;
+                case 't': out += '\t'; break;
+                case 'u': {
+                    unsigned code;
+                    if (!Hex4(code)) {
+                        return nullptr;
+                    }
+                    if (code >= 0xD800 && code < 0xDC00) {
+                        unsigned low;
+                        if (!Literal("\\u") || !Hex4(low) || low < 0xDC00 || low >= 0xE000) {
+                            return nullptr;
+                        }
+                        code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+                    }
+                    AppendUtf8(out, code);
+                    break;
+                }
+                default:
+                    return nullptr;
+            }
+        }
+        if (p >= end) {
+            return nullptr;
+        }
+        p++;
+        return strdup(out.c_str());
+    }
+
+    cJSON* Value(int depth) {
+        SkipWhitespace();
+        if (p >= end || depth > 64) {
+            return nullptr;
+        }
+        auto item = (cJSON*)calloc(1, sizeof(cJSON));
+        if (*p == '{' || *p == '[') {
+            bool object = *p == '{';
+            char close = object ? '}' : ']';
+            item->type = object ? cJSON_Object : cJSON_Array;
+            p++;
+            SkipWhitespace();
+            if (p < end && *p == close) {
+                p++;
+                return item;
+            }
+            cJSON* last = nullptr;
+            while (true) {
+                char* key = nullptr;
+                if (object) {
+                    SkipWhitespace();
+                    key = String();
+                    SkipWhitespace();
+                    if (key == nullptr || p >= end || *p != ':') {
+                        free(key);
+                        cJSON_Delete(item);
+                        return nullptr;
+                    }
+                    p++;
+                }
+                cJSON* child = Value(depth + 1);
+                if (child == nullptr) {
+                    free(key);
+                    cJSON_Delete(item);
+                    return nullptr;
+                }
+                child->string = key;
+                if (last == nullptr) {
+                    item->child = child;
+                } else {
+                    last->next = child;
+                    child->prev = last;
+                }
+                last = child;
+                SkipWhitespace();
+                if (p < end && *p == ',') {
+                    p++;
+                    continue;
+                }
+                if (p < end && *p == close) {
+                    p++;
+                    return item;
+                }
+                cJSON_Delete(item);
+                return nullptr;
+            }
+        }
+        if (*p == '"') {
+            item->type = cJSON_String;
+            item->valuestring = String();
+            if (item->valuestring == nullptr) {
+                free(item);
+                return nullptr;
+            }
+            return item;
+        }
+        if (Literal("true")) {
+            item->type = cJSON_True;
+            item->valueint = 1;
+            return item;
+        }
+        if (Literal("false")) {
+            item->type = cJSON_False;
+            return item;
+        }
+        if (Literal("null")) {
+            item->type = cJSON_NULL;
+            return item;
+        }
+        // strtod needs a terminated copy, the input may not be null-terminated
+        const char* start = p;
+        while (p < end && strchr("+-0123456789.eE", *p) != nullptr) {
+            p++;
+        }
+        std::string number(start, p - start);
+        char* number_end;
+        double value = strtod(number.c_str(), &number_end);
+        if (number.empty() || number_end != number.c_str() + number.size()) {
+            free(item);
+            return nullptr;
+        }
+        item->type = cJSON_Number;
+        item->valuedouble = value;
+        item->valueint = value >= 2147483647.0 ? 2147483647 : value <= -2147483648.0 ? (-2147483647 - 1) : (int)value;
+        return item;
+    }
+};
+
+void PrintString(std::string& out, const char* str) {
+    out += '"';
+    for (; *str != '\0'; str++) {
+        unsigned char c = *str;
+        switch (c) {
+            case '"': out += "\\\""; break;
+            case '\\': out += "\\\\"; break;
+            case '\b': out += "\\b"; break;
+            case '\f': out += "\\f"; break;
+            case '\n': out += "\\n"; break;
+            case '\r': out += "\\r"; break;
+            case '\t': out += "\\t"; break;
+            default:
+                if (c < 0x20) {
+                    char escape[8];
+                    snprintf(escape, sizeof(escape), "\\u%04x", c);
+                    out += escape;
+                } else {
+                    out += (char)c;
+                }
+        }
+    }
+    out += '"';
+}
+
+void PrintValue(std::string& out, const cJSON* item) {
+    switch (item->type) {
+        case cJSON_False: out += "false"; break;
+        case cJSON_True: out += "true"; break;
+        case cJSON_NULL: out += "null"; break;
+        case cJSON_Number: {
+            char number[32];
+            if (item->valuedouble == (double)item->valueint) {
+                snprintf(number, sizeof(number), "%d", item->valueint);
+            } else if (std::isfinite(item->valuedouble)) {
+                snprintf(number, sizeof(number), "%1.15g", item->valuedouble);
+                if (strtod(number, nullptr) != item->valuedouble) {
+                    snprintf(number, sizeof(number), "%1.17g", item->valuedouble);
+                }
+            } else {
+                snprintf(number, sizeof(number), "null");
+            }
+            out += number;
+            break;
+        }
+        case cJSON_String: PrintString(out, item->valuestring); break;
+        case cJSON_Array:
+        case cJSON_Object: {
+            bool object = item->type == cJSON_Object;
+            out += object ? '{' : '[';
+            for (const cJSON* child = item->child; child != nullptr; child = child->next) {
+                if (child != item->child) {
+                    out += ',';
+                }
+                if (object) {
+                    PrintString(out, child->string);
+                    out += ':';
+                }
+                PrintValue(out, child);
+            }
+            out += object ? '}' : ']';
+            break;
+        }
+    }
+}
+
+} // namespace
+
+cJSON* cJSON_ParseWithLength(const char* value, size_t buffer_length) {
+    if (value == nullptr) {
+        return nullptr;
+    }
+    Parser parser{value, value + buffer_length};
+    cJSON* root = parser.Value(0);
+    if (root == nullptr) {
+        return nullptr;
+    }
+    // Trailing garbage is accepted, as cJSON does without require_null_terminated
+    return root;
+}
+
+cJSON* cJSON_Parse(const char* value) {
+    return value != nullptr ? cJSON_ParseWithLength(value, strlen(value)) : nullptr;
+}
+
+void cJSON_Delete(cJSON* item) {
+    while (item != nullptr) {
+        cJSON* next = item->next;
+        cJSON_Delete(item->child);
+        free(item->valuestring);
+        free(item->string);
+        free(item);
+        item = next;
+    }
+}
+
+char* cJSON_PrintUnformatted(const cJSON* item) {
+    if (item == nullptr) {
+        return nullptr;
+    }
+    std::string out;
+    PrintValue(out, item);
+    return strdup(out.c_str());
+}
+
+void cJSON_free(void* object) {
+    free(object);
+}
+
+cJSON* cJSON_GetObjectItem(const cJSON* object, const char* string) {
+    if (object == nullptr || string == nullptr) {
+        return nullptr;
+    }
+    for (cJSON* child = object->child; child != nullptr; child = child->next) {
+        if (child->string != nullptr && strcasecmp(child->string, string) == 0) {
+            return child;
+        }
+    }
+    return nullptr;
+}
+
+int cJSON_GetArraySize(const cJSON* array) {
+    int size = 0;
+    for (const cJSON* child = array != nullptr ? array->child : nullptr; child != nullptr; child = child->next) {
+        size++;
+    }
+    return size;
+}
+
+cJSON* cJSON_GetArrayItem(const cJSON* array, int index) {
+    cJSON* child = array != nullptr ? array->child : nullptr;
+    while (child != nullptr && index-- > 0) {
+        child = child->next;
+    }
+    return index < 0 ? child : nullptr;
+}
@@ -0,0 +1,49 @@
+#ifndef _HOST_CJSON_H
+#define _HOST_CJSON_H
+
+// Host shim, the part of the cJSON API the protocols use: parsing, lookups and printing
+#include <cstddef>
+
+#define cJSON_Invalid (0)
+#define cJSON_False (1 << 0)
+#define cJSON_True (1 << 1)
+#define cJSON_NULL (1 << 2)
+#define cJSON_Number (1 << 3)
+#define cJSON_String (1 << 4)
+#define cJSON_Array (1 << 5)
+#define cJSON_Object (1 << 6)
+
+typedef struct cJSON {
+    struct cJSON* next;
+    struct cJSON* prev;
+    struct cJSON* child;
+    int type;
+    char* valuestring;
+    int valueint;
+    double valuedouble;
+    char* string;
+} cJSON;
+
+cJSON* cJSON_Parse(const char* value);
+cJSON* cJSON_ParseWithLength(const char* value, size_t buffer_length);
+void cJSON_Delete(cJSON* item);
+char* cJSON_PrintUnformatted(const cJSON* item);
+void cJSON_free(void* object);
+
+// Key lookups ignore case, as in cJSON
+cJSON* cJSON_GetObjectItem(const cJSON* object, const char* string);
+int cJSON_GetArraySize(const cJSON* array);
+cJSON* cJSON_GetArrayItem(const cJSON* array, int index);
+
+static inline bool cJSON_IsTrue(const cJSON* item) { return item != nullptr && item->type == cJSON_True; }
+static inline bool cJSON_IsBool(const cJSON* item) { return item != nullptr && (item->type & (cJSON_True | cJSON_False)) != 0; }
+static inline bool cJSON_IsNull(const cJSON* item) { return item != nullptr && item->type == cJSON_NULL; }
+static inline bool cJSON_IsNumber(const cJSON* item) { return item != nullptr && item->type == cJSON_Number; }
+static inline bool cJSON_IsString(const cJSON* item) { return item != nullptr && item->type == cJSON_String; }
+static inline bool cJSON_IsArray(const cJSON* item) { return item != nullptr && item->type == cJSON_Array; }
+static inline bool cJSON_IsObject(const cJSON* item) { return item != nullptr && item->type == cJSON_Object; }
+
+#define cJSON_ArrayForEach(element, array) \
+    for (element = (array != nullptr) ? (array)->child : nullptr; element != nullptr; element = element->next)
+
+#endif // _HOST_CJSON_H
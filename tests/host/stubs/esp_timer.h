@@ -0,0 +1,13 @@
+#ifndef _HOST_ESP_TIMER_H
+#define _HOST_ESP_TIMER_H
+
+// Host shim, microseconds from a monotonic clock
+#include <chrono>
+#include <cstdint>
+
+static inline int64_t esp_timer_get_time() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+#endif // _HOST_ESP_TIMER_H
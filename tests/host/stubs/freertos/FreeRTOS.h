@@ -0,0 +1,16 @@
+#ifndef _HOST_FREERTOS_H
+#define _HOST_FREERTOS_H
+
+// Host shim, one tick is one millisecond
+#include "sdkconfig.h"
+#include <cstdint>
+
+typedef uint32_t TickType_t;
+typedef int BaseType_t;
+
+#define pdFALSE 0
+#define pdTRUE 1
+#define portMAX_DELAY ((TickType_t)0xffffffffUL)
+#define pdMS_TO_TICKS(ms) ((TickType_t)(ms))
+
+#endif // _HOST_FREERTOS_H
@@ -0,0 +1,60 @@
+#ifndef _HOST_EVENT_GROUPS_H
+#define _HOST_EVENT_GROUPS_H
+
+// Host shim, an event group is a bit mask guarded by a mutex and a condition variable
+#include "FreeRTOS.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+
+typedef uint32_t EventBits_t;
+
+struct HostEventGroup {
+    std::mutex mutex;
+    std::condition_variable changed;
+    EventBits_t bits = 0;
+};
+typedef HostEventGroup* EventGroupHandle_t;
+
+static inline EventGroupHandle_t xEventGroupCreate() {
+    return new HostEventGroup();
+}
+
+static inline void vEventGroupDelete(EventGroupHandle_t group) {
+    delete group;
+}
+
+static inline EventBits_t xEventGroupSetBits(EventGroupHandle_t group, EventBits_t bits) {
+    std::lock_guard<std::mutex> lock(group->mutex);
+    group->bits |= bits;
+    group->changed.notify_all();
+    return group->bits;
+}
+
+static inline EventBits_t xEventGroupClearBits(EventGroupHandle_t group, EventBits_t bits) {
+    std::lock_guard<std::mutex> lock(group->mutex);
+    EventBits_t previous = group->bits;
+    group->bits &= ~bits;
+    return previous;
+}
+
+static inline EventBits_t xEventGroupWaitBits(EventGroupHandle_t group, EventBits_t bits, BaseType_t clear_on_exit,
+        BaseType_t wait_for_all, TickType_t ticks_to_wait) {
+    std::unique_lock<std::mutex> lock(group->mutex);
+    auto satisfied = [&]() {
+        return wait_for_all ? (group->bits & bits) == bits : (group->bits & bits) != 0;
+    };
+    if (ticks_to_wait == portMAX_DELAY) {
+        group->changed.wait(lock, satisfied);
+    } else {
+        group->changed.wait_for(lock, std::chrono::milliseconds(ticks_to_wait), satisfied);
+    }
+    EventBits_t result = group->bits;
+    if (clear_on_exit && satisfied()) {
+        group->bits &= ~bits;
+    }
+    return result;
+}
+
+#endif // _HOST_EVENT_GROUPS_H
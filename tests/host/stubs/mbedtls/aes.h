@@ -0,0 +1,55 @@
+#ifndef _HOST_MBEDTLS_AES_H
+#define _HOST_MBEDTLS_AES_H
+
+// Host shim, the mbedtls AES-CTR API on top of the OpenSSL block cipher
+#include <cstddef>
+#include <cstring>
+#include <openssl/aes.h>
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wdeprecated-declarations"
+
+typedef struct {
+    AES_KEY key;
+} mbedtls_aes_context;
+
+static inline void mbedtls_aes_init(mbedtls_aes_context* ctx) {
+    memset(ctx, 0, sizeof(*ctx));
+}
+
+static inline void mbedtls_aes_free(mbedtls_aes_context* ctx) {
+    memset(ctx, 0, sizeof(*ctx));
+}
+
+static inline int mbedtls_aes_setkey_enc(mbedtls_aes_context* ctx, const unsigned char* key, unsigned int keybits) {
+    return AES_set_encrypt_key(key, keybits, &ctx->key) == 0 ? 0 : -0x0020;
+}
+
+// Same contract as mbedtls: nonce_counter is incremented as a 128-bit big-endian
+// number per block, nc_off and stream_block carry a partial block across calls
+static inline int mbedtls_aes_crypt_ctr(mbedtls_aes_context* ctx, size_t length, size_t* nc_off,
+        unsigned char nonce_counter[16], unsigned char stream_block[16],
+        const unsigned char* input, unsigned char* output) {
+    size_t n = *nc_off;
+    if (n > 0x0F) {
+        return -0x0021;
+    }
+    while (length--) {
+        if (n == 0) {
+            AES_encrypt(nonce_counter, stream_block, &ctx->key);
+            for (int i = 16; i > 0; i--) {
+                if (++nonce_counter[i - 1] != 0) {
+                    break;
+                }
+            }
+        }
+        *output++ = *input++ ^ stream_block[n];
+        n = (n + 1) & 0x0F;
+    }
+    *nc_off = n;
+    return 0;
+}
+
+#pragma GCC diagnostic pop
+
+#endif // _HOST_MBEDTLS_AES_H
@@ -0,0 +1,7 @@
+#ifndef _HOST_ML307_MQTT_H
+#define _HOST_ML307_MQTT_H
+
+// Host shim, the protocols only use the transport interfaces
+#include "mqtt.h"
+
+#endif // _HOST_ML307_MQTT_H
@@ -0,0 +1,7 @@
+#ifndef _HOST_ML307_UDP_H
+#define _HOST_ML307_UDP_H
+
+// Host shim, the protocols only use the transport interfaces
+#include "udp.h"
+
+#endif // _HOST_ML307_UDP_H
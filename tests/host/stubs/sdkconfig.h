@@ -0,0 +1,11 @@
+#ifndef _HOST_SDKCONFIG_H
+#define _HOST_SDKCONFIG_H
+
+// Host configuration, the optional protocol features are enabled so the tests cover them
+#define CONFIG_USE_WEBSOCKET_PROTOCOL_V4 1
+#define CONFIG_KEEP_AUDIO_CHANNEL_WARM 1
+#define CONFIG_KEEP_AUDIO_CHANNEL_WARM_SECONDS 300
+#define CONFIG_USE_MQTT_UDP_PACKING 1
+#define CONFIG_MQTT_UDP_PACK_LATENCY_MS 120
+
+#endif // _HOST_SDKCONFIG_H
@@ -0,0 +1,12 @@
+#ifndef _HOST_SYSTEM_INFO_H
+#define _HOST_SYSTEM_INFO_H
+
+// Host shim
+#include <string>
+
+class SystemInfo {
+public:
+    static std::string GetMacAddress() { return "02:00:00:00:00:01"; }
+};
+
+#endif // _HOST_SYSTEM_INFO_H
@@ -0,0 +1,24 @@
+#ifndef _HOST_UDP_H
+#define _HOST_UDP_H
+
+// Host shim of the esp-ml307 Udp interface, the tests derive their mock transports from it
+#include <functional>
+#include <string>
+
+class Udp {
+public:
+    virtual ~Udp() = default;
+
+    virtual bool Connect(const std::string& host, int port) = 0;
+    virtual void Disconnect() = 0;
+    virtual int Send(const std::string& data) = 0;
+
+    virtual void OnMessage(std::function<void(const std::string& data)> callback) {
+        message_callback_ = std::move(callback);
+    }
+
+protected:
+    std::function<void(const std::string& data)> message_callback_;
+};
+
+#endif // _HOST_UDP_H
@@ -0,0 +1,33 @@
+#ifndef _HOST_WEB_SOCKET_H
+#define _HOST_WEB_SOCKET_H
+
+// Host shim of the esp-ml307 WebSocket interface, the tests derive their mock transports from it
+#include <cstddef>
+#include <functional>
+#include <string>
+
+class WebSocket {
+public:
+    virtual ~WebSocket() = default;
+
+    virtual void SetHeader(const char* key, const char* value) = 0;
+    virtual bool Connect(const char* uri) = 0;
+    virtual bool Send(const std::string& data) = 0;
+    virtual bool Send(const void* data, size_t len, bool binary = false, bool fin = true) = 0;
+    virtual void Ping() = 0;
+    virtual void Close() = 0;
+    virtual bool IsConnected() const = 0;
+
+    void OnConnected(std::function<void()> callback) { on_connected_ = std::move(callback); }
+    void OnDisconnected(std::function<void()> callback) { on_disconnected_ = std::move(callback); }
+    void OnData(std::function<void(const char*, size_t, bool binary)> callback) { on_data_ = std::move(callback); }
+    void OnError(std::function<void(int)> callback) { on_error_ = std::move(callback); }
+
+protected:
+    std::function<void()> on_connected_;
+    std::function<void()> on_disconnected_;
+    std::function<void(const char*, size_t, bool binary)> on_data_;
+    std::function<void(int)> on_error_;
+};
+
+#endif // _HOST_WEB_SOCKET_H
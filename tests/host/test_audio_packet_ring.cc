@@ -0,0 +1,117 @@
+#include "audio_packet_ring.h"
+#include "test_util.h"
+
+#include <thread>
+#include <vector>
+
+static void TestPushPop() {
+    AudioPacketRing ring(4, 16);
+    CHECK(ring.Empty());
+    uint8_t payload[] = {1, 2, 3};
+    CHECK(ring.Push(100, payload, sizeof(payload), 7));
+    CHECK_EQ(ring.Size(), 1u);
+
+    AudioStreamPacket packet;
+    int64_t push_time_us = 0;
+    CHECK(ring.Pop(packet, &push_time_us));
+    CHECK(push_time_us > 0);
+    CHECK_EQ(packet.timestamp, 100u);
+    CHECK_EQ(packet.sequence, 7u);
+    CHECK_EQ(packet.size(), 3u);
+    CHECK(packet.borrowed_payload == nullptr);
+    CHECK_EQ(packet.data()[2], 3);
+    CHECK(!ring.Pop(packet));
+}
+
+static void TestFullAndOversized() {
+    AudioPacketRing ring(2, 4);
+    uint8_t payload[8] = {};
+    CHECK(!ring.Push(0, payload, 5));
+    CHECK(ring.Push(1, payload, 4));
+    CHECK(ring.Push(2, payload, 4));
+    CHECK(ring.Full());
+    CHECK(!ring.Push(3, payload, 4));
+
+    // Slots are reused in order after the wrap
+    AudioStreamPacket packet;
+    for (uint32_t i = 1; i <= 10; i++) {
+        CHECK(ring.Pop(packet));
+        CHECK_EQ(packet.timestamp, i);
+        CHECK(ring.Push(i + 2, payload, 4));
+    }
+}
+
+static void TestBorrowedPacket() {
+    static const uint8_t network[] = {9, 8, 7};
+    AudioPacketRing ring(2, 4);
+    // A packet that borrows its payload is copied into the slot, the pop owns it
+    AudioStreamPacket borrowed;
+    borrowed.timestamp = 5;
+    borrowed.Borrow(network, sizeof(network));
+    CHECK(ring.Push(borrowed));
+
+    AudioStreamPacket packet;
+    CHECK(ring.Pop(packet));
+    CHECK(packet.borrowed_payload == nullptr);
+    CHECK_EQ(packet.timestamp, 5u);
+    CHECK(packet.payload == std::vector<uint8_t>(network, network + sizeof(network)));
+
+    // Borrowed payloads are limited by the slot size like any other
+    static const uint8_t large[] = {1, 2, 3, 4, 5};
+    borrowed.Borrow(large, sizeof(large));
+    CHECK(!ring.Push(borrowed));
+}
+
+static void TestClear() {
+    AudioPacketRing ring(4, 4);
+    uint8_t payload[] = {1};
+    CHECK(ring.Push(1, payload, 1));
+    CHECK(ring.Push(2, payload, 1));
+    ring.Clear();
+    CHECK(ring.Empty());
+    CHECK(ring.Push(3, payload, 1));
+    CHECK_EQ(ring.Size(), 1u);
+
+    AudioStreamPacket packet;
+    CHECK(ring.Pop(packet));
+    CHECK_EQ(packet.timestamp, 3u);
+    CHECK(!ring.Pop(packet));
+}
+
+static void TestProducerConsumer() {
+    constexpr uint32_t kPackets = 100000;
+    AudioPacketRing ring(8, 8);
+    std::thread producer([&ring] {
+        for (uint32_t i = 1; i <= kPackets; ) {
+            uint8_t payload[4] = {(uint8_t)i, (uint8_t)(i >> 8), (uint8_t)(i >> 16), (uint8_t)(i >> 24)};
+            if (ring.Push(i, payload, 1 + i % 4, i)) {
+                i++;
+            } else {
+                std::this_thread::yield();
+            }
+        }
+    });
+
+    AudioStreamPacket packet;
+    for (uint32_t expected = 1; expected <= kPackets; ) {
+        if (!ring.Pop(packet)) {
+            std::this_thread::yield();
+            continue;
+        }
+        CHECK_EQ(packet.timestamp, expected);
+        CHECK_EQ(packet.size(), 1 + expected % 4);
+        CHECK_EQ(packet.data()[0], (uint8_t)expected);
+        expected++;
+    }
+    producer.join();
+    CHECK(ring.Empty());
+}
+
+int main() {
+    TestPushPop();
+    TestFullAndOversized();
+    TestBorrowedPacket();
+    TestClear();
+    TestProducerConsumer();
+    return 0;
+}
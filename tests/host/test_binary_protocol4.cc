@@ -0,0 +1,83 @@
+#include "binary_protocol4.h"
+#include "test_util.h"
+
+#include <cstring>
+#include <string>
+
+static const uint8_t* Data(const std::string& buffer) {
+    return (const uint8_t*)buffer.data();
+}
+
+static void TestMinimalAudioRecord() {
+    std::string buffer;
+    BinaryProtocol4Writer writer(buffer);
+    uint8_t opus[] = {0xf8, 0xff, 0xfe};
+    writer.AddAudio(opus, sizeof(opus), 0, 0);
+    // Header, sequence and size, no timestamp
+    CHECK_EQ(writer.size(), 3u + sizeof(opus));
+    CHECK_EQ((uint8_t)buffer[0], kBinaryProtocol4Audio | BINARY_PROTOCOL4_HAS_SEQUENCE);
+
+    BinaryProtocol4Reader reader(Data(buffer), buffer.size());
+    BinaryProtocol4Record record;
+    CHECK(reader.Next(record));
+    CHECK_EQ(record.type, kBinaryProtocol4Audio);
+    CHECK(!record.has_timestamp);
+    CHECK_EQ(record.payload_size, sizeof(opus));
+    CHECK(memcmp(record.payload, opus, sizeof(opus)) == 0);
+    CHECK(!reader.Next(record));
+    CHECK(!reader.error());
+}
+
+static void TestMixedRecords() {
+    std::string buffer;
+    BinaryProtocol4Writer writer(buffer);
+    std::string large(300, 'o');
+    writer.AddAudio((const uint8_t*)large.data(), large.size(), 0xffffffff, 128);
+    writer.AddJson("{\"type\":\"listen\",\"state\":\"stop\"}");
+    writer.AddAudio((const uint8_t*)"x", 1, 60, 129);
+
+    BinaryProtocol4Reader reader(Data(buffer), buffer.size());
+    BinaryProtocol4Record record;
+    CHECK(reader.Next(record));
+    CHECK(record.has_timestamp && record.has_sequence);
+    CHECK_EQ(record.timestamp, 0xffffffffu);
+    CHECK_EQ(record.sequence, 128u);
+    CHECK_EQ(record.payload_size, large.size());
+    CHECK(reader.Next(record));
+    CHECK_EQ(record.type, kBinaryProtocol4Json);
+    CHECK(std::string((const char*)record.payload, record.payload_size) == "{\"type\":\"listen\",\"state\":\"stop\"}");
+    CHECK(reader.Next(record));
+    CHECK_EQ(record.timestamp, 60u);
+    CHECK_EQ(record.sequence, 129u);
+    CHECK_EQ(record.payload[0], 'x');
+    CHECK(!reader.Next(record));
+    CHECK(!reader.error());
+}
+
+static void TestMalformed() {
+    std::string buffer;
+    BinaryProtocol4Writer writer(buffer);
+    writer.AddAudio((const uint8_t*)"abcd", 4, 1000, 1);
+
+    // Every truncation of the record is an error, never a read past the end
+    for (size_t size = 1; size < buffer.size(); size++) {
+        BinaryProtocol4Reader reader(Data(buffer), size);
+        BinaryProtocol4Record record;
+        CHECK(!reader.Next(record));
+        CHECK(reader.error());
+    }
+
+    // A varint longer than 5 bytes
+    const uint8_t overlong[] = {kBinaryProtocol4Json, 0x80, 0x80, 0x80, 0x80, 0x80, 0x01};
+    BinaryProtocol4Reader reader(overlong, sizeof(overlong));
+    BinaryProtocol4Record record;
+    CHECK(!reader.Next(record));
+    CHECK(reader.error());
+}
+
+int main() {
+    TestMinimalAudioRecord();
+    TestMixedRecords();
+    TestMalformed();
+    return 0;
+}
@@ -0,0 +1,132 @@
+#include "jitter_buffer.h"
+#include "test_util.h"
+
+static void Put(JitterBuffer& buffer, uint32_t sequence, uint32_t timestamp, int64_t arrival_ms) {
+    AudioStreamPacket packet;
+    packet.sequence = sequence;
+    packet.timestamp = timestamp;
+    packet.payload.assign(1, (uint8_t)(sequence != 0 ? sequence : timestamp / 60));
+    buffer.Put(std::move(packet), arrival_ms * 1000);
+}
+
+static JitterBuffer::Result Get(JitterBuffer& buffer, AudioStreamPacket& packet, int64_t now_ms) {
+    return buffer.Get(packet, now_ms * 1000);
+}
+
+static void TestInOrder() {
+    JitterBuffer buffer(8, 60, 600);
+    AudioStreamPacket packet;
+    CHECK_EQ(Get(buffer, packet, 0), JitterBuffer::kJitterBufferEmpty);
+    for (uint32_t i = 1; i <= 3; i++) {
+        Put(buffer, i, 0, i * 60);
+    }
+    for (uint32_t i = 1; i <= 3; i++) {
+        CHECK_EQ(Get(buffer, packet, 200), JitterBuffer::kJitterBufferFrame);
+        CHECK_EQ(packet.sequence, i);
+        CHECK_EQ(packet.payload[0], i);
+    }
+    CHECK_EQ(Get(buffer, packet, 200), JitterBuffer::kJitterBufferEmpty);
+    CHECK_EQ(buffer.lost_frames(), 0u);
+}
+
+static void TestReorderBeforePlayout() {
+    JitterBuffer buffer(8, 120, 600);
+    AudioStreamPacket packet;
+    Put(buffer, 2, 0, 0);
+    // One frame is less than the 120 ms target, keep buffering
+    CHECK_EQ(Get(buffer, packet, 0), JitterBuffer::kJitterBufferEmpty);
+    Put(buffer, 1, 0, 0);
+    CHECK_EQ(Get(buffer, packet, 0), JitterBuffer::kJitterBufferFrame);
+    CHECK_EQ(packet.sequence, 1u);
+    CHECK_EQ(Get(buffer, packet, 0), JitterBuffer::kJitterBufferFrame);
+    CHECK_EQ(packet.sequence, 2u);
+}
+
+static void TestLossAndLate() {
+    JitterBuffer buffer(8, 60, 600);
+    AudioStreamPacket packet;
+    Put(buffer, 1, 60, 0);
+    Put(buffer, 2, 120, 60);
+    Put(buffer, 4, 240, 180);
+    CHECK_EQ(Get(buffer, packet, 200), JitterBuffer::kJitterBufferFrame);
+    CHECK_EQ(Get(buffer, packet, 200), JitterBuffer::kJitterBufferFrame);
+    CHECK_EQ(Get(buffer, packet, 200), JitterBuffer::kJitterBufferFrameLost);
+    CHECK(packet.empty());
+    CHECK_EQ(packet.timestamp, 180u);
+    // Frame 3 arrives after it was concealed
+    Put(buffer, 3, 180, 200);
+    CHECK_EQ(buffer.late_packets(), 1u);
+    CHECK_EQ(Get(buffer, packet, 200), JitterBuffer::kJitterBufferFrame);
+    CHECK_EQ(packet.sequence, 4u);
+    CHECK_EQ(buffer.lost_frames(), 1u);
+}
+
+static void TestLongGapIsSkipped() {
+    JitterBuffer buffer(16, 60, 600);
+    AudioStreamPacket packet;
+    Put(buffer, 1, 0, 0);
+    Put(buffer, 10, 0, 540);
+    CHECK_EQ(Get(buffer, packet, 600), JitterBuffer::kJitterBufferFrame);
+    for (int i = 0; i < 3; i++) {
+        CHECK_EQ(Get(buffer, packet, 600), JitterBuffer::kJitterBufferFrameLost);
+    }
+    // Concealment stops after three frames and playout jumps to the next buffered one
+    CHECK_EQ(Get(buffer, packet, 600), JitterBuffer::kJitterBufferFrame);
+    CHECK_EQ(packet.sequence, 10u);
+    CHECK_EQ(buffer.lost_frames(), 3u);
+}
+
+static void TestTimestampIndex() {
+    JitterBuffer buffer(8, 60, 600);
+    AudioStreamPacket packet;
+    // Without a sequence the timestamp gives the order
+    Put(buffer, 0, 120, 0);
+    Put(buffer, 0, 60, 0);
+    CHECK_EQ(Get(buffer, packet, 100), JitterBuffer::kJitterBufferFrame);
+    CHECK_EQ(packet.timestamp, 60u);
+    CHECK_EQ(Get(buffer, packet, 100), JitterBuffer::kJitterBufferFrame);
+    CHECK_EQ(packet.timestamp, 120u);
+}
+
+static void TestDelayAdapts() {
+    JitterBuffer buffer(8, 60, 600);
+    AudioStreamPacket packet;
+    CHECK_EQ(buffer.target_delay_ms(), 60);
+    Put(buffer, 1, 0, 0);
+    // Due at 60 ms, arrives 200 ms late
+    Put(buffer, 2, 0, 260);
+    CHECK_EQ(buffer.target_delay_ms(), 260);
+    // Capped at the maximum
+    Put(buffer, 3, 0, 2000);
+    CHECK_EQ(buffer.target_delay_ms(), 600);
+}
+
+static void TestUnderrunAndReset() {
+    JitterBuffer buffer(8, 60, 600);
+    AudioStreamPacket packet;
+    Put(buffer, 1, 0, 0);
+    CHECK_EQ(Get(buffer, packet, 0), JitterBuffer::kJitterBufferFrame);
+    CHECK_EQ(Get(buffer, packet, 60), JitterBuffer::kJitterBufferEmpty);
+    Put(buffer, 2, 0, 100);
+    CHECK_EQ(buffer.underruns(), 1u);
+
+    buffer.Reset();
+    CHECK(buffer.Empty());
+    // The reset is applied by the next call, a new stream starts from its first packet
+    Put(buffer, 50, 0, 1000);
+    CHECK_EQ(buffer.size(), 1u);
+    CHECK_EQ(buffer.underruns(), 0u);
+    CHECK_EQ(Get(buffer, packet, 1100), JitterBuffer::kJitterBufferFrame);
+    CHECK_EQ(packet.sequence, 50u);
+}
+
+int main() {
+    TestInOrder();
+    TestReorderBeforePlayout();
+    TestLossAndLate();
+    TestLongGapIsSkipped();
+    TestTimestampIndex();
+    TestDelayAdapts();
+    TestUnderrunAndReset();
+    return 0;
+}
@@ -0,0 +1,118 @@
+#include "json_message_router.h"
+#include "test_util.h"
+
+#include <cstring>
+#include <string>
+
+// Parses a message, dispatches it and returns the name of the handler that ran, "" for none
+struct Routes {
+    JsonMessageRouter router;
+    std::string handled;
+    // Points into root, which is kept until the next dispatch
+    JsonMessage last;
+    cJSON* root = nullptr;
+
+    ~Routes() {
+        cJSON_Delete(root);
+    }
+
+    std::string Dispatch(const char* json, bool expect_route) {
+        cJSON_Delete(root);
+        root = cJSON_Parse(json);
+        CHECK(root != nullptr);
+        handled.clear();
+        CHECK_EQ(router.Dispatch(root), expect_route);
+        return handled;
+    }
+
+    JsonMessageRouter::Handler Handler(const char* name) {
+        return [this, name](const JsonMessage& message) {
+            handled = name;
+            last = message;
+        };
+    }
+};
+
+static void TestStatePrecedence() {
+    Routes routes;
+    // The catch-all route is registered first and still loses to the state routes
+    routes.router.On("tts", routes.Handler("tts"));
+    routes.router.On("tts", "start", routes.Handler("tts start"));
+    routes.router.On("tts", "stop", routes.Handler("tts stop"));
+    routes.router.On("stt", routes.Handler("stt"));
+
+    CHECK(routes.Dispatch("{\"type\":\"tts\",\"state\":\"start\"}", true) == "tts start");
+    CHECK(routes.Dispatch("{\"state\":\"stop\",\"type\":\"tts\"}", true) == "tts stop");
+    // A state without a route of its own and a missing state go to the catch-all
+    CHECK(routes.Dispatch("{\"type\":\"tts\",\"state\":\"sentence_start\",\"text\":\"hi\"}", true) == "tts");
+    CHECK(routes.Dispatch("{\"type\":\"tts\"}", true) == "tts");
+    // State routes only match their own type
+    CHECK(routes.Dispatch("{\"type\":\"stt\",\"state\":\"start\"}", true) == "stt");
+    CHECK(routes.Dispatch("{\"type\":\"llm\",\"state\":\"start\"}", false) == "");
+
+    // Without a catch-all, an unrouted state is not handled
+    Routes strict;
+    strict.router.On("tts", "start", strict.Handler("tts start"));
+    CHECK(strict.Dispatch("{\"type\":\"tts\",\"state\":\"stop\"}", false) == "");
+    CHECK(strict.Dispatch("{\"type\":\"tts\"}", false) == "");
+}
+
+static void TestMissingType() {
+    Routes routes;
+    routes.router.On("tts", routes.Handler("tts"));
+    CHECK(routes.Dispatch("{\"state\":\"start\"}", false) == "");
+    CHECK(routes.Dispatch("{\"type\":1}", false) == "");
+    CHECK(routes.Dispatch("{\"type\":null}", false) == "");
+    CHECK(routes.Dispatch("[\"tts\"]", false) == "");
+    CHECK(routes.Dispatch("\"tts\"", false) == "");
+    CHECK(!routes.router.Dispatch(nullptr));
+}
+
+// "glbvs" and "yacxa" have the same FNV-1a hash, 0xa1bc9a4f
+static void TestHashCollision() {
+    Routes routes;
+    routes.router.On("glbvs", routes.Handler("glbvs"));
+    CHECK(routes.Dispatch("{\"type\":\"glbvs\"}", true) == "glbvs");
+    CHECK(routes.Dispatch("{\"type\":\"yacxa\"}", false) == "");
+
+    // A colliding state falls through to the catch-all
+    routes.router.On("tts", routes.Handler("tts"));
+    routes.router.On("tts", "glbvs", routes.Handler("tts glbvs"));
+    CHECK(routes.Dispatch("{\"type\":\"tts\",\"state\":\"glbvs\"}", true) == "tts glbvs");
+    CHECK(routes.Dispatch("{\"type\":\"tts\",\"state\":\"yacxa\"}", true) == "tts");
+
+    // Both sides of a collision can have their own route
+    routes.router.On("yacxa", routes.Handler("yacxa"));
+    CHECK(routes.Dispatch("{\"type\":\"yacxa\"}", true) == "yacxa");
+    CHECK(routes.Dispatch("{\"type\":\"glbvs\"}", true) == "glbvs");
+}
+
+static void TestFields() {
+    Routes routes;
+    routes.router.On("alert", routes.Handler("alert"));
+    routes.router.On("iot", routes.Handler("iot"));
+
+    CHECK(routes.Dispatch("{\"type\":\"alert\",\"status\":\"错误\",\"message\":\"m\",\"emotion\":\"sad\","
+        "\"text\":\"t\",\"command\":\"c\",\"extra\":{\"type\":\"nested\"}}", true) == "alert");
+    CHECK(strcmp(routes.last.status, "错误") == 0);
+    CHECK(strcmp(routes.last.message, "m") == 0);
+    CHECK(strcmp(routes.last.emotion, "sad") == 0);
+    CHECK(strcmp(routes.last.text, "t") == 0);
+    CHECK(strcmp(routes.last.command, "c") == 0);
+    CHECK(routes.last.state == nullptr);
+    CHECK(routes.last.commands == nullptr);
+
+    // Fields that are not strings are left out, commands is passed as it is
+    CHECK(routes.Dispatch("{\"type\":\"iot\",\"text\":5,\"commands\":[{\"name\":\"Speaker\"}]}", true) == "iot");
+    CHECK(routes.last.text == nullptr);
+    CHECK(cJSON_IsArray(routes.last.commands));
+    CHECK_EQ(cJSON_GetArraySize(routes.last.commands), 1);
+}
+
+int main() {
+    TestStatePrecedence();
+    TestMissingType();
+    TestHashCollision();
+    TestFields();
+    return 0;
+}
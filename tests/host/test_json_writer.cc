@@ -0,0 +1,53 @@
+#include "json_writer.h"
+#include "test_util.h"
+
+#include <string>
+
+static void TestObject() {
+    std::string buffer = "stale";
+    JsonWriter writer(buffer);
+    writer.BeginObject()
+        .Field("session_id", "abc")
+        .Field("type", "listen")
+        .Field("version", 3)
+        .Field("realtime", true)
+        .Key("features").BeginObject().Field("aec", false).EndObject()
+        .Key("frames").BeginArray().Int(-1).Int(0).Int(INT64_MAX).EndArray()
+        .Key("descriptors").Raw("[{\"name\":\"Lamp\"}]")
+        .EndObject();
+    CHECK(buffer ==
+        "{\"session_id\":\"abc\",\"type\":\"listen\",\"version\":3,\"realtime\":true,"
+        "\"features\":{\"aec\":false},\"frames\":[-1,0,9223372036854775807],"
+        "\"descriptors\":[{\"name\":\"Lamp\"}]}");
+}
+
+static void TestEmptyContainers() {
+    std::string buffer;
+    JsonWriter(buffer).BeginArray().BeginObject().EndObject().BeginArray().EndArray().EndArray();
+    CHECK(buffer == "[{},[]]");
+}
+
+static void TestEscaping() {
+    std::string buffer;
+    JsonWriter(buffer).BeginObject().Field("wake\"word", "a\"b\\c\n\r\t\b\f\x01\x1f 你好").EndObject();
+    CHECK(buffer == "{\"wake\\\"word\":\"a\\\"b\\\\c\\n\\r\\t\\b\\f\\u0001\\u001f 你好\"}");
+}
+
+static void TestBufferIsReused() {
+    std::string buffer;
+    JsonWriter(buffer).BeginObject().Field("text", std::string(200, 'x')).EndObject();
+    size_t capacity = buffer.capacity();
+    const char* data = buffer.data();
+    JsonWriter(buffer).BeginObject().Field("type", "abort").EndObject();
+    CHECK(buffer == "{\"type\":\"abort\"}");
+    CHECK_EQ(buffer.capacity(), capacity);
+    CHECK(buffer.data() == data);
+}
+
+int main() {
+    TestObject();
+    TestEmptyContainers();
+    TestEscaping();
+    TestBufferIsReused();
+    return 0;
+}
@@ -0,0 +1,247 @@
+#include "mqtt_protocol.h"
+#include "mock_transports.h"
+#include "test_util.h"
+
+#include <application.h>
+#include <board.h>
+#include <settings.h>
+#include <arpa/inet.h>
+#include <cstring>
+#include <set>
+#include <string>
+#include <vector>
+
+static const uint8_t kKey[16] = {0x00, 0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77,
+    0x88, 0x99, 0xaa, 0xbb, 0xcc, 0xdd, 0xee, 0xff};
+
+struct Harness {
+    MqttProtocol protocol;
+    MockMqtt* mqtt = nullptr;
+    MockUdp* udp = nullptr;
+    bool udp_alive = false;
+    bool server_udp_pack = false;
+    std::vector<AudioStreamPacket> audio;
+    int opened = 0;
+    int closed = 0;
+
+    Harness() {
+        Settings settings("mqtt", true);
+        settings.SetString("endpoint", "mqtt.example.com:1883");
+        settings.SetString("client_id", "test-client");
+        settings.SetString("publish_topic", "device-server");
+
+        Board::GetInstance().SetMqttFactory([this]() {
+            mqtt = new MockMqtt();
+            mqtt->server = [this](MockMqtt& mqtt, const std::string& payload) {
+                if (payload.find("\"type\":\"hello\"") != std::string::npos) {
+                    mqtt.Receive(std::string("{\"type\":\"hello\",\"transport\":\"udp\",\"session_id\":\"mqtt-1\",")
+                        + "\"audio_params\":{\"sample_rate\":24000,\"frame_duration\":60},"
+                        + "\"features\":{\"udp_pack\":" + (server_udp_pack ? "true" : "false") + "},"
+                        + "\"udp\":{\"server\":\"192.0.2.1\",\"port\":8888,"
+                        + "\"key\":\"00112233445566778899AABBCCDDEEFF\","
+                        + "\"nonce\":\"01000000DEADBEEF0000000000000000\"}}");
+                }
+            };
+            return mqtt;
+        });
+        Board::GetInstance().SetUdpFactory([this]() {
+            udp = new MockUdp();
+            udp_alive = true;
+            udp->alive = &udp_alive;
+            return udp;
+        });
+        protocol.OnIncomingAudio([this](AudioStreamPacket&& packet) {
+            packet.payload.assign(packet.data(), packet.data() + packet.size());
+            packet.borrowed_payload = nullptr;
+            audio.push_back(std::move(packet));
+        });
+        protocol.OnAudioChannelOpened([this]() { opened++; });
+        protocol.OnAudioChannelClosed([this]() { closed++; });
+    }
+};
+
+// The datagram header is the initial counter block
+static std::string Crypt(const std::string& datagram) {
+    mbedtls_aes_context aes;
+    mbedtls_aes_init(&aes);
+    mbedtls_aes_setkey_enc(&aes, kKey, 128);
+    uint8_t counter[16];
+    memcpy(counter, datagram.data(), sizeof(counter));
+    size_t nc_off = 0;
+    uint8_t stream_block[16] = {0};
+    std::string output(datagram.size() - 16, '\0');
+    CHECK_EQ(mbedtls_aes_crypt_ctr(&aes, output.size(), &nc_off, counter, stream_block,
+        (const uint8_t*)datagram.data() + 16, (uint8_t*)output.data()), 0);
+    return output;
+}
+
+static std::string Header(uint8_t type, uint8_t flags, uint16_t size, uint32_t timestamp, uint32_t sequence) {
+    uint8_t header[16] = {type, flags, 0, 0, 0xde, 0xad, 0xbe, 0xef};
+    *(uint16_t*)&header[2] = htons(size);
+    *(uint32_t*)&header[8] = htonl(timestamp);
+    *(uint32_t*)&header[12] = htonl(sequence);
+    return std::string((const char*)header, sizeof(header));
+}
+
+static uint32_t Word(const std::string& datagram, size_t offset) {
+    uint32_t value;
+    memcpy(&value, datagram.data() + offset, sizeof(value));
+    return ntohl(value);
+}
+
+static AudioStreamPacket Packet(uint32_t timestamp, size_t size, uint8_t fill) {
+    AudioStreamPacket packet;
+    packet.timestamp = timestamp;
+    packet.payload.assign(size, fill);
+    return packet;
+}
+
+// Adds the counter blocks a datagram consumes, none may be used twice under one key
+static void AddCounterBlocks(std::set<std::string>& used, const std::string& datagram) {
+    uint8_t counter[16];
+    memcpy(counter, datagram.data(), sizeof(counter));
+    for (size_t offset = 16; offset < datagram.size(); offset += 16) {
+        CHECK(used.insert(std::string((const char*)counter, sizeof(counter))).second);
+        for (int i = 16; i > 0 && ++counter[i - 1] == 0; i--) {
+        }
+    }
+}
+
+static void TestSingleFrames() {
+    Harness harness;
+    CHECK(harness.protocol.Start());
+    CHECK(harness.mqtt->broker_address == "mqtt.example.com");
+    CHECK_EQ(harness.mqtt->broker_port, 1883);
+
+    CHECK(harness.protocol.OpenAudioChannel());
+    CHECK_EQ(harness.opened, 1);
+    auto& hello = harness.mqtt->published[0];
+    CHECK(hello.first == "device-server");
+    CHECK(hello.second.find("\"udp_pack\":true") != std::string::npos);
+    CHECK(harness.protocol.session_id() == "mqtt-1");
+    CHECK_EQ(harness.protocol.server_sample_rate(), 24000);
+    CHECK(harness.udp->host == "192.0.2.1");
+    CHECK_EQ(harness.udp->port, 8888);
+    CHECK(harness.protocol.IsAudioChannelOpened());
+
+    // The server declined packing, every frame is its own datagram
+    for (uint32_t i = 0; i < 3; i++) {
+        harness.protocol.SendAudio(Packet(60 * (i + 1), 100 + i, 0x10 + i));
+    }
+    CHECK_EQ(harness.udp->sent.size(), 3u);
+    for (uint32_t i = 0; i < 3; i++) {
+        auto& datagram = harness.udp->sent[i];
+        CHECK_EQ(datagram.size(), 16u + 100 + i);
+        CHECK_EQ((uint8_t)datagram[0], MQTT_UDP_TYPE_AUDIO);
+        CHECK_EQ(ntohs(*(const uint16_t*)&datagram[2]), 100 + i);
+        CHECK(datagram.substr(4, 4) == "\xde\xad\xbe\xef");
+        CHECK_EQ(Word(datagram, 8), 60 * (i + 1));
+        CHECK_EQ(Word(datagram, 12), i + 1);
+        CHECK(Crypt(datagram) == std::string(100 + i, 0x10 + i));
+    }
+
+    std::string payload(80, 'a');
+    std::string datagram = Header(MQTT_UDP_TYPE_AUDIO, 0, payload.size(), 40, 5);
+    harness.udp->Receive(datagram + Crypt(datagram + payload));
+    CHECK_EQ(harness.audio.size(), 1u);
+    CHECK_EQ(harness.audio[0].timestamp, 40u);
+    CHECK_EQ(harness.audio[0].sequence, 5u);
+    CHECK(std::string(harness.audio[0].payload.begin(), harness.audio[0].payload.end()) == payload);
+
+    // Wrong type and short datagrams are dropped
+    harness.udp->Receive(Header(0x07, 0, 0, 0, 6));
+    harness.udp->Receive("\x01");
+    CHECK_EQ(harness.audio.size(), 1u);
+
+    // A goodbye for this session closes the channel from the main loop
+    harness.mqtt->Receive("{\"type\":\"goodbye\",\"session_id\":\"other\"}");
+    Application::GetInstance().RunScheduled();
+    CHECK(harness.udp_alive);
+    harness.mqtt->Receive("{\"type\":\"goodbye\",\"session_id\":\"mqtt-1\"}");
+    CHECK(harness.udp_alive);
+    Application::GetInstance().RunScheduled();
+    CHECK(!harness.udp_alive);
+    CHECK_EQ(harness.closed, 1);
+    CHECK(harness.mqtt->published.back().second == "{\"session_id\":\"mqtt-1\",\"type\":\"goodbye\"}");
+    CHECK(!harness.protocol.IsAudioChannelOpened());
+}
+
+static void TestPacking() {
+    Harness harness;
+    harness.server_udp_pack = true;
+    CHECK(harness.protocol.Start());
+    CHECK(harness.protocol.OpenAudioChannel());
+    auto udp = harness.udp;
+    std::set<std::string> counters;
+
+    // 120 ms of extra latency at 60 ms frames packs three frames
+    harness.protocol.SendAudio(Packet(60, 80, 1));
+    harness.protocol.SendAudio(Packet(120, 90, 2));
+    CHECK(udp->sent.empty());
+    harness.protocol.SendAudio(Packet(180, 100, 3));
+    CHECK_EQ(udp->sent.size(), 1u);
+    auto& packed = udp->sent[0];
+    CHECK_EQ((uint8_t)packed[0], MQTT_UDP_TYPE_PACKED_AUDIO);
+    CHECK_EQ((uint8_t)packed[1], 3);
+    CHECK_EQ(ntohs(*(const uint16_t*)&packed[2]), 3 * 6 + 80 + 90 + 100);
+    CHECK_EQ(Word(packed, 8), 1u);
+    CHECK_EQ(Word(packed, 12), 1u);
+    std::string plain = Crypt(packed);
+    size_t offset = 0;
+    for (int i = 0; i < 3; i++) {
+        uint16_t size = ntohs(*(const uint16_t*)&plain[offset]);
+        CHECK_EQ(size, 80 + 10 * i);
+        CHECK_EQ(Word(plain, offset + 2), 60u * (i + 1));
+        CHECK(plain.substr(offset + 6, size) == std::string(size, (char)(i + 1)));
+        offset += 6 + size;
+    }
+    CHECK_EQ(offset, plain.size());
+    AddCounterBlocks(counters, packed);
+
+    // Control messages flush a partial datagram first
+    harness.protocol.SendAudio(Packet(240, 50, 4));
+    harness.protocol.SendStopListening();
+    CHECK_EQ(udp->sent.size(), 2u);
+    CHECK_EQ((uint8_t)udp->sent[1][1], 1);
+    CHECK_EQ(Word(udp->sent[1], 8), 2u);
+    CHECK_EQ(Word(udp->sent[1], 12), 4u);
+    AddCounterBlocks(counters, udp->sent[1]);
+
+    // A batch is limited by the datagram size only
+    harness.protocol.BeginBatch();
+    for (int i = 0; i < 12; i++) {
+        harness.protocol.SendAudio(Packet(300 + 60 * i, 100, 5 + i));
+    }
+    CHECK_EQ(udp->sent.size(), 3u);
+    harness.protocol.EndBatch();
+    CHECK_EQ(udp->sent.size(), 4u);
+    CHECK_EQ((uint8_t)udp->sent[2][1], 11);
+    CHECK(udp->sent[2].size() <= MQTT_UDP_PACK_MAX_SIZE);
+    CHECK_EQ(Word(udp->sent[2], 12), 5u);
+    CHECK_EQ((uint8_t)udp->sent[3][1], 1);
+    CHECK_EQ(Word(udp->sent[3], 12), 16u);
+    AddCounterBlocks(counters, udp->sent[2]);
+    AddCounterBlocks(counters, udp->sent[3]);
+
+    // Incoming packed datagrams are unpacked with consecutive sequence numbers
+    std::string frames;
+    for (uint8_t i = 0; i < 2; i++) {
+        uint16_t size = htons(3);
+        uint32_t timestamp = htonl(1000 + 60 * i);
+        frames.append((const char*)&size, 2).append((const char*)&timestamp, 4).append(3, 'x' + i);
+    }
+    std::string header = Header(MQTT_UDP_TYPE_PACKED_AUDIO, 2, frames.size(), 1, 10);
+    udp->Receive(header + Crypt(header + frames));
+    CHECK_EQ(harness.audio.size(), 2u);
+    for (uint32_t i = 0; i < 2; i++) {
+        CHECK_EQ(harness.audio[i].sequence, 10 + i);
+        CHECK_EQ(harness.audio[i].timestamp, 1000 + 60 * i);
+        CHECK(harness.audio[i].payload == std::vector<uint8_t>(3, 'x' + i));
+    }
+}
+
+int main() {
+    TestSingleFrames();
+    TestPacking();
+    return 0;
+}
@@ -0,0 +1,120 @@
+#include "pcm_kernels.h"
+#include "test_util.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+// Lengths around the unroll factor, so both the unrolled loop and the tail are covered
+static const size_t kLengths[] = {0, 1, 3, 4, 5, 8, 11, 960};
+
+static int16_t Sample(size_t i) {
+    // Spans the full range including both extremes
+    return (int16_t)(i * 7919 % 65536 - 32768);
+}
+
+static void TestVolumeFactor() {
+    CHECK_EQ(PcmVolumeFactor(0), 0);
+    CHECK_EQ(PcmVolumeFactor(100), 65536);
+    CHECK_EQ(PcmVolumeFactor(50), 16384);
+    CHECK_EQ(PcmVolumeFactor(-5), 0);
+    CHECK_EQ(PcmVolumeFactor(150), 65536);
+}
+
+static void TestScaleAndNarrow() {
+    for (size_t length : kLengths) {
+        std::vector<int16_t> in(length);
+        for (size_t i = 0; i < length; i++) {
+            in[i] = Sample(i);
+        }
+        std::vector<int32_t> scaled(length);
+        std::vector<int16_t> out(length);
+        for (int32_t factor : {0, 16384, 65536}) {
+            PcmScaleToInt32(in.data(), scaled.data(), length, factor);
+            PcmNarrowToInt16(scaled.data(), out.data(), length, 16);
+            for (size_t i = 0; i < length; i++) {
+                CHECK_EQ(scaled[i], (int32_t)in[i] * factor);
+                int32_t expected = std::clamp<int32_t>(((int32_t)in[i] * factor) >> 16, -INT16_MAX, INT16_MAX);
+                CHECK_EQ(out[i], expected);
+            }
+        }
+    }
+}
+
+static void TestNarrowClamps() {
+    int32_t in[] = {INT32_MAX, INT32_MIN, 70000, -70000, 12345, -32768, 32767, 0, -1};
+    int16_t out[9];
+    PcmNarrowToInt16(in, out, 9, 0);
+    CHECK_EQ(out[0], INT16_MAX);
+    CHECK_EQ(out[1], -INT16_MAX);
+    CHECK_EQ(out[2], INT16_MAX);
+    CHECK_EQ(out[3], -INT16_MAX);
+    CHECK_EQ(out[4], 12345);
+    // -32768 is clamped too so the result is symmetric
+    CHECK_EQ(out[5], -INT16_MAX);
+    CHECK_EQ(out[6], INT16_MAX);
+    CHECK_EQ(out[7], 0);
+    CHECK_EQ(out[8], -1);
+
+    // 32-bit I2S samples carry the 16-bit sample in the upper half
+    int32_t wide[] = {0x12340000, (int32_t)0xedcc0000};
+    PcmNarrowToInt16(wide, out, 2, 16);
+    CHECK_EQ(out[0], 0x1234);
+    CHECK_EQ(out[1], -0x1234);
+}
+
+static void TestMixQ15() {
+    for (size_t length : kLengths) {
+        std::vector<int16_t> in(length);
+        for (size_t i = 0; i < length; i++) {
+            in[i] = Sample(i);
+        }
+        // Ramp from silence towards unity, checked against the per-sample definition
+        int32_t gain = 0;
+        int32_t step = length > 0 ? 32768 / (int32_t)length : 0;
+        std::vector<int32_t> acc(length, 100);
+        PcmMixQ15(in.data(), acc.data(), length, gain, step);
+        for (size_t i = 0; i < length; i++) {
+            CHECK_EQ(acc[i], 100 + (((int32_t)in[i] * (gain + (int32_t)i * step)) >> 15));
+        }
+
+        // A constant unity gain copies, two sources sum before the saturating narrow
+        std::vector<int32_t> sum(length, 0);
+        PcmMixQ15(in.data(), sum.data(), length, 32768, 0);
+        PcmMixQ15(in.data(), sum.data(), length, 32768, 0);
+        std::vector<int16_t> out(length);
+        PcmNarrowToInt16(sum.data(), out.data(), length, 0);
+        for (size_t i = 0; i < length; i++) {
+            CHECK_EQ(sum[i], 2 * (int32_t)in[i]);
+            CHECK_EQ(out[i], std::clamp<int32_t>(2 * in[i], -INT16_MAX, INT16_MAX));
+        }
+    }
+}
+
+static void TestInterleave() {
+    for (size_t frames : kLengths) {
+        std::vector<int16_t> stereo(frames * 2);
+        for (size_t i = 0; i < stereo.size(); i++) {
+            stereo[i] = Sample(i);
+        }
+        std::vector<int16_t> left(frames);
+        std::vector<int16_t> right(frames);
+        PcmDeinterleave(stereo.data(), left.data(), right.data(), frames);
+        for (size_t i = 0; i < frames; i++) {
+            CHECK_EQ(left[i], stereo[2 * i]);
+            CHECK_EQ(right[i], stereo[2 * i + 1]);
+        }
+        std::vector<int16_t> round_trip(frames * 2);
+        PcmInterleave(left.data(), right.data(), round_trip.data(), frames);
+        CHECK(round_trip == stereo);
+    }
+}
+
+int main() {
+    TestVolumeFactor();
+    TestScaleAndNarrow();
+    TestNarrowClamps();
+    TestMixQ15();
+    TestInterleave();
+    return 0;
+}
@@ -0,0 +1,105 @@
+#include "pcm_ring.h"
+#include "test_util.h"
+
+#include <algorithm>
+#include <thread>
+#include <vector>
+
+static void TestCapacity() {
+    PcmRing ring(100);
+    CHECK_EQ(ring.capacity(), 128u);
+    CHECK_EQ(ring.Free(), 128u);
+    PcmRing exact(64);
+    CHECK_EQ(exact.capacity(), 64u);
+}
+
+static void TestWrap() {
+    PcmRing ring(8);
+    int16_t in[5];
+    int16_t out[5];
+    int16_t next = 0;
+    int16_t expected = 0;
+    // Writes and reads of 5 make every copy but the first cross the end of the buffer
+    for (int round = 0; round < 20; round++) {
+        for (int i = 0; i < 5; i++) {
+            in[i] = next++;
+        }
+        CHECK_EQ(ring.Write(in, 5), 5u);
+        CHECK_EQ(ring.Read(out, 5), 5u);
+        for (int i = 0; i < 5; i++) {
+            CHECK_EQ(out[i], expected++);
+        }
+    }
+    CHECK(ring.Empty());
+}
+
+static void TestPartial() {
+    PcmRing ring(4);
+    int16_t in[6] = {1, 2, 3, 4, 5, 6};
+    int16_t out[6] = {};
+    CHECK_EQ(ring.Write(in, 6), 4u);
+    CHECK_EQ(ring.Free(), 0u);
+    CHECK_EQ(ring.Read(out, 6), 4u);
+    CHECK_EQ(out[3], 4);
+    CHECK_EQ(ring.Read(out, 6), 0u);
+}
+
+static void TestClear() {
+    PcmRing ring(8);
+    int16_t in[4] = {1, 2, 3, 4};
+    int16_t out[4] = {};
+    uint32_t clears = ring.clears();
+    ring.Write(in, 4);
+    ring.Clear();
+    CHECK_EQ(ring.clears(), clears + 1);
+    CHECK(ring.Empty());
+    CHECK_EQ(ring.Free(), 8u);
+    ring.Write(in + 2, 2);
+    CHECK_EQ(ring.Read(out, 4), 2u);
+    CHECK_EQ(out[0], 3);
+    CHECK_EQ(out[1], 4);
+}
+
+static void TestProducerConsumer() {
+    constexpr int kSamples = 1 << 20;
+    PcmRing ring(256);
+    std::thread producer([&ring] {
+        std::vector<int16_t> chunk(97);
+        int written = 0;
+        while (written < kSamples) {
+            size_t count = std::min<size_t>(chunk.size(), kSamples - written);
+            for (size_t i = 0; i < count; i++) {
+                chunk[i] = (int16_t)(written + i);
+            }
+            size_t done = ring.Write(chunk.data(), count);
+            written += done;
+            if (done == 0) {
+                std::this_thread::yield();
+            }
+        }
+    });
+
+    std::vector<int16_t> chunk(61);
+    int read = 0;
+    while (read < kSamples) {
+        size_t done = ring.Read(chunk.data(), chunk.size());
+        for (size_t i = 0; i < done; i++) {
+            CHECK_EQ(chunk[i], (int16_t)(read + i));
+        }
+        read += done;
+        if (done == 0) {
+            std::this_thread::yield();
+        }
+    }
+    producer.join();
+    CHECK(ring.Empty());
+}
+
+int main() {
+    TestCapacity();
+    TestWrap();
+    TestPartial();
+    TestClear();
+    TestProducerConsumer();
+    return 0;
+}
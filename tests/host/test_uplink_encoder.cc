@@ -0,0 +1,105 @@
+#include "uplink_encoder.h"
+#include "uplink_gate.h"
+#include "test_util.h"
+
+#include <vector>
+
+// 16 kHz, 60 ms frames of 960 samples, fed in AFE chunks of 512 samples that do not line up
+#define FRAME_SAMPLES 960
+#define CHUNK_SAMPLES 512
+
+struct Packet {
+    bool voiced;  // The stub encodes a frame with any non-zero sample to 1
+    bool gated;
+};
+
+// A frame is gated only if every sample in it came from a gated chunk
+static void TestMixedFrames() {
+    UplinkEncoder encoder(16000, 1, 60);
+    std::vector<Packet> packets;
+    auto handler = [&packets](std::vector<uint8_t>&& opus, bool gated) {
+        CHECK_EQ(opus.size(), 1u);
+        packets.push_back({opus[0] == 1, gated});
+    };
+
+    // Open, then gated silence, then open again
+    encoder.Encode(std::vector<int16_t>(CHUNK_SAMPLES, 1), false, handler);
+    CHECK(packets.empty());
+    for (int i = 0; i < 8; i++) {
+        encoder.Encode(std::vector<int16_t>(CHUNK_SAMPLES, 0), true, handler);
+    }
+    encoder.Encode(std::vector<int16_t>(CHUNK_SAMPLES * 3, 1), false, handler);
+
+    // 12 chunks of 512 are 6144 samples, 6 frames and 384 samples carried over
+    CHECK_EQ(packets.size(), 6u);
+    // Samples 0-959 start with open audio
+    CHECK(packets[0].voiced && !packets[0].gated);
+    // 960-4607 are silence, only the frames that lie entirely inside it are gated
+    for (int i = 1; i <= 3; i++) {
+        CHECK(!packets[i].voiced && packets[i].gated);
+    }
+    // 3840-4799 runs from the silence into open audio
+    CHECK(packets[4].voiced && !packets[4].gated);
+    CHECK(packets[5].voiced && !packets[5].gated);
+
+    // The carried-over samples keep their flag across calls
+    packets.clear();
+    encoder.Encode(std::vector<int16_t>(FRAME_SAMPLES - 384, 0), true, handler);
+    CHECK_EQ(packets.size(), 1u);
+    CHECK(packets[0].voiced && !packets[0].gated);
+    encoder.Encode(std::vector<int16_t>(FRAME_SAMPLES, 0), true, handler);
+    CHECK_EQ(packets.size(), 2u);
+    CHECK(!packets[1].voiced && packets[1].gated);
+}
+
+// The flags follow the buffered samples when the frame duration changes
+static void TestFrameDurationChange() {
+    UplinkEncoder encoder(16000, 1, 60);
+    std::vector<bool> gated;
+    auto handler = [&gated](std::vector<uint8_t>&& opus, bool frame_gated) {
+        gated.push_back(frame_gated);
+    };
+    encoder.Encode(std::vector<int16_t>(480, 0), true, handler);
+    encoder.Encode(std::vector<int16_t>(160, 1), false, handler);
+    CHECK(gated.empty());
+    encoder.SetFrameDuration(20);
+    // 640 buffered samples plus 0 new ones make two 320 sample frames
+    encoder.Encode(std::vector<int16_t>(), true, handler);
+    CHECK_EQ(gated.size(), 2u);
+    CHECK(gated[0]);
+    CHECK(!gated[1]);
+
+    encoder.Encode(std::vector<int16_t>(100, 0), true, handler);
+    encoder.ResetState();
+    encoder.Encode(std::vector<int16_t>(320, 1), false, handler);
+    CHECK_EQ(gated.size(), 3u);
+    CHECK(!gated[2]);
+}
+
+// The gate and the encoder together count every frame once and as the gate emitted it
+static void TestGateStatistics() {
+    UplinkGate gate(16000, 0, 0);
+    UplinkEncoder encoder(16000, 1, 60);
+    int speech_pattern[] = {1, 1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 0, 1, 1, 1};
+    int voiced_gated = 0;
+    for (int speech : speech_pattern) {
+        gate.Process(std::vector<int16_t>(CHUNK_SAMPLES, 100), speech == 1, [&](std::vector<int16_t>&& pcm, bool open) {
+            encoder.Encode(std::move(pcm), !open, [&](std::vector<uint8_t>&& opus, bool gated) {
+                gate.OnPacket(opus.size(), gated);
+                voiced_gated += gated && opus[0] == 1;
+            });
+        });
+    }
+    // No gated packet carries audio that was sent open
+    CHECK_EQ(voiced_gated, 0);
+    CHECK_EQ(gate.packets(), (uint32_t)(15 * CHUNK_SAMPLES / FRAME_SAMPLES));
+    CHECK(gate.gated_packets() > 0);
+    CHECK(gate.gated_packets() < gate.packets());
+}
+
+int main() {
+    TestMixedFrames();
+    TestFrameDurationChange();
+    TestGateStatistics();
+    return 0;
+}
@@ -0,0 +1,99 @@
+#include "uplink_gate.h"
+#include "test_util.h"
+
+#include <vector>
+
+// 16 kHz, 60 ms frames of 960 samples, 120 ms hangover and 120 ms look-back
+#define FRAME_SAMPLES 960
+
+struct Emitted {
+    int16_t first;
+    bool open;
+};
+
+static std::vector<int16_t> Frame(int16_t value) {
+    return std::vector<int16_t>(FRAME_SAMPLES, value);
+}
+
+static void TestOnsetAndHangover() {
+    UplinkGate gate(16000, 120, 120);
+    std::vector<Emitted> emitted;
+    auto emit = [&emitted](std::vector<int16_t>&& pcm, bool open) {
+        CHECK_EQ(pcm.size(), (size_t)FRAME_SAMPLES);
+        emitted.push_back({pcm[0], open});
+    };
+
+    // Open at the start of a session until the VAD says otherwise
+    gate.Process(Frame(1), true, emit);
+    CHECK_EQ(emitted.size(), 1u);
+    CHECK(emitted[0].open);
+
+    // Two frames of hangover pass through
+    gate.Process(Frame(2), false, emit);
+    gate.Process(Frame(3), false, emit);
+    CHECK_EQ(emitted.size(), 3u);
+    CHECK(emitted[2].open);
+
+    // Then frames are held for the look-back, older ones leave as silence
+    emitted.clear();
+    for (int16_t i = 4; i <= 8; i++) {
+        gate.Process(Frame(i), false, emit);
+    }
+    CHECK_EQ(emitted.size(), 3u);
+    for (int i = 0; i < 3; i++) {
+        CHECK(!emitted[i].open);
+        CHECK_EQ(emitted[i].first, 0);
+    }
+
+    // Speech flushes the held onset first, in capture order
+    emitted.clear();
+    gate.Process(Frame(9), true, emit);
+    CHECK_EQ(emitted.size(), 3u);
+    CHECK_EQ(emitted[0].first, 7);
+    CHECK_EQ(emitted[1].first, 8);
+    CHECK_EQ(emitted[2].first, 9);
+    CHECK(emitted[0].open && emitted[2].open);
+}
+
+static void TestResetDropsHeld() {
+    UplinkGate gate(16000, 0, 120);
+    std::vector<Emitted> emitted;
+    auto emit = [&emitted](std::vector<int16_t>&& pcm, bool open) {
+        emitted.push_back({pcm[0], open});
+    };
+    gate.Process(Frame(1), false, emit);
+    gate.Process(Frame(2), false, emit);
+    CHECK(emitted.empty());
+
+    gate.Reset();
+    gate.Process(Frame(3), true, emit);
+    CHECK_EQ(emitted.size(), 1u);
+    CHECK_EQ(emitted[0].first, 3);
+}
+
+static void TestStatistics() {
+    UplinkGate gate(16000, 0, 0);
+    CHECK_EQ(gate.bytes_saved(), 0u);
+    for (int i = 0; i < 4; i++) {
+        gate.OnPacket(100, false);
+    }
+    for (int i = 0; i < 4; i++) {
+        gate.OnPacket(10, true);
+    }
+    CHECK_EQ(gate.packets(), 8u);
+    CHECK_EQ(gate.gated_packets(), 4u);
+    CHECK_EQ(gate.bytes_sent(), 440u);
+    // Four gated packets would have cost 400 bytes at the open rate, 40 were sent
+    CHECK_EQ(gate.bytes_saved(), 360u);
+
+    gate.Reset();
+    CHECK_EQ(gate.packets(), 0u);
+    CHECK_EQ(gate.bytes_saved(), 0u);
+}
+
+int main() {
+    TestOnsetAndHangover();
+    TestResetDropsHeld();
+    TestStatistics();
+    return 0;
+}
@@ -0,0 +1,25 @@
+#ifndef _TEST_UTIL_H
+#define _TEST_UTIL_H
+
+#include <cstdio>
+#include <cstdlib>
+
+// Minimal assertions for the host tests, a failed check aborts the test with its location
+#define CHECK(condition) do { \
+        if (!(condition)) { \
+            fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #condition); \
+            abort(); \
+        } \
+    } while (0)
+
+#define CHECK_EQ(a, b) do { \
+        auto _a = (a); \
+        auto _b = (b); \
+        if (!(_a == _b)) { \
+            fprintf(stderr, "%s:%d: CHECK_EQ(%s, %s) failed: %lld != %lld\n", __FILE__, __LINE__, \
+                #a, #b, (long long)_a, (long long)_b); \
+            abort(); \
+        } \
+    } while (0)
+
+#endif // _TEST_UTIL_H
@@ -0,0 +1,237 @@
+#include "websocket_protocol.h"
+#include "mock_transports.h"
+#include "test_util.h"
+
+#include <board.h>
+#include <settings.h>
+#include <arpa/inet.h>
+#include <cstring>
+#include <string>
+#include <vector>
+
+struct Received {
+    std::vector<AudioStreamPacket> audio;
+    std::vector<std::string> json_types;
+    int opened = 0;
+    int closed = 0;
+};
+
+struct Harness {
+    WebsocketProtocol protocol;
+    Received received;
+    MockWebSocket* websocket = nullptr;
+    int created = 0;
+    int server_version = 3;
+
+    Harness(int version) {
+        Settings settings("websocket", true);
+        settings.SetString("url", "wss://example.com/xiaozhi/v1/");
+        settings.SetString("token", "test-token");
+        settings.SetInt("version", version);
+
+        Board::GetInstance().SetWebSocketFactory([this]() {
+            websocket = new MockWebSocket();
+            websocket->server = [this](MockWebSocket& websocket, const MockWebSocket::Frame& frame) {
+                if (!frame.binary && frame.data.find("\"type\":\"hello\"") != std::string::npos) {
+                    websocket.Receive("{\"type\":\"hello\",\"transport\":\"websocket\",\"session_id\":\"ws-1\","
+                        "\"version\":" + std::to_string(server_version) + ","
+                        "\"audio_params\":{\"sample_rate\":16000,\"frame_duration\":60}}", false);
+                }
+            };
+            created++;
+            return websocket;
+        });
+        protocol.OnIncomingAudio([this](AudioStreamPacket&& packet) {
+            // Borrowed payloads are only valid during the callback
+            packet.payload.assign(packet.data(), packet.data() + packet.size());
+            packet.borrowed_payload = nullptr;
+            received.audio.push_back(std::move(packet));
+        });
+        protocol.OnIncomingJson([this](const cJSON* root) {
+            received.json_types.push_back(cJSON_GetObjectItem(root, "type")->valuestring);
+        });
+        protocol.OnAudioChannelOpened([this]() { received.opened++; });
+        protocol.OnAudioChannelClosed([this]() { received.closed++; });
+    }
+};
+
+static AudioStreamPacket Packet(uint32_t timestamp, std::vector<uint8_t> payload) {
+    AudioStreamPacket packet;
+    packet.timestamp = timestamp;
+    packet.payload = std::move(payload);
+    return packet;
+}
+
+static std::vector<BinaryProtocol4Record> Records(const std::string& message) {
+    std::vector<BinaryProtocol4Record> records;
+    BinaryProtocol4Reader reader((const uint8_t*)message.data(), message.size());
+    BinaryProtocol4Record record;
+    while (reader.Next(record)) {
+        records.push_back(record);
+    }
+    CHECK(!reader.error());
+    return records;
+}
+
+static void TestHelloAndV3Framing() {
+    Harness harness(3);
+    CHECK(harness.protocol.Start());
+    CHECK(harness.protocol.OpenAudioChannel());
+    CHECK(harness.protocol.IsAudioChannelOpened());
+    CHECK_EQ(harness.received.opened, 1);
+
+    auto websocket = harness.websocket;
+    CHECK(websocket->uri == "wss://example.com/xiaozhi/v1/");
+    CHECK(websocket->headers["Authorization"] == "Bearer test-token");
+    CHECK(websocket->headers["Protocol-Version"] == "3");
+    CHECK(websocket->headers["Device-Id"] == "02:00:00:00:00:01");
+    // The client offers v4, the server answers with 3 and the legacy framing stays
+    CHECK_EQ(websocket->sent.size(), 1u);
+    CHECK(!websocket->sent[0].binary);
+    CHECK(websocket->sent[0].data.find("\"version\":4") != std::string::npos);
+    CHECK(websocket->sent[0].data.find("\"frame_duration\":60") != std::string::npos);
+    CHECK(harness.protocol.session_id() == "ws-1");
+    CHECK_EQ(harness.protocol.server_sample_rate(), 16000);
+
+    harness.protocol.SendAudio(Packet(60, {1, 2, 3}));
+    auto& frame = websocket->sent.back();
+    CHECK(frame.binary);
+    CHECK_EQ(frame.data.size(), sizeof(BinaryProtocol3) + 3);
+    auto bp3 = (const BinaryProtocol3*)frame.data.data();
+    CHECK_EQ(bp3->type, 0);
+    CHECK_EQ(ntohs(bp3->payload_size), 3);
+    CHECK(memcmp(bp3->payload, "\x01\x02\x03", 3) == 0);
+
+    harness.protocol.SendStopListening();
+    CHECK(!websocket->sent.back().binary);
+    CHECK(websocket->sent.back().data == "{\"session_id\":\"ws-1\",\"type\":\"listen\",\"state\":\"stop\"}");
+
+    websocket->Receive(std::string("\x00\x00\x00\x02\x09\x08", 6), true);
+    CHECK_EQ(harness.received.audio.size(), 1u);
+    CHECK(harness.received.audio[0].payload == std::vector<uint8_t>({9, 8}));
+
+    websocket->Receive("{\"type\":\"tts\",\"state\":\"start\"}", false);
+    websocket->Receive("{\"state\":\"start\"}", false);
+    websocket->Receive("not json", false);
+    CHECK_EQ(harness.received.json_types.size(), 1u);
+    CHECK(harness.received.json_types[0] == "tts");
+}
+
+static void TestV4Framing() {
+    Harness harness(1);
+    harness.server_version = 4;
+    CHECK(harness.protocol.OpenAudioChannel());
+    auto websocket = harness.websocket;
+
+    // One message per frame outside a batch, sequence numbers start at 1
+    harness.protocol.SendAudio(Packet(60, {1}));
+    harness.protocol.SendAudio(Packet(120, {2, 2}));
+    CHECK_EQ(websocket->sent.size(), 3u);
+    for (int i = 0; i < 2; i++) {
+        auto& frame = websocket->sent[1 + i];
+        CHECK(frame.binary);
+        auto records = Records(frame.data);
+        CHECK_EQ(records.size(), 1u);
+        CHECK_EQ(records[0].type, kBinaryProtocol4Audio);
+        CHECK_EQ(records[0].sequence, (uint32_t)(i + 1));
+        CHECK_EQ(records[0].timestamp, (uint32_t)(60 * (i + 1)));
+        CHECK_EQ(records[0].payload_size, (size_t)(i + 1));
+    }
+
+    // A batch is one message and control messages keep their place among the frames
+    harness.protocol.BeginBatch();
+    harness.protocol.SendAudio(Packet(180, {3}));
+    harness.protocol.SendAudio(Packet(240, {4}));
+    harness.protocol.SendStopListening();
+    harness.protocol.SendAudio(Packet(300, {5}));
+    CHECK_EQ(websocket->sent.size(), 3u);
+    harness.protocol.EndBatch();
+    CHECK_EQ(websocket->sent.size(), 4u);
+    auto records = Records(websocket->sent.back().data);
+    CHECK_EQ(records.size(), 4u);
+    CHECK_EQ(records[0].sequence, 3u);
+    CHECK_EQ(records[1].sequence, 4u);
+    CHECK_EQ(records[2].type, kBinaryProtocol4Json);
+    CHECK(std::string((const char*)records[2].payload, records[2].payload_size).find("\"state\":\"stop\"") != std::string::npos);
+    CHECK_EQ(records[3].sequence, 5u);
+
+    std::string message;
+    BinaryProtocol4Writer writer(message);
+    writer.AddJson("{\"type\":\"stt\",\"text\":\"hi\"}");
+    writer.AddAudio((const uint8_t*)"\x07\x07\x07", 3, 100, 7);
+    websocket->Receive(message, true);
+    CHECK_EQ(harness.received.json_types.size(), 1u);
+    CHECK(harness.received.json_types[0] == "stt");
+    CHECK_EQ(harness.received.audio.size(), 1u);
+    CHECK_EQ(harness.received.audio[0].timestamp, 100u);
+    CHECK_EQ(harness.received.audio[0].sequence, 7u);
+    CHECK_EQ(harness.received.audio[0].payload.size(), 3u);
+
+    // A truncated message delivers the complete records before the error
+    websocket->Receive(message.substr(0, message.size() - 1), true);
+    CHECK_EQ(harness.received.json_types.size(), 2u);
+    CHECK_EQ(harness.received.audio.size(), 1u);
+}
+
+static void TestWarmChannel() {
+    Harness harness(3);
+    CHECK(harness.protocol.OpenAudioChannel());
+    auto websocket = harness.websocket;
+    bool alive = true;
+    websocket->alive = &alive;
+
+    // Closing parks the connection and tells the server that the turn is over
+    harness.protocol.CloseAudioChannel();
+    CHECK(alive);
+    CHECK_EQ(harness.received.closed, 1);
+    CHECK(!harness.protocol.IsAudioChannelOpened());
+    CHECK(websocket->sent.back().data.find("\"state\":\"stop\"") != std::string::npos);
+
+    // The tail of a reply that arrives while parked is dropped
+    websocket->Receive(std::string("\x00\x00\x00\x01\x01", 5), true);
+    websocket->Receive("{\"type\":\"tts\",\"state\":\"stop\"}", false);
+    CHECK(harness.received.audio.empty());
+    CHECK(harness.received.json_types.empty());
+
+    // Reopening with the same frame duration skips the handshake
+    size_t sent = websocket->sent.size();
+    CHECK(harness.protocol.OpenAudioChannel());
+    CHECK_EQ(harness.created, 1);
+    CHECK_EQ(websocket->sent.size(), sent);
+    CHECK_EQ(harness.received.opened, 2);
+    CHECK(harness.protocol.IsAudioChannelOpened());
+
+    // A new frame duration needs a new hello on a new connection
+    harness.protocol.CloseAudioChannel();
+    harness.protocol.RequestUplinkFrameDuration(20);
+    CHECK(harness.protocol.OpenAudioChannel());
+    CHECK(!alive);
+    CHECK_EQ(harness.created, 2);
+    CHECK(harness.websocket->sent[0].data.find("\"frame_duration\":20") != std::string::npos);
+    CHECK_EQ(harness.protocol.uplink_frame_duration(), 20);
+
+    // A parked connection that drops is released by KeepAlive
+    websocket = harness.websocket;
+    alive = true;
+    websocket->alive = &alive;
+    harness.protocol.CloseAudioChannel();
+    CHECK_EQ(harness.received.closed, 3);
+    websocket->Disconnect();
+    CHECK_EQ(harness.received.closed, 3);
+    harness.protocol.KeepAlive();
+    CHECK(!alive);
+
+    // An open channel that drops is reported
+    CHECK(harness.protocol.OpenAudioChannel());
+    CHECK_EQ(harness.created, 3);
+    harness.websocket->Disconnect();
+    CHECK_EQ(harness.received.closed, 4);
+    CHECK(!harness.protocol.IsAudioChannelOpened());
+}
+
+int main() {
+    TestHelloAndV3Framing();
+    TestV4Framing();
+    TestWarmChannel();
+    return 0;
+}